@@ -0,0 +1,18 @@
+#version 330 core
+
+layout (location = 0) in vec3 pos;
+layout (location = 1) in vec2 tex_coord;
+layout (location = 2) in vec4 instance_rect; // x, y, width, height (in world units)
+layout (location = 3) in float instance_layer;
+
+out VS_OUT {
+    vec3 tex_coord;
+} vs_out;
+
+uniform mat4 projection_view_matrix;
+
+void main() {
+    vec2 world_pos = instance_rect.xy + pos.xy * instance_rect.zw;
+    gl_Position = projection_view_matrix * vec4(world_pos, pos.z, 1.0f);
+    vs_out.tex_coord = vec3(tex_coord, instance_layer);
+}
@@ -20,6 +20,9 @@
 #include "platform.h"
 #include "stringutils.h"
 #include "gui.h"
+#include "pixel_buffer_pool.h"
+#include "tile_residency.h"
+#include "tile_scheduler.h"
 
 #if COMPILER_MSVC
 #include <direct.h>
@@ -170,6 +173,35 @@ void console_execute_command(app_state_t* app_state, const char* command) {
 			begin_a_very_long_task();
 		} else if (strcmp(cmd, "modal") == 0) {
 			gui_add_modal_message_popup("Modal test", "This is a modal message test.");
+		} else if (strcmp(cmd, "isyntax_huffman_multi_symbol") == 0) {
+			if (arg) {
+				if (arg[0] == '0') isyntax_huffman_multi_symbol_enabled = false;
+				if (arg[0] == '1') isyntax_huffman_multi_symbol_enabled = true;
+			}
+			console_print("isyntax_huffman_multi_symbol: %d\n", isyntax_huffman_multi_symbol_enabled);
+		} else if (strcmp(cmd, "isyntax_huffman_benchmark") == 0) {
+			i32 max_codeblock_count = arg ? atoi(arg) : 1000;
+			image_t* isyntax_image = NULL;
+			for (i32 i = 0; i < arrlen(app_state->loaded_images); ++i) {
+				if (app_state->loaded_images[i]->backend == IMAGE_BACKEND_ISYNTAX) {
+					isyntax_image = app_state->loaded_images[i];
+					break;
+				}
+			}
+			if (isyntax_image) {
+				isyntax_benchmark_hulsken_decompress(&isyntax_image->isyntax, max_codeblock_count);
+			} else {
+				console_print("No iSyntax file loaded\n");
+			}
+		} else if (strcmp(cmd, "pixel_pool") == 0) {
+			pixel_buffer_pool_print_stats();
+		} else if (strcmp(cmd, "temp_memory") == 0) {
+			print_thread_memory_stats();
+			work_queue_print_task_memory_stats();
+		} else if (strcmp(cmd, "residency") == 0) {
+			tile_residency_print_stats();
+		} else if (strcmp(cmd, "scheduler") == 0) {
+			tile_scheduler_print_stats();
 		} else if (strcmp(cmd, "tiff_save_description") == 0) {
 			if (arrlen(app_state->loaded_images) > 0) {
 				image_t* image = app_state->loaded_images[0];
@@ -20,6 +20,7 @@
 #include "platform.h"
 #include "image.h"
 #include "jpeg_decoder.h"
+#include "pixel_buffer_pool.h"
 
 #define STBI_ASSERT(x) ASSERT(x)
 #include "stb_image.h" // for stbi_image_free()
@@ -29,7 +30,7 @@
 // TODO: refcount mechanism and eviction scheme, retain tiles for re-use?
 void tile_release_cache(tile_t* tile) {
 	ASSERT(tile);
-	if (tile->pixels) free(tile->pixels);
+	if (tile->pixels) pixel_buffer_free(tile->pixels);
 	tile->pixels = NULL;
 	tile->is_cached = false;
 	tile->need_keep_in_cache = false;
@@ -796,13 +797,10 @@ bool image_read_region(image_t* image, i32 level, i32 x, i32 y, i32 w, i32 h, vo
 			i32 height_in_tiles = tiles_within_level_bounds.bottom - tiles_within_level_bounds.top;
 
 			if (width_in_tiles > 0 && height_in_tiles > 0) {
-				load_tile_task_t* wishlist = calloc(width_in_tiles * height_in_tiles, sizeof(load_tile_task_t));
-				i32 tiles_to_load = 0;
+				// Load the tiles into the tile cache, and wait for them (helping out with the work meanwhile).
+				work_queue_task_group_t task_group;
+				work_queue_task_group_init(&task_group, &global_work_queue);
 
-				work_queue_t read_completion_queue = work_queue_create("/imagereadregionsem",
-                                                                       width_in_tiles * height_in_tiles);
-
-				// request tiles
 				benaphore_lock(&image->lock);
 				for (i32 tile_y = tiles_within_level_bounds.min.y; tile_y < tiles_within_level_bounds.max.y; ++tile_y) {
 					for (i32 tile_x = tiles_within_level_bounds.min.x; tile_x < tiles_within_level_bounds.max.x; ++tile_x) {
@@ -813,48 +811,24 @@ bool image_read_region(image_t* image, i32 level, i32 x, i32 y, i32 w, i32 h, vo
 							continue; // already cached
 						}
 						tile->need_keep_in_cache = true;
-						wishlist[tiles_to_load++] = (load_tile_task_t){
+						tile->is_submitted_for_loading = true;
+						load_tile_task_t task = {
 							.resource_id = image->resource_id,
 							.image = image, .tile = tile, .level = level,
 							.tile_x = tile->tile_x,
 							.tile_y = tile->tile_y,
 							.need_gpu_residency = tile->need_gpu_residency,
 							.need_keep_in_cache = true,
-							.completion_queue = &read_completion_queue,
-                            .refcount_to_decrement = 1, // refcount will be decremented at end of thread proc load_tile_func()
+                            .refcount_to_decrement = 1, // refcount will be decremented at end of load_tile_into_cache_func()
 						};
-
+						atomic_add(&image->refcount, task.refcount_to_decrement);
+						WORK_QUEUE_NAME_TASK(load_tile_into_cache_func);
+						work_queue_task_group_submit(&task_group, load_tile_into_cache_func, &task, sizeof(task));
 					}
 				}
-
-				request_tiles(image, wishlist, tiles_to_load);
 				benaphore_unlock(&image->lock);
 
-				// retrieve all requested tiles
-				while (read_completion_queue.completion_count < tiles_to_load) {
-					if (work_queue_is_work_in_progress(&read_completion_queue)) {
-						work_queue_entry_t entry = work_queue_get_next_entry(&read_completion_queue);
-						if (entry.is_valid) {
-							benaphore_lock(&image->lock);
-                            work_queue_mark_entry_completed(&read_completion_queue);
-							viewer_notify_tile_completed_task_t* task = (viewer_notify_tile_completed_task_t*) entry.userdata;
-							if (task->pixel_memory) {
-								tile_t* tile = get_tile_from_tile_index(image, task->scale, task->tile_index);
-								ASSERT(tile->pixels == NULL);
-								if (task->pixel_memory) {
-									tile->pixels = task->pixel_memory; // TODO: retain
-									tile->is_cached = true;
-								}
-							}
-							benaphore_unlock(&image->lock);
-						}
-					} else if (work_queue_is_work_waiting_to_start(&global_work_queue)) {
-                        work_queue_do_work(&global_work_queue, 0);
-					} else {
-						platform_sleep(1);
-					}
-				}
-                work_queue_destroy(&read_completion_queue);
+				work_queue_task_group_wait(&task_group);
 			}
 
 
@@ -939,7 +913,7 @@ bool image_read_region(image_t* image, i32 level, i32 x, i32 y, i32 w, i32 h, vo
 					tile_t* tile = get_tile(level_image, tile_x, tile_y);
 					if (tile->is_empty) continue; // no need to load empty tiles
 					if (tile->is_cached && tile->pixels) {
-						free(tile->pixels);
+						pixel_buffer_free(tile->pixels);
 						tile->pixels = NULL;
 						tile->is_cached = false;
 					}
@@ -1004,19 +978,33 @@ void begin_level_image_indexing(image_t* image, level_image_t* level_image, i32
 
 	level_image->indexing_job_submitted = true;
 	atomic_increment(&image->refcount); // retain
+	WORK_QUEUE_NAME_TASK(level_image_indexing_task_func);
 	if (!work_queue_submit_task(&global_work_queue, level_image_indexing_task_func, &task, sizeof(task))) {
 		atomic_decrement(&image->refcount); // chicken out
 		level_image->indexing_job_submitted = false;
 	};
 }
 
+// Passes a hint about the upcoming access pattern to the OS, if the image file is memory-mapped
+// (e.g. sequential while exporting, random while viewing).
+void image_set_file_access_pattern(image_t* image, file_access_pattern_enum pattern) {
+	if (image->type != IMAGE_TYPE_WSI) return;
+	if (image->backend == IMAGE_BACKEND_TIFF) {
+		file_map_advise(image->tiff.file_mapping, image->tiff.file_mapping_size, 0, 0, pattern);
+	} else if (image->backend == IMAGE_BACKEND_ISYNTAX) {
+		file_map_advise(image->isyntax.file_mapping, image->isyntax.file_mapping_size, 0, 0, pattern);
+	} else if (image->backend == IMAGE_BACKEND_DICOM) {
+		for (i32 i = 0; i < arrlen(image->dicom.instances); ++i) {
+			dicom_instance_t* instance = image->dicom.instances + i;
+			file_map_advise(instance->file_mapping, instance->file_mapping_size, 0, 0, pattern);
+		}
+	}
+}
+
 void image_destroy(image_t* image) {
     image->is_deleted = true;
-    while (image->refcount > 0) {
-//		console_print_error("refcount = %d\n", image->refcount);
-        platform_sleep(1);
-        work_queue_do_work(&global_work_queue, 0);
-    }
+    // Wait for tasks still referencing the image (helping out with the work meanwhile)
+    work_queue_wait_until_zero(&global_work_queue, &image->refcount);
 	if (image) {
 		if (image->type == IMAGE_TYPE_WSI) {
 			if (image->backend == IMAGE_BACKEND_OPENSLIDE) {
@@ -1050,13 +1038,15 @@ void image_destroy(image_t* image) {
 				for (i32 j = 0; j < level_image->tile_count; ++j) {
 					tile_t* tile = level_image->tiles + j;
 					if (tile->texture != 0) {
-						unload_texture(tile->texture);
+						release_tile_texture(tile);
 					}
 				}
 			}
 			free(level_image->tiles);
 			level_image->tiles = NULL;
 		}
+		arrfree(image->pending_tile_loads);
+		arrfree(image->resident_tiles);
 
 		if (image->macro_image.is_valid) {
 			if (image->macro_image.pixels) stbi_image_free(image->simple.pixels);
@@ -27,6 +27,7 @@
 #include "isyntax.h"
 #include "libisyntax.h"
 #include "dicom.h"
+#include "work_queue.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -105,14 +106,33 @@ typedef struct tile_t {
     i32 tile_y;
     u8* pixels;
     u32 texture;
+    i32 texture_array_index; // index + 1 of the texture array that holds the tile's texture, or 0 if it has its own
+    i32 texture_array_layer;
     bool8 is_submitted_for_loading;
     bool8 is_empty;
     bool8 is_cached;
     bool8 need_keep_in_cache;
     bool8 need_gpu_residency; // TODO: revise: still needed?
-    i64 time_last_drawn;
+    i64 time_last_drawn; // frame in which the tile was last visible, predicted to be, or loaded (used for eviction)
+    i32 resident_index; // index + 1 into image->resident_tiles, or 0 if not tracked
+    work_queue_cancel_token_t load_cancel_token; // used to drop the load task if the tile scrolls off-screen
 } tile_t;
 
+// Tile that holds a texture and/or cached pixels, tracked for eviction (see tile_residency.h)
+typedef struct resident_tile_t {
+    tile_t* tile;
+    i32 level;
+} resident_tile_t;
+
+// Tile load task that was submitted to the work queue, and that may still be cancelled.
+typedef struct pending_tile_load_t {
+    tile_t* tile;
+    i32 scale;
+    i32 tile_x;
+    i32 tile_y;
+    bool is_prefetch;
+} pending_tile_load_t;
+
 typedef struct cached_tile_t {
     i32 tile_width;
     u8* pixels;
@@ -184,6 +204,10 @@ typedef struct image_t {
     simple_image_t macro_image;
     simple_image_t label_image;
     i32 resource_id;
+    pending_tile_load_t* pending_tile_loads; // array (stb_ds); only accessed from the main thread
+    resident_tile_t* resident_tiles; // array (stb_ds); only accessed from the main thread
+    volatile i32 tile_loads_in_flight; // submitted by request_tiles(), not yet completed or cancelled
+    volatile i32 prefetch_tile_loads_in_flight;
 	volatile i32 refcount;
 	benaphore_t lock;
 } image_t;
@@ -227,6 +251,7 @@ bool init_image_from_stbi(image_t* image, simple_image_t* simple, bool is_overla
 void init_image_from_openslide(image_t* image, wsi_t* wsi, bool is_overlay);
 bool image_read_region(image_t* image, i32 level, i32 x, i32 y, i32 w, i32 h, void* dest, pixel_format_enum desired_pixel_format);
 void begin_level_image_indexing(image_t* image, level_image_t* level_image, i32 scale);
+void image_set_file_access_pattern(image_t* image, file_access_pattern_enum pattern);
 void image_destroy(image_t* image);
 
 #ifdef __cplusplus
@@ -173,7 +173,8 @@ image_transform_t do_local_image_registration(image_t* image1, image_t* image2,
     image_transform_t result = {};
 
     if (image1->backend == IMAGE_BACKEND_ISYNTAX || image2->backend == IMAGE_BACKEND_ISYNTAX) {
-        // TODO: implement read_region() for iSyntax backend
+        // TODO: use libisyntax_read_region() for iSyntax backend. This needs an isyntax_cache_t that does not
+        //  conflict with the tile state managed by the iSyntax streamer (isyntax_streamer.c).
         return result;
     }
 
@@ -0,0 +1,296 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2024  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+#include "platform.h"
+#include "image.h"
+#include "viewer.h" // for release_tile_texture()
+
+#define TILE_RESIDENCY_IMPL
+#include "tile_residency.h"
+
+typedef struct eviction_candidate_t {
+	image_t* image;
+	tile_t* tile;
+	i32 level;
+	i32 array_used_layer_count; // layers in use in the tile's texture array (0 if the tile has its own texture)
+	i64 time_last_drawn;
+	i64 size_in_bytes;
+} eviction_candidate_t;
+
+static tile_residency_stats_t tile_residency_stats;
+static eviction_candidate_t* eviction_candidates; // array (stb_ds), reused every frame
+static i64 separate_texture_bytes_last_frame; // textures that are not in a texture array
+
+static i64 get_tile_size_in_bytes(image_t* image, i32 level) {
+	level_image_t* level_image = image->level_images + level;
+	return (i64)level_image->tile_width * level_image->tile_height * 4;
+}
+
+// Tiles of simple images can't be evicted: they share their single texture with the image itself.
+static bool can_evict_tiles_of_image(image_t* image) {
+	return image->type == IMAGE_TYPE_WSI && !image->is_deleted && image->backend != IMAGE_BACKEND_STBI;
+}
+
+static isyntax_tile_t* get_isyntax_tile(image_t* image, i32 level, tile_t* tile) {
+	isyntax_t* isyntax = &image->isyntax;
+	isyntax_level_t* isyntax_level = isyntax->images[isyntax->wsi_image_index].levels + level;
+	return isyntax_level->tiles + tile->tile_index;
+}
+
+// iSyntax tiles are pushed by the isyntax streamer, which only (re)loads tiles that it hasn't loaded before.
+// The tiles of the highest levels can't be reloaded: their coefficients are freed after the first load.
+static bool can_evict_tile(image_t* image, i32 level, tile_t* tile) {
+	if (image->backend == IMAGE_BACKEND_ISYNTAX) {
+		isyntax_t* isyntax = &image->isyntax;
+		isyntax_level_t* isyntax_level = isyntax->images[isyntax->wsi_image_index].levels + level;
+		return !isyntax_level->is_fully_loaded && get_isyntax_tile(image, level, tile)->is_loaded;
+	}
+	return true;
+}
+
+// After evicting the texture of an iSyntax tile, let the isyntax streamer know it needs to load the tile again.
+static void mark_isyntax_tile_for_reloading(image_t* image, i32 level, tile_t* tile) {
+	isyntax_tile_t* isyntax_tile = get_isyntax_tile(image, level, tile);
+	isyntax_tile->is_loaded = false;
+	isyntax_tile->is_submitted_for_loading = false;
+}
+
+void tile_residency_track(image_t* image, i32 level, tile_t* tile) {
+	if (tile->resident_index == 0) {
+		resident_tile_t resident = {.tile = tile, .level = level};
+		arrput(image->resident_tiles, resident);
+		tile->resident_index = (i32)arrlen(image->resident_tiles);
+	}
+}
+
+static void tile_residency_untrack(image_t* image, i32 index) {
+	tile_t* tile = image->resident_tiles[index].tile;
+	tile->resident_index = 0;
+	arrdelswap(image->resident_tiles, index);
+	if (index < arrlen(image->resident_tiles)) {
+		image->resident_tiles[index].tile->resident_index = index + 1;
+	}
+}
+
+static void evict_tile_texture(eviction_candidate_t* candidate) {
+	tile_t* tile = candidate->tile;
+	release_tile_texture(tile);
+	if (candidate->image->backend == IMAGE_BACKEND_ISYNTAX) {
+		mark_isyntax_tile_for_reloading(candidate->image, candidate->level, tile);
+	}
+	++tile_residency_stats.evicted_texture_count;
+}
+
+static int eviction_candidate_compare_func(const void* a, const void* b) {
+	i64 time_a = ((eviction_candidate_t*)a)->time_last_drawn;
+	i64 time_b = ((eviction_candidate_t*)b)->time_last_drawn;
+	return (time_a > time_b) - (time_a < time_b);
+}
+
+// The memory of a texture array is only given back once all of its layers are released. So: tiles that have their
+// own texture go first, then the tiles of the least occupied texture arrays (grouped per array), least recently drawn first.
+static int texture_eviction_candidate_compare_func(const void* a, const void* b) {
+	eviction_candidate_t* candidate_a = (eviction_candidate_t*)a;
+	eviction_candidate_t* candidate_b = (eviction_candidate_t*)b;
+	i32 used_a = candidate_a->array_used_layer_count;
+	i32 used_b = candidate_b->array_used_layer_count;
+	if (used_a != used_b) {
+		return (used_a > used_b) - (used_a < used_b);
+	}
+	i32 array_a = candidate_a->tile->texture_array_index;
+	i32 array_b = candidate_b->tile->texture_array_index;
+	if (array_a != array_b) {
+		return (array_a > array_b) - (array_a < array_b);
+	}
+	return eviction_candidate_compare_func(a, b);
+}
+
+void tile_residency_enforce_budget(image_t** images, i32 image_count, i64 current_frame) {
+	tile_residency_stats_t* stats = &tile_residency_stats;
+	stats->texture_budget = (i64)tile_residency_texture_budget_in_mb * MEGABYTES(1);
+	stats->cache_budget = (i64)tile_residency_cache_budget_in_mb * MEGABYTES(1);
+
+	// Take stock of what is resident (and stop tracking tiles that don't hold anything anymore)
+	i32 resident_texture_count = 0;
+	i32 cached_tile_count = 0;
+	i64 separate_texture_bytes = 0; // textures that are not in a texture array
+	i64 cached_bytes = 0;
+	for (i32 image_index = 0; image_index < image_count; ++image_index) {
+		image_t* image = images[image_index];
+		benaphore_lock(&image->lock); // cached pixels may be released by worker threads
+		for (i32 i = (i32)arrlen(image->resident_tiles) - 1; i >= 0; --i) {
+			resident_tile_t* resident = image->resident_tiles + i;
+			tile_t* tile = resident->tile;
+			bool has_texture = (tile->texture != 0);
+			bool has_cached_pixels = (tile->is_cached && tile->pixels);
+			if (!has_texture && !has_cached_pixels) {
+				if (!tile->is_submitted_for_loading) {
+					tile_residency_untrack(image, i);
+				}
+				continue;
+			}
+			i64 size_in_bytes = get_tile_size_in_bytes(image, resident->level);
+			if (has_texture) {
+				++resident_texture_count;
+				if (!tile->texture_array_index) {
+					separate_texture_bytes += size_in_bytes;
+				}
+			}
+			if (has_cached_pixels) {
+				++cached_tile_count;
+				cached_bytes += size_in_bytes;
+			}
+		}
+		benaphore_unlock(&image->lock);
+	}
+	// Texture arrays count in full: their memory is allocated up front, and only given back once they are empty.
+	i64 texture_bytes = separate_texture_bytes + get_tile_texture_arrays_size_in_bytes();
+
+	bool need_evict_textures = texture_bytes > stats->texture_budget;
+	bool need_evict_cache = cached_bytes > stats->cache_budget;
+	if (need_evict_textures || need_evict_cache) {
+		// Evict down to 90% of the budget, so that we don't need to evict again on the next frame
+		i64 texture_target = stats->texture_budget / 10 * 9;
+		i64 cache_target = stats->cache_budget / 10 * 9;
+
+		arrsetlen(eviction_candidates, 0);
+		i32 evictable_layer_counts[TILE_TEXTURE_ARRAY_MAX_COUNT] = {0};
+		for (i32 image_index = 0; image_index < image_count; ++image_index) {
+			image_t* image = images[image_index];
+			if (!can_evict_tiles_of_image(image)) {
+				continue;
+			}
+			for (i32 i = 0; i < arrlen(image->resident_tiles); ++i) {
+				resident_tile_t* resident = image->resident_tiles + i;
+				tile_t* tile = resident->tile;
+				if (tile->time_last_drawn >= current_frame || tile->is_submitted_for_loading ||
+				    !can_evict_tile(image, resident->level, tile)) {
+					continue; // visible, still busy, or can't be reloaded
+				}
+				eviction_candidate_t candidate = {
+					.image = image, .tile = tile, .level = resident->level,
+					.array_used_layer_count = get_tile_texture_array_used_layer_count(tile),
+					.time_last_drawn = tile->time_last_drawn,
+					.size_in_bytes = get_tile_size_in_bytes(image, resident->level),
+				};
+				arrput(eviction_candidates, candidate);
+				if (tile->texture_array_index) {
+					++evictable_layer_counts[tile->texture_array_index - 1];
+				}
+			}
+		}
+
+		if (need_evict_textures) {
+			qsort(eviction_candidates, arrlen(eviction_candidates), sizeof(eviction_candidate_t),
+			      texture_eviction_candidate_compare_func);
+			for (i32 i = 0; i < arrlen(eviction_candidates) && texture_bytes > texture_target; ++i) {
+				eviction_candidate_t* candidate = eviction_candidates + i;
+				tile_t* tile = candidate->tile;
+				if (tile->texture == 0) {
+					continue;
+				}
+				if (tile->texture_array_index &&
+				    evictable_layer_counts[tile->texture_array_index - 1] < candidate->array_used_layer_count) {
+					continue; // some tiles in this array must stay, so evicting the others would not free the array
+				}
+				if (!tile->texture_array_index) {
+					separate_texture_bytes -= candidate->size_in_bytes;
+				}
+				evict_tile_texture(candidate);
+				--resident_texture_count;
+				texture_bytes = separate_texture_bytes + get_tile_texture_arrays_size_in_bytes();
+			}
+
+			// Still over budget: the remaining arrays also hold tiles that must stay. Evict their other layers as well,
+			// so that new tiles can reuse those layers instead of needing more arrays (least recently drawn first).
+			if (texture_bytes > texture_target) {
+				i64 used_texture_bytes = separate_texture_bytes + get_tile_texture_arrays_used_size_in_bytes();
+				qsort(eviction_candidates, arrlen(eviction_candidates), sizeof(eviction_candidate_t),
+				      eviction_candidate_compare_func);
+				for (i32 i = 0; i < arrlen(eviction_candidates) && used_texture_bytes > texture_target; ++i) {
+					eviction_candidate_t* candidate = eviction_candidates + i;
+					tile_t* tile = candidate->tile;
+					if (tile->texture == 0) {
+						continue;
+					}
+					if (!tile->texture_array_index) {
+						separate_texture_bytes -= candidate->size_in_bytes;
+					}
+					evict_tile_texture(candidate);
+					--resident_texture_count;
+					used_texture_bytes -= candidate->size_in_bytes;
+				}
+				texture_bytes = separate_texture_bytes + get_tile_texture_arrays_size_in_bytes();
+			}
+		}
+
+		if (need_evict_cache) {
+			// Least recently drawn first
+			qsort(eviction_candidates, arrlen(eviction_candidates), sizeof(eviction_candidate_t),
+			      eviction_candidate_compare_func);
+			for (i32 i = 0; i < arrlen(eviction_candidates) && cached_bytes > cache_target; ++i) {
+				eviction_candidate_t* candidate = eviction_candidates + i;
+				tile_t* tile = candidate->tile;
+				benaphore_lock(&candidate->image->lock);
+				// Note: tiles that are kept in the cache on purpose (e.g. for exporting) are left alone.
+				if (tile->is_cached && tile->pixels && !tile->need_keep_in_cache) {
+					tile_release_cache(tile);
+					--cached_tile_count;
+					cached_bytes -= candidate->size_in_bytes;
+					++stats->evicted_cache_count;
+				}
+				benaphore_unlock(&candidate->image->lock);
+			}
+		}
+		if (texture_bytes > stats->texture_budget || cached_bytes > stats->cache_budget) {
+			++stats->frames_over_budget;
+		}
+	}
+
+	separate_texture_bytes_last_frame = separate_texture_bytes;
+	stats->resident_texture_count = resident_texture_count;
+	stats->cached_tile_count = cached_tile_count;
+	stats->texture_bytes = texture_bytes;
+	stats->cached_bytes = cached_bytes;
+	stats->peak_texture_bytes = MAX(stats->peak_texture_bytes, texture_bytes);
+	stats->peak_cached_bytes = MAX(stats->peak_cached_bytes, cached_bytes);
+}
+
+bool tile_residency_can_allocate_texture_memory(i64 size_in_bytes) {
+	i64 texture_budget = (i64)tile_residency_texture_budget_in_mb * MEGABYTES(1);
+	return separate_texture_bytes_last_frame + get_tile_texture_arrays_size_in_bytes() + size_in_bytes <= texture_budget;
+}
+
+void tile_residency_get_stats(tile_residency_stats_t* stats) {
+	*stats = tile_residency_stats;
+}
+
+void tile_residency_print_stats() {
+	tile_residency_stats_t* stats = &tile_residency_stats;
+	console_print("Tile residency:\n");
+	console_print("    textures: %d tiles, %.1f / %.1f MiB (peak %.1f MiB), %lld evicted\n",
+	              stats->resident_texture_count, (double)stats->texture_bytes / MEGABYTES(1),
+	              (double)stats->texture_budget / MEGABYTES(1), (double)stats->peak_texture_bytes / MEGABYTES(1),
+	              stats->evicted_texture_count);
+	console_print("    cached pixels: %d tiles, %.1f / %.1f MiB (peak %.1f MiB), %lld evicted\n",
+	              stats->cached_tile_count, (double)stats->cached_bytes / MEGABYTES(1),
+	              (double)stats->cache_budget / MEGABYTES(1), (double)stats->peak_cached_bytes / MEGABYTES(1),
+	              stats->evicted_cache_count);
+	console_print("    frames over budget (nothing left to evict): %lld\n", stats->frames_over_budget);
+}
@@ -0,0 +1,76 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2024  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "common.h"
+#include "image.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Keeps the GPU textures and cached pixels of WSI tiles within a memory budget.
+// Tiles that received a texture or cached pixels are tracked per image (image->resident_tiles). Once per frame,
+// the budget is checked; if it is exceeded, the least recently drawn tiles are evicted until usage drops
+// below 90% of the budget. Tiles that are visible in the current frame are never evicted.
+// Tile texture arrays count toward the texture budget with their full size, because their memory is only given back
+// once all of their layers are released; the least occupied arrays are emptied first. If that is not enough, the
+// layers of arrays that can't be emptied are evicted too, so that they can be reused (new arrays are only allocated
+// while within the budget, see tile_residency_can_allocate_texture_memory()).
+// Must only be called from the main thread.
+
+typedef struct tile_residency_stats_t {
+	i32 resident_texture_count;
+	i32 cached_tile_count;
+	i64 texture_bytes;
+	i64 cached_bytes;
+	i64 peak_texture_bytes;
+	i64 peak_cached_bytes;
+	i64 texture_budget;
+	i64 cache_budget;
+	i64 evicted_texture_count;
+	i64 evicted_cache_count;
+	i64 frames_over_budget; // budget was exceeded, but there was not enough to evict (everything is visible)
+} tile_residency_stats_t;
+
+void tile_residency_track(image_t* image, i32 level, tile_t* tile);
+void tile_residency_enforce_budget(image_t** images, i32 image_count, i64 current_frame);
+bool tile_residency_can_allocate_texture_memory(i64 size_in_bytes);
+void tile_residency_get_stats(tile_residency_stats_t* stats);
+void tile_residency_print_stats();
+
+// globals
+#if defined(TILE_RESIDENCY_IMPL)
+#define INIT(...) __VA_ARGS__
+#define extern
+#else
+#define INIT(...)
+#undef extern
+#endif
+
+extern i32 tile_residency_texture_budget_in_mb INIT(= 1024);
+extern i32 tile_residency_cache_budget_in_mb INIT(= 512);
+
+#undef INIT
+#undef extern
+
+#ifdef __cplusplus
+}
+#endif
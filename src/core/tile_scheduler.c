@@ -0,0 +1,232 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2024  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+#include "platform.h"
+#include "image.h"
+#include "viewer.h"
+
+#define TILE_SCHEDULER_IMPL
+#include "tile_scheduler.h"
+
+// For remote slides, tiles are requested in batches to reduce the load on the server (see request_tiles());
+// these are only sent out once per frame, and never more than this many at a time.
+#define TILE_SCHEDULER_MAX_REMOTE_TILES_PER_FRAME 3
+
+typedef struct tile_scheduler_image_t {
+	image_t* image;
+	i32 resource_id;
+	load_tile_task_t* tasks; // array (stb_ds); visible tiles first, then prefetched tiles, each by descending priority
+	i32 next_task;
+	bool is_sorted;
+	bool is_used_this_frame;
+} tile_scheduler_image_t;
+
+static tile_scheduler_image_t* scheduled_images; // array (stb_ds)
+static tile_scheduler_stats_t tile_scheduler_stats;
+
+static tile_scheduler_image_t* get_scheduled_image(image_t* image) {
+	for (i32 i = 0; i < arrlen(scheduled_images); ++i) {
+		tile_scheduler_image_t* scheduled = scheduled_images + i;
+		if (scheduled->image == image && scheduled->resource_id == image->resource_id) {
+			return scheduled;
+		}
+	}
+	tile_scheduler_image_t new_scheduled = {.image = image, .resource_id = image->resource_id};
+	arrput(scheduled_images, new_scheduled);
+	return scheduled_images + arrlen(scheduled_images) - 1;
+}
+
+static bool is_image_loaded(image_t* image, i32 resource_id, image_t** images, i32 image_count) {
+	for (i32 i = 0; i < image_count; ++i) {
+		if (images[i] == image && image->resource_id == resource_id) {
+			return !image->is_deleted;
+		}
+	}
+	return false;
+}
+
+static bool does_tile_need_loading(load_tile_task_t* task) {
+	tile_t* tile = task->tile;
+	return tile->texture == 0 && !tile->is_empty && !tile->is_submitted_for_loading;
+}
+
+static int scheduled_task_compare_func(const void* a, const void* b) {
+	load_tile_task_t* task_a = (load_tile_task_t*)a;
+	load_tile_task_t* task_b = (load_tile_task_t*)b;
+	if (task_a->is_prefetch != task_b->is_prefetch) {
+		return (i32)task_a->is_prefetch - (i32)task_b->is_prefetch;
+	}
+	return task_b->priority - task_a->priority;
+}
+
+// Starts collecting a new set of needed tiles (the set from the previous frame is discarded).
+void tile_scheduler_begin_frame() {
+	for (i32 i = 0; i < arrlen(scheduled_images); ++i) {
+		tile_scheduler_image_t* scheduled = scheduled_images + i;
+		arrsetlen(scheduled->tasks, 0);
+		scheduled->next_task = 0;
+		scheduled->is_sorted = false;
+		scheduled->is_used_this_frame = false;
+	}
+}
+
+void tile_scheduler_add_tile(image_t* image, load_tile_task_t* task) {
+	tile_scheduler_image_t* scheduled = get_scheduled_image(image);
+	scheduled->is_used_this_frame = true;
+	scheduled->is_sorted = false;
+	arrput(scheduled->tasks, *task);
+}
+
+// Returns the next task of the image that still needs loading, or NULL if there is none (in this pass).
+static load_tile_task_t* get_next_scheduled_task(tile_scheduler_image_t* scheduled, bool is_prefetch_pass) {
+	while (scheduled->next_task < arrlen(scheduled->tasks)) {
+		load_tile_task_t* task = scheduled->tasks + scheduled->next_task;
+		if (task->is_prefetch && !is_prefetch_pass) {
+			return NULL; // visible tiles are done; prefetched tiles have to wait for the second pass
+		}
+		if (does_tile_need_loading(task)) {
+			return task;
+		}
+		++scheduled->next_task; // already loaded, or on its way
+	}
+	return NULL;
+}
+
+// Submits tile loads until the limit of loads in flight is reached. Call this after each frame's set of tiles is
+// complete (is_new_frame = true), and whenever tile loads complete. Returns the number of tile loads submitted.
+i32 tile_scheduler_dispatch(image_t** images, i32 image_count, bool is_new_frame) {
+	tile_scheduler_stats_t* stats = &tile_scheduler_stats;
+
+	// Forget about images that are no longer loaded
+	for (i32 i = (i32)arrlen(scheduled_images) - 1; i >= 0; --i) {
+		tile_scheduler_image_t* scheduled = scheduled_images + i;
+		if (!scheduled->is_used_this_frame || !is_image_loaded(scheduled->image, scheduled->resource_id, images, image_count)) {
+			arrfree(scheduled->tasks);
+			arrdelswap(scheduled_images, i);
+		}
+	}
+
+	// Count the tile loads that are still in flight
+	// (Note: cancelled loads still count until a worker thread has taken them off the queue)
+	i32 in_flight_count = 0;
+	i32 prefetch_in_flight_count = 0;
+	for (i32 image_index = 0; image_index < image_count; ++image_index) {
+		image_t* image = images[image_index];
+		in_flight_count += image->tile_loads_in_flight;
+		prefetch_in_flight_count += image->prefetch_tile_loads_in_flight;
+	}
+	i32 max_in_flight_count = tile_scheduler_max_tiles_in_flight;
+	if (max_in_flight_count <= 0) {
+		// Enough to keep all worker threads busy until the next refill (at least one frame later)
+		max_in_flight_count = ATLEAST(4, 2 * global_worker_thread_count + 2);
+	}
+	i32 free_slots = max_in_flight_count - in_flight_count;
+
+	i32 submitted_count = 0;
+	for (i32 i = 0; i < arrlen(scheduled_images); ++i) {
+		tile_scheduler_image_t* scheduled = scheduled_images + i;
+		if (!scheduled->is_sorted) {
+			qsort(scheduled->tasks, arrlen(scheduled->tasks), sizeof(load_tile_task_t), scheduled_task_compare_func);
+			scheduled->next_task = 0;
+			scheduled->is_sorted = true;
+		}
+
+		// Remote slides don't count toward the slots (they are loaded on the I/O thread, in batches)
+		image_t* image = scheduled->image;
+		if (image->backend == IMAGE_BACKEND_TIFF && image->tiff.is_remote) {
+			if (is_new_frame) {
+				load_tile_task_t batch[TILE_SCHEDULER_MAX_REMOTE_TILES_PER_FRAME];
+				i32 batch_count = 0;
+				for (i32 task_index = 0; task_index < arrlen(scheduled->tasks) && batch_count < COUNT(batch); ++task_index) {
+					load_tile_task_t* task = scheduled->tasks + task_index;
+					if (does_tile_need_loading(task)) {
+						batch[batch_count++] = *task;
+					}
+				}
+				if (batch_count > 0) {
+					benaphore_lock(&image->lock);
+					submitted_count += request_tiles(image, batch, batch_count);
+					benaphore_unlock(&image->lock);
+				}
+			}
+			scheduled->next_task = (i32)arrlen(scheduled->tasks); // skip in the passes below
+		}
+	}
+
+	// Hand out the free slots round-robin, first to the visible tiles, then to the prefetched tiles
+	for (i32 pass = 0; pass < 2; ++pass) {
+		bool is_prefetch_pass = (pass == 1);
+		bool any_submitted = true;
+		while (free_slots > 0 && any_submitted) {
+			any_submitted = false;
+			for (i32 i = 0; i < arrlen(scheduled_images) && free_slots > 0; ++i) {
+				if (is_prefetch_pass && prefetch_in_flight_count >= prefetch_max_tiles_in_flight) {
+					break;
+				}
+				tile_scheduler_image_t* scheduled = scheduled_images + i;
+				load_tile_task_t* task = get_next_scheduled_task(scheduled, is_prefetch_pass);
+				if (!task) {
+					continue;
+				}
+				benaphore_lock(&scheduled->image->lock);
+				i32 task_submitted_count = request_tiles(scheduled->image, task, 1);
+				benaphore_unlock(&scheduled->image->lock);
+				++scheduled->next_task;
+				if (task_submitted_count > 0) {
+					--free_slots;
+					++submitted_count;
+					any_submitted = true;
+					++stats->submitted_count;
+					if (task->is_prefetch) {
+						++prefetch_in_flight_count;
+						++stats->prefetch_submitted_count;
+					}
+				}
+			}
+		}
+	}
+
+	i32 needed_tile_count = 0;
+	for (i32 i = 0; i < arrlen(scheduled_images); ++i) {
+		tile_scheduler_image_t* scheduled = scheduled_images + i;
+		for (i32 task_index = scheduled->next_task; task_index < arrlen(scheduled->tasks); ++task_index) {
+			if (does_tile_need_loading(scheduled->tasks + task_index)) {
+				++needed_tile_count;
+			}
+		}
+	}
+	stats->needed_tile_count = needed_tile_count;
+	stats->in_flight_count = max_in_flight_count - free_slots;
+	stats->prefetch_in_flight_count = prefetch_in_flight_count;
+	stats->max_in_flight_count = max_in_flight_count;
+	return submitted_count;
+}
+
+void tile_scheduler_get_stats(tile_scheduler_stats_t* stats) {
+	*stats = tile_scheduler_stats;
+}
+
+void tile_scheduler_print_stats() {
+	tile_scheduler_stats_t* stats = &tile_scheduler_stats;
+	console_print("Tile scheduler:\n");
+	console_print("    in flight: %d / %d (%d prefetched)\n", stats->in_flight_count, stats->max_in_flight_count,
+	              stats->prefetch_in_flight_count);
+	console_print("    waiting: %d tiles\n", stats->needed_tile_count);
+	console_print("    submitted: %lld tiles (%lld prefetched)\n", stats->submitted_count, stats->prefetch_submitted_count);
+}
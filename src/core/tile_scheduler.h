@@ -0,0 +1,70 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2024  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "common.h"
+#include "image.h"
+#include "viewer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Viewer-wide scheduling of tile loads.
+// Every frame, each image hands over the full set of tiles that it needs (visible tiles, and tiles predicted to become
+// visible soon) using tile_scheduler_add_tile(). The scheduler keeps the worker threads fed from this set, up to a limit
+// on the number of tile loads in flight. The free slots are refilled whenever tile loads complete, not only when the next
+// frame's set comes in. Visible tiles always go before prefetched tiles, and the free slots are shared round-robin
+// between the loaded images, so that an overlay does not starve the base image (or vice versa).
+// iSyntax images are not scheduled here; they are streamed by the iSyntax streamer.
+// Must only be called from the main thread.
+
+typedef struct tile_scheduler_stats_t {
+	i32 needed_tile_count;   // tiles in the current set that still need loading
+	i32 in_flight_count;     // tile loads submitted to the worker threads, not yet completed
+	i32 prefetch_in_flight_count;
+	i32 max_in_flight_count;
+	i64 submitted_count;
+	i64 prefetch_submitted_count;
+} tile_scheduler_stats_t;
+
+void tile_scheduler_begin_frame();
+void tile_scheduler_add_tile(image_t* image, load_tile_task_t* task);
+i32 tile_scheduler_dispatch(image_t** images, i32 image_count, bool is_new_frame);
+void tile_scheduler_get_stats(tile_scheduler_stats_t* stats);
+void tile_scheduler_print_stats();
+
+// globals
+#if defined(TILE_SCHEDULER_IMPL)
+#define INIT(...) __VA_ARGS__
+#define extern
+#else
+#define INIT(...)
+#undef extern
+#endif
+
+extern i32 tile_scheduler_max_tiles_in_flight INIT(= 0); // 0 = automatic (based on the number of worker threads)
+
+#undef INIT
+#undef extern
+
+#ifdef __cplusplus
+}
+#endif
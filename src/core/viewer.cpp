@@ -54,6 +54,9 @@
 #include "shader.h"
 #include "ini.h"
 #include "image_registration.h"
+#include "pixel_buffer_pool.h"
+#include "tile_residency.h"
+#include "tile_scheduler.h"
 
 #include "viewer_opengl.cpp"
 #include "viewer_io_file.cpp"
@@ -132,10 +135,6 @@ bool is_key_down(input_t* input, i32 keycode) {
 	return result;
 }
 
-int priority_cmp_func (const void* a, const void* b) {
-	return ( (*(load_tile_task_t*)b).priority - (*(load_tile_task_t*)a).priority );
-}
-
 void init_app_state(app_state_t* app_state, app_command_t command) {
 	ASSERT(!app_state->initialized); // check sanity
 	ASSERT(app_state->temp_storage_memory == NULL);
@@ -197,7 +196,25 @@ void autosave(app_state_t* app_state, bool force_ignore_delay) {
 
 }
 
-void request_tiles(image_t* image, load_tile_task_t* wishlist, i32 tiles_to_load) {
+// Tile loads submitted by request_tiles() take up a slot in the tile scheduler, until they have completed or were cancelled.
+static void begin_tile_load_in_flight(load_tile_task_t* task) {
+	atomic_increment(&task->image->tile_loads_in_flight);
+	if (task->is_prefetch) {
+		atomic_increment(&task->image->prefetch_tile_loads_in_flight);
+	}
+}
+
+// Note: call this before the task releases the image (see finish_load_tile()).
+void end_tile_load_in_flight(load_tile_task_t* task) {
+	atomic_decrement(&task->image->tile_loads_in_flight);
+	if (task->is_prefetch) {
+		atomic_decrement(&task->image->prefetch_tile_loads_in_flight);
+	}
+}
+
+// Returns the number of tiles submitted.
+i32 request_tiles(image_t* image, load_tile_task_t* wishlist, i32 tiles_to_load) {
+	i32 submitted_count = 0;
 	i32 tasks_waiting = work_queue_get_entry_count(&global_work_queue);
 	i32 max_acceptable_tasks = global_work_queue.entry_count-1;
 	i32 usable_slots = max_acceptable_tasks - tasks_waiting;
@@ -218,7 +235,8 @@ void request_tiles(image_t* image, load_tile_task_t* wishlist, i32 tiles_to_load
 				load_tile_task_batch_t batch = {};
 				batch.task_count = ATMOST(COUNT(batch.tile_tasks), tiles_to_load);
 				memcpy(batch.tile_tasks, wishlist, batch.task_count * sizeof(load_tile_task_t));
-				if (work_queue_submit_task(&global_work_queue, tiff_load_tile_batch_func, &batch, sizeof(batch))) {
+				WORK_QUEUE_NAME_TASK(tiff_load_tile_batch_func);
+				if (work_queue_submit_task(get_io_work_queue(), tiff_load_tile_batch_func, &batch, sizeof(batch))) {
 					// success
 					for (i32 i = 0; i < batch.task_count; ++i) {
 						load_tile_task_t* task = batch.tile_tasks + i;
@@ -228,6 +246,7 @@ void request_tiles(image_t* image, load_tile_task_t* wishlist, i32 tiles_to_load
 						tile->need_keep_in_cache = task->need_keep_in_cache;
                         atomic_add(&image->refcount, task->refcount_to_decrement);
 					}
+					submitted_count = batch.task_count;
 				}
 			}
 		} else {
@@ -237,26 +256,45 @@ void request_tiles(image_t* image, load_tile_task_t* wishlist, i32 tiles_to_load
 				tile_t* tile = task.tile;
 				if (tile->is_cached && tile->texture == 0 && task.need_gpu_residency) {
 					// only GPU upload needed
+					WORK_QUEUE_NAME_TASK(viewer_upload_already_cached_tile_to_gpu);
 					if (work_queue_submit_task(&global_completion_queue, viewer_upload_already_cached_tile_to_gpu,
 					                           &task,
 					                           sizeof(task))) {
 						tile->is_submitted_for_loading = true;
 						tile->need_gpu_residency = task.need_gpu_residency;
 						tile->need_keep_in_cache = task.need_keep_in_cache;
+						begin_tile_load_in_flight(&task);
+						++submitted_count;
 					}
 				} else {
-					if (work_queue_submit_task(&global_work_queue, load_tile_func, &task, sizeof(task))) {
+					// Note: set these before submitting, because the task may already be cancelled (resetting
+					// is_submitted_for_loading) before we get here otherwise.
+					tile->is_submitted_for_loading = true;
+					tile->need_gpu_residency = task.need_gpu_residency;
+					tile->need_keep_in_cache = task.need_keep_in_cache;
+					atomic_add(&image->refcount, task.refcount_to_decrement);
+					begin_tile_load_in_flight(&task);
+					WORK_QUEUE_NAME_TASK(load_tile_func);
+					if (work_queue_submit_with_priority(&global_work_queue, load_tile_func,
+					                                    (work_queue_priority_enum)task.priority_lane,
+					                                    &tile->load_cancel_token, load_tile_cancelled_func,
+					                                    &task, sizeof(task))) {
 						// TODO: should we even allow this to fail?
 						// success
-						tile->is_submitted_for_loading = true;
-						tile->need_gpu_residency = task.need_gpu_residency;
-						tile->need_keep_in_cache = task.need_keep_in_cache;
-                        atomic_add(&image->refcount, task.refcount_to_decrement);
+						pending_tile_load_t pending = {.tile = tile, .scale = task.level, .tile_x = task.tile_x, .tile_y = task.tile_y,
+						                               .is_prefetch = (bool)task.is_prefetch};
+						arrput(image->pending_tile_loads, pending);
+						++submitted_count;
+					} else {
+						tile->is_submitted_for_loading = false;
+						end_tile_load_in_flight(&task);
+						atomic_subtract(&image->refcount, task.refcount_to_decrement);
 					}
 				}
 			}
 		}
 	}
+	return submitted_count;
 }
 
 bool is_resource_valid(app_state_t* app_state, i32 resource_id) {
@@ -281,8 +319,24 @@ image_t* get_image_from_resource_id(app_state_t* app_state, i32 resource_id) {
 
 #define VIEWER_ISYNTAX_TILE_COMPLETION_TASK_IDENTIFIER 5000
 
+// Tile pixels may have been decoded straight into the upload ring instead of a pixel buffer
+// iSyntax tiles are decoded straight into the GPU upload ring if there is room (see isyntax_streamer_t).
+static void* alloc_isyntax_tile_pixels(size_t size) {
+	u8* pixels = tile_upload_ring_alloc(size);
+	return pixels ? pixels : pixel_buffer_alloc(size);
+}
+
+static void free_tile_pixels(u8* pixels) {
+	if (tile_upload_ring_contains(pixels)) {
+		tile_upload_ring_free(pixels);
+	} else {
+		pixel_buffer_free(pixels);
+	}
+}
+
 void viewer_process_completion_queue(app_state_t* app_state) {
 	float max_texture_load_time = 0.007f; // TODO: pin to frame time
+	tile_upload_ring_reclaim_finished_uploads();
 #if 1
 	if (!finalize_textures_immediately) {
 		// Finalize textures that were uploaded via PBO the previous frame
@@ -310,7 +364,8 @@ void viewer_process_completion_queue(app_state_t* app_state) {
 #endif
 
 	// Retrieve completed tasks from the worker threads
-	i32 pixel_transfer_index_start = app_state->next_pixel_transfer_to_submit;
+	i64 pixel_transfer_count_start = app_state->pixel_transfer_count;
+	bool any_tile_completed = false;
 	while (work_queue_is_work_in_progress(&global_completion_queue)) {
 		work_queue_entry_t entry = work_queue_get_next_entry(&global_completion_queue);
 		if (entry.is_valid) {
@@ -319,60 +374,91 @@ void viewer_process_completion_queue(app_state_t* app_state) {
 
 			// TODO(pvalkema): fix assumption here that isyntax_streamer_tile_completed_task_t has the same layout as viewer_notify_tile_completed_task_t
 			if (entry.callback == viewer_notify_load_tile_completed || entry.task_identifier == VIEWER_ISYNTAX_TILE_COMPLETION_TASK_IDENTIFIER) {
-				viewer_notify_tile_completed_task_t* task = (viewer_notify_tile_completed_task_t*) entry.userdata;
+				viewer_notify_tile_completed_task_t* task = (viewer_notify_tile_completed_task_t*) work_queue_entry_get_userdata(&entry);
 				image_t* image = get_image_from_resource_id(app_state, task->resource_id);
+				any_tile_completed = true;
 				if (!image) {
 					// Image doesn't exist anymore (was unloaded?)
-					if (task->pixel_memory) free(task->pixel_memory);
+					free_tile_pixels(task->pixel_memory);
 				} else {
 					// Upload the tile to the GPU
 					tile_t* tile = get_tile_from_tile_index(image, task->scale, task->tile_index);
 					ASSERT(tile);
 					tile->is_submitted_for_loading = false;
-
-					if (task->pixel_memory) {
+					// Freshly loaded (maybe prefetched, not drawn yet): don't let it be the first to be evicted
+					tile->time_last_drawn = app_state->frame_counter;
+
+					u8* pixels = task->pixel_memory;
+					if (pixels && tile->need_keep_in_cache && tile_upload_ring_contains(pixels)) {
+						// The tile needs to be cached after all, but the upload ring can't be used as cache memory
+						size_t pixel_memory_size = (size_t)task->tile_width * task->tile_height * BYTES_PER_PIXEL;
+						u8* cached_pixels = (u8*)pixel_buffer_alloc(pixel_memory_size);
+						memcpy(cached_pixels, pixels, pixel_memory_size);
+						tile_upload_ring_free(pixels);
+						pixels = cached_pixels;
+					}
+					if (pixels) {
 						bool need_free_pixel_memory = true;
 						if (task->want_gpu_residency) {
-							pixel_transfer_state_t* transfer_state =
-									submit_texture_upload_via_pbo(app_state, task->tile_width, task->tile_height,
-									                              4, task->pixel_memory, finalize_textures_immediately);
-							if (finalize_textures_immediately) {
-								tile->texture = transfer_state->texture;
+							bool is_in_upload_ring = tile_upload_ring_contains(pixels);
+							if (finalize_textures_immediately &&
+							    upload_tile_to_texture_array(app_state, tile, task->tile_width, task->tile_height, pixels)) {
+								// done
+							} else if (is_in_upload_ring) {
+								tile->texture = load_texture_from_upload_ring(app_state, pixels, task->tile_width, task->tile_height);
 							} else {
-								transfer_state->userdata = (void*) tile;
-								tile->is_submitted_for_loading = true; // stuff still needs to happen, don't resubmit!
+								pixel_transfer_state_t* transfer_state =
+										submit_texture_upload_via_pbo(app_state, task->tile_width, task->tile_height,
+										                              4, pixels, finalize_textures_immediately);
+								if (finalize_textures_immediately) {
+									tile->texture = transfer_state->texture;
+								} else {
+									transfer_state->userdata = (void*) tile;
+									tile->is_submitted_for_loading = true; // stuff still needs to happen, don't resubmit!
+								}
+							}
+							if (is_in_upload_ring) {
+								need_free_pixel_memory = false; // the slot is recycled once the GPU is done with it
 							}
 						}
 						if (tile->need_keep_in_cache) {
 							need_free_pixel_memory = false;
-							tile->pixels = task->pixel_memory;
+							tile->pixels = pixels;
 							tile->is_cached = true;
 						}
 						if (need_free_pixel_memory) {
-							free(task->pixel_memory);
+							free_tile_pixels(pixels);
 						}
+						tile_residency_track(image, task->scale, tile);
 					} else {
 						tile->is_empty = true; // failed; don't resubmit!
 					}
 				}
 
 			} else if (entry.callback == viewer_upload_already_cached_tile_to_gpu) {
-				load_tile_task_t* task = (load_tile_task_t*) entry.userdata;
+				load_tile_task_t* task = (load_tile_task_t*) work_queue_entry_get_userdata(&entry);
 				if (!is_resource_valid(app_state, task->resource_id)) {
 					// Image no longer exists
 				} else {
 					tile_t* tile = task->tile;
 					ASSERT(tile);
 					tile->is_submitted_for_loading = false;
+					tile->time_last_drawn = app_state->frame_counter;
+					end_tile_load_in_flight(task);
+					any_tile_completed = true;
 					if (tile->is_cached && tile->pixels) {
 						if (tile->need_gpu_residency) {
-							pixel_transfer_state_t* transfer_state = submit_texture_upload_via_pbo(app_state,
-							                                                                       task->image->tile_width,
-							                                                                       task->image->tile_height,
-							                                                                       4,
-							                                                                       tile->pixels,
-							                                                                       finalize_textures_immediately);
-							tile->texture = transfer_state->texture;
+							if (!upload_tile_to_texture_array(app_state, tile, task->image->tile_width,
+							                                  task->image->tile_height, tile->pixels)) {
+								pixel_transfer_state_t* transfer_state = submit_texture_upload_via_pbo(app_state,
+								                                                                       task->image->tile_width,
+								                                                                       task->image->tile_height,
+								                                                                       4,
+								                                                                       tile->pixels,
+								                                                                       finalize_textures_immediately);
+								tile->texture = transfer_state->texture;
+							}
+							tile_residency_track(task->image, task->level, tile);
 						} else {
 							ASSERT(!"viewer_only_upload_cached_tile() called but !tile->need_gpu_residency\n");
 						}
@@ -386,6 +472,7 @@ void viewer_process_completion_queue(app_state_t* app_state) {
 				}
 
 			}
+			work_queue_release_entry(&global_completion_queue, &entry);
 		}
 
 		float time_elapsed = get_seconds_elapsed(app_state->last_frame_start, get_clock());
@@ -394,11 +481,86 @@ void viewer_process_completion_queue(app_state_t* app_state) {
 			break;
 		}
 
-		if (pixel_transfer_index_start == app_state->next_pixel_transfer_to_submit) {
+		if (app_state->pixel_transfer_count - pixel_transfer_count_start >= COUNT(app_state->pixel_transfer_states)) {
 //				console_print("Warning: not enough PBO's to do all the pixel transfers\n");
 			break;
 		}
 	}
+
+	tile_upload_ring_fence_pending_uploads();
+
+	// Refill the worker threads with tiles that are still needed
+	if (any_tile_completed) {
+		if (tile_scheduler_dispatch(app_state->loaded_images, (i32)arrlen(app_state->loaded_images), false) > 0) {
+			app_state->allow_idling_next_frame = false;
+		}
+	}
+}
+
+// Note: the shader program needs to be bound
+static void set_tile_shader_uniforms(basic_shader_t* shader, app_state_t* app_state, mat4x4 projection_view_matrix) {
+	scene_t* scene = &app_state->scene;
+	glUniform1i(shader->u_tex, 0);
+
+	glUniformMatrix4fv(shader->u_projection_view_matrix, 1, GL_FALSE, &projection_view_matrix[0][0]);
+
+	glUniform3fv(shader->u_background_color, 1, (GLfloat *) &app_state->clear_color);
+	if (app_state->use_image_adjustments) {
+		glUniform1f(shader->u_black_level, app_state->black_level);
+		glUniform1f(shader->u_white_level, app_state->white_level);
+	} else {
+		glUniform1f(shader->u_black_level, 0.0f);
+		glUniform1f(shader->u_white_level, 1.0f);
+	}
+	glUniform1i(shader->u_use_transparent_filter, scene->use_transparent_filter);
+	if (scene->use_transparent_filter) {
+		glUniform3fv(shader->u_transparent_color, 1, (GLfloat *) &scene->transparent_color);
+		glUniform1f(shader->u_transparent_tolerance, scene->transparent_tolerance);
+	}
+}
+
+// Tracks how fast the camera is moving (whether by keyboard panning, mouse dragging, or the zoom animation).
+static void scene_update_camera_velocity(scene_t* scene, float delta_time) {
+	v2f delta = v2f_subtract(scene->camera, scene->previous_camera);
+	scene->previous_camera = scene->camera;
+	float screen_size = MAX(scene->r_minus_l, scene->t_minus_b);
+	if (delta_time <= 0.0f || v2f_length(delta) > 2.0f * screen_size) {
+		scene->camera_velocity = V2F(0.0f, 0.0f); // the camera jumped (e.g. a different image was loaded)
+		return;
+	}
+	v2f velocity = v2f_scale(1.0f / delta_time, delta);
+	float t = MIN(1.0f, 10.0f * delta_time); // smooth over roughly 100 ms
+	scene->camera_velocity = v2f_lerp(scene->camera_velocity, v2f_subtract(velocity, scene->camera_velocity), t);
+}
+
+// Predicts where the camera will be a moment from now: where the zoom animation is heading (if include_zoom is set),
+// or otherwise, where the camera is panning to. Returns false if the camera is more or less at rest.
+static bool scene_predict_camera_bounds(scene_t* scene, bool include_zoom, bounds2f* predicted_bounds, i32* predicted_zoom_level) {
+	bounds2f bounds = scene->camera_bounds;
+	float screen_width = bounds.max.x - bounds.min.x;
+	float screen_height = bounds.max.y - bounds.min.y;
+	bool is_zooming = include_zoom && scene->need_zoom_animation && fabsf(scene->zoom_target_state.pos - scene->zoom.pos) > 0.1f;
+	if (is_zooming) {
+		// The zoom animation scales the view around the zoom pivot (this includes the camera movement toward the pivot)
+		float scale = scene->zoom_target_state.pixel_width / scene->zoom.pixel_width;
+		v2f pivot = scene->zoom_pivot;
+		bounds.min = v2f_add(pivot, v2f_scale(scale, v2f_subtract(bounds.min, pivot)));
+		bounds.max = v2f_add(pivot, v2f_scale(scale, v2f_subtract(bounds.max, pivot)));
+		*predicted_zoom_level = scene->zoom_target_state.level;
+	} else {
+		// Extrapolate the panning movement, but don't look further ahead than one screen
+		v2f shift = v2f_scale((float)prefetch_lookahead_ms * 0.001f, scene->camera_velocity);
+		shift.x = CLAMP(shift.x, -screen_width, screen_width);
+		shift.y = CLAMP(shift.y, -screen_height, screen_height);
+		if (fabsf(shift.x) < 0.1f * screen_width && fabsf(shift.y) < 0.1f * screen_height) {
+			return false;
+		}
+		bounds.min = v2f_add(bounds.min, shift);
+		bounds.max = v2f_add(bounds.max, shift);
+		*predicted_zoom_level = scene->zoom.level;
+	}
+	*predicted_bounds = bounds;
+	return true;
 }
 
 void update_and_render_image(app_state_t* app_state, image_t* image) {
@@ -470,6 +632,7 @@ void update_and_render_image(app_state_t* app_state, image_t* image) {
 			tile_streamer.tile_completion_callback = NULL;
 			tile_streamer.tile_completion_task_identifier = VIEWER_ISYNTAX_TILE_COMPLETION_TASK_IDENTIFIER;
             tile_streamer.pixel_format = LIBISYNTAX_PIXEL_FORMAT_BGRA;
+			tile_streamer.alloc_tile_pixels = alloc_isyntax_tile_pixels;
 			if (!wsi->first_load_complete && !wsi->first_load_in_progress) {
 				wsi->first_load_in_progress = true;
 				isyntax_begin_first_load(&tile_streamer);
@@ -484,6 +647,11 @@ void update_and_render_image(app_state_t* app_state, image_t* image) {
 				tile_streamer.crop_bounds = scene->crop_bounds;
 				tile_streamer.is_cropped = scene->is_cropped;
 				tile_streamer.zoom_level = scene->zoom.level;
+				if (use_predictive_prefetch) {
+					i32 predicted_zoom_level = 0;
+					tile_streamer.has_prefetch_bounds = scene_predict_camera_bounds(scene, false, &tile_streamer.prefetch_bounds,
+					                                                                &predicted_zoom_level);
+				}
 				isyntax_begin_stream_image_tiles(&tile_streamer);
 			}
 		} else if (image->backend == IMAGE_BACKEND_STBI) {
@@ -500,10 +668,9 @@ void update_and_render_image(app_state_t* app_state, image_t* image) {
 
 		} else {
 
-			// Create a 'wishlist' of tiles to request
-			load_tile_task_t tile_wishlist[32];
-			i32 num_tasks_on_wishlist = 0;
+			// Hand over all the tiles that need to be loaded to the tile scheduler
 			float screen_radius = ATLEAST(1.0f, sqrtf(SQUARE(client_width/2) + SQUARE(client_height/2)));
+			bounds2i visible_tiles_per_scale[IMAGE_PYRAMID_MAX_LEVELS] = {};
 
 			for (i32 scale = highest_visible_scale; scale >= lowest_visible_scale; --scale) {
 				ASSERT(scale >= 0 && scale < COUNT(image->level_images));
@@ -527,6 +694,7 @@ void update_and_render_image(app_state_t* app_state, image_t* image) {
 					                                                        drawn_level->y_tile_side_in_um, image->origin_offset);
 					visible_tiles = clip_bounds2i(visible_tiles, crop_tile_bounds);
 				}
+				visible_tiles_per_scale[scale] = visible_tiles;
 
 				i32 base_priority = (image->level_count - scale) * 100; // highest priority for the most zoomed in levels
 
@@ -535,6 +703,8 @@ void update_and_render_image(app_state_t* app_state, image_t* image) {
 					for (i32 tile_x = visible_tiles.min.x; tile_x < visible_tiles.max.x; ++tile_x) {
 
 						tile_t* tile = get_tile(drawn_level, tile_x, tile_y);
+						// Counts as visible (not to be evicted), even if it ends up hidden behind a more detailed level
+						tile->time_last_drawn = app_state->frame_counter;
                         // TODO: check that the file offset is actually known (level might need indexing)
 						if (tile->texture != 0 || tile->is_empty || tile->is_submitted_for_loading) {
 							continue; // nothing needs to be done with this tile
@@ -551,37 +721,109 @@ void update_and_render_image(app_state_t* app_state, image_t* image) {
 						float priority_bonus = (1.0f - tile_distance_from_center_of_screen) * 300.0f; // can be tweaked.
 						i32 tile_priority = base_priority + (i32)priority_bonus;
 
-						if (num_tasks_on_wishlist >= COUNT(tile_wishlist)) {
-							break;
-						}
 						load_tile_task_t task = {
 								.resource_id = image->resource_id,
 								.image = image, .tile = tile, .level = scale, .tile_x = tile_x, .tile_y = tile_y,
 								.priority = tile_priority,
+								// Tiles near the center of the screen may overtake tiles requested in earlier frames
+								.priority_lane = (priority_bonus >= 200.0f) ? WORK_QUEUE_PRIORITY_HIGH : WORK_QUEUE_PRIORITY_NORMAL,
 								.need_gpu_residency = true,
 								.need_keep_in_cache = tile->need_keep_in_cache,
 								.completion_callback = viewer_notify_load_tile_completed,
 //								.completion_queue = &global_completion_queue,
                                 .refcount_to_decrement = 1, // will be decremented at and of thread proc load_tile_func()
 						};
-						tile_wishlist[num_tasks_on_wishlist++] = task;
+						tile_scheduler_add_tile(image, &task);
 					}
 				}
 			}
-//			if (num_tasks_on_wishlist > 0) {
-//				console_print_verbose("Num tiles on wishlist = %d\n", num_tasks_on_wishlist);
-//			}
 
-			qsort(tile_wishlist, num_tasks_on_wishlist, sizeof(load_tile_task_t), priority_cmp_func);
-
-//		    last_section = profiler_end_section(last_section, "viewer_update_and_render: create tiles wishlist", 5.0f);
+			// Predict which tiles will be needed soon (while panning or zooming), so that we can prefetch them.
+			i32 prefetch_scale = -1;
+			bounds2i prefetch_tiles = {};
+			bounds2f predicted_bounds = {};
+			i32 predicted_zoom_level = 0;
+			if (use_predictive_prefetch && scene_predict_camera_bounds(scene, true, &predicted_bounds, &predicted_zoom_level)) {
+				prefetch_scale = CLAMP(predicted_zoom_level, 0, highest_visible_scale);
+				for (; prefetch_scale > 0; --prefetch_scale) {
+					if (image->level_images[prefetch_scale].exists) {
+						break;
+					}
+				}
+				level_image_t* prefetch_level = image->level_images + prefetch_scale;
+				if (prefetch_level->exists && !prefetch_level->needs_indexing) {
+					bounds2i level_tiles_bounds = BOUNDS2I(0, 0, (i32)prefetch_level->width_in_tiles, (i32)prefetch_level->height_in_tiles);
+					prefetch_tiles = world_bounds_to_tile_bounds(&predicted_bounds, prefetch_level->x_tile_side_in_um,
+					                                             prefetch_level->y_tile_side_in_um, image->origin_offset);
+					prefetch_tiles = clip_bounds2i(prefetch_tiles, level_tiles_bounds);
+					if (scene->is_cropped) {
+						bounds2i crop_tile_bounds = world_bounds_to_tile_bounds(&scene->crop_bounds,
+						                                                        prefetch_level->x_tile_side_in_um,
+						                                                        prefetch_level->y_tile_side_in_um, image->origin_offset);
+						prefetch_tiles = clip_bounds2i(prefetch_tiles, crop_tile_bounds);
+					}
+				} else {
+					prefetch_scale = -1;
+				}
+			}
 
-			i32 max_tiles_to_load = (image->backend == IMAGE_BACKEND_TIFF && image->tiff.is_remote) ? 3 : 10;
-			i32 tiles_to_load = ATMOST(num_tasks_on_wishlist, max_tiles_to_load);
+			// Cancel loading tiles that went off-screen before a worker thread got to them (e.g. while panning).
+			// Prefetched tiles are kept as long as they are still in the predicted area.
+			for (i32 i = 0; i < arrlen(image->pending_tile_loads);) {
+				pending_tile_load_t* pending = image->pending_tile_loads + i;
+				tile_t* tile = pending->tile;
+				bounds2i visible_tiles = visible_tiles_per_scale[pending->scale];
+				bool is_visible = pending->tile_x >= visible_tiles.min.x && pending->tile_x < visible_tiles.max.x &&
+				                  pending->tile_y >= visible_tiles.min.y && pending->tile_y < visible_tiles.max.y;
+				bool is_predicted = pending->scale == prefetch_scale &&
+				                    pending->tile_x >= prefetch_tiles.min.x && pending->tile_x < prefetch_tiles.max.x &&
+				                    pending->tile_y >= prefetch_tiles.min.y && pending->tile_y < prefetch_tiles.max.y;
+				if (!tile->is_submitted_for_loading) {
+					arrdelswap(image->pending_tile_loads, i); // done (or already cancelled)
+				} else if (!is_visible && !(pending->is_prefetch && is_predicted)) {
+					work_queue_cancel(&tile->load_cancel_token);
+					arrdelswap(image->pending_tile_loads, i);
+				} else {
+					++i;
+				}
+			}
 
-			if (tiles_to_load > 0) {
-				request_tiles(image, tile_wishlist, tiles_to_load);
-				app_state->allow_idling_next_frame = false;
+			// Predicted tiles that are not visible yet can be prefetched, at a lower priority than the visible tiles.
+			if (prefetch_scale >= 0) {
+				level_image_t* prefetch_level = image->level_images + prefetch_scale;
+				bounds2i visible_tiles = visible_tiles_per_scale[prefetch_scale];
+				v2f predicted_center = V2F(0.5f * (predicted_bounds.min.x + predicted_bounds.max.x),
+				                           0.5f * (predicted_bounds.min.y + predicted_bounds.max.y));
+				for (i32 tile_y = prefetch_tiles.min.y; tile_y < prefetch_tiles.max.y; ++tile_y) {
+					for (i32 tile_x = prefetch_tiles.min.x; tile_x < prefetch_tiles.max.x; ++tile_x) {
+						if (tile_x >= visible_tiles.min.x && tile_x < visible_tiles.max.x &&
+						    tile_y >= visible_tiles.min.y && tile_y < visible_tiles.max.y) {
+							continue; // visible tiles are already taken care of
+						}
+						tile_t* tile = get_tile(prefetch_level, tile_x, tile_y);
+						// Predicted tiles are about to be drawn, so they should not be evicted either
+						tile->time_last_drawn = app_state->frame_counter;
+						if (tile->texture != 0 || tile->is_empty || tile->is_submitted_for_loading) {
+							continue;
+						}
+						// Prefer tiles close to where the center of the screen is going to be
+						float distance_x = (predicted_center.x - ((tile_x + 0.5f) * prefetch_level->x_tile_side_in_um)) / prefetch_level->um_per_pixel_x;
+						float distance_y = (predicted_center.y - ((tile_y + 0.5f) * prefetch_level->y_tile_side_in_um)) / prefetch_level->um_per_pixel_y;
+						i32 tile_priority = -(i32)sqrtf(SQUARE(distance_x) + SQUARE(distance_y));
+						load_tile_task_t task = {
+								.resource_id = image->resource_id,
+								.image = image, .tile = tile, .level = prefetch_scale, .tile_x = tile_x, .tile_y = tile_y,
+								.priority = tile_priority,
+								.priority_lane = WORK_QUEUE_PRIORITY_LOW,
+								.need_gpu_residency = true,
+								.need_keep_in_cache = tile->need_keep_in_cache,
+								.is_prefetch = true,
+								.completion_callback = viewer_notify_load_tile_completed,
+								.refcount_to_decrement = 1,
+						};
+						tile_scheduler_add_tile(image, &task);
+					}
+				}
 			}
 		}
 
@@ -615,25 +857,13 @@ void update_and_render_image(app_state_t* app_state, image_t* image) {
 		mat4x4 projection_view_matrix;
 		mat4x4_mul(projection_view_matrix, projection, view_matrix);
 
+		if (tile_batch_shader.program) {
+			glUseProgram(tile_batch_shader.program);
+			set_tile_shader_uniforms(&tile_batch_shader, app_state, projection_view_matrix);
+		}
 		glUseProgram(basic_shader.program);
 		glActiveTexture(GL_TEXTURE0);
-		glUniform1i(basic_shader.u_tex, 0);
-
-		glUniformMatrix4fv(basic_shader.u_projection_view_matrix, 1, GL_FALSE, &projection_view_matrix[0][0]);
-
-		glUniform3fv(basic_shader.u_background_color, 1, (GLfloat *) &app_state->clear_color);
-		if (app_state->use_image_adjustments) {
-			glUniform1f(basic_shader.u_black_level, app_state->black_level);
-			glUniform1f(basic_shader.u_white_level, app_state->white_level);
-		} else {
-			glUniform1f(basic_shader.u_black_level, 0.0f);
-			glUniform1f(basic_shader.u_white_level, 1.0f);
-		}
-		glUniform1i(basic_shader.u_use_transparent_filter, scene->use_transparent_filter);
-		if (scene->use_transparent_filter) {
-			glUniform3fv(basic_shader.u_transparent_color, 1, (GLfloat *) &app_state->scene.transparent_color);
-			glUniform1f(basic_shader.u_transparent_tolerance, app_state->scene.transparent_tolerance);
-		}
+		set_tile_shader_uniforms(&basic_shader, app_state, projection_view_matrix);
 
 //		last_section = profiler_end_section(last_section, "viewer_update_and_render: render (1)", 5.0f);
 
@@ -729,11 +959,19 @@ void update_and_render_image(app_state_t* app_state, image_t* image) {
 					tile_t *tile = get_tile(drawn_level, tile_x, tile_y);
 					if (tile->texture) {
 						tile->time_last_drawn = app_state->frame_counter;
-						u32 texture = get_texture_for_tile(image, level, tile_x, tile_y);
+						tile_residency_track(image, level, tile);
 
 						float tile_pos_x = drawn_level->origin_offset.x + drawn_level->x_tile_side_in_um * tile_x;
 						float tile_pos_y = drawn_level->origin_offset.y + drawn_level->y_tile_side_in_um * tile_y;
 
+						if (tile->texture_array_index) {
+							// Tile lives in a texture array: it will be drawn together with the rest of this level
+							queue_tile_instance(tile, tile_pos_x, tile_pos_y, drawn_level->x_tile_side_in_um,
+							                    drawn_level->y_tile_side_in_um);
+							continue;
+						}
+						u32 texture = get_texture_for_tile(image, level, tile_x, tile_y);
+
 						// define model matrix
 						mat4x4 model_matrix;
 						mat4x4_translate(model_matrix, tile_pos_x, tile_pos_y, 0.0f);
@@ -747,6 +985,9 @@ void update_and_render_image(app_state_t* app_state, image_t* image) {
 					}
 				}
 			}
+			if (draw_queued_tile_instances()) {
+				glUseProgram(basic_shader.program);
+			}
 
 			if (missing_tiles_on_this_level == 0) {
 				break; // don't need to bother drawing the next level, there are no gaps left to fill in!
@@ -1675,6 +1916,9 @@ void viewer_update_and_render(app_state_t *app_state, input_t *input, i32 client
 		draw_scale_bar(&scene->scale_bar);
 	}
 
+	scene_update_camera_velocity(scene, delta_time);
+	tile_scheduler_begin_frame();
+
 	if (image_count <= 1) {
 		// Render everything at once
 //		glBindFramebuffer(GL_FRAMEBUFFER, 0); // Redundant
@@ -1721,6 +1965,13 @@ void viewer_update_and_render(app_state_t *app_state, input_t *input, i32 client
 		glBindVertexArray(0);
 	}
 
+	// Submit the tiles needed for this frame (for all images), as far as there are free worker slots
+	if (tile_scheduler_dispatch(app_state->loaded_images, image_count, true) > 0) {
+		app_state->allow_idling_next_frame = false;
+	}
+
+	// Free up textures and cached tiles that haven't been drawn for a while, if we are over budget
+	tile_residency_enforce_budget(app_state->loaded_images, image_count, app_state->frame_counter);
 
 	do_after_scene_render(app_state, input);
 }
@@ -73,6 +73,7 @@ typedef struct directory_info_t {
 } directory_info_t;
 
 #define BYTES_PER_PIXEL 4
+#define TILE_TEXTURE_ARRAY_MAX_COUNT 32 // see viewer_opengl.cpp
 
 typedef enum filetype_hint_enum {
 	FILETYPE_HINT_NONE = 0,
@@ -102,8 +103,10 @@ typedef struct load_tile_task_t {
 	i32 tile_x;
 	i32 tile_y;
 	i32 priority;
+	i32 priority_lane; // work_queue_priority_enum
 	bool8 need_gpu_residency;
 	bool8 need_keep_in_cache;
+	bool8 is_prefetch; // not visible yet, but predicted to become visible soon
 	work_queue_callback_t* completion_callback;
 	work_queue_t* completion_queue;
     i32 refcount_to_decrement;
@@ -120,6 +123,7 @@ typedef struct viewer_notify_tile_completed_task_t {
 } viewer_notify_tile_completed_task_t;
 
 
+// Note: a batch is too large to fit inline in a work queue entry, it goes into the queue's payload storage.
 #define TILE_LOAD_BATCH_MAX 8
 
 typedef struct load_tile_task_batch_t {
@@ -219,6 +223,8 @@ typedef struct scene_t {
 	v2f panning_velocity;
 	v2f zoom_pivot;
 	zoom_state_t zoom_target_state;
+	v2f camera_velocity; // observed camera movement in um/s (smoothed), used for predictive prefetching
+	v2f previous_camera;
 	v2f level_pixel_size;
 	v4f clear_color;
 	u32 entity_count;
@@ -330,6 +336,7 @@ typedef struct app_state_t {
 	i32 keyboard_base_panning_speed;
 	pixel_transfer_state_t pixel_transfer_states[32];
 	u32 next_pixel_transfer_to_submit;
+	i64 pixel_transfer_count; // number of transfers that went through pixel_transfer_states
 	window_handle_t main_window;
 	bool is_window_title_set_for_image;
 	input_t* input;
@@ -352,6 +359,8 @@ void unload_all_images(app_state_t* app_state);
 bool load_generic_file(app_state_t* app_state, const char* filename, u32 filetype_hint);
 image_t* load_image_from_file(app_state_t* app_state, file_info_t* file, directory_info_t* directory, u32 filetype_hint);
 void load_tile_func(i32 logical_thread_index, void* userdata);
+void load_tile_cancelled_func(i32 logical_thread_index, void* userdata);
+void load_tile_into_cache_func(i32 logical_thread_index, void* userdata);
 void load_openslide_wsi(wsi_t* wsi, const char* filename);
 void unload_openslide_wsi(wsi_t* wsi);
 bool was_button_pressed(button_state_t* button);
@@ -360,7 +369,8 @@ bool was_key_pressed(input_t* input, i32 keycode);
 bool is_key_down(input_t* input, i32 keycode);
 void init_app_state(app_state_t* app_state, app_command_t command);
 void autosave(app_state_t* app_state, bool force_ignore_delay);
-void request_tiles(image_t* image, load_tile_task_t* wishlist, i32 tiles_to_load);
+i32 request_tiles(image_t* image, load_tile_task_t* wishlist, i32 tiles_to_load);
+void end_tile_load_in_flight(load_tile_task_t* task);
 void scene_update_camera_pos(scene_t* scene, v2f pos);
 void viewer_switch_tool(app_state_t* app_state, placement_tool_enum tool);
 void viewer_update_and_render(app_state_t* app_state, input_t* input, i32 client_width, i32 client_height, float delta_time);
@@ -369,6 +379,19 @@ void do_after_scene_render(app_state_t* app_state, input_t* input);
 // viewer_opengl.cpp
 u32 load_texture(void* pixels, i32 width, i32 height, u32 pixel_format);
 void unload_texture(u32 texture);
+bool upload_tile_to_texture_array(app_state_t* app_state, tile_t* tile, i32 width, i32 height, u8* pixels);
+u8* tile_upload_ring_alloc(size_t size);
+bool tile_upload_ring_contains(void* pixels);
+void tile_upload_ring_free(void* pixels);
+void tile_upload_ring_fence_pending_uploads();
+void tile_upload_ring_reclaim_finished_uploads();
+u32 load_texture_from_upload_ring(app_state_t* app_state, u8* pixels, i32 width, i32 height);
+void release_tile_texture(tile_t* tile);
+i64 get_tile_texture_arrays_size_in_bytes();
+i64 get_tile_texture_arrays_used_size_in_bytes();
+i32 get_tile_texture_array_used_layer_count(tile_t* tile);
+void queue_tile_instance(tile_t* tile, float x, float y, float width, float height);
+bool draw_queued_tile_instances();
 void init_opengl_stuff(app_state_t* app_state);
 void upload_tile_on_worker_thread(image_t* image, void* tile_pixels, i32 scale, i32 tile_index, i32 tile_width, i32 tile_height);
 
@@ -423,6 +446,11 @@ extern i64 zoom_out_key_hold_down_start_time;
 extern i64 zoom_out_key_times_zoomed_while_holding;
 extern bool prefer_integer_zoom INIT(= false);
 extern bool use_fast_rendering INIT(= false); // optimize for performance for e.g. remote desktop
+extern bool use_batched_tile_rendering INIT(= true); // draw tiles using texture arrays + instancing, if available
+extern bool use_tile_upload_ring INIT(= true); // decode tiles straight into a persistently mapped PBO, if available
+extern bool use_predictive_prefetch INIT(= true); // also request tiles for where the camera is heading (panning/zooming)
+extern i32 prefetch_lookahead_ms INIT(= 500);
+extern i32 prefetch_max_tiles_in_flight INIT(= 16);
 extern i32 global_lowest_scale_to_render INIT(= 0);
 extern i32 global_highest_scale_to_render INIT(= 16);
 
@@ -19,6 +19,8 @@
 #include "tif_lzw.h"
 #include "dicom.h"
 #include "dicom_wsi.h"
+#include "async_io.h"
+#include "pixel_buffer_pool.h"
 
 // TODO: refactor
 void viewer_upload_already_cached_tile_to_gpu(int logical_thread_index, void* userdata) {
@@ -28,23 +30,17 @@ void viewer_upload_already_cached_tile_to_gpu(int logical_thread_index, void* us
 
 void viewer_notify_load_tile_completed(int logical_thread_index, void* userdata) {
 	viewer_notify_tile_completed_task_t* task = (viewer_notify_tile_completed_task_t*)userdata;
+	WORK_QUEUE_NAME_TASK(viewer_notify_load_tile_completed);
 	work_queue_submit_task(&global_completion_queue, viewer_notify_load_tile_completed, task, sizeof(*task));
 }
 
 
-void load_tile_func(i32 logical_thread_index, void* userdata) {
-	load_tile_task_t* task = (load_tile_task_t*) userdata;
-	image_t* image = task->image;
-
-	if (image->is_deleted) {
-		// Early out to save time if the image was already closed/waiting for destruction
-		atomic_subtract(&image->refcount, task->refcount_to_decrement);
-		return;
-	}
-
-	i32 level = task->level;
-	i32 tile_x = task->tile_x;
-	i32 tile_y = task->tile_y;
+// Decodes a tile; returns the BGRA pixels (release with pixel_buffer_free()), or NULL on failure.
+// For TIFF, prefetched_tile_data may hold the compressed tile if it was already read (ownership is transferred).
+// If use_upload_ring is set, the tile is decoded straight into the GPU upload ring if there is room; in that case
+// the returned pixels must be released with tile_upload_ring_free() instead (or be handed over to the upload).
+static u8* load_tile_pixels(i32 logical_thread_index, image_t* image, i32 level, i32 tile_x, i32 tile_y, u8* prefetched_tile_data,
+                            bool use_upload_ring) {
 	level_image_t* level_image = image->level_images + level;
 	ASSERT(level_image->exists);
 	i32 tile_index = tile_y * level_image->width_in_tiles + tile_x;
@@ -54,24 +50,29 @@ void load_tile_func(i32 logical_thread_index, void* userdata) {
 	float tile_x_excess = tile_world_pos_x_end - image->width_in_um;
 	float tile_y_excess = tile_world_pos_y_end - image->height_in_um;
 
-	// Note: when the thread started up we allocated a large blob of memory for the thread to use privately
-	// TODO: better/more explicit allocator (instead of some setting some hard-coded pointers)
+	// The TIFF and DICOM decoders allocate the pixel buffer themselves (from the pixel buffer pool), unless we can
+	// give them a slot in the upload ring.
+	// OpenSlide composites into the destination (reading it back), which would be very slow on the upload ring's
+	// write-combined memory, so it always gets normal memory.
 	size_t pixel_memory_size = level_image->tile_width * level_image->tile_height * BYTES_PER_PIXEL;
-	u8* temp_memory = (u8*)malloc(pixel_memory_size);
-	memset(temp_memory, 0xFF, pixel_memory_size);
-//	u8* compressed_tile_data = NULL;
+	if (image->backend == IMAGE_BACKEND_OPENSLIDE) {
+		use_upload_ring = false;
+	}
+	u8* upload_ring_memory = use_upload_ring ? tile_upload_ring_alloc(pixel_memory_size) : NULL;
+	u8* temp_memory = NULL;
 
 	bool failed = false;
 	ASSERT(image->type == IMAGE_TYPE_WSI);
 	if (image->backend == IMAGE_BACKEND_TIFF) {
 		tiff_t* tiff = &image->tiff;
 		tiff_ifd_t* level_ifd = tiff->level_images_ifd + level_image->pyramid_image_index;
-		u8* pixels = tiff_decode_tile(logical_thread_index, tiff, level_ifd, tile_index, level, tile_x, tile_y);
-		if (pixels) {
-			free(temp_memory);
-			temp_memory = pixels;
-		} else {
-			failed = true;
+		temp_memory = tiff_decode_tile(logical_thread_index, tiff, level_ifd, tile_index, level, tile_x, tile_y, prefetched_tile_data,
+		                               upload_ring_memory, upload_ring_memory ? pixel_memory_size : 0);
+		if (!temp_memory) {
+			if (upload_ring_memory) {
+				tile_upload_ring_free(upload_ring_memory);
+			}
+			return NULL;
 		}
 
 		// Trim the tile (replace with transparent color) if it extends beyond the image size
@@ -100,13 +101,13 @@ void load_tile_func(i32 logical_thread_index, void* userdata) {
 		i32 wsi_file_level = level_image->pyramid_image_index;
 		i64 x = (tile_x * level_image->tile_width) << level;
 		i64 y = (tile_y * level_image->tile_height) << level;
+		temp_memory = (u8*)pixel_buffer_alloc(pixel_memory_size);
+		memset(temp_memory, 0xFF, pixel_memory_size);
 		openslide.read_region(wsi->osr, (u32*)temp_memory, x, y, wsi_file_level, level_image->tile_width, level_image->tile_height);
 	} else if (image->backend == IMAGE_BACKEND_DICOM) {
-		u8* pixels = dicom_wsi_decode_tile_to_bgra(&image->dicom, level, tile_index);
-		if (pixels) {
-			free(temp_memory);
-			temp_memory = pixels;
-		} else {
+		temp_memory = dicom_wsi_decode_tile_to_bgra(&image->dicom, level, tile_index,
+		                                            upload_ring_memory, upload_ring_memory ? pixel_memory_size : 0);
+		if (!temp_memory) {
 			failed = true;
 		}
 	} else if (image->backend == IMAGE_BACKEND_ISYNTAX) {
@@ -122,9 +123,29 @@ void load_tile_func(i32 logical_thread_index, void* userdata) {
 
 
 	if (failed && temp_memory != NULL) {
-		free(temp_memory);
+		if (temp_memory != upload_ring_memory) {
+			pixel_buffer_free(temp_memory);
+		}
 		temp_memory = NULL;
 	}
+	if (upload_ring_memory && temp_memory != upload_ring_memory) {
+		tile_upload_ring_free(upload_ring_memory); // not used after all
+	}
+	return temp_memory;
+}
+
+static void finish_load_tile(i32 logical_thread_index, load_tile_task_t* task, u8* prefetched_tile_data) {
+	image_t* image = task->image;
+	i32 level = task->level;
+	i32 tile_x = task->tile_x;
+	i32 tile_y = task->tile_y;
+	level_image_t* level_image = image->level_images + level;
+	i32 tile_index = tile_y * level_image->width_in_tiles + tile_x;
+	// Tiles that only need to be uploaded (by viewer_process_completion_queue()) can be decoded straight into the upload ring.
+	// Cached tiles need memory of their own.
+	bool use_upload_ring = task->need_gpu_residency && !task->need_keep_in_cache &&
+	                       task->completion_callback == viewer_notify_load_tile_completed && !task->completion_queue;
+	u8* temp_memory = load_tile_pixels(logical_thread_index, image, level, tile_x, tile_y, prefetched_tile_data, use_upload_ring);
 
 //	console_print_verbose("[thread %d] completing...\n", logical_thread_index);
 
@@ -165,12 +186,114 @@ void load_tile_func(i32 logical_thread_index, void* userdata) {
     // NOTE: we guarantee existence of image_t until the jobs submitted from the main thread are done.
     // However, we will NOT wait for the completion queues to also be finished (usually the responsibility of the main thread).
     // This means that when we receive the completion tasks on the main thread, we have to check if the image is still valid.
+    end_tile_load_in_flight(task);
     atomic_subtract(&image->refcount, task->refcount_to_decrement);
 
 //	console_print_verbose("[thread %d] tile load done\n", logical_thread_index);
 
 }
 
+// Called on a worker thread when the compressed tile data submitted in load_tile_submit_async_read() has been read.
+static void load_tile_read_completed_func(i32 logical_thread_index, void* userdata) {
+	async_io_completion_t* completion = (async_io_completion_t*) userdata;
+	load_tile_task_t* task = (load_tile_task_t*) completion->userdata;
+	u8* compressed_tile_data = (u8*) completion->dest;
+	if (completion->bytes_read != (i64)completion->size) {
+		// Retry synchronously (this will report the error, if there is one)
+		free(compressed_tile_data);
+		compressed_tile_data = NULL;
+	}
+	if (task->image->is_deleted) {
+		free(compressed_tile_data);
+		end_tile_load_in_flight(task);
+		atomic_subtract(&task->image->refcount, task->refcount_to_decrement);
+		return;
+	}
+	finish_load_tile(logical_thread_index, task, compressed_tile_data);
+}
+
+// For local tiled TIFF files, the compressed tile is read asynchronously, so that the worker thread does not block
+// on the disk. The tile is decoded in load_tile_read_completed_func() once the data has arrived.
+static bool load_tile_submit_async_read(load_tile_task_t* task) {
+	image_t* image = task->image;
+	if (image->backend != IMAGE_BACKEND_TIFF || image->tiff.is_remote || async_io_get_backend() == ASYNC_IO_BACKEND_NONE) {
+		return false;
+	}
+	level_image_t* level_image = image->level_images + task->level;
+	tiff_ifd_t* level_ifd = image->tiff.level_images_ifd + level_image->pyramid_image_index;
+	if (!level_ifd->is_tiled || image->tiff.file_mapping) {
+		return false; // if the file is memory-mapped, the decoder reads straight from the mapping instead
+	}
+	i32 tile_index = task->tile_y * level_image->width_in_tiles + task->tile_x;
+	u64 tile_offset = level_ifd->tile_offsets[tile_index];
+	u64 tile_size = level_ifd->tile_byte_counts[tile_index];
+	if (tile_offset == 0 || tile_size == 0) {
+		return false; // empty tile, nothing to read
+	}
+	u8* compressed_tile_data = (u8*)malloc(tile_size);
+	if (!async_io_submit_read(image->tiff.file_handle, compressed_tile_data, tile_offset, tile_size, &global_work_queue,
+	                          task->priority_lane, load_tile_read_completed_func, task, sizeof(*task))) {
+		free(compressed_tile_data);
+		return false;
+	}
+	return true;
+}
+
+void load_tile_func(i32 logical_thread_index, void* userdata) {
+	load_tile_task_t* task = (load_tile_task_t*) userdata;
+	image_t* image = task->image;
+
+	if (image->is_deleted) {
+		// Early out to save time if the image was already closed/waiting for destruction
+		end_tile_load_in_flight(task);
+		atomic_subtract(&image->refcount, task->refcount_to_decrement);
+		return;
+	}
+
+	if (load_tile_submit_async_read(task)) {
+		return; // the tile will be finished once the read completes
+	}
+	finish_load_tile(logical_thread_index, task, NULL);
+}
+
+// Loads a tile into the tile cache (tile->pixels), for tasks that need the pixels instead of a texture
+// (e.g. reading a region, or exporting). Use together with a work_queue_task_group_t to wait for the tiles.
+void load_tile_into_cache_func(i32 logical_thread_index, void* userdata) {
+	load_tile_task_t* task = (load_tile_task_t*) userdata;
+	image_t* image = task->image;
+	tile_t* tile = task->tile;
+
+	u8* pixels = NULL;
+	if (!image->is_deleted) {
+		pixels = load_tile_pixels(logical_thread_index, image, task->level, task->tile_x, task->tile_y, NULL, false);
+	}
+
+	benaphore_lock(&image->lock);
+	if (pixels) {
+		if (tile->pixels) {
+			pixel_buffer_free(pixels); // tile got cached in the meantime
+		} else {
+			tile->pixels = pixels;
+			tile->is_cached = true;
+		}
+	} else if (!image->is_deleted) {
+		tile->is_empty = true; // failed; don't resubmit!
+	}
+	tile->is_submitted_for_loading = false;
+	benaphore_unlock(&image->lock);
+
+	atomic_subtract(&image->refcount, task->refcount_to_decrement);
+}
+
+// Called instead of load_tile_func() if the tile went off-screen before a worker thread got to it.
+void load_tile_cancelled_func(i32 logical_thread_index, void* userdata) {
+	load_tile_task_t* task = (load_tile_task_t*) userdata;
+	task->tile->is_submitted_for_loading = false; // allow the tile to be requested again
+	write_barrier;
+	end_tile_load_in_flight(task);
+	atomic_subtract(&task->image->refcount, task->refcount_to_decrement);
+}
+
 void load_openslide_wsi(wsi_t* wsi, const char* filename) {
 	if (!is_openslide_loading_done) {
 #if DO_DEBUG
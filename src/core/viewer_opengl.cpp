@@ -68,6 +68,7 @@ typedef struct finalblit_shader_t {
 } finalblit_shader_t;
 
 basic_shader_t basic_shader;
+basic_shader_t tile_batch_shader; // same uniforms as the basic shader (except the model matrix)
 finalblit_shader_t finalblit_shader;
 
 u32 dummy_texture;
@@ -155,17 +156,442 @@ void draw_rect(u32 texture) {
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
 }
 
+// Batched tile rendering:
+// Tile textures are stored as layers in a few large 2D texture arrays (one for each tile size, more if they fill up).
+// All tiles of a level that live in the same array can then be drawn using a single instanced draw call, instead of
+// a texture bind + uniform update + draw call for every tile.
+// Tiles that can't be placed in an array (no free layers, or texture arrays not available) get their own texture,
+// and are drawn one by one as before.
+#define TILE_TEXTURE_ARRAY_TARGET_SIZE MEGABYTES(64)
+
+typedef struct tile_texture_array_t {
+	u32 texture; // GL_TEXTURE_2D_ARRAY; 0 if not in use
+	i32 tile_width;
+	i32 tile_height;
+	i32 layer_count;
+	i32* free_layers; // stack of unused layers
+	i32 free_layer_count;
+} tile_texture_array_t;
+
+typedef struct tile_instance_t {
+	float x;
+	float y;
+	float width;
+	float height;
+	float layer;
+} tile_instance_t;
+
+static tile_texture_array_t tile_texture_arrays[TILE_TEXTURE_ARRAY_MAX_COUNT];
+static tile_instance_t* tile_instances_per_array[TILE_TEXTURE_ARRAY_MAX_COUNT]; // array (stb_ds); queued for drawing
+static bool tile_batch_rendering_available;
+static i32 max_array_texture_layers;
+static u32 vao_tile_batch;
+static u32 vbo_tile_instances;
+
+static void init_tile_batch_rendering() {
+	if (!tile_batch_shader.program) {
+		console_print("Batched tile rendering is not available (shader failed to load)\n");
+		return;
+	}
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_array_texture_layers);
+	if (max_array_texture_layers < 16) {
+		console_print("Batched tile rendering is not available (GL_MAX_ARRAY_TEXTURE_LAYERS = %d)\n", max_array_texture_layers);
+		return;
+	}
 
-pixel_transfer_state_t* submit_texture_upload_via_pbo(app_state_t *app_state, i32 width, i32 height,
-                                                      i32 bytes_per_pixel, u8 *pixels, bool finalize) {
+	// Same vertices as draw_rect(), plus per-instance attributes
+	glGenVertexArrays(1, &vao_tile_batch);
+	glBindVertexArray(vao_tile_batch);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_rect);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_rect);
+	u32 vertex_stride = 5 * sizeof(float);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)0); // position coordinates
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(3*sizeof(float))); // texture coordinates
+	glEnableVertexAttribArray(1);
+
+	glGenBuffers(1, &vbo_tile_instances);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_tile_instances);
+	u32 instance_stride = sizeof(tile_instance_t);
+	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, instance_stride, (void*)0); // tile rect
+	glEnableVertexAttribArray(2);
+	glVertexAttribDivisor(2, 1);
+	glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, instance_stride, (void*)offsetof(tile_instance_t, layer));
+	glEnableVertexAttribArray(3);
+	glVertexAttribDivisor(3, 1);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glUseProgram(tile_batch_shader.program);
+	glUniform1i(tile_batch_shader.u_tex, 0);
+	glUseProgram(0);
+
+	tile_batch_rendering_available = true;
+}
+
+// Prefers the fullest array that still has a free layer, so that the other arrays can drain and be freed.
+static i32 get_tile_texture_array_with_free_layer(i32 tile_width, i32 tile_height) {
+	i32 unused_index = -1;
+	i32 fullest_index = -1;
+	for (i32 i = 0; i < TILE_TEXTURE_ARRAY_MAX_COUNT; ++i) {
+		tile_texture_array_t* array = tile_texture_arrays + i;
+		if (array->texture == 0) {
+			if (unused_index < 0) unused_index = i;
+		} else if (array->tile_width == tile_width && array->tile_height == tile_height && array->free_layer_count > 0) {
+			if (fullest_index < 0 || array->free_layer_count < tile_texture_arrays[fullest_index].free_layer_count) {
+				fullest_index = i;
+			}
+		}
+	}
+	if (fullest_index >= 0) {
+		return fullest_index;
+	}
+	if (unused_index < 0) {
+		return -1; // all arrays are full
+	}
+
+	// Create a new array
+	tile_texture_array_t* array = tile_texture_arrays + unused_index;
+	i64 tile_size_in_bytes = (i64)tile_width * tile_height * BYTES_PER_PIXEL;
+	i32 layer_count = (i32)CLAMP(TILE_TEXTURE_ARRAY_TARGET_SIZE / tile_size_in_bytes, 1, max_array_texture_layers);
+	if (!tile_residency_can_allocate_texture_memory(tile_size_in_bytes * layer_count)) {
+		return -1; // would exceed the texture budget; the tile gets its own texture instead
+	}
+	u32 texture = 0;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, default_texture_mag_filter);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, default_texture_min_filter);
+	while (glGetError() != GL_NO_ERROR) {} // clear any errors from before, so that we can detect allocation failure
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, tile_width, tile_height, layer_count, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+	GLenum error = glGetError();
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	if (error != GL_NO_ERROR) {
+		console_print_error("Could not allocate a tile texture array (%dx%d, %d layers): OpenGL error 0x%x\n",
+		                    tile_width, tile_height, layer_count, error);
+		glDeleteTextures(1, &texture);
+		return -1;
+	}
+
+	array->texture = texture;
+	array->tile_width = tile_width;
+	array->tile_height = tile_height;
+	array->layer_count = layer_count;
+	array->free_layers = (i32*)malloc(layer_count * sizeof(i32));
+	for (i32 i = 0; i < layer_count; ++i) {
+		array->free_layers[i] = layer_count - 1 - i; // hand out the lowest layers first
+	}
+	array->free_layer_count = layer_count;
+	return unused_index;
+}
+
+static pixel_transfer_state_t* copy_pixels_into_next_pbo(app_state_t* app_state, i64 buffer_size, u8* pixels) {
 	pixel_transfer_state_t* transfer_state = app_state->pixel_transfer_states + app_state->next_pixel_transfer_to_submit;
 	app_state->next_pixel_transfer_to_submit = (app_state->next_pixel_transfer_to_submit + 1) % COUNT(app_state->pixel_transfer_states);
-	i64 buffer_size = width * height * bytes_per_pixel;
+	++app_state->pixel_transfer_count;
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, transfer_state->pbo);
 	glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer_size, NULL, GL_STREAM_DRAW);
 	void* mapped_buffer = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
 	memcpy(mapped_buffer, pixels, buffer_size);
 	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	return transfer_state;
+}
+
+// Streaming tile uploads through a persistently mapped pixel unpack buffer (needs OpenGL 4.4 or ARB_buffer_storage).
+// The buffer is divided into tile-sized slots. Worker threads claim a slot with tile_upload_ring_alloc() and decode
+// the tile straight into it, so that the main thread does not need to copy the pixels into a PBO first; it only issues
+// glTexSubImage2D/3D from the slot's offset. A fence is placed behind each batch of uploads, and the slots are recycled
+// once the fence has signaled (instead of orphaning/remapping the buffer or stalling with glFinish()).
+#define TILE_UPLOAD_RING_SLOT_SIZE MEGABYTES(1) // fits a 512x512 BGRA tile
+#define TILE_UPLOAD_RING_SLOT_COUNT 64
+
+typedef struct tile_upload_in_flight_t {
+	GLsync fence;
+	i32 slot;
+} tile_upload_in_flight_t;
+
+typedef struct tile_upload_ring_t {
+	u32 pbo;
+	u8* mapped_memory;
+	bool is_available;
+	benaphore_t lock;
+	i32 free_slots[TILE_UPLOAD_RING_SLOT_COUNT]; // protected by lock
+	i32 free_slot_count;
+	// Only accessed on the main thread:
+	i32* slots_awaiting_fence; // array (stb_ds)
+	tile_upload_in_flight_t* in_flight; // array (stb_ds), oldest first
+} tile_upload_ring_t;
+
+static tile_upload_ring_t tile_upload_ring;
+
+static void init_tile_upload_ring() {
+#if !APPLE
+	if (!use_tile_upload_ring) {
+		return;
+	}
+	if (!glBufferStorage || !glFenceSync) {
+		console_print("Persistently mapped tile upload buffer is not available (needs OpenGL 4.4 or ARB_buffer_storage)\n");
+		return;
+	}
+	i64 ring_size = (i64)TILE_UPLOAD_RING_SLOT_SIZE * TILE_UPLOAD_RING_SLOT_COUNT;
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &tile_upload_ring.pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, tile_upload_ring.pbo);
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, ring_size, NULL, flags);
+	tile_upload_ring.mapped_memory = (u8*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ring_size, flags);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (!tile_upload_ring.mapped_memory) {
+		console_print_error("Could not map the tile upload buffer (OpenGL error 0x%x)\n", glGetError());
+		glDeleteBuffers(1, &tile_upload_ring.pbo);
+		tile_upload_ring.pbo = 0;
+		return;
+	}
+	tile_upload_ring.lock = benaphore_create();
+	for (i32 i = 0; i < TILE_UPLOAD_RING_SLOT_COUNT; ++i) {
+		tile_upload_ring.free_slots[i] = TILE_UPLOAD_RING_SLOT_COUNT - 1 - i;
+	}
+	tile_upload_ring.free_slot_count = TILE_UPLOAD_RING_SLOT_COUNT;
+	write_barrier;
+	tile_upload_ring.is_available = true;
+#endif
+}
+
+// Can be called from any thread. Returns NULL if no slot is available (the caller should then allocate normally).
+u8* tile_upload_ring_alloc(size_t size) {
+	if (!tile_upload_ring.is_available || size > TILE_UPLOAD_RING_SLOT_SIZE) {
+		return NULL;
+	}
+	i32 slot = -1;
+	benaphore_lock(&tile_upload_ring.lock);
+	if (tile_upload_ring.free_slot_count > 0) {
+		slot = tile_upload_ring.free_slots[--tile_upload_ring.free_slot_count];
+	}
+	benaphore_unlock(&tile_upload_ring.lock);
+	if (slot < 0) {
+		return NULL;
+	}
+	return tile_upload_ring.mapped_memory + (i64)slot * TILE_UPLOAD_RING_SLOT_SIZE;
+}
+
+bool tile_upload_ring_contains(void* pixels) {
+	u8* ptr = (u8*)pixels;
+	u8* start = tile_upload_ring.mapped_memory;
+	return start != NULL && ptr >= start && ptr < start + (i64)TILE_UPLOAD_RING_SLOT_SIZE * TILE_UPLOAD_RING_SLOT_COUNT;
+}
+
+static i32 get_tile_upload_ring_slot(void* pixels) {
+	ASSERT(tile_upload_ring_contains(pixels));
+	return (i32)(((u8*)pixels - tile_upload_ring.mapped_memory) / TILE_UPLOAD_RING_SLOT_SIZE);
+}
+
+static void tile_upload_ring_release_slot(i32 slot) {
+	benaphore_lock(&tile_upload_ring.lock);
+	ASSERT(tile_upload_ring.free_slot_count < TILE_UPLOAD_RING_SLOT_COUNT);
+	tile_upload_ring.free_slots[tile_upload_ring.free_slot_count++] = slot;
+	benaphore_unlock(&tile_upload_ring.lock);
+}
+
+// Gives back a slot whose contents were never uploaded (e.g. decoding failed). Can be called from any thread.
+void tile_upload_ring_free(void* pixels) {
+	tile_upload_ring_release_slot(get_tile_upload_ring_slot(pixels));
+}
+
+// Binds the buffer that the pixels should be uploaded from, and returns the pointer to pass to glTexSubImage*().
+// Pixels that live in the upload ring are used in place; other pixels are copied into the next PBO.
+// Pixels in the upload ring are owned by the ring afterwards: the slot is recycled when the GPU is done reading it.
+static u8* bind_pixel_unpack_source(app_state_t* app_state, i64 buffer_size, u8* pixels) {
+	if (tile_upload_ring_contains(pixels)) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, tile_upload_ring.pbo);
+		arrput(tile_upload_ring.slots_awaiting_fence, get_tile_upload_ring_slot(pixels));
+		return (u8*)(pixels - tile_upload_ring.mapped_memory); // offset into the buffer
+	} else {
+		copy_pixels_into_next_pbo(app_state, buffer_size, pixels);
+		return NULL;
+	}
+}
+
+// Places a fence behind the uploads that were issued from the upload ring since the last call. Main thread only.
+void tile_upload_ring_fence_pending_uploads() {
+#if !APPLE
+	i32 slot_count = (i32)arrlen(tile_upload_ring.slots_awaiting_fence);
+	if (slot_count == 0) {
+		return;
+	}
+	GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	for (i32 i = 0; i < slot_count; ++i) {
+		tile_upload_in_flight_t in_flight = {fence, tile_upload_ring.slots_awaiting_fence[i]};
+		arrput(tile_upload_ring.in_flight, in_flight);
+	}
+	arrsetlen(tile_upload_ring.slots_awaiting_fence, 0);
+#endif
+}
+
+// Recycles the slots of uploads that the GPU has finished (without waiting for the ones that are still busy). Main thread only.
+void tile_upload_ring_reclaim_finished_uploads() {
+#if !APPLE
+	i32 in_flight_count = (i32)arrlen(tile_upload_ring.in_flight);
+	i32 reclaimed_count = 0;
+	while (reclaimed_count < in_flight_count) {
+		GLsync fence = tile_upload_ring.in_flight[reclaimed_count].fence;
+		GLenum status = glClientWaitSync(fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			break; // fences signal in order, so the rest is still busy as well
+		}
+		glDeleteSync(fence);
+		// All uploads of a batch share the same fence
+		while (reclaimed_count < in_flight_count && tile_upload_ring.in_flight[reclaimed_count].fence == fence) {
+			tile_upload_ring_release_slot(tile_upload_ring.in_flight[reclaimed_count].slot);
+			++reclaimed_count;
+		}
+	}
+	if (reclaimed_count > 0) {
+		arrdeln(tile_upload_ring.in_flight, 0, reclaimed_count);
+	}
+#endif
+}
+
+// Creates a separate texture for pixels that were decoded into the upload ring.
+u32 load_texture_from_upload_ring(app_state_t* app_state, u8* pixels, i32 width, i32 height) {
+	u8* pixel_source = bind_pixel_unpack_source(app_state, (i64)width * height * BYTES_PER_PIXEL, pixels);
+	u32 texture = 0;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, default_texture_mag_filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, default_texture_min_filter);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, pixel_source);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return texture;
+}
+
+// Upload the tile into a free layer of a texture array. Returns false if that is not possible
+// (the caller should then fall back to creating a separate texture for the tile).
+bool upload_tile_to_texture_array(app_state_t* app_state, tile_t* tile, i32 width, i32 height, u8* pixels) {
+	if (!tile_batch_rendering_available || !use_batched_tile_rendering) {
+		return false;
+	}
+	ASSERT(tile->texture == 0);
+	i32 array_index = get_tile_texture_array_with_free_layer(width, height);
+	if (array_index < 0) {
+		return false;
+	}
+	tile_texture_array_t* array = tile_texture_arrays + array_index;
+	i32 layer = array->free_layers[--array->free_layer_count];
+
+	u8* pixel_source = bind_pixel_unpack_source(app_state, (i64)width * height * BYTES_PER_PIXEL, pixels);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, array->texture);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, pixel_source);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	tile->texture = array->texture;
+	tile->texture_array_index = array_index + 1;
+	tile->texture_array_layer = layer;
+	return true;
+}
+
+// Frees the tile's texture, whether it is a separate texture or a layer in a texture array.
+void release_tile_texture(tile_t* tile) {
+	if (tile->texture_array_index) {
+		tile_texture_array_t* array = tile_texture_arrays + (tile->texture_array_index - 1);
+		ASSERT(array->texture == tile->texture);
+		ASSERT(array->free_layer_count < array->layer_count);
+		array->free_layers[array->free_layer_count++] = tile->texture_array_layer;
+		if (array->free_layer_count == array->layer_count) {
+			// Array is empty; give the memory back
+			glDeleteTextures(1, &array->texture);
+			free(array->free_layers);
+			memset(array, 0, sizeof(*array));
+		}
+	} else if (tile->texture) {
+		unload_texture(tile->texture);
+	}
+	tile->texture = 0;
+	tile->texture_array_index = 0;
+	tile->texture_array_layer = 0;
+}
+
+// Returns the video memory held by the tile texture arrays, including their unused layers.
+i64 get_tile_texture_arrays_size_in_bytes() {
+	i64 result = 0;
+	for (i32 i = 0; i < TILE_TEXTURE_ARRAY_MAX_COUNT; ++i) {
+		tile_texture_array_t* array = tile_texture_arrays + i;
+		if (array->texture) {
+			result += (i64)array->tile_width * array->tile_height * BYTES_PER_PIXEL * array->layer_count;
+		}
+	}
+	return result;
+}
+
+// Returns the video memory taken up by the layers of the tile texture arrays that are in use.
+i64 get_tile_texture_arrays_used_size_in_bytes() {
+	i64 result = 0;
+	for (i32 i = 0; i < TILE_TEXTURE_ARRAY_MAX_COUNT; ++i) {
+		tile_texture_array_t* array = tile_texture_arrays + i;
+		if (array->texture) {
+			i32 used_layer_count = array->layer_count - array->free_layer_count;
+			result += (i64)array->tile_width * array->tile_height * BYTES_PER_PIXEL * used_layer_count;
+		}
+	}
+	return result;
+}
+
+// Returns the number of layers in use in the texture array that holds the tile (0 if the tile has its own texture).
+i32 get_tile_texture_array_used_layer_count(tile_t* tile) {
+	if (!tile->texture_array_index) {
+		return 0;
+	}
+	tile_texture_array_t* array = tile_texture_arrays + (tile->texture_array_index - 1);
+	return array->layer_count - array->free_layer_count;
+}
+
+void queue_tile_instance(tile_t* tile, float x, float y, float width, float height) {
+	ASSERT(tile->texture_array_index > 0);
+	tile_instance_t instance = {x, y, width, height, (float)tile->texture_array_layer};
+	arrput(tile_instances_per_array[tile->texture_array_index - 1], instance);
+}
+
+// Draws all queued tile instances, with one draw call per texture array.
+// Leaves the tile batch shader bound if anything was drawn; returns true in that case.
+bool draw_queued_tile_instances() {
+	bool any_drawn = false;
+	for (i32 i = 0; i < TILE_TEXTURE_ARRAY_MAX_COUNT; ++i) {
+		i32 instance_count = (i32)arrlen(tile_instances_per_array[i]);
+		if (instance_count == 0) {
+			continue;
+		}
+		if (!any_drawn) {
+			any_drawn = true;
+			glUseProgram(tile_batch_shader.program);
+			glBindVertexArray(vao_tile_batch);
+			glActiveTexture(GL_TEXTURE0);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_tile_instances);
+		glBufferData(GL_ARRAY_BUFFER, instance_count * sizeof(tile_instance_t), tile_instances_per_array[i], GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tile_texture_arrays[i].texture);
+		glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0, instance_count);
+		arrsetlen(tile_instances_per_array[i], 0);
+	}
+	if (any_drawn) {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	return any_drawn;
+}
+
+
+pixel_transfer_state_t* submit_texture_upload_via_pbo(app_state_t *app_state, i32 width, i32 height,
+                                                      i32 bytes_per_pixel, u8 *pixels, bool finalize) {
+	i64 buffer_size = width * height * bytes_per_pixel;
+	pixel_transfer_state_t* transfer_state = copy_pixels_into_next_pbo(app_state, buffer_size, pixels);
 
 	if (!finalize) {
         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
@@ -262,7 +688,7 @@ void upload_tile_on_worker_thread(image_t* image, void* tile_pixels, i32 scale,
 
 //write data into the mapped buffer, possibly in another thread.
 	memcpy(mapped_buffer, tile_pixels, pixel_memory_size);
-	free(tile_pixels);
+	pixel_buffer_free(tile_pixels);
 
 // after reading is complete back on the main thread
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, local_thread_memory->pbo);
@@ -299,6 +725,7 @@ void upload_tile_on_worker_thread(image_t* image, void* tile_pixels, i32 scale,
 	completion_task.tile_index = tile_index;
 	completion_task.want_gpu_residency = true;
 	//	console_print("[thread %d] Loaded tile: level=%d tile_x=%d tile_y=%d\n", logical_thread_index, level, tile_x, tile_y);
+	WORK_QUEUE_NAME_TASK(viewer_notify_load_tile_completed);
 	work_queue_submit_task(&global_completion_queue, viewer_notify_load_tile_completed, &completion_task,
 	                       sizeof(completion_task));
 #endif
@@ -406,6 +833,22 @@ void init_opengl_stuff(app_state_t* app_state) {
 	finalblit_shader.attrib_location_pos = get_attrib(finalblit_shader.program, "pos");
 	finalblit_shader.attrib_location_tex_coord = get_attrib(finalblit_shader.program, "tex_coord");
 
+	// Load the shader for batched tile rendering (optional, we fall back to drawing tiles one by one if this fails)
+	tile_batch_shader.program = load_shader_program_if_possible("shaders/tile_batch.vert", "shaders/tile_batch.frag");
+	if (tile_batch_shader.program) {
+		tile_batch_shader.u_projection_view_matrix = get_uniform(tile_batch_shader.program, "projection_view_matrix");
+		tile_batch_shader.u_model_matrix = -1; // not used
+		tile_batch_shader.u_tex = get_uniform(tile_batch_shader.program, "the_texture");
+		tile_batch_shader.u_black_level = get_uniform(tile_batch_shader.program, "black_level");
+		tile_batch_shader.u_white_level = get_uniform(tile_batch_shader.program, "white_level");
+		tile_batch_shader.u_background_color = get_uniform(tile_batch_shader.program, "bg_color");
+		tile_batch_shader.u_transparent_color = get_uniform(tile_batch_shader.program, "transparent_color");
+		tile_batch_shader.u_transparent_tolerance = get_uniform(tile_batch_shader.program, "transparent_tolerance");
+		tile_batch_shader.u_use_transparent_filter = get_uniform(tile_batch_shader.program, "use_transparent_filter");
+		tile_batch_shader.attrib_location_pos = get_attrib(tile_batch_shader.program, "pos");
+		tile_batch_shader.attrib_location_tex_coord = get_attrib(tile_batch_shader.program, "tex_coord");
+	}
+
 	glUseProgram(finalblit_shader.program);
 	glUniform1i(finalblit_shader.u_texture0, 0);
 	glUniform1i(finalblit_shader.u_texture1, 1);
@@ -416,6 +859,8 @@ void init_opengl_stuff(app_state_t* app_state) {
 	write_stringified_shaders();
 #endif
 	init_draw_rect();
+	init_tile_batch_rendering();
+	init_tile_upload_ring();
 
 	u32 dummy_texture_color = MAKE_BGRA(255, 255, 0, 255);
 	dummy_texture = load_texture(&dummy_texture_color, 1, 1, GL_BGRA);
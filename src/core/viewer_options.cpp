@@ -32,6 +32,28 @@ void viewer_init_options(app_state_t* app_state) {
 	ini_register_i32(ini, "window_height", &desired_window_height);
 	ini_register_bool(ini, "window_start_maximized", &window_start_maximized);
 	ini_register_bool(ini, "vsync", &is_vsync_enabled);
+	ini_register_bool(ini, "batched_tile_rendering", &use_batched_tile_rendering);
+	ini_register_bool(ini, "persistent_upload_buffer", &use_tile_upload_ring);
+	ini_register_bool(ini, "predictive_prefetch", &use_predictive_prefetch);
+	ini_register_i32(ini, "prefetch_lookahead_ms", &prefetch_lookahead_ms);
+	ini_register_i32(ini, "prefetch_max_tiles_in_flight", &prefetch_max_tiles_in_flight);
+	ini_register_i32(ini, "max_tiles_in_flight", &tile_scheduler_max_tiles_in_flight);
+	ini_register_bool(ini, "use_memory_mapped_files", &memory_mapped_files_enabled);
+	ini_register_i32(ini, "pixel_buffer_pool_size_mb", &pixel_buffer_pool_depot_size_in_mb);
+	ini_register_i32(ini, "texture_budget_mb", &tile_residency_texture_budget_in_mb);
+	ini_register_i32(ini, "tile_cache_budget_mb", &tile_residency_cache_budget_in_mb);
+
+	ini_begin_section(ini, "iSyntax");
+	ini_register_bool(ini, "use_index_files", &isyntax_index_sidecar_enabled);
+
+	// NOTE: these only take effect at startup (the threads are created after the options are loaded).
+	ini_begin_section(ini, "Threads");
+	ini_register_i32(ini, "decode_threads", &global_thread_pool_options.decode_thread_count);
+	ini_register_bool(ini, "decode_threads_use_smt", &global_thread_pool_options.decode_threads_use_smt);
+	ini_register_bool(ini, "pin_decode_threads", &global_thread_pool_options.pin_decode_threads);
+	ini_register_i32(ini, "io_threads", &global_thread_pool_options.io_thread_count);
+	ini_register_bool(ini, "pin_io_threads", &global_thread_pool_options.pin_io_threads);
+	ini_register_bool(ini, "use_io_uring", &async_io_use_io_uring);
 
 	ini_apply(ini);
 }
@@ -1381,6 +1381,12 @@ bool dicom_open_from_directory(dicom_series_t* dicom, directory_info_t* director
 			console_print_error("Error: Could not reopen file for asynchronous I/O: '%s'\n", instance->filename);
 			success = false;
 		}
+		if (memory_mapped_files_enabled) {
+			instance->file_mapping = file_map_read_only(instance->filename, &instance->file_mapping_size);
+			if (instance->file_mapping) {
+				file_map_advise(instance->file_mapping, instance->file_mapping_size, 0, 0, FILE_ACCESS_PATTERN_RANDOM);
+			}
+		}
 	}
 
 	console_print("DICOM parsing took %g seconds\n", get_seconds_elapsed(start, get_clock()));
@@ -1568,6 +1574,7 @@ void dicom_instance_destroy(dicom_instance_t* instance) {
     }
     arrfree(instance->optical_paths);
 	if (instance->file_handle) file_handle_close(instance->file_handle);
+	if (instance->file_mapping) file_unmap(instance->file_mapping, instance->file_mapping_size);
 }
 
 void dicom_destroy(dicom_series_t* dicom_series) {
@@ -370,6 +370,8 @@ typedef struct dicom_instance_t {
 	dicom_parser_callback_func_t* tag_handler_func;
 	char filename[512];
 	file_handle_t file_handle; // for simultaneous file access on multiple threads
+	u8* file_mapping; // if memory-mapped file access is enabled
+	i64 file_mapping_size;
 	i32 nesting_level;
 	dicom_parser_pos_t pos_stack[16]; // one per nesting level, for keeping track where we need to push/pop during parsing
 	dicom_tag_t nested_sequences[8]; // one for every two nesting levels (sequences only, not sequence items)
@@ -21,6 +21,7 @@
 #include "dicom_wsi.h"
 
 #include "jpeg_decoder.h"
+#include "pixel_buffer_pool.h"
 
 // Returns either &array[index] if it already exists, or a newly added and zeroed element at the end of the array
 #define array_last_maybe_expand(array, index) \
@@ -375,13 +376,44 @@ void dicom_wsi_interpret_nested_data_element(dicom_instance_t* instance, dicom_d
 	}
 }
 
-u8* dicom_wsi_decode_tile_to_bgra(dicom_series_t* dicom_series, i32 scale, i32 tile_index) {
+// If dest is not NULL and large enough, the tile is decoded into it (the caller keeps ownership of dest).
+// Otherwise, the pixels are allocated with pixel_buffer_alloc().
+u8* dicom_wsi_decode_tile_to_bgra(dicom_series_t* dicom_series, i32 scale, i32 tile_index, u8* dest, size_t dest_size) {
 	dicom_instance_t* instance = dicom_series->wsi.level_instances[scale];
 	ASSERT(instance);
 	if (!instance) return NULL;
 	dicom_tile_t* dicom_tile = instance->tiles + tile_index;
 	size_t read_size = dicom_tile->data_size;
-	if (dicom_tile->data_size == DICOM_UNDEFINED_LENGTH) {
+
+	// If the file is memory-mapped and the frame consists of a single fragment, decode straight from the mapping.
+	// (Frames that consist of multiple fragments need to be defragmented, which needs a writable copy.)
+	u8* mapped_frame = NULL;
+	if (instance->file_mapping && dicom_tile->data_offset_in_file < (u64)instance->file_mapping_size) {
+		i64 bytes_available = instance->file_mapping_size - dicom_tile->data_offset_in_file;
+		if (read_size != DICOM_UNDEFINED_LENGTH) {
+			bytes_available = MIN(bytes_available, (i64)read_size);
+		}
+		u8* frame = instance->file_mapping + dicom_tile->data_offset_in_file;
+		dicom_data_element_t element = dicom_read_data_element(frame, 0, DICOM_TRANSFER_SYNTAX_IMPLICIT_VR_LITTLE_ENDIAN, bytes_available);
+		if (element.tag.as_u32 == DICOM_Item && element.length != DICOM_UNDEFINED_LENGTH &&
+		    element.data_offset + (i64)element.length <= bytes_available) {
+			i64 rest = bytes_available - (element.data_offset + element.length);
+			bool is_single_fragment = (read_size == DICOM_UNDEFINED_LENGTH || rest < 8);
+			if (!is_single_fragment) {
+				dicom_data_element_t next = dicom_read_data_element(frame, element.data_offset + element.length,
+				                                                    DICOM_TRANSFER_SYNTAX_IMPLICIT_VR_LITTLE_ENDIAN, rest);
+				is_single_fragment = (next.tag.as_u32 != DICOM_Item);
+			}
+			if (is_single_fragment) {
+				mapped_frame = frame + element.data_offset;
+				read_size = element.length;
+			}
+		}
+	}
+
+	if (mapped_frame) {
+		// nothing to read
+	} else if (dicom_tile->data_size == DICOM_UNDEFINED_LENGTH) {
 		u8 temp[12];
 		size_t bytes_read = file_handle_read_at_offset(temp, instance->file_handle, dicom_tile->data_offset_in_file, 12);
 		dicom_data_element_t element = dicom_read_data_element(temp, 0, instance->encoding, bytes_read);
@@ -396,23 +428,35 @@ u8* dicom_wsi_decode_tile_to_bgra(dicom_series_t* dicom_series, i32 scale, i32 t
 		ASSERT(!"unknown length");
 		return NULL;
 	}
-	u8* compressed_tile_data = (u8*)arena_push_size(&local_thread_memory->temp_arena, read_size);
-	file_handle_read_at_offset(compressed_tile_data, instance->file_handle, dicom_tile->data_offset_in_file, read_size);
+	u8* compressed_tile_data = NULL;
+	i64 data_size = 0;
+	if (mapped_frame) {
+		compressed_tile_data = mapped_frame;
+		data_size = read_size;
+	} else {
+		compressed_tile_data = (u8*)arena_push_size(&local_thread_memory->temp_arena, read_size);
+		file_handle_read_at_offset(compressed_tile_data, instance->file_handle, dicom_tile->data_offset_in_file, read_size);
 
-	// TODO: handle native pixel data instead of encapsulated
-	i64 data_size = dicom_defragment_encapsulated_pixel_data_frame(compressed_tile_data, read_size);
+		// TODO: handle native pixel data instead of encapsulated
+		data_size = dicom_defragment_encapsulated_pixel_data_frame(compressed_tile_data, read_size);
+	}
 	if (data_size > 0) {
 		if (instance->lossy_image_compression_method == DICOM_LOSSY_IMAGE_COMPRESSION_METHOD_ISO_10918_1) {
 			// JPEG compression
 			i32 width = 0;
 			i32 height = 0;
 			i32 channels_in_file = 0;
-			u8* pixels = jpeg_decode_image(compressed_tile_data, data_size, &width, &height, &channels_in_file);
-			if (pixels && width == instance->columns && height == instance->rows && channels_in_file == 4) {
+			size_t pixel_memory_size = (size_t)instance->columns * instance->rows * sizeof(u32);
+			u8* pixels = (dest && dest_size >= pixel_memory_size) ? dest : (u8*)pixel_buffer_alloc(pixel_memory_size);
+			bool decoded = jpeg_decode_image_into(compressed_tile_data, data_size, pixels, pixel_memory_size,
+			                                      &width, &height, &channels_in_file);
+			if (decoded && width == instance->columns && height == instance->rows && channels_in_file == 4) {
 				// success
 				return pixels;
 			} else {
-				if (pixels) free(pixels);
+				if (pixels != dest) {
+					pixel_buffer_free(pixels);
+				}
 				return NULL;
 			}
 		} else {
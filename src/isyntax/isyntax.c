@@ -52,6 +52,7 @@
 #include "intrinsics.h"
 
 #include "isyntax.h"
+#include "crc32.h"
 
 // XML library for parsing the header
 #include "yxml.h"
@@ -1588,20 +1589,11 @@ static void convert_ycocg_to_rgba_block(icoeff_t* Y, icoeff_t* Co, icoeff_t* Cg,
 
 #define DEBUG_OUTPUT_IDWT_STEPS_AS_PNG 0
 
-void isyntax_idwt(icoeff_t* idwt, i32 quadrant_width, i32 quadrant_height, bool output_steps_as_png, const char* png_name) {
+static void isyntax_idwt_horizontal_pass(icoeff_t* idwt, i32 quadrant_width, i32 quadrant_height) {
 	i32 full_width = quadrant_width * 2;
 	i32 full_height= quadrant_height * 2;
 	i32 idwt_stride = full_width;
 
-#if ISYNTAX_WANT_DEBUG_OUTPUT_PNG
-	if (output_steps_as_png) {
-		char filename[512];
-		snprintf(filename, sizeof(filename), "%s_step0.png", png_name);
-		debug_convert_wavelet_coefficients_to_image2(idwt, full_width, full_height, filename);
-	}
-#endif
-
-	// Horizontal pass
 	opj_dwt_t h = {0};
 	size_t dwt_mem_size = (MAX(quadrant_width, quadrant_height)*2) * PARALLEL_COLS_53 * sizeof(icoeff_t);
 
@@ -1614,6 +1606,23 @@ void isyntax_idwt(icoeff_t* idwt, i32 quadrant_width, i32 quadrant_height, bool
 		icoeff_t* input_row = idwt + y * idwt_stride;
 		opj_idwt53_h(&h, input_row);
 	}
+}
+
+void isyntax_idwt(icoeff_t* idwt, i32 quadrant_width, i32 quadrant_height, bool output_steps_as_png, const char* png_name) {
+	i32 full_width = quadrant_width * 2;
+	i32 full_height= quadrant_height * 2;
+	i32 idwt_stride = full_width;
+
+#if ISYNTAX_WANT_DEBUG_OUTPUT_PNG
+	if (output_steps_as_png) {
+		char filename[512];
+		snprintf(filename, sizeof(filename), "%s_step0.png", png_name);
+		debug_convert_wavelet_coefficients_to_image2(idwt, full_width, full_height, filename);
+	}
+#endif
+
+	// Horizontal pass
+	isyntax_idwt_horizontal_pass(idwt, quadrant_width, quadrant_height);
 
 #if ISYNTAX_WANT_DEBUG_OUTPUT_PNG
 	if (output_steps_as_png) {
@@ -1625,7 +1634,8 @@ void isyntax_idwt(icoeff_t* idwt, i32 quadrant_width, i32 quadrant_height, bool
 
 	// Vertical pass
 	opj_dwt_t v = {0};
-	v.mem = h.mem;
+	size_t dwt_mem_size = (MAX(quadrant_width, quadrant_height)*2) * PARALLEL_COLS_53 * sizeof(icoeff_t);
+	v.mem = (icoeff_t*)alloca(dwt_mem_size); // TODO: need aligned memory?
 	v.sn = quadrant_height; // number of elements in low pass band
 	v.dn = quadrant_height; // number of elements in high pass band
 	v.cas = 1;
@@ -1649,6 +1659,84 @@ void isyntax_idwt(icoeff_t* idwt, i32 quadrant_width, i32 quadrant_height, bool
 
 }
 
+// Fused final stage of the IDWT for tiles that only need to be converted to pixels (no LL blocks for child tiles):
+// the vertical pass is done a pair of rows at a time, restricted to the visible part of the tile, and each finished
+// row is immediately converted to BGRA/RGBA while it is still in cache. This avoids writing back the full-size
+// Y/Co/Cg planes and reading them again in a separate color conversion pass.
+// The input planes must already have had the horizontal pass applied.
+static void isyntax_idwt_vertical_pass_to_pixels(icoeff_t* Y, icoeff_t* Co, icoeff_t* Cg, i32 quadrant_width, i32 quadrant_height,
+                                                 i32 first_valid_pixel, i32 tile_width, i32 tile_height,
+                                                 u32* out_pixels, enum isyntax_pixel_format_t pixel_format) {
+	i32 idwt_stride = 2 * quadrant_width;
+	i32 sn = quadrant_height;
+	icoeff_t* planes[3] = {Y + first_valid_pixel, Co + first_valid_pixel, Cg + first_valid_pixel};
+
+	// Small working set: for each channel, two buffers holding a pair of output rows each.
+	// The odd (second) row of the previous pair holds the high pass values needed for the next pair.
+	icoeff_t* row_pairs[2][3];
+	size_t row_pair_size = 2 * tile_width * sizeof(icoeff_t);
+	for (i32 i = 0; i < 2; ++i) {
+		for (i32 c = 0; c < 3; ++c) {
+			row_pairs[i][c] = (icoeff_t*)alloca(row_pair_size);
+		}
+	}
+	icoeff_t* abs_Y = (icoeff_t*)alloca(row_pair_size);
+
+	// To get the same results as isyntax_idwt(), the columns that it processes in whole column groups
+	// need to be treated differently from the rest (see opj_idwt53_v_cas1_even_row_pair()).
+	i32 mcols_end = 0;
+#if (defined(__SSE2__) || defined(__AVX2__))
+	mcols_end = (2 * quadrant_width / PARALLEL_COLS_53) * PARALLEL_COLS_53;
+#endif
+	i32 mcols_width = CLAMP(mcols_end - first_valid_pixel, 0, tile_width);
+
+	i32 first_row_pair = first_valid_pixel / 2;
+	i32 last_row_pair = (first_valid_pixel + tile_height - 1) / 2;
+	ASSERT(last_row_pair < sn);
+	i32 current = 0;
+	if (first_row_pair > 0) {
+		for (i32 c = 0; c < 3; ++c) {
+			opj_idwt53_v_cas1_even_row_d(planes[c], sn, idwt_stride, mcols_width, first_row_pair - 1, row_pairs[1][c] + tile_width);
+		}
+	}
+
+	for (i32 j = first_row_pair; j <= last_row_pair; ++j) {
+		icoeff_t** rows = row_pairs[current];
+		icoeff_t** prev_rows = row_pairs[current ^ 1];
+		for (i32 c = 0; c < 3; ++c) {
+			opj_idwt53_v_cas1_even_row_pair(planes[c], sn, idwt_stride, tile_width, mcols_width, j, prev_rows[c] + tile_width,
+			                                rows[c], rows[c] + tile_width);
+		}
+		// Clip the row pair to the visible part of the tile
+		i32 y = 2 * j - first_valid_pixel;
+		i32 first_row = 0;
+		i32 row_count = 2;
+		if (y < 0) {
+			first_row = -y;
+			row_count -= first_row;
+		}
+		if (y + 2 > tile_height) {
+			row_count -= (y + 2) - tile_height;
+		}
+		if (row_count > 0) {
+			icoeff_t* row_Co = rows[1] + first_row * tile_width;
+			icoeff_t* row_Cg = rows[2] + first_row * tile_width;
+			u32* dest = out_pixels + (y + first_row) * tile_width;
+			// For the Y (luminance) color channel, we actually need the absolute value of the Y-channel wavelet coefficient.
+			// (Work on a copy: the odd row is still needed as input for the next row pair.)
+			icoeff_t* row_Y = abs_Y;
+			memcpy(row_Y, rows[0] + first_row * tile_width, row_count * tile_width * sizeof(icoeff_t));
+			signed_magnitude_to_absolute_value_16_block(row_Y, row_count * tile_width);
+			if (pixel_format == LIBISYNTAX_PIXEL_FORMAT_RGBA) {
+				convert_ycocg_to_rgba_block(row_Y, row_Co, row_Cg, tile_width, row_count, tile_width, dest);
+			} else {
+				convert_ycocg_to_bgra_block(row_Y, row_Co, row_Cg, tile_width, row_count, tile_width, dest);
+			}
+		}
+		current ^= 1;
+	}
+}
+
 static inline void get_offsetted_coeff_blocks(icoeff_t** ll_hl_lh_hh, i32 offset, isyntax_tile_channel_t* color_channel, i32 block_stride, icoeff_t* black_dummy_coeff, icoeff_t* white_dummy_coeff) {
 	if (color_channel->coeff_ll) {
 		ll_hl_lh_hh[0] = color_channel->coeff_ll + offset; //ll
@@ -1726,7 +1814,8 @@ u32 isyntax_get_adjacent_tiles_mask_only_existing(isyntax_level_t* level, i32 ti
 	return mask;
 }
 
-u32 isyntax_idwt_tile_for_color_channel(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y, i32 color, icoeff_t* dest_buffer) {
+static u32 idwt_tile_for_color_channel(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y, i32 color,
+                                       icoeff_t* dest_buffer, bool horizontal_pass_only) {
 	isyntax_level_t* level = wsi->levels + scale;
 	ASSERT(tile_x >= 0 && tile_x < level->width_in_tiles);
 	ASSERT(tile_y >= 0 && tile_y < level->height_in_tiles);
@@ -1970,12 +2059,20 @@ u32 isyntax_idwt_tile_for_color_channel(isyntax_t* isyntax, isyntax_image_t* wsi
 	if (scale == wsi->max_scale && tile_x == 1 && tile_y == 1 && color == 0) {
 		output_pngs = true;
 	}*/
-	isyntax_idwt(idwt, quadrant_width, quadrant_height, output_pngs, debug_png);
+	if (horizontal_pass_only) {
+		isyntax_idwt_horizontal_pass(idwt, quadrant_width, quadrant_height);
+	} else {
+		isyntax_idwt(idwt, quadrant_width, quadrant_height, output_pngs, debug_png);
+	}
 
 	u32 invalid_edges = invalid_neighbors_h | invalid_neighbors_ll;
 	return invalid_edges;
 }
 
+u32 isyntax_idwt_tile_for_color_channel(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y, i32 color, icoeff_t* dest_buffer) {
+	return idwt_tile_for_color_channel(isyntax, wsi, scale, tile_x, tile_y, color, dest_buffer, false);
+}
+
 void isyntax_load_tile(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y,
                        block_allocator_t* ll_coeff_block_allocator,
                        u32* out_buffer_or_null, enum isyntax_pixel_format_t pixel_format) {
@@ -2004,13 +2101,18 @@ void isyntax_load_tile(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32
 
 	u32 invalid_edges = 0;
 
+	// At level 0 there are no child tiles that need the LL blocks, so if we only need the pixels we can fuse the
+	// vertical IDWT pass with the color conversion (no need to produce the full-size Y, Co and Cg planes).
+	bool fuse_vertical_pass_with_color_conversion = (scale == 0 && out_buffer_or_null != NULL);
+
 	for (i32 color = 0; color < 3; ++color) {
 		i64 start_idwt = get_clock();
 		// idwt will be allocated in temporary memory (only needed for the duration of this function)
 		size_t idwt_buffer_size = idwt_width * idwt_height * sizeof(icoeff_t);
 		icoeff_t* idwt = arena_push_size(temp_memory.arena, idwt_buffer_size);
 		memset(idwt, 0, idwt_buffer_size);
-		invalid_edges |= isyntax_idwt_tile_for_color_channel(isyntax, wsi, scale, tile_x, tile_y, color, idwt);
+		invalid_edges |= idwt_tile_for_color_channel(isyntax, wsi, scale, tile_x, tile_y, color, idwt,
+		                                             fuse_vertical_pass_with_color_conversion);
 		elapsed_idwt += get_seconds_elapsed(start_idwt, get_clock());
 		ASSERT(idwt);
 		switch(color) {
@@ -2028,69 +2130,41 @@ void isyntax_load_tile(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32
 		}
 
 		// Distribute result to child tiles if it was not distributed already.
+		// NOTE: children that already have their LL blocks are skipped: the result would be identical, and the child
+		// may be loading right now (this happens when a tile is reloaded after its texture was evicted).
 		isyntax_level_t* next_level = wsi->levels + (scale - 1);
 		isyntax_tile_t* child_top_left = next_level->tiles + (tile_y*2) * next_level->width_in_tiles + (tile_x*2);
-		isyntax_tile_t* child_top_right = child_top_left + 1;
-		isyntax_tile_t* child_bottom_left = child_top_left + next_level->width_in_tiles;
-		isyntax_tile_t* child_bottom_right = child_bottom_left + 1;
-
-		// TODO(avirodov): instead of releasing here, skip copy if still allocated.
-		if (child_top_left->color_channels[color].coeff_ll) {
-			block_free(ll_coeff_block_allocator, child_top_left->color_channels[color].coeff_ll);
-		}
-		if (child_top_right->color_channels[color].coeff_ll) {
-			block_free(ll_coeff_block_allocator, child_top_right->color_channels[color].coeff_ll);
-		}
-		if (child_bottom_left->color_channels[color].coeff_ll) {
-			block_free(ll_coeff_block_allocator, child_bottom_left->color_channels[color].coeff_ll);
-		}
-		if (child_bottom_right->color_channels[color].coeff_ll) {
-			block_free(ll_coeff_block_allocator, child_bottom_right->color_channels[color].coeff_ll);
-		}
-
-		// NOTE: malloc() and free() can become a bottleneck, they don't scale well especially across many threads.
-		// We use a custom block allocator to address this.
-		i64 start_malloc = get_clock();
-		child_top_left->color_channels[color].coeff_ll = (icoeff_t*)block_alloc(ll_coeff_block_allocator);
-		child_top_right->color_channels[color].coeff_ll = (icoeff_t*)block_alloc(ll_coeff_block_allocator);
-		child_bottom_left->color_channels[color].coeff_ll = (icoeff_t*)block_alloc(ll_coeff_block_allocator);
-		child_bottom_right->color_channels[color].coeff_ll = (icoeff_t*)block_alloc(ll_coeff_block_allocator);
-		elapsed_malloc += get_seconds_elapsed(start_malloc, get_clock());
+		isyntax_tile_t* children[4] = {
+			child_top_left,
+			child_top_left + 1,
+			child_top_left + next_level->width_in_tiles,
+			child_top_left + next_level->width_in_tiles + 1,
+		};
+		// Offsets of the child LL blocks in the idwt result (top left, top right, bottom left, bottom right)
+		i32 child_offsets[4] = {
+			(first_valid_pixel * idwt_stride) + first_valid_pixel,
+			(first_valid_pixel * idwt_stride) + first_valid_pixel + block_width,
+			((first_valid_pixel + block_height) * idwt_stride) + first_valid_pixel,
+			((first_valid_pixel + block_height) * idwt_stride) + first_valid_pixel + block_width,
+		};
 		i32 dest_stride = block_width;
-		// Blit top left child LL block
-		{
-			icoeff_t* dest = child_top_left->color_channels[color].coeff_ll;
-			icoeff_t* source = idwt + (first_valid_pixel * idwt_stride) + first_valid_pixel;
-			for (i32 y = 0; y < block_height; ++y) {
-				memcpy(dest, source, row_copy_size);
-				dest += dest_stride;
-				source += idwt_stride;
-			}
-		}
-		// Blit top right child LL block
-		{
-			icoeff_t* dest = child_top_right->color_channels[color].coeff_ll;
-			icoeff_t* source = idwt + (first_valid_pixel * idwt_stride) + first_valid_pixel + block_width;
-			for (i32 y = 0; y < block_height; ++y) {
-				memcpy(dest, source, row_copy_size);
-				dest += dest_stride;
-				source += idwt_stride;
+		for (i32 i = 0; i < 4; ++i) {
+			isyntax_tile_t* child = children[i];
+			if (child->has_ll) {
+				continue;
 			}
-		}
-		// Blit bottom left child LL block
-		{
-			icoeff_t* dest = child_bottom_left->color_channels[color].coeff_ll;
-			icoeff_t* source = idwt + ((first_valid_pixel + block_height) * idwt_stride) + first_valid_pixel;
-			for (i32 y = 0; y < block_height; ++y) {
-				memcpy(dest, source, row_copy_size);
-				dest += dest_stride;
-				source += idwt_stride;
+			// TODO(avirodov): instead of releasing here, skip copy if still allocated.
+			if (child->color_channels[color].coeff_ll) {
+				block_free(ll_coeff_block_allocator, child->color_channels[color].coeff_ll);
 			}
-		}
-		// Blit bottom right child LL block
-		{
-			icoeff_t* dest = child_bottom_right->color_channels[color].coeff_ll;
-			icoeff_t* source = idwt + ((first_valid_pixel + block_height) * idwt_stride) + first_valid_pixel + block_width;
+			// NOTE: malloc() and free() can become a bottleneck, they don't scale well especially across many threads.
+			// We use a custom block allocator to address this.
+			i64 start_malloc = get_clock();
+			child->color_channels[color].coeff_ll = (icoeff_t*)block_alloc(ll_coeff_block_allocator);
+			elapsed_malloc += get_seconds_elapsed(start_malloc, get_clock());
+			// Blit the child LL block
+			icoeff_t* dest = child->color_channels[color].coeff_ll;
+			icoeff_t* source = idwt + child_offsets[i];
 			for (i32 y = 0; y < block_height; ++y) {
 				memcpy(dest, source, row_copy_size);
 				dest += dest_stride;
@@ -2100,10 +2174,9 @@ void isyntax_load_tile(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32
 
 		// After the last color channel, we can report that the children now have their LL blocks available.
 		if (color == 2) {
-			child_top_left->has_ll = true;
-			child_top_right->has_ll = true;
-			child_bottom_left->has_ll = true;
-			child_bottom_right->has_ll = true;
+			for (i32 i = 0; i < 4; ++i) {
+				children[i]->has_ll = true;
+			}
 
 			if (invalid_edges != 0) {
 				console_print_error("load: scale=%d x=%d y=%d  idwt time =%g  invalid edges=%x\n", scale, tile_x, tile_y, elapsed_idwt, invalid_edges);
@@ -2120,14 +2193,24 @@ void isyntax_load_tile(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32
 		return;
 	}
 
+	i32 tile_width = block_width * 2;
+	i32 tile_height = block_height * 2;
+
+	if (fuse_vertical_pass_with_color_conversion) {
+		i64 start = get_clock();
+		isyntax_idwt_vertical_pass_to_pixels(Y, Co, Cg, idwt_width / 2, idwt_height / 2, first_valid_pixel,
+		                                     tile_width, tile_height, out_buffer_or_null, pixel_format);
+		isyntax->total_rgb_transform_time += get_seconds_elapsed(start, get_clock());
+		release_temp_memory(&temp_memory); // free Y, Co and Cg
+		return;
+	}
+
 	// For the Y (luminance) color channel, we actually need the absolute value of the Y-channel wavelet coefficient.
 	// (This doesn't hold for Co and Cg, those are are used directly as signed integers)
     signed_magnitude_to_absolute_value_16_block(Y, idwt_width * idwt_height);
 
 	// Reconstruct RGB image from separate color channels while cutting off margins
 	i64 start = get_clock();
-	i32 tile_width = block_width * 2;
-	i32 tile_height = block_height * 2;
 
 	i32 valid_offset = (first_valid_pixel * idwt_stride) + first_valid_pixel;
     switch (pixel_format) {
@@ -2233,6 +2316,112 @@ void save_code_in_huffman_fast_lookup_table(huffman_t* h, u32 code, u32 code_wid
 	}
 }
 
+// Multi-symbol lookup table: for each HUFFMAN_FAST_BITS-wide bit pattern, store the sequence of (literal) symbols
+// that can be fully decoded from those bits, so that several symbols can be emitted with a single table lookup.
+// Zero run symbols and codes that are too long for the fast table are never stored here; in those cases the
+// entry has count == 0 and the decoder falls back to the regular one-symbol-at-a-time method.
+#define HUFFMAN_MULTI_MAX_SYMBOLS 4
+
+// Building the multi-symbol table has a fixed cost, which only pays off if the codeblock is large enough.
+#define HUFFMAN_MULTI_MIN_SERIALIZED_LENGTH 4096
+
+typedef struct huffman_multi_entry_t {
+	u32 symbols; // packed, first symbol in the lowest byte; unused bytes are zero
+	u8 count;
+	u8 bits;
+} huffman_multi_entry_t;
+
+bool isyntax_huffman_multi_symbol_enabled = true;
+
+static void build_huffman_multi_symbol_table(huffman_t* h, u8 zerorun_symbol, huffman_multi_entry_t* multi) {
+	for (u32 index = 0; index < (1 << HUFFMAN_FAST_BITS); ++index) {
+		u32 symbols = 0;
+		u32 count = 0;
+		u32 bits_used = 0;
+		while (count < HUFFMAN_MULTI_MAX_SYMBOLS) {
+			// The bits above (HUFFMAN_FAST_BITS - bits_used) are shifted in as zeroes, so the fast lookup result is
+			// only valid if the code fits within the bits that are actually known.
+			u16 c = h->fast[index >> bits_used];
+			if (c > 255 || c == zerorun_symbol) break;
+			u32 code_size = h->size[c];
+			if (code_size == 0 || code_size > HUFFMAN_FAST_BITS - bits_used) break;
+			symbols |= (u32)c << (count * 8);
+			bits_used += code_size;
+			++count;
+		}
+		multi[index].symbols = symbols;
+		multi[index].count = count;
+		multi[index].bits = bits_used;
+	}
+}
+
+// Bitplane unpacking: OR a single bit (at position shift_amount) into each coefficient, one bit per coefficient
+// taken from the packed bitplane (lowest bit first).
+typedef void unpack_bitplane_func_t(u16* coeff_buffer, u8* bitplane, i32 coeff_count, i32 shift_amount);
+
+static void unpack_bitplane(u16* coeff_buffer, u8* bitplane, i32 coeff_count, i32 shift_amount) {
+	for (i32 i = 0; i < coeff_count; i += 8) {
+		u8 b = bitplane[i/8];
+		if (b == 0) continue;
+		u16* dst = coeff_buffer + i;
+#if defined(__SSE2__)
+		// This SIMD implementation is ~20% faster compared to the simple version below.
+		uint64_t t = bswap_64(((0x8040201008040201ULL*b) & 0x8080808080808080ULL) >> 7);
+		__m128i v_t = _mm_set_epi64x(0, t);
+		__m128i array_of_bools = _mm_unpacklo_epi8(v_t, _mm_setzero_si128());
+		__m128i masks = _mm_slli_epi16(array_of_bools, shift_amount);
+		_mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_loadu_si128((__m128i*)dst), masks));
+#elif defined(__ARM_NEON)
+		static const u16 lane_bits[8] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+		uint16x8_t is_set = vtstq_u16(vdupq_n_u16(b), vld1q_u16(lane_bits));
+		uint16x8_t masks = vandq_u16(is_set, vdupq_n_u16((u16)(1 << shift_amount)));
+		vst1q_u16(dst, vorrq_u16(vld1q_u16(dst), masks));
+#else
+		for (i32 k = 0; k < 8; ++k) {
+			dst[k] |= ((b >> k) & 1) << shift_amount;
+		}
+#endif
+	}
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_UNPACK_BITPLANE_AVX2 1
+// AVX2 version: expand 16 bits (two bitplane bytes) into 16 coefficients at a time.
+// Compiled with the avx2 target attribute so that it can be selected at runtime, regardless of compiler flags.
+__attribute__((target("avx2")))
+static void unpack_bitplane_avx2(u16* coeff_buffer, u8* bitplane, i32 coeff_count, i32 shift_amount) {
+	__m256i lane_bits = _mm256_setr_epi16(0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+	                                      0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, (short)0x8000);
+	__m256i bit_to_set = _mm256_set1_epi16((short)(1 << shift_amount));
+	i32 i = 0;
+	for (; i + 16 <= coeff_count; i += 16) {
+		u16 w = *(u16*)(bitplane + i/8);
+		if (w == 0) continue;
+		__m256i v = _mm256_and_si256(_mm256_set1_epi16((short)w), lane_bits);
+		__m256i masks = _mm256_and_si256(_mm256_cmpeq_epi16(v, lane_bits), bit_to_set);
+		__m256i* dst = (__m256i*)(coeff_buffer + i);
+		_mm256_storeu_si256(dst, _mm256_or_si256(_mm256_loadu_si256(dst), masks));
+	}
+	if (i < coeff_count) {
+		unpack_bitplane(coeff_buffer + i, bitplane + i/8, coeff_count - i, shift_amount);
+	}
+}
+#endif
+
+static unpack_bitplane_func_t* get_unpack_bitplane_func() {
+	static unpack_bitplane_func_t* selected_func;
+	if (!selected_func) {
+		unpack_bitplane_func_t* func = unpack_bitplane;
+#if HAVE_UNPACK_BITPLANE_AVX2
+		if (__builtin_cpu_supports("avx2")) {
+			func = unpack_bitplane_avx2;
+		}
+#endif
+		selected_func = func; // benign race: every thread picks the same function
+	}
+	return selected_func;
+}
+
 //static u32 max_code_size;
 //static u32 symbol_counts[256];
 //static u64 fast_count;
@@ -2274,8 +2463,8 @@ void isyntax_test_decompress_block(const char* filename) {
 }
  */
 
-bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 block_width, i32 block_height,
-								i32 coefficient, i32 compressor_version, i16* out_buffer) {
+static bool hulsken_decompress(u8* compressed, size_t compressed_size, i32 block_width, i32 block_height,
+                               i32 coefficient, i32 compressor_version, i16* out_buffer, bool allow_multi_symbol) {
 	ASSERT(compressor_version == 1 || compressor_version == 2);
 
 	// Read the header information stored in the codeblock.
@@ -2459,6 +2648,17 @@ bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 bloc
 	// Decode the message
 	u8* decompressed_buffer = (u8*)arena_push_size(temp_memory.arena, serialized_length);
 
+	// For large enough codeblocks, decode multiple symbols per lookup.
+	// In that mode, the output is cleared up front so that zero runs only need to advance the write position.
+	huffman_multi_entry_t* huffman_multi = NULL;
+	bool is_decompressed_buffer_cleared = false;
+	if (allow_multi_symbol && serialized_length >= HUFFMAN_MULTI_MIN_SERIALIZED_LENGTH) {
+		huffman_multi = (huffman_multi_entry_t*)arena_push_size(temp_memory.arena, (1 << HUFFMAN_FAST_BITS) * sizeof(huffman_multi_entry_t));
+		build_huffman_multi_symbol_table(&huffman, zerorun_symbol, huffman_multi);
+		memset(decompressed_buffer, 0, serialized_length);
+		is_decompressed_buffer_cleared = true;
+	}
+
 	u32 zerorun_code = huffman.code[zerorun_symbol];
 	u32 zerorun_code_size = huffman.size[zerorun_symbol];
 	if (zerorun_code_size == 0) zerorun_code_size = 1; // handle special case of the 'empty' Huffman tree (root node is leaf node)
@@ -2474,6 +2674,17 @@ bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 bloc
 		i32 code_size = 1;
 		u64 blob = bitstream_lsb_read(compressed, bits_read);
 		u32 fast_index = blob & fast_mask;
+		if (huffman_multi) {
+			// Emit several literal symbols at once. Only allowed if none of the symbols would have triggered the
+			// termination checks at the top of the loop, so that the result is identical to the one-by-one method.
+			huffman_multi_entry_t multi = huffman_multi[fast_index];
+			if (multi.count > 0 && decompressed_length + 4 <= serialized_length && bits_read + multi.bits < block_size_in_bits) {
+				*(u32*)(decompressed_buffer + decompressed_length) = multi.symbols; // unused bytes are zero
+				decompressed_length += multi.count;
+				bits_read += multi.bits;
+				continue;
+			}
+		}
 		u16 c = huffman.fast[fast_index];
 		if (c <= 255) {
 			// Lookup the symbol directly.
@@ -2543,7 +2754,9 @@ bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 bloc
 				u32 actual_numzeroes = (compressor_version == 2) ? numzeroes + 1 : numzeroes; // v2 stores actual count minus one
 				if (decompressed_length + actual_numzeroes >= serialized_length || bits_read >= block_size_in_bits) {
 					// Reached the end, terminate
-					memset(decompressed_buffer + decompressed_length, 0, MIN(serialized_length - decompressed_length, actual_numzeroes));
+					if (!is_decompressed_buffer_cleared) {
+						memset(decompressed_buffer + decompressed_length, 0, MIN(serialized_length - decompressed_length, actual_numzeroes));
+					}
 					decompressed_length += actual_numzeroes;
 					break;
 				}
@@ -2575,7 +2788,9 @@ bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 bloc
 
 				i32 bytes_to_write = MIN(serialized_length - decompressed_length, actual_numzeroes);
 				ASSERT(bytes_to_write > 0);
-				memset(decompressed_buffer + decompressed_length, 0, bytes_to_write);
+				if (!is_decompressed_buffer_cleared) {
+					memset(decompressed_buffer + decompressed_length, 0, bytes_to_write);
+				}
 				decompressed_length += actual_numzeroes;
 			} else {
 				// This is not a 'zero run' after all, but an escaped symbol. So output the symbol.
@@ -2640,6 +2855,7 @@ bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 bloc
 	memset(out_buffer, 0, coeff_buffer_size);
 
 	{
+		unpack_bitplane_func_t* unpack_bitplane_func = get_unpack_bitplane_func();
 		u32 running_bit_index = 0;
 		i32 running_coeff_index = 0;
 		u32 bitmasks_copy[3];
@@ -2690,43 +2906,16 @@ bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 bloc
 			// Now we figured out which coeff and bit number this bitplane belongs to
 
 			u16* current_coeff_buffer = coeff_buffer + (running_coeff_index * (block_width * block_height));
-			u16* current_out_buffer = (u16*)out_buffer + (running_coeff_index * (block_width * block_height));
 
 			// Do the bitplane unpacking
-			for (i32 i = 0; i < block_width * block_height; i += 8) {
-				i32 j = i/8;
-				// The order bitplanes are stored in depends on the compressor version
-				i32 shift_amount;
-				if (compressor_version == 1) {
-					shift_amount = (running_bit_index == 0) ? 15 : running_bit_index - 1; // bitplanes are stored sign, lsb ... msb
-				} else {
-					shift_amount = 15 - running_bit_index; // bitplanes are stored sign, msb ... lsb
-				}
-				u8 b = bitplane[j];
-				if (b == 0) continue;
-#if !defined(__SSE2__)
-				// Non-SIMD version
-					current_coeff_buffer[i+0] |= ((b >> 0) & 1) << shift_amount;
-					current_coeff_buffer[i+1] |= ((b >> 1) & 1) << shift_amount;
-					current_coeff_buffer[i+2] |= ((b >> 2) & 1) << shift_amount;
-					current_coeff_buffer[i+3] |= ((b >> 3) & 1) << shift_amount;
-					current_coeff_buffer[i+4] |= ((b >> 4) & 1) << shift_amount;
-					current_coeff_buffer[i+5] |= ((b >> 5) & 1) << shift_amount;
-					current_coeff_buffer[i+6] |= ((b >> 6) & 1) << shift_amount;
-					current_coeff_buffer[i+7] |= ((b >> 7) & 1) << shift_amount;
-#else
-				// This SIMD implementation is ~20% faster compared to the simple version above.
-				// Can it be made faster?
-				__m128i* dst = (__m128i*) (current_coeff_buffer+i);
-				uint64_t t = bswap_64(((0x8040201008040201ULL*b) & 0x8080808080808080ULL) >> 7);
-				__m128i v_t = _mm_set_epi64x(0, t);
-				__m128i array_of_bools = _mm_unpacklo_epi8(v_t, _mm_setzero_si128());
-				__m128i masks = _mm_slli_epi16(array_of_bools, shift_amount);
-				__m128i result = _mm_or_si128(*dst, masks);
-				*dst = result;
-#endif
-				DUMMY_STATEMENT;
+			// The order bitplanes are stored in depends on the compressor version
+			i32 shift_amount;
+			if (compressor_version == 1) {
+				shift_amount = (running_bit_index == 0) ? 15 : running_bit_index - 1; // bitplanes are stored sign, lsb ... msb
+			} else {
+				shift_amount = 15 - running_bit_index; // bitplanes are stored sign, msb ... lsb
 			}
+			unpack_bitplane_func(current_coeff_buffer, bitplane, block_width * block_height, shift_amount);
 
 			// finish iterating: basically, this is the '++i' part of the 'for loop' that got complicated because
 			// the v1 and v2 compressors store bitplanes in a different order
@@ -2770,6 +2959,82 @@ bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 bloc
 	return true;
 }
 
+bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 block_width, i32 block_height,
+                                i32 coefficient, i32 compressor_version, i16* out_buffer) {
+	return hulsken_decompress(compressed, compressed_size, block_width, block_height, coefficient, compressor_version,
+	                          out_buffer, isyntax_huffman_multi_symbol_enabled);
+}
+
+// Decode a number of codeblocks from the base level of the WSI using both the one-symbol-at-a-time decoder and the
+// multi-symbol decoder, check that the results are identical, and report the throughput of both methods.
+void isyntax_benchmark_hulsken_decompress(isyntax_t* isyntax, i32 max_codeblock_count) {
+	isyntax_image_t* wsi = isyntax->images + isyntax->wsi_image_index;
+	if (wsi->codeblock_count == 0 || wsi->codeblocks == NULL) {
+		console_print("iSyntax Huffman benchmark: no codeblocks available\n");
+		return;
+	}
+	i32 block_width = isyntax->block_width;
+	i32 block_height = isyntax->block_height;
+	size_t max_coeff_buffer_size = 3 * block_width * block_height * sizeof(i16);
+	i16* reference_buffer = (i16*)malloc(max_coeff_buffer_size);
+	i16* test_buffer = (i16*)malloc(max_coeff_buffer_size);
+
+	i64 total_compressed_bytes = 0;
+	i64 total_coeff_bytes = 0;
+	float seconds_single = 0.0f;
+	float seconds_multi = 0.0f;
+	i32 blocks_tested = 0;
+	i32 mismatch_count = 0;
+	for (i32 i = 0; i < wsi->codeblock_count && blocks_tested < max_codeblock_count; ++i) {
+		isyntax_codeblock_t* codeblock = wsi->codeblocks + i;
+		if (codeblock->scale != 0 || codeblock->block_size <= 8) continue;
+		u8* compressed = (u8*)malloc(codeblock->block_size + 8); // extra safety bytes for reading the bitstream
+		size_t bytes_read = file_handle_read_at_offset(compressed, isyntax->file_handle, codeblock->block_data_offset, codeblock->block_size);
+		if (bytes_read != codeblock->block_size) {
+			free(compressed);
+			break;
+		}
+		memset(compressed + codeblock->block_size, 0, 8);
+		i32 coeff_count = (codeblock->coefficient == 1) ? 3 : 1;
+
+		i64 start = get_clock();
+		hulsken_decompress(compressed, codeblock->block_size, block_width, block_height,
+		                   codeblock->coefficient, wsi->compressor_version, reference_buffer, false);
+		i64 mid = get_clock();
+		hulsken_decompress(compressed, codeblock->block_size, block_width, block_height,
+		                   codeblock->coefficient, wsi->compressor_version, test_buffer, true);
+		i64 end = get_clock();
+		seconds_single += get_seconds_elapsed(start, mid);
+		seconds_multi += get_seconds_elapsed(mid, end);
+
+		size_t coeff_buffer_size = coeff_count * block_width * block_height * sizeof(i16);
+		if (memcmp(reference_buffer, test_buffer, coeff_buffer_size) != 0) {
+			++mismatch_count;
+		}
+		total_compressed_bytes += codeblock->block_size;
+		total_coeff_bytes += coeff_buffer_size;
+		++blocks_tested;
+		free(compressed);
+	}
+
+	float mb = 1.0f / (1024.0f * 1024.0f);
+	console_print("iSyntax Huffman benchmark: %d codeblocks, %.1f MB compressed -> %.1f MB coefficients\n",
+	              blocks_tested, total_compressed_bytes * mb, total_coeff_bytes * mb);
+	if (seconds_single > 0.0f && seconds_multi > 0.0f) {
+		console_print("   one symbol per lookup:   %.3f s (%.1f MB/s compressed input)\n",
+		              seconds_single, total_compressed_bytes * mb / seconds_single);
+		console_print("   multi-symbol lookup:     %.3f s (%.1f MB/s compressed input), speedup %.2fx\n",
+		              seconds_multi, total_compressed_bytes * mb / seconds_multi, seconds_single / seconds_multi);
+	}
+	if (mismatch_count > 0) {
+		console_print_error("iSyntax Huffman benchmark: %d codeblocks decoded differently!\n", mismatch_count);
+	} else {
+		console_print("   outputs are identical\n");
+	}
+	free(reference_buffer);
+	free(test_buffer);
+}
+
 static inline i32 get_first_valid_coef_pixel(i32 scale) {
 	i32 result = (PER_LEVEL_PADDING << scale) - (PER_LEVEL_PADDING - 1);
 	return result;
@@ -2833,11 +3098,321 @@ void isyntax_set_work_queue(isyntax_t* isyntax, work_queue_t* work_queue) {
 }
 
 
+// Sidecar index file, storing the parsed header information (codeblock table, data chunk table, level geometry) so that
+// the XML header does not need to be parsed again the next time the file is opened.
+// Layout: isyntax_index_header_t | isyntax_t | codeblocks | data chunks | tiles for each level.
+// The file is memory-mapped copy-on-write, and the tables in the isyntax_t point directly into the mapping.
+// The index is only valid for the exact file it was created from (checked using file size, modification time and a
+// hash of the start of the file), and for the build that created it (checked using the struct sizes).
+
+#define ISYNTAX_INDEX_MAGIC 0x58444958 // "XIDX"
+#define ISYNTAX_INDEX_VERSION 1
+#define ISYNTAX_INDEX_EXTENSION ".sxidx"
+#define ISYNTAX_INDEX_HASHED_HEADER_SIZE KILOBYTES(64)
+#define ISYNTAX_INDEX_ALIGNMENT 64
+
+bool isyntax_index_sidecar_enabled = false;
+
+typedef struct isyntax_index_header_t {
+	u32 magic;
+	u32 version;
+	u32 isyntax_struct_size;
+	u32 codeblock_struct_size;
+	u32 data_chunk_struct_size;
+	u32 tile_struct_size;
+	i64 filesize;
+	i64 mtime;
+	u32 header_hash;
+	u32 level_count;
+	i64 isyntax_offset;
+	i64 codeblocks_offset;
+	i64 data_chunks_offset;
+	i64 tiles_offset[16];
+	i64 total_size;
+} isyntax_index_header_t;
+
+static bool isyntax_index_get_file_identity(const char* filename, i64* filesize, i64* mtime, u32* header_hash) {
+	struct stat st = {0};
+	if (platform_stat(filename, &st) != 0) {
+		return false;
+	}
+	*filesize = st.st_size;
+	*mtime = (i64)st.st_mtime;
+
+	// Also hash the start of the XML header, in case the file was replaced while keeping the same size and mtime.
+	file_stream_t fp = file_stream_open_for_reading(filename);
+	if (!fp) {
+		return false;
+	}
+	size_t hashed_size = MIN(ISYNTAX_INDEX_HASHED_HEADER_SIZE, *filesize);
+	u8* buffer = malloc(hashed_size);
+	i64 bytes_read = file_stream_read(buffer, hashed_size, fp);
+	file_stream_close(fp);
+	bool success = (bytes_read == (i64)hashed_size);
+	if (success) {
+		*header_hash = crc32(buffer, (int)hashed_size);
+	}
+	free(buffer);
+	return success;
+}
+
+static void isyntax_index_get_filename(const char* filename, char* index_filename, size_t index_filename_size) {
+	snprintf(index_filename, index_filename_size, "%s" ISYNTAX_INDEX_EXTENSION, filename);
+}
+
+// Checks that a table of count elements at offset lies within the index file (guarding against overflow).
+static bool isyntax_index_is_range_valid(i64 offset, i64 count, i64 element_size, i64 mapping_size) {
+	if (offset < (i64)sizeof(isyntax_index_header_t) || offset > mapping_size || count < 0) {
+		return false;
+	}
+	return count <= (mapping_size - offset) / element_size;
+}
+
+// The header information in an index file with a matching identity might still be corrupted, so check that all the
+// tables lie within the file before pointing into it.
+static bool isyntax_index_is_valid(isyntax_index_header_t* header, u8* mapping, i64 mapping_size) {
+	if (!isyntax_index_is_range_valid(header->isyntax_offset, 1, sizeof(isyntax_t), mapping_size)) {
+		return false;
+	}
+	isyntax_t* saved_isyntax = (isyntax_t*)(mapping + header->isyntax_offset);
+	if (saved_isyntax->wsi_image_index < 0 || saved_isyntax->wsi_image_index >= COUNT(saved_isyntax->images)) {
+		return false;
+	}
+	isyntax_image_t* wsi_image = saved_isyntax->images + saved_isyntax->wsi_image_index;
+	if (wsi_image->level_count < 0 || wsi_image->level_count > COUNT(wsi_image->levels) ||
+	    wsi_image->level_count != (i32)header->level_count) {
+		return false;
+	}
+	if (!isyntax_index_is_range_valid(header->codeblocks_offset, wsi_image->codeblock_count,
+	                                  sizeof(isyntax_codeblock_t), mapping_size) ||
+	    !isyntax_index_is_range_valid(header->data_chunks_offset, wsi_image->data_chunk_count,
+	                                  sizeof(isyntax_data_chunk_t), mapping_size)) {
+		return false;
+	}
+	for (i32 scale = 0; scale < wsi_image->level_count; ++scale) {
+		isyntax_level_t* level = wsi_image->levels + scale;
+		if (level->width_in_tiles < 0 || level->height_in_tiles < 0 ||
+		    (u64)level->width_in_tiles * (u64)level->height_in_tiles != level->tile_count ||
+		    !isyntax_index_is_range_valid(header->tiles_offset[scale], level->tile_count, sizeof(isyntax_tile_t), mapping_size)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool isyntax_index_read(isyntax_t* isyntax, const char* filename) {
+	char index_filename[4096];
+	isyntax_index_get_filename(filename, index_filename, sizeof(index_filename));
+	if (!file_exists(index_filename)) {
+		return false;
+	}
+	i64 filesize = 0;
+	i64 mtime = 0;
+	u32 header_hash = 0;
+	if (!isyntax_index_get_file_identity(filename, &filesize, &mtime, &header_hash)) {
+		return false;
+	}
+
+	i64 mapping_size = 0;
+	u8* mapping = file_map_copy_on_write(index_filename, &mapping_size);
+	if (!mapping) {
+		return false;
+	}
+	isyntax_index_header_t* header = (isyntax_index_header_t*)mapping;
+	if (mapping_size < (i64)sizeof(isyntax_index_header_t) ||
+	    header->magic != ISYNTAX_INDEX_MAGIC ||
+	    header->version != ISYNTAX_INDEX_VERSION ||
+	    header->isyntax_struct_size != sizeof(isyntax_t) ||
+	    header->codeblock_struct_size != sizeof(isyntax_codeblock_t) ||
+	    header->data_chunk_struct_size != sizeof(isyntax_data_chunk_t) ||
+	    header->tile_struct_size != sizeof(isyntax_tile_t) ||
+	    header->filesize != filesize ||
+	    header->mtime != mtime ||
+	    header->header_hash != header_hash ||
+	    header->total_size != mapping_size ||
+	    header->level_count > COUNT(header->tiles_offset) ||
+	    !isyntax_index_is_valid(header, mapping, mapping_size)) {
+		console_print_verbose("iSyntax: ignoring outdated or invalid index file %s\n", index_filename);
+		file_unmap(mapping, mapping_size);
+		return false;
+	}
+
+	// Restore the parsed header information; everything that is not part of the header is left untouched.
+	isyntax_t* saved_isyntax = (isyntax_t*)(mapping + header->isyntax_offset);
+	work_queue_t* work_submission_queue = isyntax->work_submission_queue;
+	*isyntax = *saved_isyntax;
+	memset(&isyntax->parser, 0, sizeof(isyntax->parser));
+	isyntax->file_handle = 0;
+	isyntax->black_dummy_coeff = NULL;
+	isyntax->white_dummy_coeff = NULL;
+	isyntax->ll_coeff_block_allocator = NULL;
+	isyntax->h_coeff_block_allocator = NULL;
+	isyntax->is_block_allocator_owned = false;
+	isyntax->work_submission_queue = work_submission_queue;
+	isyntax->refcount = 0;
+	isyntax->cache = NULL;
+	isyntax->release_from_cache = NULL;
+
+	isyntax_image_t* wsi_image = isyntax->images + isyntax->wsi_image_index;
+	wsi_image->codeblocks = (isyntax_codeblock_t*)(mapping + header->codeblocks_offset);
+	wsi_image->data_chunks = (isyntax_data_chunk_t*)(mapping + header->data_chunks_offset);
+	for (i32 scale = 0; scale < wsi_image->level_count; ++scale) {
+		wsi_image->levels[scale].tiles = (isyntax_tile_t*)(mapping + header->tiles_offset[scale]);
+	}
+	isyntax->index_mapping = mapping;
+	isyntax->index_mapping_size = mapping_size;
+	return true;
+}
+
+static i64 isyntax_index_write_section(file_stream_t fp, i64 offset, void* data, size_t size) {
+	i64 padding = ((offset + ISYNTAX_INDEX_ALIGNMENT - 1) & ~(i64)(ISYNTAX_INDEX_ALIGNMENT - 1)) - offset;
+	if (padding > 0) {
+		u8 zeroes[ISYNTAX_INDEX_ALIGNMENT] = {0};
+		file_stream_write(zeroes, padding, fp);
+	}
+	if (size > 0) {
+		file_stream_write(data, size, fp);
+	}
+	return offset + padding;
+}
+
+static void isyntax_index_write(isyntax_t* isyntax, const char* filename) {
+	isyntax_image_t* wsi_image = isyntax->images + isyntax->wsi_image_index;
+	ASSERT(wsi_image->level_count <= 16);
+
+	isyntax_index_header_t header = {
+		.magic = ISYNTAX_INDEX_MAGIC,
+		.version = ISYNTAX_INDEX_VERSION,
+		.isyntax_struct_size = sizeof(isyntax_t),
+		.codeblock_struct_size = sizeof(isyntax_codeblock_t),
+		.data_chunk_struct_size = sizeof(isyntax_data_chunk_t),
+		.tile_struct_size = sizeof(isyntax_tile_t),
+		.level_count = wsi_image->level_count,
+	};
+	if (!isyntax_index_get_file_identity(filename, &header.filesize, &header.mtime, &header.header_hash)) {
+		return;
+	}
+
+	// Lay out the sections
+	i64 offset = sizeof(header);
+	i64 align = ISYNTAX_INDEX_ALIGNMENT;
+	header.isyntax_offset = (offset + align - 1) & ~(align - 1);
+	offset = header.isyntax_offset + sizeof(isyntax_t);
+	header.codeblocks_offset = (offset + align - 1) & ~(align - 1);
+	offset = header.codeblocks_offset + wsi_image->codeblock_count * sizeof(isyntax_codeblock_t);
+	header.data_chunks_offset = (offset + align - 1) & ~(align - 1);
+	offset = header.data_chunks_offset + wsi_image->data_chunk_count * sizeof(isyntax_data_chunk_t);
+	for (i32 scale = 0; scale < wsi_image->level_count; ++scale) {
+		header.tiles_offset[scale] = (offset + align - 1) & ~(align - 1);
+		offset = header.tiles_offset[scale] + wsi_image->levels[scale].tile_count * sizeof(isyntax_tile_t);
+	}
+	header.total_size = offset;
+
+	char index_filename[4096];
+	isyntax_index_get_filename(filename, index_filename, sizeof(index_filename));
+	file_stream_t fp = file_stream_open_for_writing(index_filename);
+	if (!fp) {
+		console_print_verbose("iSyntax: could not create index file %s\n", index_filename);
+		return;
+	}
+	// Write the header last, so that an incomplete index file will be rejected.
+	isyntax_index_header_t incomplete_header = {0};
+	offset = isyntax_index_write_section(fp, 0, &incomplete_header, sizeof(header)) + sizeof(header);
+	offset = isyntax_index_write_section(fp, offset, isyntax, sizeof(isyntax_t)) + sizeof(isyntax_t);
+	ASSERT(offset == header.isyntax_offset + (i64)sizeof(isyntax_t));
+	offset = isyntax_index_write_section(fp, offset, wsi_image->codeblocks, wsi_image->codeblock_count * sizeof(isyntax_codeblock_t))
+	         + wsi_image->codeblock_count * sizeof(isyntax_codeblock_t);
+	offset = isyntax_index_write_section(fp, offset, wsi_image->data_chunks, wsi_image->data_chunk_count * sizeof(isyntax_data_chunk_t))
+	         + wsi_image->data_chunk_count * sizeof(isyntax_data_chunk_t);
+	for (i32 scale = 0; scale < wsi_image->level_count; ++scale) {
+		isyntax_level_t* level = wsi_image->levels + scale;
+		offset = isyntax_index_write_section(fp, offset, level->tiles, level->tile_count * sizeof(isyntax_tile_t))
+		         + level->tile_count * sizeof(isyntax_tile_t);
+	}
+	ASSERT(offset == header.total_size);
+	file_stream_set_pos(fp, 0);
+	file_stream_write(&header, sizeof(header), fp);
+	file_stream_close(fp);
+}
+
+// Final steps of isyntax_open(), after the header information is known (either parsed, or read from the index file).
+static bool isyntax_finish_open(isyntax_t* isyntax, const char* filename, bool init_allocators) {
+	size_t ll_coeff_block_size = isyntax->block_width * isyntax->block_height * sizeof(icoeff_t);
+	size_t block_allocator_maximum_capacity_in_blocks = GIGABYTES(32) / ll_coeff_block_size;
+	size_t ll_coeff_block_allocator_capacity_in_blocks = block_allocator_maximum_capacity_in_blocks / 4;
+	size_t h_coeff_block_size = ll_coeff_block_size * 3;
+	size_t h_coeff_block_allocator_capacity_in_blocks = ll_coeff_block_allocator_capacity_in_blocks * 3;
+	if (init_allocators) {
+		isyntax->ll_coeff_block_allocator = malloc(sizeof(block_allocator_t));
+		isyntax->h_coeff_block_allocator = malloc(sizeof(block_allocator_t));
+		*isyntax->ll_coeff_block_allocator = block_allocator_create(ll_coeff_block_size, ll_coeff_block_allocator_capacity_in_blocks, MEGABYTES(256));
+		*isyntax->h_coeff_block_allocator = block_allocator_create(h_coeff_block_size, h_coeff_block_allocator_capacity_in_blocks, MEGABYTES(256));
+		isyntax->is_block_allocator_owned = true;
+	} else {
+		// The caller must inject the allocators after return of isyntax_open().
+		isyntax->ll_coeff_block_allocator = NULL;
+		isyntax->h_coeff_block_allocator = NULL;
+		isyntax->is_block_allocator_owned = false;
+	}
+
+	// Blocks with 'background' coefficients, to use for filling in margins at the edges (in case the neighboring codeblock doesn't exist)
+	if (!isyntax->black_dummy_coeff) {
+		isyntax->black_dummy_coeff = (icoeff_t*)calloc(1, isyntax->block_width * isyntax->block_height * sizeof(icoeff_t));
+	}
+	if (!isyntax->white_dummy_coeff) {
+		isyntax->white_dummy_coeff = (icoeff_t*)malloc(isyntax->block_width * isyntax->block_height * sizeof(icoeff_t));
+		for (i32 i = 0; i < isyntax->block_width * isyntax->block_height; ++i) {
+			isyntax->white_dummy_coeff[i] = 255;
+		}
+	}
+
+	isyntax->file_handle = open_file_handle_for_simultaneous_access(filename);
+	if (!isyntax->file_handle) {
+		console_print_error("Error: Could not reopen file for asynchronous I/O\n");
+		return false;
+	}
+	if (memory_mapped_files_enabled) {
+		isyntax->file_mapping = file_map_read_only(filename, &isyntax->file_mapping_size);
+		if (isyntax->file_mapping) {
+			file_map_advise(isyntax->file_mapping, isyntax->file_mapping_size, 0, 0, FILE_ACCESS_PATTERN_RANDOM);
+		}
+	}
+	return true;
+}
+
+// Returns a pointer into the memory-mapped file if the range is available there, or NULL otherwise.
+// NOTE: the decoder may read a few bytes past the end of a codeblock (see bitstream_lsb_read()), so we require some
+// slack at the end of the mapping.
+u8* isyntax_get_mapped_data(isyntax_t* isyntax, i64 offset, i64 size) {
+	if (isyntax->file_mapping && offset >= 0 && offset + size + 8 <= isyntax->file_mapping_size) {
+		return isyntax->file_mapping + offset;
+	}
+	return NULL;
+}
+
+// Data that points into the memory-mapped file must not be freed.
+bool isyntax_is_mapped_data(isyntax_t* isyntax, u8* data) {
+	return isyntax->file_mapping && data >= isyntax->file_mapping && data < isyntax->file_mapping + isyntax->file_mapping_size;
+}
+
 bool isyntax_open(isyntax_t* isyntax, const char* filename, bool init_allocators) {
 
 	console_print_verbose("Attempting to open iSyntax: %s\n", filename);
 	ASSERT(isyntax);
 
+	if (isyntax_index_sidecar_enabled) {
+		i64 index_load_begin = get_clock();
+		if (isyntax_index_read(isyntax, filename)) {
+			bool success = isyntax_finish_open(isyntax, filename, init_allocators);
+			isyntax->loading_time = get_seconds_elapsed(index_load_begin, get_clock());
+			console_print_verbose("iSyntax: opened using index file (took %g seconds)\n", isyntax->loading_time);
+			if (!success) {
+				isyntax_destroy(isyntax);
+			}
+			return success;
+		}
+	}
+
 	int ret = 0; (void)ret;
 	file_stream_t fp = file_stream_open_for_reading(filename);
 	bool success = false;
@@ -3278,35 +3853,6 @@ bool isyntax_open(isyntax_t* isyntax, const char* filename, bool init_allocators
 				goto failed;
 			}
 
-			size_t ll_coeff_block_size = isyntax->block_width * isyntax->block_height * sizeof(icoeff_t);
-			size_t block_allocator_maximum_capacity_in_blocks = GIGABYTES(32) / ll_coeff_block_size;
-			size_t ll_coeff_block_allocator_capacity_in_blocks = block_allocator_maximum_capacity_in_blocks / 4;
-			size_t h_coeff_block_size = ll_coeff_block_size * 3;
-			size_t h_coeff_block_allocator_capacity_in_blocks = ll_coeff_block_allocator_capacity_in_blocks * 3;
-			if (init_allocators) {
-				isyntax->ll_coeff_block_allocator = malloc(sizeof(block_allocator_t));
-				isyntax->h_coeff_block_allocator = malloc(sizeof(block_allocator_t));
-				*isyntax->ll_coeff_block_allocator = block_allocator_create(ll_coeff_block_size, ll_coeff_block_allocator_capacity_in_blocks, MEGABYTES(256));
-				*isyntax->h_coeff_block_allocator = block_allocator_create(h_coeff_block_size, h_coeff_block_allocator_capacity_in_blocks, MEGABYTES(256));
-				isyntax->is_block_allocator_owned = true;
-			} else {
-				// The caller must inject the allocators after return of isyntax_open().
-				isyntax->ll_coeff_block_allocator = NULL;
-				isyntax->h_coeff_block_allocator = NULL;
-				isyntax->is_block_allocator_owned = false;
-			}
-
-			// Blocks with 'background' coefficients, to use for filling in margins at the edges (in case the neighboring codeblock doesn't exist)
-			if (!isyntax->black_dummy_coeff) {
-				isyntax->black_dummy_coeff = (icoeff_t*)calloc(1, isyntax->block_width * isyntax->block_height * sizeof(icoeff_t));
-			}
-			if (!isyntax->white_dummy_coeff) {
-				isyntax->white_dummy_coeff = (icoeff_t*)malloc(isyntax->block_width * isyntax->block_height * sizeof(icoeff_t));
-				for (i32 i = 0; i < isyntax->block_width * isyntax->block_height; ++i) {
-					isyntax->white_dummy_coeff[i] = 255;
-				}
-			}
-
 			success = true;
 
 			free(read_buffer);
@@ -3327,11 +3873,10 @@ bool isyntax_open(isyntax_t* isyntax, const char* filename, bool init_allocators
 		file_stream_close(fp);
 
 		if (success) {
-			isyntax->file_handle = open_file_handle_for_simultaneous_access(filename);
-			if (!isyntax->file_handle) {
-				console_print_error("Error: Could not reopen file for asynchronous I/O\n");
-				success = false;
+			if (isyntax_index_sidecar_enabled) {
+				isyntax_index_write(isyntax, filename);
 			}
+			success = isyntax_finish_open(isyntax, filename, init_allocators);
 		}
 	}
 	return success;
@@ -3352,6 +3897,11 @@ void isyntax_destroy(isyntax_t* isyntax) {
 			}
 		}
 	}
+	if (isyntax->cache && isyntax->release_from_cache) {
+		// The cache holds on to our tiles (and compressed copies of their coefficients); take them back first.
+		isyntax->release_from_cache(isyntax->cache, isyntax);
+		isyntax->cache = NULL;
+	}
     if (isyntax->is_block_allocator_owned) {
         if (isyntax->ll_coeff_block_allocator->is_valid) {
             block_allocator_destroy(isyntax->ll_coeff_block_allocator);
@@ -3371,18 +3921,19 @@ void isyntax_destroy(isyntax_t* isyntax) {
 	for (i32 image_index = 0; image_index < isyntax->image_count; ++image_index) {
 		isyntax_image_t* image = isyntax->images + image_index;
 		if (image->image_type == ISYNTAX_IMAGE_TYPE_WSI) {
+			// NOTE: if the file was opened using an index file, the tables point into the index file mapping.
 			if (image->codeblocks) {
-				free(image->codeblocks);
+				if (!isyntax->index_mapping) free(image->codeblocks);
 				image->codeblocks = NULL;
 			}
 			if (image->data_chunks) {
 				for (i32 i = 0; i < image->data_chunk_count; ++i) {
 					isyntax_data_chunk_t* chunk = image->data_chunks + i;
-					if (chunk->data) {
+					if (chunk->data && !isyntax_is_mapped_data(isyntax, chunk->data)) {
 						free(chunk->data);
 					}
 				}
-				free(image->data_chunks);
+				if (!isyntax->index_mapping) free(image->data_chunks);
 				image->data_chunks = NULL;
 			}
 			for (i32 i = 0; i < image->level_count; ++i) {
@@ -3398,12 +3949,20 @@ void isyntax_destroy(isyntax_t* isyntax) {
 						}
 					}
 #endif
-					free(level->tiles);
+					if (!isyntax->index_mapping) free(level->tiles);
 					level->tiles = NULL;
 				}
 			}
 		}
 	}
+	if (isyntax->index_mapping) {
+		file_unmap(isyntax->index_mapping, isyntax->index_mapping_size);
+		isyntax->index_mapping = NULL;
+	}
+	if (isyntax->file_mapping) {
+		file_unmap(isyntax->file_mapping, isyntax->file_mapping_size);
+		isyntax->file_mapping = NULL;
+	}
 	file_handle_close(isyntax->file_handle);
 }
 
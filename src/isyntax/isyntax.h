@@ -257,9 +257,21 @@ typedef struct isyntax_tile_t {
     // TODO(avirodov): need to rethink this, maybe an external struct that points to isyntax_tile_t. The benefit
     //   is that the cache is usually smaller than the number of tiles. The con is that I'll need to manage list memory
     //   (probably another allocator for small objects - list nodes).
-    bool cache_marked;
+    u8 cache_plan_flags; // scratch space for isyntax_reader, while holding the cache lock
+    // Set while a reader thread is writing to this tile (loading its coefficients, or writing its LL coefficients in
+    // the IDWT of the parent). While in flight, the tile is not in the cache list: other threads needing it must wait,
+    // and it cannot be evicted.
+    volatile bool cache_in_flight;
+    // Number of reader threads using the coefficients of this tile as an input. While pinned, the tile cannot be
+    // written to or evicted. Protected by the cache lock.
+    i32 cache_pin_count;
+    // Number of region reads that need this tile to stay in the cache. Held tiles cannot be evicted, but unlike pinned
+    // tiles they can be written to. Protected by the cache lock.
+    i32 cache_hold_count;
     struct isyntax_tile_t* cache_next;
     struct isyntax_tile_t* cache_prev;
+    // LZ4-compressed copy of the coefficients, kept by isyntax_reader after the tile was evicted from the cache list.
+    struct isyntax_compressed_coeffs_t* cache_compressed;
 
     // Note(avirodov): this is needed for isyntax_reader. It is very convenient to be able to compute neighbors
     // from the tile itself, although at the cost of additional memory (3 ints) per tile.
@@ -388,11 +400,24 @@ typedef struct isyntax_t {
 	i32 data_model_major_version; // <100 (usually 5) for iSyntax format v1, >= 100 for iSyntax format v2
 	work_queue_t* work_submission_queue;
 	volatile i32 refcount;
+	u8* index_mapping; // if opened using an index file: the tables point into this mapping
+	i64 index_mapping_size;
+	u8* file_mapping; // if memory-mapped file access is enabled
+	i64 file_mapping_size;
+	// Set by isyntax_reader when the tiles are read through a cache (which may be shared with other files).
+	// isyntax_destroy() calls release_from_cache, so that the cache lets go of the tiles before they are freed.
+	isyntax_cache_t* cache;
+	void (*release_from_cache)(isyntax_cache_t* cache, struct isyntax_t* isyntax);
 } isyntax_t;
 
+// globals
+extern bool isyntax_huffman_multi_symbol_enabled; // decode multiple Huffman symbols per table lookup (if worthwhile)
+extern bool isyntax_index_sidecar_enabled; // read/write parsed header information from/to '<filename>.sxidx'
+
 // function prototypes
 void isyntax_xml_parser_init(isyntax_xml_parser_t* parser);
 bool isyntax_hulsken_decompress(u8 *compressed, size_t compressed_size, i32 block_width, i32 block_height, i32 coefficient, i32 compressor_version, i16* out_buffer);
+void isyntax_benchmark_hulsken_decompress(isyntax_t* isyntax, i32 max_codeblock_count);
 void isyntax_set_work_queue(isyntax_t* isyntax, work_queue_t* work_queue);
 bool isyntax_open(isyntax_t* isyntax, const char* filename, bool init_allocators);
 void isyntax_destroy(isyntax_t* isyntax);
@@ -406,6 +431,8 @@ void isyntax_decompress_codeblock_in_chunk(isyntax_codeblock_t* codeblock, i32 b
 i32 isyntax_get_chunk_codeblocks_per_color_for_level(i32 level, bool has_ll);
 u8* isyntax_get_associated_image_pixels(isyntax_t* isyntax, isyntax_image_t* image, enum isyntax_pixel_format_t pixel_format);
 u8* isyntax_get_associated_image_jpeg(isyntax_t* isyntax, isyntax_image_t* image, u32* jpeg_size);
+u8* isyntax_get_mapped_data(isyntax_t* isyntax, i64 offset, i64 size);
+bool isyntax_is_mapped_data(isyntax_t* isyntax, u8* data);
 
 
 #ifdef __cplusplus
@@ -154,35 +154,6 @@ static void  opj_idwt53_h_cas1(icoeff_t* tmp, const i32 sn, const i32 len, icoef
 	memcpy(tiledp, tmp, (u32)len * sizeof(icoeff_t));
 }
 
-/* <summary>                            */
-/* Inverse 5-3 wavelet transform in 1-D for one row. */
-/* </summary>                           */
-/* Performs interleave, inverse wavelet transform and copy back to buffer */
-static void opj_idwt53_h(const opj_dwt_t *dwt, icoeff_t* tiledp) {
-	const i32 sn = dwt->sn;
-	const i32 len = sn + dwt->dn;
-	if (dwt->cas == 0) { /* Left-most sample is on even coordinate */
-		if (len > 1) {
-			opj_idwt53_h_cas0(dwt->mem, sn, len, tiledp);
-		} else {
-			/* Unmodified value */
-		}
-	} else { /* Left-most sample is on odd coordinate */
-		if (len == 1) {
-			tiledp[0] /= 2;
-		} else if (len == 2) {
-			icoeff_t* out = dwt->mem;
-			const icoeff_t* in_even = &tiledp[sn];
-			const icoeff_t* in_odd = &tiledp[0];
-			out[1] = in_odd[0] - ((in_even[0] + 1) >> 1);
-			out[0] = in_even[0] + out[1];
-			memcpy(tiledp, dwt->mem, (u32)len * sizeof(icoeff_t));
-		} else if (len > 2) {
-			opj_idwt53_h_cas1(dwt->mem, sn, len, tiledp);
-		}
-	}
-}
-
 #if (defined(__SSE2__) || defined(__AVX2__))
 
 /* Conveniency macros to improve the readabilty of the formulas */
@@ -203,6 +174,7 @@ static void opj_idwt53_h(const opj_dwt_t *dwt, icoeff_t* tiledp) {
 #define LOADU(x)    _mm256_loadu_si256((const VREG*)(x))
 #define STORE(x,y)  _mm256_store_si256((VREG*)(x),(y))
 #define STOREU(x,y) _mm256_storeu_si256((VREG*)(x),(y))
+#define AND(x,y)    _mm256_and_si256((x),(y))
 #else
 #define VREG        __m128i
 #if (DWT_COEFF_BITS==16)
@@ -220,9 +192,103 @@ static void opj_idwt53_h(const opj_dwt_t *dwt, icoeff_t* tiledp) {
 #define LOADU(x)    _mm_loadu_si128((const VREG*)(x))
 #define STORE(x,y)  _mm_store_si128((VREG*)(x),(y))
 #define STOREU(x,y) _mm_storeu_si128((VREG*)(x),(y))
+#define AND(x,y)    _mm_and_si128((x),(y))
 #endif
 #define ADD3(x,y,z) ADD(ADD(x,y),z)
 
+#if (DWT_COEFF_BITS==16)
+
+/* The scalar horizontal pass computes the lifting steps in (promoted) 32-bit */
+/* int arithmetic, and only truncates to 16 bits when storing the result. */
+/* To get exactly the same results with 16-bit lanes, the sums are computed */
+/* in a way that cannot overflow: */
+/*   (a + b) >> 1     == (a >> 1) + (b >> 1) + (a & b & 1) */
+/*   (a + b + 2) >> 2 == (a >> 2) + (b >> 2) + (((a & 3) + (b & 3) + 2) >> 2) */
+static inline VREG opj_avg2_floor_16(VREG a, VREG b) {
+	return ADD3(SAR(a, 1), SAR(b, 1), AND(AND(a, b), LOAD_CST(1)));
+}
+
+static inline VREG opj_avg4_round_16(VREG a, VREG b) {
+	const VREG three = LOAD_CST(3);
+	VREG fraction = SAR(ADD3(AND(a, three), AND(b, three), LOAD_CST(2)), 2);
+	return ADD3(SAR(a, 2), SAR(b, 2), fraction);
+}
+
+/** Horizontal inverse 5x3 wavelet transform for one row, when left-most */
+/* pixel is on odd coordinate and the row length is even (sn == dn). */
+/* Instead of processing multiple rows at once, this vectorizes along the row: */
+/* the high pass band is computed first for all positions, after which the */
+/* low pass band is computed and interleaved with it. */
+static void opj_idwt53_h_cas1_even_SSE2_OR_AVX2(icoeff_t* tmp, const i32 sn, icoeff_t* tiledp) {
+	const i32 len = 2 * sn;
+	const icoeff_t* in_even = &tiledp[sn];
+	const icoeff_t* in_odd = &tiledp[0];
+	/* d[j + 1] holds the high pass value for position j, d[0] is a copy of d[1] (symmetric extension) */
+	icoeff_t* d = tmp;
+	icoeff_t* out = tmp + sn + 1 + VREG_INT_COUNT;
+	i32 j;
+
+	ASSERT(sn >= 1);
+
+	/* dn = in_odd[j] - ((in_even[j] + in_even[j + 1] + 2) >> 2); */
+	for (j = 0; j + VREG_INT_COUNT < sn; j += VREG_INT_COUNT) {
+		VREG s1 = LOADU(in_even + j);
+		VREG s2 = LOADU(in_even + j + 1);
+		STOREU(d + 1 + j, SUB(LOADU(in_odd + j), opj_avg4_round_16(s1, s2)));
+	}
+	for (; j < sn; ++j) {
+		/* at the right edge: dn = in_odd[j] - ((s1 + 1) >> 1); */
+		i32 s2 = (j + 1 < sn) ? in_even[j + 1] : in_even[j];
+		d[1 + j] = (icoeff_t)(in_odd[j] - ((in_even[j] + s2 + 2) >> 2));
+	}
+	d[0] = d[1];
+
+	/* tmp[2 * j] = s1 + ((dn + dc) >> 1); tmp[2 * j + 1] = dn; */
+	for (j = 0; j + VREG_INT_COUNT <= sn; j += VREG_INT_COUNT) {
+		VREG dc = LOADU(d + j);
+		VREG dn = LOADU(d + 1 + j);
+		VREG s = ADD(LOADU(in_even + j), opj_avg2_floor_16(dn, dc));
+#if __AVX2__
+		VREG lo = _mm256_unpacklo_epi16(s, dn);
+		VREG hi = _mm256_unpackhi_epi16(s, dn);
+		STOREU(out + 2 * j, _mm256_permute2x128_si256(lo, hi, 0x20));
+		STOREU(out + 2 * j + VREG_INT_COUNT, _mm256_permute2x128_si256(lo, hi, 0x31));
+#else
+		STOREU(out + 2 * j, _mm_unpacklo_epi16(s, dn));
+		STOREU(out + 2 * j + VREG_INT_COUNT, _mm_unpackhi_epi16(s, dn));
+#endif
+	}
+	for (; j < sn; ++j) {
+		out[2 * j] = in_even[j] + ((d[1 + j] + d[j]) >> 1);
+		out[2 * j + 1] = d[1 + j];
+	}
+	memcpy(tiledp, out, (u32)len * sizeof(icoeff_t));
+}
+
+/* Lifting steps for VREG_INT_COUNT columns, used by the row-by-row vertical pass below. */
+/* Same (wrapping) arithmetic as opj_idwt53_v_cas1_mcols_SSE2_OR_AVX2(), so that the results are identical. */
+/* Note: unlike the horizontal pass above, this must not use the overflow-safe averages, because the */
+/* column group kernel doesn't either; columns outside the column groups are handled by the caller. */
+/* dn = in_odd - ((s1 + s2 + 2) >> 2); out_even = s1 + ((dn + dc) >> 1); out_odd = dn */
+static inline void opj_idwt53_lift_row_pair_SSE2_OR_AVX2(const icoeff_t* in_odd, const icoeff_t* s1, const icoeff_t* s2,
+                                                         const icoeff_t* dc, icoeff_t* out_even, icoeff_t* out_odd) {
+	VREG s1_ = LOADU(s1);
+	VREG dn = SUB(LOADU(in_odd), SAR(ADD3(s1_, LOADU(s2), LOAD_CST(2)), 2));
+	STOREU(out_odd, dn);
+	if (dc) {
+		STOREU(out_even, ADD(s1_, SAR(ADD(dn, LOADU(dc)), 1)));
+	} else {
+		STOREU(out_even, ADD(s1_, dn)); /* top edge: tmp[0] = in_even[0] + dc */
+	}
+}
+
+/* dn = in_odd - ((s1 + s2 + 2) >> 2) */
+static inline void opj_idwt53_lift_d_SSE2_OR_AVX2(icoeff_t* d, const icoeff_t* in_odd, const icoeff_t* s1, const icoeff_t* s2) {
+	STOREU(d, SUB(LOADU(in_odd), SAR(ADD3(LOADU(s1), LOADU(s2), LOAD_CST(2)), 2)));
+}
+
+#endif //(DWT_COEFF_BITS==16)
+
 static void opj_idwt53_v_final_memcpy(icoeff_t* tiledp_col, const icoeff_t* tmp, i32 len, size_t stride) {
 	for (i32 i = 0; i < len; ++i) {
 		/* A memcpy(&tiledp_col[i * stride + 0],
@@ -433,9 +499,48 @@ static void opj_idwt53_v_cas1_mcols_SSE2_OR_AVX2(icoeff_t* tmp, const i32 sn, co
 #undef ADD3
 #undef SUB
 #undef SAR
+#undef AND
 
 #endif /* (defined(__SSE2__) || defined(__AVX2__)) && !defined(STANDARD_SLOW_VERSION) */
 
+/* <summary>                            */
+/* Inverse 5-3 wavelet transform in 1-D for one row. */
+/* </summary>                           */
+/* Performs interleave, inverse wavelet transform and copy back to buffer */
+static void opj_idwt53_h(const opj_dwt_t *dwt, icoeff_t* tiledp) {
+	const i32 sn = dwt->sn;
+	const i32 len = sn + dwt->dn;
+	if (dwt->cas == 0) { /* Left-most sample is on even coordinate */
+		if (len > 1) {
+			opj_idwt53_h_cas0(dwt->mem, sn, len, tiledp);
+		} else {
+			/* Unmodified value */
+		}
+	} else { /* Left-most sample is on odd coordinate */
+		if (len == 1) {
+			tiledp[0] /= 2;
+		} else if (len == 2) {
+			icoeff_t* out = dwt->mem;
+			const icoeff_t* in_even = &tiledp[sn];
+			const icoeff_t* in_odd = &tiledp[0];
+			out[1] = in_odd[0] - ((in_even[0] + 1) >> 1);
+			out[0] = in_even[0] + out[1];
+			memcpy(tiledp, dwt->mem, (u32)len * sizeof(icoeff_t));
+		} else if (len > 2) {
+#if (defined(__SSE2__) || defined(__AVX2__)) && (DWT_COEFF_BITS==16)
+			if (sn == dwt->dn && sn >= VREG_INT_COUNT) {
+				/* Same as below general case, except that thanks to SSE2/AVX2 */
+				/* we can efficiently process 8/16 positions in parallel */
+				opj_idwt53_h_cas1_even_SSE2_OR_AVX2(dwt->mem, sn, tiledp);
+				return;
+			}
+#endif
+			opj_idwt53_h_cas1(dwt->mem, sn, len, tiledp);
+		}
+	}
+}
+
+
 /** Vertical inverse 5x3 wavelet transform for one column, when top-most
  * pixel is on even coordinate */
 static void opj_idwt3_v_cas0(icoeff_t* tmp, const i32 sn, const i32 len, icoeff_t* tiledp_col, const size_t stride) {
@@ -591,4 +696,70 @@ static void opj_idwt53_v(const opj_dwt_t *dwt, icoeff_t* tiledp_col, size_t stri
 		}
 	}
 }
-// End of openjp2 code.
\ No newline at end of file
+// End of openjp2 code.
+
+/* Vertical inverse 5x3 wavelet transform (top-most pixel on odd coordinate, sn == dn), */
+/* computed one pair of output rows at a time instead of one column group at a time. */
+/* This allows the caller to immediately consume the output rows (e.g. for color conversion), */
+/* without writing back the full-size coefficient plane. */
+/* Results are identical to opj_idwt53_v(), which uses two different kinds of arithmetic: */
+/* - columns in whole groups of PARALLEL_COLS_53 go through opj_idwt53_v_cas1_mcols_SSE2_OR_AVX2(), */
+/*   which computes everything in (wrapping) icoeff_t lanes; */
+/* - the remaining columns go through opj_idwt3_v_cas1(), which computes in 32-bit int and also keeps */
+/*   the high pass values in 32 bits from one row pair to the next. */
+/* mcols_width is the number of leading columns that opj_idwt53_v() processes in column groups. */
+
+/* Compute the high pass value for row pair j: in_odd[j] - ((in_even[j] + in_even[j + 1] + 2) >> 2) */
+/* (only for the first mcols_width columns, see opj_idwt53_v_cas1_even_row_pair()) */
+static void opj_idwt53_v_cas1_even_row_d(const icoeff_t* tiledp_col, i32 sn, size_t stride, i32 mcols_width, i32 j, icoeff_t* d) {
+	const icoeff_t* in_odd = tiledp_col + (size_t)j * stride;
+	const icoeff_t* s1 = tiledp_col + (size_t)(sn + j) * stride;
+	const icoeff_t* s2 = (j + 1 < sn) ? s1 + stride : s1; /* symmetric extension at the bottom edge */
+	i32 x = 0;
+#if (defined(__SSE2__) || defined(__AVX2__)) && (DWT_COEFF_BITS==16)
+	for (; x + VREG_INT_COUNT <= mcols_width; x += VREG_INT_COUNT) {
+		opj_idwt53_lift_d_SSE2_OR_AVX2(d + x, in_odd + x, s1 + x, s2 + x);
+	}
+#endif
+	for (; x < mcols_width; ++x) {
+		icoeff_t sum = (icoeff_t)(s1[x] + s2[x] + 2);
+		d[x] = (icoeff_t)(in_odd[x] - (sum >> 2));
+	}
+}
+
+/* Compute output rows 2*j and 2*j+1. */
+/* d_prev must contain the high pass values of row pair j-1 (ignored if j == 0), */
+/* which is the odd output row of the previous row pair. Only the first mcols_width columns of d_prev are used; */
+/* for the other columns the high pass value of row pair j-1 is recomputed, because it is needed in 32 bits. */
+static void opj_idwt53_v_cas1_even_row_pair(const icoeff_t* tiledp_col, i32 sn, size_t stride, i32 width, i32 mcols_width,
+                                            i32 j, const icoeff_t* d_prev, icoeff_t* out_even, icoeff_t* out_odd) {
+	const icoeff_t* in_odd = tiledp_col + (size_t)j * stride;
+	const icoeff_t* s1 = tiledp_col + (size_t)(sn + j) * stride;
+	const icoeff_t* s2 = (j + 1 < sn) ? s1 + stride : s1; /* symmetric extension at the bottom edge */
+	const icoeff_t* dc = (j == 0) ? NULL : d_prev; /* symmetric extension at the top edge */
+	i32 x = 0;
+#if (defined(__SSE2__) || defined(__AVX2__)) && (DWT_COEFF_BITS==16)
+	for (; x + VREG_INT_COUNT <= mcols_width; x += VREG_INT_COUNT) {
+		opj_idwt53_lift_row_pair_SSE2_OR_AVX2(in_odd + x, s1 + x, s2 + x, dc ? dc + x : NULL, out_even + x, out_odd + x);
+	}
+#endif
+	/* Rest of the column groups: same wrapping arithmetic as the SIMD kernel */
+	for (; x < mcols_width; ++x) {
+		icoeff_t sum = (icoeff_t)(s1[x] + s2[x] + 2);
+		icoeff_t dn = (icoeff_t)(in_odd[x] - (sum >> 2));
+		out_even[x] = dc ? (icoeff_t)(s1[x] + ((icoeff_t)(dn + dc[x]) >> 1)) : (icoeff_t)(s1[x] + dn);
+		out_odd[x] = dn;
+	}
+	/* Columns outside the column groups: same 32-bit arithmetic as opj_idwt3_v_cas1() */
+	for (; x < width; ++x) {
+		i32 dn = in_odd[x] - ((s1[x] + s2[x] + 2) >> 2);
+		i32 dc_x = dn;
+		if (j > 0) {
+			const icoeff_t* in_odd_prev = in_odd - stride;
+			const icoeff_t* s0 = s1 - stride;
+			dc_x = in_odd_prev[x] - ((s0[x] + s1[x] + 2) >> 2);
+		}
+		out_even[x] = (icoeff_t)(s1[x] + ((dn + dc_x) >> 1));
+		out_odd[x] = (icoeff_t)dn;
+	}
+}
@@ -26,7 +26,12 @@
 */
 
 #include "common.h"
+#include "intrinsics.h"
 #include "isyntax_reader.h"
+#include "timerutils.h"
+#include "work_queue.h"
+#include "pixel_buffer_pool.h"
+#include "lz4.h"
 
 #define LOG(msg, ...) console_print(msg, ##__VA_ARGS__)
 #define LOG_VAR(fmt, var) console_print("%s: %s=" fmt "\n", __FUNCTION__, #var, var)
@@ -75,29 +80,209 @@ static void tile_list_insert_first(isyntax_tile_list_t* list, isyntax_tile_t* ti
     list->count++;
 }
 
-static void tile_list_insert_list_first(isyntax_tile_list_t* target_list, isyntax_tile_list_t* source_list) {
-    if (source_list->head == NULL && source_list->tail == NULL) {
-        return;
+#define ITERATE_TILE_LIST(_iter, _list) \
+    isyntax_tile_t* _iter = _list.head; _iter; _iter = _iter->cache_next
+
+static void compressed_list_remove(isyntax_compressed_coeffs_list_t* list, isyntax_compressed_coeffs_t* entry) {
+    if (list->head == entry) {
+        list->head = entry->next;
+    }
+    if (list->tail == entry) {
+        list->tail = entry->prev;
+    }
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
     }
+    entry->next = NULL;
+    entry->prev = NULL;
+    list->count--;
+    list->size_in_bytes -= entry->total_size;
+}
 
-    source_list->tail->cache_next = target_list->head;
-    if (target_list->head) {
-        target_list->head->cache_prev = source_list->tail;
+static void compressed_list_insert_first(isyntax_compressed_coeffs_list_t* list, isyntax_compressed_coeffs_t* entry) {
+    ASSERT(entry->next == NULL && entry->prev == NULL);
+    if (list->head == NULL) {
+        list->head = entry;
+        list->tail = entry;
+    } else {
+        list->head->prev = entry;
+        entry->next = list->head;
+        list->head = entry;
     }
+    list->count++;
+    list->size_in_bytes += entry->total_size;
+}
 
-    target_list->head = source_list->head;
-    if (target_list->tail == NULL) {
-        target_list->tail = source_list->tail;
+// Must be called with the cache lock held. Sleeps until another thread gives back the tiles it was using;
+// the lock is released.
+static void isyntax_cache_wait_and_unlock(isyntax_cache_t* cache) {
+    if (!cache->wait_semaphore) {
+#ifdef _WIN32
+        cache->wait_semaphore = CreateSemaphore(NULL, 0, 1000000, NULL);
+#else
+        static i32 counter = 0;
+        char semaphore_name[64];
+        snprintf(semaphore_name, sizeof(semaphore_name), "/isyntax_cache%d", atomic_increment(&counter));
+        cache->wait_semaphore = sem_open(semaphore_name, O_CREAT, 0644, 0);
+        sem_unlink(semaphore_name); // the name is no longer needed once it is open
+#endif
     }
-    target_list->count += source_list->count;
-    source_list->head = NULL;
-    source_list->tail = NULL;
-    source_list->count = 0;
+    ++cache->wait_count;
+    benaphore_unlock(&cache->mutex);
+#ifdef _WIN32
+    WaitForSingleObject(cache->wait_semaphore, INFINITE);
+#else
+    sem_wait(cache->wait_semaphore);
+#endif
 }
 
-#define ITERATE_TILE_LIST(_iter, _list) \
-    isyntax_tile_t* _iter = _list.head; _iter; _iter = _iter->cache_next
+// Must be called with the cache lock held, after tiles were given back. The woken threads make a new plan.
+static void isyntax_cache_wake_waiters(isyntax_cache_t* cache) {
+    for (; cache->wait_count > 0; --cache->wait_count) {
+#ifdef _WIN32
+        ReleaseSemaphore(cache->wait_semaphore, 1, NULL);
+#else
+        sem_post(cache->wait_semaphore);
+#endif
+    }
+}
+
+// Compresses the LL and/or H coefficients of a tile. Called without holding the cache lock, the tile must be owned
+// by the calling thread (in flight). Returns NULL if compression failed.
+static isyntax_compressed_coeffs_t* isyntax_cache_compress_tile(isyntax_cache_t* cache, isyntax_tile_t* tile) {
+    i32 ll_size = (i32)cache->ll_coeff_block_allocator.block_size;
+    i32 h_size = (i32)cache->h_coeff_block_allocator.block_size;
+    i64 capacity = 0;
+    if (tile->has_ll) capacity += 3 * LZ4_compressBound(ll_size);
+    if (tile->has_h) capacity += 3 * LZ4_compressBound(h_size);
+
+    isyntax_compressed_coeffs_t* entry = malloc(sizeof(isyntax_compressed_coeffs_t) + capacity);
+    memset(entry, 0, sizeof(isyntax_compressed_coeffs_t));
+    entry->tile = tile;
+    entry->has_ll = tile->has_ll;
+    entry->has_h = tile->has_h;
+    u8* pos = (u8*)(entry + 1);
+    u8* end = pos + capacity;
+    for (int i = 0; i < 6; ++i) {
+        bool is_ll = (i < 3);
+        if (is_ll ? !tile->has_ll : !tile->has_h) continue;
+        icoeff_t* src = is_ll ? tile->color_channels[i].coeff_ll : tile->color_channels[i - 3].coeff_h;
+        i32 compressed_size = LZ4_compress_default((const char*)src, (char*)pos, is_ll ? ll_size : h_size, (int)(end - pos));
+        if (compressed_size <= 0) {
+            console_print_error("isyntax_cache_compress_tile(): LZ4 compression failed\n");
+            free(entry);
+            return NULL;
+        }
+        entry->compressed_sizes[i] = compressed_size;
+        pos += compressed_size;
+    }
+    entry->total_size = pos - (u8*)entry;
+    // Give back the unused part of the worst case allocation.
+    isyntax_compressed_coeffs_t* shrunk = realloc(entry, entry->total_size);
+    return shrunk ? shrunk : entry;
+}
+
+// Restores the coefficients that the tile is missing from its compressed copy, and frees the compressed copy.
+// The entry must have been detached from the compressed list, and the tile must be owned by the calling thread.
+static bool isyntax_cache_decompress_tile(isyntax_cache_t* cache, isyntax_tile_t* tile) {
+    isyntax_compressed_coeffs_t* entry = tile->cache_compressed;
+    ASSERT(entry && entry->tile == tile);
+    tile->cache_compressed = NULL;
+    bool restore_ll = entry->has_ll && !tile->has_ll;
+    bool restore_h = entry->has_h && !tile->has_h;
+    i32 ll_size = (i32)cache->ll_coeff_block_allocator.block_size;
+    i32 h_size = (i32)cache->h_coeff_block_allocator.block_size;
+    bool ok = true;
+    u8* pos = (u8*)(entry + 1);
+    for (int i = 0; i < 6 && ok; ++i) {
+        bool is_ll = (i < 3);
+        i32 compressed_size = entry->compressed_sizes[i];
+        if ((is_ll && restore_ll) || (!is_ll && restore_h)) {
+            icoeff_t* dest;
+            if (is_ll) {
+                dest = tile->color_channels[i].coeff_ll = (icoeff_t*) block_alloc(&cache->ll_coeff_block_allocator);
+            } else {
+                dest = tile->color_channels[i - 3].coeff_h = (icoeff_t*) block_alloc(&cache->h_coeff_block_allocator);
+            }
+            i32 decompressed_size = LZ4_decompress_safe((const char*)pos, (char*)dest, compressed_size,
+                                                        is_ll ? ll_size : h_size);
+            if (decompressed_size != (is_ll ? ll_size : h_size)) {
+                console_print_error("isyntax_cache_decompress_tile(): LZ4 decompression failed\n");
+                ok = false;
+            }
+        }
+        pos += compressed_size;
+    }
+    if (!ok) {
+        // Give back what we allocated; the coefficients will be loaded from the file instead.
+        for (int color = 0; color < 3; ++color) {
+            if (restore_ll && tile->color_channels[color].coeff_ll) {
+                block_free(&cache->ll_coeff_block_allocator, tile->color_channels[color].coeff_ll);
+                tile->color_channels[color].coeff_ll = NULL;
+            }
+            if (restore_h && tile->color_channels[color].coeff_h) {
+                block_free(&cache->h_coeff_block_allocator, tile->color_channels[color].coeff_h);
+                tile->color_channels[color].coeff_h = NULL;
+            }
+        }
+    } else {
+        if (restore_ll) tile->has_ll = true;
+        if (restore_h) tile->has_h = true;
+    }
+    free(entry);
+    return ok && (restore_ll || restore_h);
+}
+
+// Must be called with the cache lock held.
+static void isyntax_cache_trim_compressed(isyntax_cache_t* cache) {
+    isyntax_compressed_coeffs_list_t* list = &cache->compressed_list;
+    while (list->tail && list->size_in_bytes > cache->target_compressed_size_in_bytes) {
+        isyntax_compressed_coeffs_t* entry = list->tail;
+        compressed_list_remove(list, entry);
+        entry->tile->cache_compressed = NULL;
+        free(entry);
+        ++cache->compressed_eviction_count;
+    }
+}
 
+// The coefficients held by a tile in the cache list count towards cache->resident_size_in_bytes. Must be called with
+// the cache lock held. Tiles are only written to while they are out of the list (in flight), so the size that is
+// subtracted on removal is always the size that was added on insertion.
+static i64 isyntax_cache_get_tile_size_in_bytes(isyntax_cache_t* cache, isyntax_tile_t* tile) {
+    return 3 * ((tile->has_ll ? (i64)cache->ll_coeff_block_allocator.block_size : 0) +
+                (tile->has_h ? (i64)cache->h_coeff_block_allocator.block_size : 0));
+}
+
+static void isyntax_cache_list_insert_first(isyntax_cache_t* cache, isyntax_tile_t* tile) {
+    tile_list_insert_first(&cache->cache_list, tile);
+    cache->resident_size_in_bytes += isyntax_cache_get_tile_size_in_bytes(cache, tile);
+}
+
+static void isyntax_cache_list_remove(isyntax_cache_t* cache, isyntax_tile_t* tile) {
+    bool is_in_list = tile->cache_next || tile->cache_prev || cache->cache_list.head == tile;
+    if (is_in_list) {
+        tile_list_remove(&cache->cache_list, tile);
+        cache->resident_size_in_bytes -= isyntax_cache_get_tile_size_in_bytes(cache, tile);
+    }
+}
+
+static void isyntax_cache_free_tile_coefficients(isyntax_cache_t* cache, isyntax_tile_t* tile) {
+    for (int i = 0; i < 3; ++i) {
+        if (tile->has_ll) {
+            block_free(&cache->ll_coeff_block_allocator, tile->color_channels[i].coeff_ll);
+            tile->color_channels[i].coeff_ll = NULL;
+        }
+        if (tile->has_h) {
+            block_free(&cache->h_coeff_block_allocator, tile->color_channels[i].coeff_h);
+            tile->color_channels[i].coeff_h = NULL;
+        }
+    }
+    tile->has_ll = false;
+    tile->has_h = false;
+}
 
 static void isyntax_openslide_load_tile_coefficients_ll_or_h(isyntax_cache_t* cache,
                                                              isyntax_t* isyntax, isyntax_tile_t* tile,
@@ -118,19 +303,25 @@ static void isyntax_openslide_load_tile_coefficients_ll_or_h(isyntax_cache_t* ca
         }
         // TODO(avirodov): fancy allocators, for multiple sequential blocks (aka chunk). Or let OS do the caching.
         // Adding 7 safety bytes so bitstream_lsb_read() won't access out of bounds in isyntax_hulsken_decompress().
-        u8* codeblock_data = malloc(codeblock->block_size + 7);
-        size_t bytes_read = file_handle_read_at_offset(codeblock_data, isyntax->file_handle,
-                                                       codeblock->block_data_offset, codeblock->block_size);
-        if (!(bytes_read > 0)) {
-            console_print_error("Error: could not read iSyntax data at offset %lld (read size %lld)\n",
-                                codeblock->block_data_offset, codeblock->block_size);
+        u8* codeblock_data = isyntax_get_mapped_data(isyntax, codeblock->block_data_offset, codeblock->block_size);
+        bool is_mapped = (codeblock_data != NULL);
+        if (!is_mapped) {
+            codeblock_data = malloc(codeblock->block_size + 7);
+            size_t bytes_read = file_handle_read_at_offset(codeblock_data, isyntax->file_handle,
+                                                           codeblock->block_data_offset, codeblock->block_size);
+            if (!(bytes_read > 0)) {
+                console_print_error("Error: could not read iSyntax data at offset %lld (read size %lld)\n",
+                                    codeblock->block_data_offset, codeblock->block_size);
+            }
         }
 
         isyntax_hulsken_decompress(codeblock_data, codeblock->block_size,
                                    isyntax->block_width, isyntax->block_height,
                                    codeblock->coefficient, wsi->compressor_version,
                                    is_ll ? tile->color_channels[color].coeff_ll : tile->color_channels[color].coeff_h);
-        free(codeblock_data);
+        if (!is_mapped) {
+            free(codeblock_data);
+        }
     }
 
     if (is_ll) {
@@ -140,18 +331,31 @@ static void isyntax_openslide_load_tile_coefficients_ll_or_h(isyntax_cache_t* ca
     }
 }
 
-static void isyntax_openslide_load_tile_coefficients(isyntax_cache_t* cache, isyntax_t* isyntax, isyntax_tile_t* tile) {
+typedef enum isyntax_coefficients_source_t {
+    ISYNTAX_COEFFICIENTS_CACHED,     // everything was already resident
+    ISYNTAX_COEFFICIENTS_COMPRESSED, // restored from the compressed tier
+    ISYNTAX_COEFFICIENTS_LOADED,     // (partially) loaded and decoded from the file
+} isyntax_coefficients_source_t;
+
+static isyntax_coefficients_source_t isyntax_openslide_load_tile_coefficients(isyntax_cache_t* cache, isyntax_t* isyntax,
+                                                                              isyntax_tile_t* tile) {
     isyntax_image_t* wsi = &isyntax->images[isyntax->wsi_image_index];
 
     if (!tile->exists) {
-        return;
+        return ISYNTAX_COEFFICIENTS_CACHED;
+    }
+    bool restored = false;
+    if (tile->cache_compressed) {
+        restored = isyntax_cache_decompress_tile(cache, tile);
     }
+    bool loaded = false;
 
     // Load LL codeblocks here only for top-level tiles. For other levels, the LL coefficients are computed from parent
     // tiles later on.
     if (!tile->has_ll && tile->tile_scale == wsi->max_scale) {
         isyntax_openslide_load_tile_coefficients_ll_or_h(
                 cache, isyntax, tile, /*codeblock_index=*/tile->codeblock_index, /*is_ll=*/true);
+        loaded = true;
     }
 
     if (!tile->has_h) {
@@ -174,7 +378,12 @@ static void isyntax_openslide_load_tile_coefficients(isyntax_cache_t* cache, isy
         isyntax_openslide_load_tile_coefficients_ll_or_h(
                 cache, isyntax, tile,
                 /*codeblock_index=*/tile->codeblock_chunk_index + codeblock_index_in_chunk, /*is_ll=*/false);
+        loaded = true;
     }
+    if (loaded) {
+        return ISYNTAX_COEFFICIENTS_LOADED;
+    }
+    return restored ? ISYNTAX_COEFFICIENTS_COMPRESSED : ISYNTAX_COEFFICIENTS_CACHED;
 }
 
 typedef union isyntax_tile_children_t {
@@ -235,184 +444,616 @@ static void isyntax_openslide_idwt(isyntax_cache_t* cache, isyntax_t* isyntax, i
                       /*pixels_buffer=*/NULL, /*pixel_format=*/0);
 }
 
-static void isyntax_make_tile_lists_add_parent_to_list(isyntax_t* isyntax, isyntax_tile_t* tile,
-                                                       isyntax_tile_list_t* idwt_list, isyntax_tile_list_t* cache_list) {
+static isyntax_tile_t* isyntax_openslide_compute_parent(isyntax_t* isyntax, isyntax_tile_t* tile) {
     isyntax_image_t* wsi = &isyntax->images[isyntax->wsi_image_index];
     int parent_tile_scale = tile->tile_scale + 1;
     if (parent_tile_scale > wsi->max_scale) {
-        return;
+        return NULL;
     }
-
-    int parent_tile_x = tile->tile_x / 2;
-    int parent_tile_y = tile->tile_y / 2;
     isyntax_level_t* parent_level = &wsi->levels[parent_tile_scale];
-    isyntax_tile_t* parent_tile = &parent_level->tiles[parent_level->width_in_tiles * parent_tile_y + parent_tile_x];
-    if (parent_tile->exists && !parent_tile->cache_marked) {
-        tile_list_remove(cache_list, parent_tile);
-        parent_tile->cache_marked = true;
-        tile_list_insert_first(idwt_list, parent_tile);
+    return &parent_level->tiles[parent_level->width_in_tiles * (tile->tile_y / 2) + (tile->tile_x / 2)];
+}
+
+// Flags in tile->cache_plan_flags, only used while making a plan (with the cache lock held).
+#define ISYNTAX_TILE_PLAN_TOUCHED      0x1 // the tile is in plan->touched_tiles
+#define ISYNTAX_TILE_PLAN_NEEDS_COEFFS 0x2 // the LL and H coefficients are read by one of the IDWTs
+#define ISYNTAX_TILE_PLAN_IDWT         0x4 // an IDWT is done for this tile
+#define ISYNTAX_TILE_PLAN_WRITE        0x8 // coefficients are loaded into the tile, or its LL is (re)written by the
+                                           // IDWT of its parent
+
+// Per scale, at most 3x3 tiles need an IDWT, their 5x5 neighborhood needs coefficients, and the 6x6 children below
+// get their LL coefficients written.
+#define ISYNTAX_TILE_PLAN_TILES_PER_SCALE (9 + 25 + 36)
+
+// The tiles involved in reading a tile, and what needs to be done with them.
+// Tiles that are written to are reserved: they are in flight and taken out of the cache list, so that no other thread
+// uses them until the read is finished. Tiles that are only read from are pinned (cache_pin_count): any number of
+// threads can read from them at the same time, but they cannot be written to or evicted until they are unpinned.
+typedef struct isyntax_tile_read_plan_t {
+    isyntax_tile_t** touched_tiles;
+    isyntax_tile_t** idwt_tiles; // by increasing scale, starting with the requested tile; done in reverse order
+    isyntax_tile_t** load_tiles; // reserved tiles that need (some of) their coefficients loaded or decompressed
+    isyntax_tile_t** reserved_tiles;
+    isyntax_tile_t** pinned_tiles;
+    int touched_count;
+    int idwt_count;
+    int load_count;
+    int reserved_count;
+    int pinned_count;
+    int capacity;
+} isyntax_tile_read_plan_t;
+
+static void isyntax_tile_plan_mark(isyntax_tile_read_plan_t* plan, isyntax_tile_t* tile, u8 flags) {
+    if (!(tile->cache_plan_flags & ISYNTAX_TILE_PLAN_TOUCHED)) {
+        ASSERT(plan->touched_count < plan->capacity);
+        plan->touched_tiles[plan->touched_count++] = tile;
     }
+    tile->cache_plan_flags |= ISYNTAX_TILE_PLAN_TOUCHED | flags;
 }
 
-static void isyntax_make_tile_lists_add_children_to_list(isyntax_t* isyntax, isyntax_tile_t* tile,
-                                                         isyntax_tile_list_t* children_list, isyntax_tile_list_t* cache_list) {
-    if (tile->tile_scale > 0) {
+// Works out which tiles need to be loaded, decoded, reserved and pinned to read the tile. Must be called with the cache
+// lock held. If another thread stands in the way (it is writing to a tile we need, or reading from a tile we need to
+// write to), that tile is returned and the plan is empty. If the plan has no IDWTs, there is nothing to do.
+static isyntax_tile_t* isyntax_tile_read_make_plan(isyntax_t* isyntax, isyntax_tile_t* tile, bool need_pixels,
+                                                   isyntax_tile_read_plan_t* plan) {
+    isyntax_image_t* wsi = &isyntax->images[isyntax->wsi_image_index];
+    plan->touched_count = 0;
+    plan->idwt_count = 0;
+    plan->load_count = 0;
+    plan->reserved_count = 0;
+    plan->pinned_count = 0;
+
+    if (!need_pixels) {
+        // Only the LL coefficients of the children are wanted; they may still be there.
         isyntax_tile_children_t children = isyntax_openslide_compute_children(isyntax, tile);
+        bool all_children_have_ll = true;
         for (int i = 0; i < 4; ++i) {
-            if (!children.as_array[i]->cache_marked) {
-                tile_list_remove(cache_list, children.as_array[i]);
-                tile_list_insert_first(children_list, children.as_array[i]);
+            if (children.as_array[i]->cache_in_flight || !children.as_array[i]->has_ll) {
+                all_children_have_ll = false;
             }
         }
+        if (all_children_have_ll) {
+            return NULL;
+        }
     }
-}
 
-static void isyntax_make_tile_lists_by_scale(isyntax_t* isyntax, int start_scale,
-                                             isyntax_tile_list_t* idwt_list,
-                                             isyntax_tile_list_t* coeff_list,
-                                             isyntax_tile_list_t* children_list,
-                                             isyntax_tile_list_t* cache_list) {
-    isyntax_image_t* wsi = &isyntax->images[isyntax->wsi_image_index];
-    for (int scale = start_scale; scale <= wsi->max_scale; ++scale) {
-        // Mark all neighbors of idwt tiles at this level as requiring coefficients.
+    isyntax_tile_t* blocking_tile = NULL;
+    isyntax_tile_plan_mark(plan, tile, ISYNTAX_TILE_PLAN_IDWT);
+    plan->idwt_tiles[plan->idwt_count++] = tile;
+    int scale_begin = 0;
+    for (int scale = tile->tile_scale; scale_begin < plan->idwt_count && !blocking_tile; ++scale) {
         isyntax_level_t* level = &wsi->levels[scale];
-        for (ITERATE_TILE_LIST(tile, (*idwt_list))) {
-            if (tile->tile_scale == scale) {
-                for (int y_offset = -1; y_offset <= 1; ++y_offset) {
-                    for (int x_offset = -1; x_offset <= 1; ++ x_offset) {
-                        int neighbor_tile_x =  tile->tile_x + x_offset;
-                        int neighbor_tile_y = tile->tile_y + y_offset;
-                        if (neighbor_tile_x < 0 || neighbor_tile_x >= level->width_in_tiles ||
-                            neighbor_tile_y < 0 || neighbor_tile_y >= level->height_in_tiles) {
-                            continue;
-                        }
-
-                        isyntax_tile_t* neighbor_tile = &level->tiles[level->width_in_tiles * neighbor_tile_y + neighbor_tile_x];
-                        if (neighbor_tile->cache_marked || !neighbor_tile->exists) {
-                            continue;
+        int scale_end = plan->idwt_count;
+        for (int i = scale_begin; i < scale_end && !blocking_tile; ++i) {
+            isyntax_tile_t* idwt_tile = plan->idwt_tiles[i];
+            // The IDWT reads the coefficients of the tile and its neighbors...
+            for (int y_offset = -1; y_offset <= 1 && !blocking_tile; ++y_offset) {
+                for (int x_offset = -1; x_offset <= 1; ++x_offset) {
+                    int neighbor_tile_x = idwt_tile->tile_x + x_offset;
+                    int neighbor_tile_y = idwt_tile->tile_y + y_offset;
+                    if (neighbor_tile_x < 0 || neighbor_tile_x >= level->width_in_tiles ||
+                        neighbor_tile_y < 0 || neighbor_tile_y >= level->height_in_tiles) {
+                        continue;
+                    }
+                    isyntax_tile_t* neighbor_tile = &level->tiles[level->width_in_tiles * neighbor_tile_y + neighbor_tile_x];
+                    if (!neighbor_tile->exists || (neighbor_tile->cache_plan_flags & ISYNTAX_TILE_PLAN_NEEDS_COEFFS)) {
+                        continue;
+                    }
+                    if (neighbor_tile->cache_in_flight) {
+                        blocking_tile = neighbor_tile;
+                        break;
+                    }
+                    isyntax_tile_plan_mark(plan, neighbor_tile, ISYNTAX_TILE_PLAN_NEEDS_COEFFS);
+                    // Missing coefficients are decoded from the file (LL only for the top level), or restored from the
+                    // compressed tier.
+                    if (!neighbor_tile->has_h || (!neighbor_tile->has_ll && scale == wsi->max_scale) ||
+                        neighbor_tile->cache_compressed) {
+                        isyntax_tile_plan_mark(plan, neighbor_tile, ISYNTAX_TILE_PLAN_WRITE);
+                        plan->load_tiles[plan->load_count++] = neighbor_tile;
+                    }
+                    // Below the top level, the LL coefficients come from the IDWT of the parent.
+                    bool has_compressed_ll = neighbor_tile->cache_compressed && neighbor_tile->cache_compressed->has_ll;
+                    if (!neighbor_tile->has_ll && !has_compressed_ll && scale < wsi->max_scale) {
+                        isyntax_tile_t* parent_tile = isyntax_openslide_compute_parent(isyntax, neighbor_tile);
+                        if (parent_tile->exists && !(parent_tile->cache_plan_flags & ISYNTAX_TILE_PLAN_IDWT)) {
+                            isyntax_tile_plan_mark(plan, parent_tile, ISYNTAX_TILE_PLAN_IDWT);
+                            plan->idwt_tiles[plan->idwt_count++] = parent_tile;
                         }
-
-                        tile_list_remove(cache_list, neighbor_tile);
-                        neighbor_tile->cache_marked = true;
-                        tile_list_insert_first(coeff_list, neighbor_tile);
                     }
                 }
             }
+            // ... and (re)writes the LL coefficients of its children.
+            if (scale > 0) {
+                isyntax_tile_children_t children = isyntax_openslide_compute_children(isyntax, idwt_tile);
+                for (int j = 0; j < 4; ++j) {
+                    isyntax_tile_plan_mark(plan, children.as_array[j], ISYNTAX_TILE_PLAN_WRITE);
+                }
+            }
         }
+        scale_begin = scale_end;
+    }
 
-        // Mark all parents of tiles at this level as requiring idwt. This way all tiles at this level will get their
-        // ll coefficients.
-        for (ITERATE_TILE_LIST(tile, (*idwt_list))) {
-            if (tile->tile_scale == scale) {
-                isyntax_make_tile_lists_add_parent_to_list(isyntax, tile, idwt_list, cache_list);
-            }
+    for (int i = 0; i < plan->touched_count && !blocking_tile; ++i) {
+        isyntax_tile_t* touched_tile = plan->touched_tiles[i];
+        if (touched_tile->cache_in_flight ||
+            ((touched_tile->cache_plan_flags & ISYNTAX_TILE_PLAN_WRITE) && touched_tile->cache_pin_count > 0)) {
+            blocking_tile = touched_tile;
         }
-        for (ITERATE_TILE_LIST(tile, (*coeff_list))) {
-            if (tile->tile_scale == scale) {
-                isyntax_make_tile_lists_add_parent_to_list(isyntax, tile, idwt_list, cache_list);
+    }
+    for (int i = 0; i < plan->touched_count; ++i) {
+        isyntax_tile_t* touched_tile = plan->touched_tiles[i];
+        if (!blocking_tile) {
+            if (touched_tile->cache_plan_flags & ISYNTAX_TILE_PLAN_WRITE) {
+                plan->reserved_tiles[plan->reserved_count++] = touched_tile;
+            } else {
+                plan->pinned_tiles[plan->pinned_count++] = touched_tile;
             }
         }
+        touched_tile->cache_plan_flags = 0;
     }
+    if (blocking_tile) {
+        plan->idwt_count = 0;
+        plan->load_count = 0;
+    }
+    return blocking_tile;
+}
 
-    // Add all children of idwt that were not yet handled. The children will have their ll coefficients written,
-    // and so should be cache bumped.
-    // TODO(avirodov): if we store the idwt result (ll of next level) in the tile instead of the children, this
-    //  would be unnecessary. But I'm not sure this is bad either.
-    for (ITERATE_TILE_LIST(tile, (*idwt_list))) {
-        isyntax_make_tile_lists_add_children_to_list(isyntax, tile, children_list, cache_list);
+// Must be called with the cache lock held.
+static void isyntax_tile_read_take_plan(isyntax_cache_t* cache, isyntax_tile_read_plan_t* plan) {
+    for (int i = 0; i < plan->reserved_count; ++i) {
+        isyntax_tile_t* tile = plan->reserved_tiles[i];
+        isyntax_cache_list_remove(cache, tile);
+        tile->cache_in_flight = true;
+    }
+    for (int i = 0; i < plan->pinned_count; ++i) {
+        ++plan->pinned_tiles[i]->cache_pin_count;
+    }
+    // Take ownership of the compressed coefficients of the tiles that we are going to load, so that they can be
+    // decompressed without holding the lock. The compressed copies of the other reserved tiles (the children that only
+    // get their LL rewritten) are left alone: they are only ever accessed with the lock held.
+    for (int i = 0; i < plan->load_count; ++i) {
+        isyntax_tile_t* tile = plan->load_tiles[i];
+        if (tile->cache_compressed) {
+            compressed_list_remove(&cache->compressed_list, tile->cache_compressed);
+        }
     }
 }
 
-void isyntax_tile_read(isyntax_t* isyntax, isyntax_cache_t* cache, int scale, int tile_x, int tile_y,
-                       uint32_t* pixels_buffer, enum isyntax_pixel_format_t pixel_format) {
-    // TODO(avirodov): more granular locking (some notes below). This will require handling overlapping work, that is
-    //  thread A needing tile 123 and started to load it, and thread B needing same tile 123 and needs to wait for A.
-    // TODO(pvalkema): Can we safely lock the mutex later, after checking if the tile exists?
-    benaphore_lock(&cache->mutex);
+static void isyntax_cache_bump(isyntax_cache_t* cache, isyntax_tile_t* tile) {
+    isyntax_cache_list_remove(cache, tile);
+    isyntax_cache_list_insert_first(cache, tile);
+}
 
+// Must be called with the cache lock held.
+static void isyntax_tile_read_release_plan(isyntax_t* isyntax, isyntax_cache_t* cache, isyntax_tile_t* tile,
+                                           isyntax_tile_read_plan_t* plan) {
+    // The children whose LL coefficients were written end up behind the neighbors, and the IDWT tiles in front,
+    // with the top level first.
+    for (int i = 0; i < plan->reserved_count; ++i) {
+        isyntax_tile_t* reserved_tile = plan->reserved_tiles[i];
+        reserved_tile->cache_in_flight = false;
+        isyntax_cache_list_insert_first(cache, reserved_tile);
+    }
+    for (int i = 0; i < plan->pinned_count; ++i) {
+        isyntax_tile_t* pinned_tile = plan->pinned_tiles[i];
+        --pinned_tile->cache_pin_count;
+        isyntax_cache_bump(cache, pinned_tile);
+    }
+    for (int i = 0; i < plan->idwt_count; ++i) {
+        isyntax_cache_bump(cache, plan->idwt_tiles[i]);
+    }
+    // The ancestors that were not needed this time are still what the next read of a tile nearby is going to need.
+    for (isyntax_tile_t* parent = isyntax_openslide_compute_parent(isyntax, tile); parent;
+         parent = isyntax_openslide_compute_parent(isyntax, parent)) {
+        if (!parent->cache_in_flight && (parent->has_ll || parent->has_h)) {
+            isyntax_cache_bump(cache, parent);
+        }
+    }
+    isyntax_cache_wake_waiters(cache);
+}
+
+// If pixels_buffer is NULL, only the coefficients are computed (the ll coefficients of the children end up in the
+// cache). This is only useful for tiles with scale > 0.
+static void isyntax_tile_read_internal(isyntax_t* isyntax, isyntax_cache_t* cache, int scale, int tile_x, int tile_y,
+                                       uint32_t* pixels_buffer, enum isyntax_pixel_format_t pixel_format) {
     isyntax_image_t* wsi = &isyntax->images[isyntax->wsi_image_index];
     isyntax_level_t* level = &wsi->levels[scale];
     isyntax_tile_t *tile = &level->tiles[level->width_in_tiles * tile_y + tile_x];
     // printf("=== isyntax_openslide_load_tile scale=%d tile_x=%d tile_y=%d\n", scale, tile_x, tile_y);
+    // Note: tile->exists never changes after the file has been opened, so no need to lock here.
     if (!tile->exists) {
-        memset(pixels_buffer, 0xff, isyntax->tile_width * isyntax->tile_height * 4);
-        benaphore_unlock(&cache->mutex);
+        if (pixels_buffer) {
+            memset(pixels_buffer, 0xff, isyntax->tile_width * isyntax->tile_height * 4);
+        }
         return;
     }
+    ASSERT(pixels_buffer != NULL || scale > 0);
 
-    // Need 3 lists:
-    // 1. idwt list - those tiles will have to perform an idwt for their children to get ll coeffs. Primary cache bump.
-    // 2. coeff list - those tiles are neighbors and will need to have coefficients loaded. Secondary cache bump.
-    // 3. children list - those tiles will have their ll coeffs loaded as a side effect. Tertiary cache bump.
-    // Those lists must be disjoint, and sorted such that parents are closer to head than children.
-    isyntax_tile_list_t idwt_list = {NULL, NULL, 0, "idwt_list"};
-    isyntax_tile_list_t coeff_list = {NULL, NULL, 0, "coeff_list"};
-    isyntax_tile_list_t children_list = {NULL, NULL, 0, "children_list"};
+    temp_memory_t temp_memory = begin_temp_memory_on_local_thread();
+    isyntax_tile_read_plan_t plan = {0};
+    plan.capacity = ISYNTAX_TILE_PLAN_TILES_PER_SCALE * (wsi->max_scale - scale + 1);
+    plan.touched_tiles = arena_push_array(temp_memory.arena, plan.capacity, isyntax_tile_t*);
+    plan.idwt_tiles = arena_push_array(temp_memory.arena, plan.capacity, isyntax_tile_t*);
+    plan.load_tiles = arena_push_array(temp_memory.arena, plan.capacity, isyntax_tile_t*);
+    plan.reserved_tiles = arena_push_array(temp_memory.arena, plan.capacity, isyntax_tile_t*);
+    plan.pinned_tiles = arena_push_array(temp_memory.arena, plan.capacity, isyntax_tile_t*);
 
     // Lock.
-    // Make a list of all dependent tiles (including the required one).
-    // Mark all dependent tiles as "reserved" so that they are not evicted by other threads as we load them.
+    // Make a plan: which tiles need to be loaded and decoded, which are only read from (pinned) and which are written
+    // to (reserved).
     // Unlock.
-    {
-        tile_list_remove(&cache->cache_list, tile);
-        tile->cache_marked = true;
-        tile_list_insert_first(&idwt_list, tile);
+    // If another thread is in the way, wait until it releases its tiles and make a new plan. By then the work is
+    // (likely) done, and we won't need to redo it.
+    for (;;) {
+        benaphore_lock(&cache->mutex);
+        isyntax_tile_t* blocking_tile = isyntax_tile_read_make_plan(isyntax, tile, pixels_buffer != NULL, &plan);
+        if (!blocking_tile) {
+            isyntax_tile_read_take_plan(cache, &plan);
+            benaphore_unlock(&cache->mutex);
+            break;
+        }
+        isyntax_cache_wait_and_unlock(cache);
+    }
+    if (plan.idwt_count == 0) {
+        // The ll coefficients of the children are already in the cache.
+        release_temp_memory(&temp_memory);
+        return;
     }
-    isyntax_make_tile_lists_by_scale(isyntax, scale, &idwt_list, &coeff_list, &children_list, &cache->cache_list);
-
-    // Unmark visit status and reserve all nodes. todo(avirodov): reserve later when doing threading.
-    for (ITERATE_TILE_LIST(tile, idwt_list))     { tile->cache_marked = false; /*printf("@@@ idwt_list tile scale=%d x=%d y=%d\n", tile->tile_scale, tile->tile_x, tile->tile_y);*/ }
-    for (ITERATE_TILE_LIST(tile, coeff_list))    { tile->cache_marked = false; /*printf("@@@ coeff_list tile scale=%d x=%d y=%d\n", tile->tile_scale, tile->tile_x, tile->tile_y);*/ }
-    for (ITERATE_TILE_LIST(tile, children_list)) { tile->cache_marked = false; /*printf("@@@ children_list tile scale=%d x=%d y=%d\n", tile->tile_scale, tile->tile_x, tile->tile_y);*/ }
 
-    // IO+decode: For all dependent tiles, read and decode coefficients where missing (hh, and ll for top tiles).
-    // Assuming lists are sorted parents first.
-    // IDWT as needed, top to bottom. This should produce idwt for this tile as well, which should be last in idwt list.
+    // IO+decode: read and decode coefficients where missing (hh, and ll for top tiles).
+    // IDWT as needed, top to bottom. The last one is the IDWT of this tile.
     // YCoCb->RGB for this tile only.
-    uint32_t* result = NULL;
-    for (ITERATE_TILE_LIST(tile, coeff_list)) {
-        isyntax_openslide_load_tile_coefficients(cache, isyntax, tile);
+    // This is all done without holding the lock: reserved tiles are not touched by other threads, and pinned tiles
+    // are not written to.
+    // Statistics are gathered locally, and added to the cache totals once we hold the lock again.
+    i64 decode_start = get_clock();
+    i64 source_counts[3] = {0};
+    source_counts[ISYNTAX_COEFFICIENTS_CACHED] = plan.pinned_count;
+    for (int i = 0; i < plan.load_count; ++i) {
+        ++source_counts[isyntax_openslide_load_tile_coefficients(cache, isyntax, plan.load_tiles[i])];
     }
-    for (ITERATE_TILE_LIST(tile, idwt_list)) {
-        isyntax_openslide_load_tile_coefficients(cache, isyntax, tile);
-    }
-    for (ITERATE_TILE_LIST(tile, idwt_list)) {
-        if (tile == idwt_list.tail) {
-            isyntax_openslide_idwt(cache, isyntax, tile, pixels_buffer, pixel_format);
-        } else {
-            isyntax_openslide_idwt(cache, isyntax, tile, /*pixels_buffer=*/NULL, /*pixel_format=*/0);
-        }
+    for (int i = plan.idwt_count - 1; i >= 1; --i) {
+        isyntax_openslide_idwt(cache, isyntax, plan.idwt_tiles[i], /*pixels_buffer=*/NULL, /*pixel_format=*/0);
     }
+    isyntax_openslide_idwt(cache, isyntax, tile, pixels_buffer, pixel_format);
+    i64 decode_clocks = get_clock() - decode_start;
 
     // Lock.
-    // Bump all the affected tiles in cache.
-    // Unmark all dependent tiles as "referenced" so that they can be evicted.
+    // Give back the reserved tiles, unpin the others, and bump all the affected tiles in cache.
     // Perform cache trim (possibly not every invocation).
     // Unlock.
+    benaphore_lock(&cache->mutex);
 
-    tile_list_insert_list_first(&cache->cache_list, &children_list);
-    tile_list_insert_list_first(&cache->cache_list, &coeff_list);
-    tile_list_insert_list_first(&cache->cache_list, &idwt_list);
+    cache->hit_count += source_counts[ISYNTAX_COEFFICIENTS_CACHED];
+    cache->compressed_hit_count += source_counts[ISYNTAX_COEFFICIENTS_COMPRESSED];
+    cache->miss_count += source_counts[ISYNTAX_COEFFICIENTS_LOADED];
+    cache->decode_clocks += decode_clocks;
+    isyntax_tile_read_release_plan(isyntax, cache, tile, &plan);
+    release_temp_memory(&temp_memory);
 
     // Cache trim. Since we have the result already, it is possible that tiles from this run will be trimmed here
     // if cache is small or work happened on other threads.
-    // TODO(avirodov): later will need to skip tiles that are reserved by other threads.
-    while (cache->cache_list.count > cache->target_cache_size) {
-        isyntax_tile_t* tile = cache->cache_list.tail;
-        tile_list_remove(&cache->cache_list, tile);
-        for (int i = 0; i < 3; ++i) {
-            if (tile->has_ll) {
-                block_free(&cache->ll_coeff_block_allocator, tile->color_channels[i].coeff_ll);
-                tile->color_channels[i].coeff_ll = NULL;
+    // Tiles that are in flight on other threads are not part of the cache list, so they are never trimmed here.
+    // Tiles that are pinned by other threads, or held by a region read, are skipped.
+    // The budget is in bytes, because tiles may hold LL and/or H coefficients (or nothing at all).
+    // If the compressed tier is enabled, evicted tiles are moved there. They are compressed without holding the lock,
+    // so they stay in flight until the compressed copy is ready.
+    i64 byte_budget = isyntax_cache_get_target_size_in_bytes(cache);
+    bool use_compressed_tier = cache->target_compressed_size_in_bytes > 0;
+    isyntax_tile_list_t compress_list;
+    tile_list_init(&compress_list, "compress_list");
+    isyntax_tile_t* next_tile = cache->cache_list.tail;
+    while (next_tile && cache->resident_size_in_bytes > byte_budget) {
+        isyntax_tile_t* tile = next_tile;
+        next_tile = tile->cache_prev;
+        if (tile->cache_pin_count > 0 || tile->cache_hold_count > 0) {
+            continue;
+        }
+        isyntax_cache_list_remove(cache, tile);
+        if (!(tile->has_ll || tile->has_h)) {
+            continue;
+        }
+        ++cache->eviction_count;
+        isyntax_compressed_coeffs_t* entry = tile->cache_compressed;
+        if (entry && (entry->has_ll || !tile->has_ll) && (entry->has_h || !tile->has_h)) {
+            // Already have a compressed copy of everything this tile holds; just bump it.
+            compressed_list_remove(&cache->compressed_list, entry);
+            compressed_list_insert_first(&cache->compressed_list, entry);
+        } else {
+            if (entry) {
+                compressed_list_remove(&cache->compressed_list, entry);
+                tile->cache_compressed = NULL;
+                free(entry);
             }
-            if (tile->has_h) {
-                block_free(&cache->h_coeff_block_allocator, tile->color_channels[i].coeff_h);
-                tile->color_channels[i].coeff_h = NULL;
+            if (use_compressed_tier) {
+                tile->cache_in_flight = true;
+                tile_list_insert_first(&compress_list, tile);
+                continue;
+            }
+        }
+        isyntax_cache_free_tile_coefficients(cache, tile);
+    }
+
+    benaphore_unlock(&cache->mutex);
+
+    if (compress_list.count > 0) {
+        for (ITERATE_TILE_LIST(tile, compress_list)) {
+            tile->cache_compressed = isyntax_cache_compress_tile(cache, tile);
+            isyntax_cache_free_tile_coefficients(cache, tile);
+        }
+        benaphore_lock(&cache->mutex);
+        while (compress_list.head) {
+            isyntax_tile_t* tile = compress_list.head;
+            tile_list_remove(&compress_list, tile);
+            if (tile->cache_compressed) {
+                compressed_list_insert_first(&cache->compressed_list, tile->cache_compressed);
+            }
+            tile->cache_in_flight = false;
+        }
+        isyntax_cache_trim_compressed(cache);
+        isyntax_cache_wake_waiters(cache);
+        benaphore_unlock(&cache->mutex);
+    }
+}
+
+// Removes all tiles of the isyntax from the cache, and frees their coefficients and compressed copies. Called from
+// isyntax_destroy(), when no reads of the isyntax can be in progress anymore.
+static void isyntax_cache_release_isyntax(isyntax_cache_t* cache, isyntax_t* isyntax) {
+    isyntax_image_t* wsi = &isyntax->images[isyntax->wsi_image_index];
+    benaphore_lock(&cache->mutex);
+    for (int scale = 0; scale <= wsi->max_scale; ++scale) {
+        isyntax_level_t* level = &wsi->levels[scale];
+        i64 tile_count = (i64)level->width_in_tiles * level->height_in_tiles;
+        for (i64 i = 0; i < tile_count; ++i) {
+            isyntax_tile_t* tile = level->tiles + i;
+            ASSERT(!tile->cache_in_flight && tile->cache_pin_count == 0 && tile->cache_hold_count == 0);
+            if (tile->cache_compressed) {
+                compressed_list_remove(&cache->compressed_list, tile->cache_compressed);
+                free(tile->cache_compressed);
+                tile->cache_compressed = NULL;
             }
+            isyntax_cache_list_remove(cache, tile);
+            isyntax_cache_free_tile_coefficients(cache, tile);
         }
-        tile->has_ll = false;
-        tile->has_h = false;
     }
+    benaphore_unlock(&cache->mutex);
+}
+
+// Lets isyntax_destroy() know which cache holds on to the tiles. An isyntax can only be read through one cache.
+static void isyntax_cache_attach(isyntax_cache_t* cache, isyntax_t* isyntax) {
+    if (isyntax->cache != cache) {
+        benaphore_lock(&cache->mutex);
+        ASSERT(isyntax->cache == NULL || isyntax->cache == cache);
+        isyntax->release_from_cache = isyntax_cache_release_isyntax;
+        isyntax->cache = cache;
+        benaphore_unlock(&cache->mutex);
+    }
+}
 
+void isyntax_tile_read(isyntax_t* isyntax, isyntax_cache_t* cache, int scale, int tile_x, int tile_y,
+                       uint32_t* pixels_buffer, enum isyntax_pixel_format_t pixel_format) {
+    isyntax_cache_attach(cache, isyntax);
+    isyntax_tile_read_internal(isyntax, cache, scale, tile_x, tile_y, pixels_buffer, pixel_format);
+}
+
+void isyntax_cache_set_target_size_in_bytes(isyntax_cache_t* cache, i64 size_in_bytes) {
+    benaphore_lock(&cache->mutex);
+    cache->target_cache_size_in_bytes = size_in_bytes;
     benaphore_unlock(&cache->mutex);
 }
+
+i64 isyntax_cache_get_target_size_in_bytes(isyntax_cache_t* cache) {
+    if (cache->target_cache_size_in_bytes > 0) {
+        return cache->target_cache_size_in_bytes;
+    }
+    // Legacy budget in tiles: assume that each tile holds both LL and H coefficients for all 3 color channels.
+    i64 bytes_per_tile = 3 * ((i64)cache->ll_coeff_block_allocator.block_size + cache->h_coeff_block_allocator.block_size);
+    return (i64)cache->target_cache_size * bytes_per_tile;
+}
+
+i64 isyntax_cache_get_resident_size_in_bytes(isyntax_cache_t* cache) {
+    // Note: updated while holding the lock; reading it without locking may be slightly out of date, which is fine
+    // for statistics.
+    return cache->resident_size_in_bytes;
+}
+
+void isyntax_cache_set_compressed_target_size_in_bytes(isyntax_cache_t* cache, i64 size_in_bytes) {
+    benaphore_lock(&cache->mutex);
+    cache->target_compressed_size_in_bytes = size_in_bytes;
+    isyntax_cache_trim_compressed(cache);
+    benaphore_unlock(&cache->mutex);
+}
+
+void isyntax_cache_clear_compressed(isyntax_cache_t* cache) {
+    benaphore_lock(&cache->mutex);
+    while (cache->compressed_list.head) {
+        isyntax_compressed_coeffs_t* entry = cache->compressed_list.head;
+        compressed_list_remove(&cache->compressed_list, entry);
+        entry->tile->cache_compressed = NULL;
+        free(entry);
+    }
+    benaphore_unlock(&cache->mutex);
+}
+
+void isyntax_cache_shutdown(isyntax_cache_t* cache) {
+    isyntax_cache_clear_compressed(cache);
+    if (cache->wait_semaphore) {
+        ASSERT(cache->wait_count == 0);
+#ifdef _WIN32
+        CloseHandle(cache->wait_semaphore);
+#else
+        sem_close(cache->wait_semaphore);
+#endif
+        cache->wait_semaphore = NULL;
+    }
+}
+
+void isyntax_cache_get_stats(isyntax_cache_t* cache, isyntax_cache_stats_t* out_stats) {
+    benaphore_lock(&cache->mutex);
+    out_stats->hit_count = cache->hit_count;
+    out_stats->miss_count = cache->miss_count;
+    out_stats->eviction_count = cache->eviction_count;
+    out_stats->bytes_resident = isyntax_cache_get_resident_size_in_bytes(cache);
+    out_stats->byte_budget = isyntax_cache_get_target_size_in_bytes(cache);
+    out_stats->tiles_resident = cache->cache_list.count;
+    out_stats->decode_seconds = get_seconds_elapsed(0, cache->decode_clocks);
+    out_stats->compressed_hit_count = cache->compressed_hit_count;
+    out_stats->compressed_eviction_count = cache->compressed_eviction_count;
+    out_stats->compressed_bytes_resident = cache->compressed_list.size_in_bytes;
+    out_stats->compressed_byte_budget = cache->target_compressed_size_in_bytes;
+    out_stats->compressed_tiles_resident = cache->compressed_list.count;
+    benaphore_unlock(&cache->mutex);
+}
+
+typedef struct isyntax_read_region_job_t {
+    isyntax_t* isyntax;
+    isyntax_cache_t* cache;
+    int scale;
+    i64 x;
+    i64 y;
+    i64 width;
+    i64 height;
+    uint32_t* pixels_buffer;
+    enum isyntax_pixel_format_t pixel_format;
+} isyntax_read_region_job_t;
+
+typedef struct isyntax_read_region_task_t {
+    isyntax_read_region_job_t* job;
+    int scale;
+    int tile_x;
+    int tile_y;
+} isyntax_read_region_task_t;
+
+static void isyntax_read_region_do_task(isyntax_read_region_task_t* task) {
+    isyntax_read_region_job_t* job = task->job;
+    isyntax_t* isyntax = job->isyntax;
+
+    if (task->scale != job->scale) {
+        // Parent tile: only decode it so that the ll coefficients of its children are ready in the cache.
+        isyntax_tile_read_internal(isyntax, job->cache, task->scale, task->tile_x, task->tile_y,
+                                   /*pixels_buffer=*/NULL, /*pixel_format=*/0);
+        return;
+    }
+
+    // Determine the part of the tile that overlaps with the region.
+    i64 tile_width = isyntax->tile_width;
+    i64 tile_height = isyntax->tile_height;
+    i64 tile_x0 = task->tile_x * tile_width;
+    i64 tile_y0 = task->tile_y * tile_height;
+    i64 copy_x0 = MAX(tile_x0, job->x);
+    i64 copy_y0 = MAX(tile_y0, job->y);
+    i64 copy_x1 = MIN(tile_x0 + tile_width, job->x + job->width);
+    i64 copy_y1 = MIN(tile_y0 + tile_height, job->y + job->height);
+    if (copy_x1 <= copy_x0 || copy_y1 <= copy_y0) {
+        return;
+    }
+
+    uint32_t* tile_pixels = pixel_buffer_alloc(tile_width * tile_height * sizeof(uint32_t));
+    isyntax_tile_read_internal(isyntax, job->cache, task->scale, task->tile_x, task->tile_y,
+                               tile_pixels, job->pixel_format);
+
+    // Copy the overlapping rows directly into the destination, at the stride of the region.
+    size_t copy_size = (copy_x1 - copy_x0) * sizeof(uint32_t);
+    uint32_t* src = tile_pixels + (copy_y0 - tile_y0) * tile_width + (copy_x0 - tile_x0);
+    uint32_t* dest = job->pixels_buffer + (copy_y0 - job->y) * job->width + (copy_x0 - job->x);
+    for (i64 y = copy_y0; y < copy_y1; ++y) {
+        memcpy(dest, src, copy_size);
+        src += tile_width;
+        dest += job->width;
+    }
+    pixel_buffer_free(tile_pixels);
+}
+
+static void isyntax_read_region_task_func(int logical_thread_index, void* userdata) {
+    isyntax_read_region_do_task((isyntax_read_region_task_t*) userdata);
+}
+
+// Decode all tiles in the range (in parallel if a work queue is available), and wait for all of them to finish.
+static void isyntax_read_region_run_tiles(isyntax_read_region_job_t* job, int scale,
+                                          int tile_x0, int tile_y0, int tile_x1, int tile_y1) {
+    work_queue_t* queue = job->isyntax->work_submission_queue;
+    work_queue_task_group_t task_group;
+    if (queue) {
+        work_queue_task_group_init(&task_group, queue);
+        WORK_QUEUE_NAME_TASK(isyntax_read_region_task_func);
+    }
+    for (int tile_y = tile_y0; tile_y < tile_y1; ++tile_y) {
+        for (int tile_x = tile_x0; tile_x < tile_x1; ++tile_x) {
+            isyntax_read_region_task_t task = {.job = job, .scale = scale, .tile_x = tile_x, .tile_y = tile_y};
+            if (queue) {
+                work_queue_task_group_submit(&task_group, isyntax_read_region_task_func, &task, sizeof(task));
+            } else {
+                isyntax_read_region_do_task(&task);
+            }
+        }
+    }
+    if (queue) {
+        // Helps out with the tasks while waiting (as the calling thread, if it is one of the queue's workers).
+        work_queue_task_group_wait(&task_group);
+    }
+}
+
+// Keeps the tiles in the range from being evicted (hold = true), or lets them go again (hold = false).
+// Unlike pinned tiles, held tiles can still be written to.
+static void isyntax_cache_hold_tiles(isyntax_t* isyntax, isyntax_cache_t* cache, int scale,
+                                     int tile_x0, int tile_y0, int tile_x1, int tile_y1, bool hold) {
+    isyntax_level_t* level = &isyntax->images[isyntax->wsi_image_index].levels[scale];
+    tile_x1 = MIN(tile_x1, level->width_in_tiles);
+    tile_y1 = MIN(tile_y1, level->height_in_tiles);
+    benaphore_lock(&cache->mutex);
+    for (int tile_y = tile_y0; tile_y < tile_y1; ++tile_y) {
+        for (int tile_x = tile_x0; tile_x < tile_x1; ++tile_x) {
+            isyntax_tile_t* tile = &level->tiles[level->width_in_tiles * tile_y + tile_x];
+            tile->cache_hold_count += hold ? 1 : -1;
+            ASSERT(tile->cache_hold_count >= 0);
+        }
+    }
+    benaphore_unlock(&cache->mutex);
+}
+
+void isyntax_read_region(isyntax_t* isyntax, isyntax_cache_t* cache, int scale, i64 x, i64 y, i64 width, i64 height,
+                         uint32_t* pixels_buffer, enum isyntax_pixel_format_t pixel_format) {
+    isyntax_cache_attach(cache, isyntax);
+    isyntax_image_t* wsi = &isyntax->images[isyntax->wsi_image_index];
+    isyntax_level_t* level = &wsi->levels[scale];
+    i64 tile_width = isyntax->tile_width;
+    i64 tile_height = isyntax->tile_height;
+
+    // Tiles covering the region, clipped to the level bounds.
+    i64 tile_x0 = MAX(0, x / tile_width);
+    i64 tile_y0 = MAX(0, y / tile_height);
+    i64 tile_x1 = MIN(level->width_in_tiles, (x + width - 1) / tile_width + 1);
+    i64 tile_y1 = MIN(level->height_in_tiles, (y + height - 1) / tile_height + 1);
+    if (x < 0 || y < 0 || x + width > level->width_in_tiles * tile_width ||
+        y + height > level->height_in_tiles * tile_height) {
+        // Part of the region lies outside of the image, fill that with white (same as nonexistent tiles).
+        memset(pixels_buffer, 0xff, width * height * sizeof(uint32_t));
+    }
+    if (tile_x1 <= tile_x0 || tile_y1 <= tile_y0) {
+        return;
+    }
+
+    isyntax_read_region_job_t job = {
+            .isyntax = isyntax, .cache = cache, .scale = scale,
+            .x = x, .y = y, .width = width, .height = height,
+            .pixels_buffer = pixels_buffer, .pixel_format = pixel_format,
+    };
+
+    // Neighboring tiles in the region share their parents. If we would decode all tiles in parallel straight away,
+    // the threads would mostly be waiting on each other to write the ll coefficients of the same tiles. So first
+    // decode the parents once (this leaves the ll coefficients of all the tiles in the region in the cache), then do
+    // the tiles themselves. The tiles written by the first pass are held in the cache until we are done, so that a
+    // small cache (or other threads) can't evict them before the second pass gets to them.
+    if (scale < wsi->max_scale && (tile_x1 - tile_x0) * (tile_y1 - tile_y0) > 1) {
+        int parent_x0 = (int)(tile_x0 / 2);
+        int parent_y0 = (int)(tile_y0 / 2);
+        int parent_x1 = (int)((tile_x1 - 1) / 2 + 1);
+        int parent_y1 = (int)((tile_y1 - 1) / 2 + 1);
+        isyntax_cache_hold_tiles(isyntax, cache, scale, parent_x0 * 2, parent_y0 * 2, parent_x1 * 2, parent_y1 * 2, true);
+        isyntax_read_region_run_tiles(&job, scale + 1, parent_x0, parent_y0, parent_x1, parent_y1);
+        isyntax_read_region_run_tiles(&job, scale, (int)tile_x0, (int)tile_y0, (int)tile_x1, (int)tile_y1);
+        isyntax_cache_hold_tiles(isyntax, cache, scale, parent_x0 * 2, parent_y0 * 2, parent_x1 * 2, parent_y1 * 2, false);
+    } else {
+        isyntax_read_region_run_tiles(&job, scale, (int)tile_x0, (int)tile_y0, (int)tile_x1, (int)tile_y1);
+    }
+}
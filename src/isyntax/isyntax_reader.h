@@ -11,11 +11,53 @@ typedef struct isyntax_tile_list_t {
     const char* dbg_name;
 } isyntax_tile_list_t;
 
+// Second cache tier: the coefficients of an evicted tile, compressed with LZ4.
+// The compressed data for each buffer (LL for the 3 colors, then H for the 3 colors) follows the struct in memory.
+typedef struct isyntax_compressed_coeffs_t {
+    isyntax_tile_t* tile;
+    struct isyntax_compressed_coeffs_t* next;
+    struct isyntax_compressed_coeffs_t* prev;
+    bool has_ll;
+    bool has_h;
+    i32 compressed_sizes[6];
+    i64 total_size; // including this header
+} isyntax_compressed_coeffs_t;
+
+typedef struct isyntax_compressed_coeffs_list_t {
+    isyntax_compressed_coeffs_t* head;
+    isyntax_compressed_coeffs_t* tail;
+    i64 count;
+    i64 size_in_bytes;
+} isyntax_compressed_coeffs_list_t;
+
 typedef struct isyntax_cache_t {
     isyntax_tile_list_t cache_list;
     benaphore_t mutex;
     // TODO(avirodov): int refcount;
-    int target_cache_size;
+    int target_cache_size; // in tiles; only used to derive the byte budget if target_cache_size_in_bytes == 0
+    i64 target_cache_size_in_bytes;
+    // Size of the coefficients held by the tiles in cache_list (protected by mutex). Tiles that are in flight are not
+    // counted, and neither are blocks held by the allocators' thread caches.
+    i64 resident_size_in_bytes;
+    // Statistics (protected by mutex).
+    i64 hit_count;
+    i64 miss_count;
+    i64 eviction_count;
+    i64 decode_clocks;
+    // Second tier, for tiles evicted from cache_list (disabled if target_compressed_size_in_bytes == 0).
+    // Entries in compressed_list are protected by mutex. Entries of tiles that are in flight are detached from the
+    // list and owned by the reading thread.
+    isyntax_compressed_coeffs_list_t compressed_list;
+    i64 target_compressed_size_in_bytes;
+    i64 compressed_hit_count;
+    i64 compressed_eviction_count;
+    // Threads waiting for tiles that are in use by other threads (protected by mutex). Created on first use.
+#ifdef _WIN32
+    HANDLE wait_semaphore;
+#else
+    sem_t* wait_semaphore;
+#endif
+    i32 wait_count;
     block_allocator_t ll_coeff_block_allocator;
     block_allocator_t h_coeff_block_allocator;
     int allocator_block_width;
@@ -26,5 +68,20 @@ typedef struct isyntax_cache_t {
 void isyntax_tile_read(isyntax_t* isyntax, isyntax_cache_t* cache, int scale, int tile_x, int tile_y,
                        uint32_t* pixels_buffer, enum isyntax_pixel_format_t pixel_format);
 
+// Reads an arbitrary region (in pixel coordinates of the level) into pixels_buffer, which should be [width * height].
+// If isyntax->work_submission_queue is set, the tiles are decoded in parallel on the work queue.
+void isyntax_read_region(isyntax_t* isyntax, isyntax_cache_t* cache, int scale, i64 x, i64 y, i64 width, i64 height,
+                         uint32_t* pixels_buffer, enum isyntax_pixel_format_t pixel_format);
+
+void isyntax_cache_set_target_size_in_bytes(isyntax_cache_t* cache, i64 size_in_bytes);
+i64 isyntax_cache_get_target_size_in_bytes(isyntax_cache_t* cache);
+i64 isyntax_cache_get_resident_size_in_bytes(isyntax_cache_t* cache);
+void isyntax_cache_set_compressed_target_size_in_bytes(isyntax_cache_t* cache, i64 size_in_bytes);
+void isyntax_cache_clear_compressed(isyntax_cache_t* cache);
+// Frees everything the reader allocated for the cache (compressed coefficients, the semaphore for waiting threads);
+// call this before destroying the cache.
+void isyntax_cache_shutdown(isyntax_cache_t* cache);
+void isyntax_cache_get_stats(isyntax_cache_t* cache, isyntax_cache_stats_t* out_stats);
+
 void tile_list_init(isyntax_tile_list_t* list, const char* dbg_name);
 void tile_list_remove(isyntax_tile_list_t* list, isyntax_tile_t* tile);
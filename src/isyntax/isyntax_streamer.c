@@ -28,6 +28,7 @@
 #include "common.h"
 #include "isyntax.h"
 #include "intrinsics.h"
+#include "pixel_buffer_pool.h"
 
 #define ISYNTAX_STREAMER_IMPL
 #include "isyntax_streamer.h"
@@ -51,6 +52,14 @@ static void submit_tile_completed(isyntax_streamer_t* streamer, void* tile_pixel
 
 }
 
+static u32* alloc_tile_pixels(isyntax_streamer_t* streamer) {
+	size_t size = streamer->isyntax->tile_width * streamer->isyntax->tile_height * sizeof(u32);
+	if (streamer->alloc_tile_pixels) {
+		return (u32*)streamer->alloc_tile_pixels(size);
+	}
+	return (u32*)pixel_buffer_alloc(size);
+}
+
 static i32 isyntax_load_all_tiles_in_level(isyntax_streamer_t* streamer, i32 scale) {
 	i32 tiles_loaded = 0;
 	i32 tile_index = 0;
@@ -65,7 +74,7 @@ static i32 isyntax_load_all_tiles_in_level(isyntax_streamer_t* streamer, i32 sca
 			if (global_worker_thread_idle_count > 0 && tasks_waiting < global_system_info.logical_cpu_count * 10) {
 				isyntax_begin_load_tile(streamer, scale, tile_x, tile_y);
 			} else if (!is_tile_streamer_frame_boundary_passed) {
-                u32* tile_pixels = (u32*)malloc(isyntax->tile_width * isyntax->tile_height * sizeof(u32));
+                u32* tile_pixels = alloc_tile_pixels(streamer);
 				isyntax_load_tile(isyntax, wsi, scale, tile_x, tile_y, isyntax->ll_coeff_block_allocator, tile_pixels, streamer->pixel_format);
 				if (tile_pixels) {
 					submit_tile_completed(streamer, tile_pixels, scale, tile_index, isyntax->tile_width, isyntax->tile_height);
@@ -102,6 +111,123 @@ static i32 isyntax_load_all_tiles_in_level(isyntax_streamer_t* streamer, i32 sca
 
 
 
+// The first load is split into a graph of tasks on the work queue:
+// 1. For each top level data chunk: read the chunk from disk.
+// 2. When a chunk has been read: decompress the codeblocks for each of the tiles in the chunk (one task per tile).
+// 3. When all codeblocks have been decompressed: per level, top to bottom, do the inverse wavelet transforms
+//    (each level depends on the LL coefficients 'donated' by the level above).
+typedef struct isyntax_first_load_t {
+	isyntax_t* isyntax;
+	isyntax_image_t* wsi;
+	u8** data_chunks; // indexed by top level tile index
+	u64* data_chunk_sizes;
+	i32 codeblocks_per_color;
+	i32 levels_in_chunk;
+	volatile i32 tasks_remaining;
+} isyntax_first_load_t;
+
+typedef struct isyntax_first_load_task_t {
+	isyntax_first_load_t* first_load;
+	i32 scale;
+	i32 tile_x;
+	i32 tile_y;
+	i32 chunk_index;
+} isyntax_first_load_task_t;
+
+static void isyntax_first_load_submit(isyntax_first_load_t* first_load, work_queue_callback_t* callback, isyntax_first_load_task_t* task) {
+	work_queue_t* queue = first_load->isyntax->work_submission_queue;
+	atomic_increment(&first_load->tasks_remaining);
+	i32 tasks_waiting = work_queue_get_entry_count(queue);
+	// The first load is what the user is waiting for, so let it jump ahead of other work.
+	if (!(tasks_waiting < global_system_info.logical_cpu_count * 10 &&
+	      work_queue_submit_with_priority(queue, callback, WORK_QUEUE_PRIORITY_HIGH, NULL, NULL, task, sizeof(*task)))) {
+		callback(0, task); // queue is busy: do it ourselves
+	}
+}
+
+static void isyntax_first_load_decompress_tile_task_func(i32 logical_thread_index, void* userdata) {
+	isyntax_first_load_task_t* task = (isyntax_first_load_task_t*) userdata;
+	isyntax_first_load_t* first_load = task->first_load;
+	isyntax_t* isyntax = first_load->isyntax;
+	isyntax_image_t* wsi = first_load->wsi;
+	isyntax_level_t* level = wsi->levels + task->scale;
+	isyntax_tile_t* tile = level->tiles + task->tile_y * level->width_in_tiles + task->tile_x;
+
+	isyntax_codeblock_t* top_chunk_codeblock = wsi->codeblocks + tile->codeblock_chunk_index;
+	u64 offset0 = top_chunk_codeblock->block_data_offset;
+	u8* chunk_data = first_load->data_chunks[task->chunk_index];
+
+	i32 scale_in_chunk = wsi->max_scale - task->scale;
+	i32 codeblock_index_in_chunk = 0;
+	if (scale_in_chunk == 0) {
+		codeblock_index_in_chunk = 0;
+	} else if (scale_in_chunk == 1) {
+		codeblock_index_in_chunk = 1 + (task->tile_y % 2) * 2 + (task->tile_x % 2);
+	} else if (scale_in_chunk == 2) {
+		codeblock_index_in_chunk = 5 + (task->tile_y % 4) * 4 + (task->tile_x % 4);
+	} else {
+		fatal_error();
+	}
+
+	for (i32 color = 0; color < 3; ++color) {
+		isyntax_codeblock_t* h_block = top_chunk_codeblock + color * first_load->codeblocks_per_color + codeblock_index_in_chunk;
+		ASSERT(h_block->scale == task->scale);
+		isyntax_tile_channel_t* color_channel = tile->color_channels + color;
+		ASSERT(color_channel->coeff_h == NULL);
+		color_channel->coeff_h = (icoeff_t*)block_alloc(isyntax->h_coeff_block_allocator);
+		isyntax_decompress_codeblock_in_chunk(h_block, isyntax->block_width, isyntax->block_height, chunk_data, offset0, wsi->compressor_version, color_channel->coeff_h);
+		if (scale_in_chunk == 0) {
+			// The top level tiles also have LL coefficients (stored as the last codeblock for each color in the chunk).
+			isyntax_codeblock_t* ll_block = top_chunk_codeblock + color * first_load->codeblocks_per_color + (first_load->codeblocks_per_color - 1);
+			ASSERT(color_channel->coeff_ll == NULL);
+			color_channel->coeff_ll = (icoeff_t*)block_alloc(isyntax->ll_coeff_block_allocator);
+			isyntax_decompress_codeblock_in_chunk(ll_block, isyntax->block_width, isyntax->block_height, chunk_data, offset0, wsi->compressor_version, color_channel->coeff_ll);
+		}
+
+		// We're loading everything at once for this level, so we can set every tile as having their neighors loaded as well.
+		color_channel->neighbors_loaded = isyntax_get_adjacent_tiles_mask(level, task->tile_x, task->tile_y);
+	}
+
+	write_barrier;
+	atomic_decrement(&first_load->tasks_remaining);
+}
+
+static void isyntax_first_load_read_chunk_task_func(i32 logical_thread_index, void* userdata) {
+	isyntax_first_load_task_t* task = (isyntax_first_load_task_t*) userdata;
+	isyntax_first_load_t* first_load = task->first_load;
+	isyntax_t* isyntax = first_load->isyntax;
+	isyntax_image_t* wsi = first_load->wsi;
+	isyntax_level_t* top_level = wsi->levels + wsi->max_scale;
+	isyntax_tile_t* tile = top_level->tiles + task->chunk_index;
+
+	u64 offset0 = wsi->codeblocks[tile->codeblock_chunk_index].block_data_offset;
+	u64 read_size = first_load->data_chunk_sizes[task->chunk_index];
+	size_t bytes_read = file_handle_read_at_offset(first_load->data_chunks[task->chunk_index], isyntax->file_handle, offset0, read_size);
+	if (!(bytes_read > 0)) {
+		console_print_error("Error: could not read iSyntax data at offset %lld (read size %lld)\n", offset0, read_size);
+	}
+
+	// The chunk is available now, so the codeblocks of all tiles in the chunk can be decompressed.
+	for (i32 i = 0; i < first_load->levels_in_chunk; ++i) {
+		i32 tiles_per_side = 1 << i;
+		for (i32 dy = 0; dy < tiles_per_side; ++dy) {
+			for (i32 dx = 0; dx < tiles_per_side; ++dx) {
+				isyntax_first_load_task_t decompress_task = {
+					.first_load = first_load,
+					.scale = wsi->max_scale - i,
+					.tile_x = task->tile_x * tiles_per_side + dx,
+					.tile_y = task->tile_y * tiles_per_side + dy,
+					.chunk_index = task->chunk_index,
+				};
+				isyntax_first_load_submit(first_load, isyntax_first_load_decompress_tile_task_func, &decompress_task);
+			}
+		}
+	}
+
+	write_barrier;
+	atomic_decrement(&first_load->tasks_remaining);
+}
+
 static void isyntax_do_first_load(isyntax_streamer_t* streamer) {
 
 	isyntax_t* isyntax = streamer->isyntax;
@@ -116,16 +242,23 @@ static void isyntax_do_first_load(isyntax_streamer_t* streamer) {
 	isyntax_level_t* current_level = wsi->levels + scale;
 	i32 codeblocks_per_color = isyntax_get_chunk_codeblocks_per_color_for_level(scale, true); // most often 1 + 4 + 16 (for scale n, n-1, n-2) + 1 (LL block)
 	i32 chunk_codeblock_count = codeblocks_per_color * 3;
-	i32 block_color_offsets[3] = {0, codeblocks_per_color, 2 * codeblocks_per_color};
 
 	i32 levels_in_chunk = (scale % 3) + 1;
 
 	temp_memory_t temp_memory = begin_temp_memory_on_local_thread();
 
-	u8** data_chunks = arena_push_array(temp_memory.arena, current_level->tile_count, u8*);
-	memset(data_chunks, 0, current_level->tile_count * sizeof(u8*));
-
-	// Read codeblock data from disk
+	isyntax_first_load_t first_load = {
+		.isyntax = isyntax,
+		.wsi = wsi,
+		.codeblocks_per_color = codeblocks_per_color,
+		.levels_in_chunk = levels_in_chunk,
+	};
+	first_load.data_chunks = arena_push_array(temp_memory.arena, current_level->tile_count, u8*);
+	memset(first_load.data_chunks, 0, current_level->tile_count * sizeof(u8*));
+	first_load.data_chunk_sizes = arena_push_array(temp_memory.arena, current_level->tile_count, u64);
+	memset(first_load.data_chunk_sizes, 0, current_level->tile_count * sizeof(u64));
+
+	// Read codeblock data from disk and decompress the codeblocks for all levels in the top level data chunks
 	{
 		i64 start = get_clock();
 
@@ -136,163 +269,37 @@ static void isyntax_do_first_load(isyntax_streamer_t* streamer) {
 				if (!tile->exists) continue;
 				isyntax_codeblock_t* top_chunk_codeblock = wsi->codeblocks + tile->codeblock_chunk_index;
 				u64 offset0 = top_chunk_codeblock->block_data_offset;
-//				console_print("loading chunk %d\n", tile->codeblock_chunk_index);
 
 				isyntax_codeblock_t* last_codeblock = wsi->codeblocks + tile->codeblock_chunk_index + chunk_codeblock_count - 1;
 				u64 offset1 = last_codeblock->block_data_offset + last_codeblock->block_size;
 				u64 read_size = offset1 - offset0;
+				// Allocate up front on this thread; the chunk will be read by another thread.
 				arena_align(temp_memory.arena, 64);
-				data_chunks[tile_index] = (u8*) arena_push_size(temp_memory.arena, read_size);
-
-				size_t bytes_read = file_handle_read_at_offset(data_chunks[tile_index], isyntax->file_handle, offset0, read_size);
-				if (!(bytes_read > 0)) {
-					console_print_error("Error: could not read iSyntax data at offset %lld (read size %lld)\n", offset0, read_size);
-				}
+				first_load.data_chunks[tile_index] = (u8*) arena_push_size(temp_memory.arena, read_size);
+				first_load.data_chunk_sizes[tile_index] = read_size;
+
+				isyntax_first_load_task_t task = {
+					.first_load = &first_load,
+					.scale = scale,
+					.tile_x = tile_x,
+					.tile_y = tile_y,
+					.chunk_index = tile_index,
+				};
+				isyntax_first_load_submit(&first_load, isyntax_first_load_read_chunk_task_func, &task);
 			}
 		}
-		float elapsed = get_seconds_elapsed(start, get_clock());
-		console_print_verbose("I/O + decompress: scale=%d  time=%g\n", scale, elapsed);
-	}
 
-	// Decompress the top level tiles
-	i32 tile_index = 0;
-	for (i32 tile_y = 0; tile_y < current_level->height_in_tiles; ++tile_y) {
-		for (i32 tile_x = 0; tile_x < current_level->width_in_tiles; ++tile_x, ++tile_index) {
-			isyntax_tile_t* tile = current_level->tiles + tile_index;
-			if (!tile->exists) continue;
-			isyntax_codeblock_t* top_chunk_codeblock = wsi->codeblocks + tile->codeblock_chunk_index;
-			u64 offset0 = top_chunk_codeblock->block_data_offset;
-
-			isyntax_codeblock_t* h_blocks[3];
-			isyntax_codeblock_t* ll_blocks[3];
-			i32 ll_block_offset = (codeblocks_per_color - 1);
-			for (i32 i = 0; i < 3; ++i) {
-				h_blocks[i] = top_chunk_codeblock + block_color_offsets[i];
-				ll_blocks[i] = top_chunk_codeblock + block_color_offsets[i] + ll_block_offset;
-			}
-			for (i32 i = 0; i < 3; ++i) {
-				isyntax_codeblock_t* h_block =  h_blocks[i];
-				isyntax_codeblock_t* ll_block = ll_blocks[i];
-				isyntax_tile_channel_t* color_channel = tile->color_channels + i;
-				ASSERT(color_channel->coeff_h == NULL);
-				ASSERT(color_channel->coeff_ll == NULL);
-				color_channel->coeff_h = (icoeff_t*)block_alloc(isyntax->h_coeff_block_allocator);
-				isyntax_decompress_codeblock_in_chunk(h_block, isyntax->block_width, isyntax->block_height, data_chunks[tile_index], offset0, wsi->compressor_version, color_channel->coeff_h);
-				color_channel->coeff_ll = (icoeff_t*)block_alloc(isyntax->ll_coeff_block_allocator);
-				isyntax_decompress_codeblock_in_chunk(ll_block, isyntax->block_width, isyntax->block_height, data_chunks[tile_index], offset0, wsi->compressor_version, color_channel->coeff_ll);
-
-				// We're loading everything at once for this level, so we can set every tile as having their neighors loaded as well.
-				color_channel->neighbors_loaded = isyntax_get_adjacent_tiles_mask(current_level, tile_x, tile_y);
-			}
-		}
-	}
+		// Wait for all reads and decompression tasks to complete (and help out in the meantime)
+		work_queue_wait_until_zero(isyntax->work_submission_queue, &first_load.tasks_remaining);
 
-	// Transform and submit the top level tiles
-	tiles_loaded += isyntax_load_all_tiles_in_level(streamer, scale);
-
-	// Decompress and transform the remaining levels in the data chunks.
-	if (levels_in_chunk >= 2) {
-		scale = wsi->max_scale - 1;
-		current_level = wsi->levels + scale;
-		// First do the Hulsken decompression on all tiles for this level
-		i32 chunk_index = 0;
-		for (i32 tile_y = 0; tile_y < current_level->height_in_tiles; tile_y += 2) {
-			for (i32 tile_x = 0; tile_x < current_level->width_in_tiles; tile_x += 2, ++chunk_index) {
-				tile_index = tile_y * current_level->width_in_tiles + tile_x;
-				isyntax_tile_t* tile = current_level->tiles + tile_index;
-				if (!tile->exists) continue;
-				// LL blocks should already be available (these were 'donated' when we were loading the higher level)
-				ASSERT(tile->color_channels[0].coeff_ll != NULL);
-				ASSERT(tile->color_channels[1].coeff_ll != NULL);
-				ASSERT(tile->color_channels[2].coeff_ll != NULL);
-				isyntax_codeblock_t* top_chunk_codeblock = wsi->codeblocks + tile->codeblock_chunk_index;
-				u64 offset0 = top_chunk_codeblock->block_data_offset;
-
-				i32 chunk_codeblock_indices_for_color[4] = {1, 2, 3, 4};
-				i32 tile_delta_x[4] = {0, 1, 0, 1};
-				i32 tile_delta_y[4] = {0, 0, 1, 1};
-				for (i32 color = 0; color < 3; ++color) {
-					// Decompress the codeblocks in this chunk for this level and this color channel
-					for (i32 i = 0; i < 4; ++i) {
-						isyntax_codeblock_t* codeblock = top_chunk_codeblock + chunk_codeblock_indices_for_color[i];
-						ASSERT(codeblock->scale == scale);
-						i64 offset_in_chunk = codeblock->block_data_offset - offset0;
-						ASSERT(offset_in_chunk >= 0);
-						i32 tile_x_in_chunk = tile_x + tile_delta_x[i];
-						i32 tile_y_in_chunk = tile_y + tile_delta_y[i];
-						tile_index = (tile_y_in_chunk * current_level->width_in_tiles) + tile_x_in_chunk;
-						isyntax_tile_t* tile_in_chunk = current_level->tiles + tile_index;
-						isyntax_tile_channel_t* color_channel = tile_in_chunk->color_channels + color;
-						color_channel->coeff_h = (icoeff_t*)block_alloc(isyntax->h_coeff_block_allocator);
-						isyntax_hulsken_decompress(data_chunks[chunk_index] + offset_in_chunk, codeblock->block_size,
-												   isyntax->block_width, isyntax->block_height,
-												   codeblock->coefficient, wsi->compressor_version, color_channel->coeff_h);
-
-						// We're loading everything at once for this level, so we can set every tile as having their neighors loaded as well.
-						color_channel->neighbors_loaded = isyntax_get_adjacent_tiles_mask(current_level, tile_x_in_chunk, tile_y_in_chunk);
-					}
-
-					// Move to the next color channel in the chunk of codeblocks
-					for (i32 i = 0; i < 4; ++i) {
-						chunk_codeblock_indices_for_color[i] += codeblocks_per_color;
-					}
-				}
-			}
-		}
-		// Now do the inverse wavelet transforms
-		tiles_loaded += isyntax_load_all_tiles_in_level(streamer, scale);
+		float elapsed = get_seconds_elapsed(start, get_clock());
+		console_print_verbose("I/O + decompress: scale=%d  time=%g\n", scale, elapsed);
 	}
 
-	// Now for the next level down (if present in the chunk)
-	if (levels_in_chunk >= 3) {
-		scale = wsi->max_scale - 2;
+	// Transform and submit the tiles, level by level (each level needs the LL coefficients from the level above).
+	for (i32 i = 0; i < levels_in_chunk; ++i) {
+		scale = wsi->max_scale - i;
 		ASSERT(scale >= 0);
-		current_level = wsi->levels + scale;
-		// First do the Hulsken decompression on all tiles for this level
-		i32 chunk_index = 0;
-		for (i32 tile_y = 0; tile_y < current_level->height_in_tiles; tile_y += 4) {
-			for (i32 tile_x = 0; tile_x < current_level->width_in_tiles; tile_x += 4, ++chunk_index) {
-				tile_index = tile_y * current_level->width_in_tiles + tile_x;
-				isyntax_tile_t* tile = current_level->tiles + tile_index;
-				if (!tile->exists) continue;
-				// LL blocks should already be available (these were 'donated' when we were loading the higher level)
-				ASSERT(tile->color_channels[0].coeff_ll != NULL);
-				ASSERT(tile->color_channels[1].coeff_ll != NULL);
-				ASSERT(tile->color_channels[2].coeff_ll != NULL);
-				isyntax_codeblock_t* top_chunk_codeblock = wsi->codeblocks + tile->codeblock_chunk_index;
-				u64 offset0 = top_chunk_codeblock->block_data_offset;
-
-				i32 chunk_codeblock_indices_for_color[16] = {5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20};
-				i32 tile_delta_x[16] = {0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
-				i32 tile_delta_y[16] = {0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3};
-				for (i32 color = 0; color < 3; ++color) {
-					// Decompress the codeblocks in this chunk for this level and this color channel
-					for (i32 i = 0; i < 16; ++i) {
-						isyntax_codeblock_t* codeblock = top_chunk_codeblock + chunk_codeblock_indices_for_color[i];
-						ASSERT(codeblock->scale == scale);
-						i64 offset_in_chunk = codeblock->block_data_offset - offset0;
-						ASSERT(offset_in_chunk >= 0);
-						i32 tile_x_in_chunk = tile_x + tile_delta_x[i];
-						i32 tile_y_in_chunk = tile_y + tile_delta_y[i];
-						tile_index = (tile_y_in_chunk * current_level->width_in_tiles) + tile_x_in_chunk;
-						isyntax_tile_t* tile_in_chunk = current_level->tiles + tile_index;
-						isyntax_tile_channel_t* color_channel = tile_in_chunk->color_channels + color;
-						color_channel->coeff_h = (icoeff_t*) block_alloc(isyntax->h_coeff_block_allocator);
-						isyntax_hulsken_decompress(data_chunks[chunk_index] + offset_in_chunk, codeblock->block_size, isyntax->block_width,
-						                                                    isyntax->block_height, codeblock->coefficient, wsi->compressor_version, color_channel->coeff_h); // TODO: free using _aligned_free()
-
-						// We're loading everything at once for this level, so we can set every tile as having their neighors loaded as well.
-						color_channel->neighbors_loaded = isyntax_get_adjacent_tiles_mask(current_level, tile_x_in_chunk, tile_y_in_chunk);
-					}
-
-					// Move to the next color channel in the chunk of codeblocks
-					for (i32 i = 0; i < 16; ++i) {
-						chunk_codeblock_indices_for_color[i] += codeblocks_per_color;
-					}
-				}
-			}
-		}
-		// Now do the inverse wavelet transforms
 		tiles_loaded += isyntax_load_all_tiles_in_level(streamer, scale);
 	}
 
@@ -334,7 +341,7 @@ typedef struct isyntax_load_tile_task_t {
 void isyntax_load_tile_task_func(i32 logical_thread_index, void* userdata) {
 	isyntax_load_tile_task_t* task = (isyntax_load_tile_task_t*) userdata;
     isyntax_t* isyntax = task->streamer.isyntax;
-	u32* tile_pixels = (u32*)malloc(isyntax->tile_width * isyntax->tile_height * sizeof(u32));
+	u32* tile_pixels = alloc_tile_pixels(&task->streamer);
     isyntax_load_tile(task->streamer.isyntax, task->streamer.wsi,
                       task->scale, task->tile_x, task->tile_y,
                       task->streamer.isyntax->ll_coeff_block_allocator,
@@ -364,6 +371,7 @@ void isyntax_begin_load_tile(isyntax_streamer_t* streamer, i32 scale, i32 tile_x
 
 		tile->is_submitted_for_loading = true;
 		atomic_increment(&isyntax->refcount); // retain; don't destroy isyntax while busy
+		WORK_QUEUE_NAME_TASK(isyntax_load_tile_task_func);
 		if (!work_queue_submit_task(isyntax->work_submission_queue, isyntax_load_tile_task_func, &task, sizeof(task))) {
 			tile->is_submitted_for_loading = false; // chicken out
 			atomic_decrement(&isyntax->refcount);
@@ -384,7 +392,9 @@ void isyntax_begin_first_load(isyntax_streamer_t* streamer) {
 		fatal_error("isyntax_begin_first_load(): work_submission_queue not set");
 	}
 	atomic_increment(&streamer->isyntax->refcount); // retain; don't destroy isyntax while busy
-	if (!work_queue_submit_task(submission_queue, isyntax_first_load_task_func, streamer, sizeof(*streamer))) {
+	WORK_QUEUE_NAME_TASK(isyntax_first_load_task_func);
+	if (!work_queue_submit_with_priority(submission_queue, isyntax_first_load_task_func, WORK_QUEUE_PRIORITY_HIGH,
+	                                     NULL, NULL, streamer, sizeof(*streamer))) {
 		atomic_decrement(&streamer->isyntax->refcount); // chicken out
 	}
 }
@@ -459,6 +469,7 @@ void isyntax_begin_decompress_h_coeff_for_tile(isyntax_t* isyntax, isyntax_image
 	atomic_increment(&isyntax->refcount); // retain; don't destroy isyntax while busy
 	tile->is_submitted_for_h_coeff_decompression = true;
 	ASSERT(isyntax->work_submission_queue);
+	WORK_QUEUE_NAME_TASK(isyntax_decompress_h_coeff_for_tile_task_func);
 	if (!work_queue_submit_task(isyntax->work_submission_queue, isyntax_decompress_h_coeff_for_tile_task_func, &task,
 	                            sizeof(task))) {
 		atomic_decrement(&isyntax->refcount); // chicken out
@@ -496,11 +507,112 @@ typedef struct isyntax_load_region_t {
 typedef struct isyntax_chunk_load_task_t {
 	i32 index;
 	i32 priority; // currently unused
+	i64 offset;
+	i64 read_size;
 } isyntax_chunk_load_task_t;
 
-// Sort chunks based on their index (ascending order as the chunks occur in the file)
-static int chunk_index_compare_func (const void* a, const void* b) {
-	return ( ((isyntax_chunk_load_task_t*)a)->index - ((isyntax_chunk_load_task_t*)b)->index );
+// Sort chunks based on their offset in the file
+static int chunk_offset_compare_func (const void* a, const void* b) {
+	i64 offset_a = ((isyntax_chunk_load_task_t*)a)->offset;
+	i64 offset_b = ((isyntax_chunk_load_task_t*)b)->offset;
+	return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+// I/O planning: chunks that are close together in the file are read using a single large read.
+// Gaps between the chunks are read as well (and thrown away), as long as they are not too large.
+#define ISYNTAX_IO_MAX_GAP_SIZE KILOBYTES(256)
+#define ISYNTAX_IO_MAX_COALESCED_READ_SIZE MEGABYTES(8)
+
+// Reads the data for all chunks in the list (sorted by offset), coalescing neighboring reads.
+// Each chunk receives its own copy of its part of the data (chunk->data), to be used by the decompression tasks.
+// Returns the number of chunks loaded; stops early if loading takes longer than max_seconds.
+static i32 isyntax_load_chunks_coalesced(isyntax_t* isyntax, isyntax_image_t* wsi, isyntax_chunk_load_task_t* chunks_to_load,
+                                         i32 chunks_to_load_count, float max_seconds) {
+	i64 clock_io_start = get_clock();
+	size_t safety_bytes = 7; // allocate extra safety bytes at the end for bitstream_lsb_read(), which might read past the end of the buffer
+
+	// Determine the byte ranges to read, and sort them by offset
+	i32 read_count = 0;
+	for (i32 i = 0; i < chunks_to_load_count; ++i) {
+		isyntax_data_chunk_t* chunk = wsi->data_chunks + chunks_to_load[i].index;
+		if (chunk->data) continue; // already loaded
+		// TODO: use known cluster size instead of ad hoc computation here
+		isyntax_codeblock_t* last_codeblock = wsi->codeblocks + chunk->top_codeblock_index + (chunk->codeblock_count_per_color * 3) - 1;
+		u64 offset1 = last_codeblock->block_data_offset + last_codeblock->block_size;
+		isyntax_chunk_load_task_t* read = chunks_to_load + read_count++;
+		*read = chunks_to_load[i];
+		read->offset = chunk->offset;
+		read->read_size = offset1 - chunk->offset;
+	}
+	qsort(chunks_to_load, read_count, sizeof(chunks_to_load[0]), chunk_offset_compare_func);
+
+	i32 chunks_loaded = 0;
+	u8* read_buffer = NULL;
+	size_t read_buffer_capacity = 0;
+	for (i32 first = 0; first < read_count; ) {
+		// Merge as many of the following chunks as possible into a single read
+		i64 range_begin = chunks_to_load[first].offset;
+		i64 range_end = range_begin + chunks_to_load[first].read_size;
+		i32 last = first;
+		while (last + 1 < read_count) {
+			isyntax_chunk_load_task_t* next = chunks_to_load + last + 1;
+			i64 next_end = MAX(range_end, next->offset + next->read_size);
+			if (next->offset - range_end > ISYNTAX_IO_MAX_GAP_SIZE || next_end - range_begin > ISYNTAX_IO_MAX_COALESCED_READ_SIZE) {
+				break;
+			}
+			range_end = next_end;
+			++last;
+		}
+
+		u8* mapped_range = isyntax_get_mapped_data(isyntax, range_begin, range_end - range_begin);
+		if (mapped_range) {
+			// The chunks point straight into the memory-mapped file; ask the OS to start paging them in.
+			file_map_advise(isyntax->file_mapping, isyntax->file_mapping_size, range_begin, range_end - range_begin,
+			                FILE_ACCESS_PATTERN_WILL_NEED);
+			for (i32 i = first; i <= last; ++i) {
+				isyntax_chunk_load_task_t* read = chunks_to_load + i;
+				wsi->data_chunks[read->index].data = mapped_range + (read->offset - range_begin);
+			}
+		} else if (first == last) {
+			// Nothing to merge: read directly into the chunk's own buffer
+			isyntax_data_chunk_t* chunk = wsi->data_chunks + chunks_to_load[first].index;
+			u8* data = (u8*)malloc(range_end - range_begin + safety_bytes);
+			size_t bytes_read = file_handle_read_at_offset(data, isyntax->file_handle, range_begin, range_end - range_begin);
+			if (!(bytes_read > 0)) {
+				console_print_error("Error: could not read iSyntax data at offset %lld (read size %lld)\n", range_begin, range_end - range_begin);
+			}
+			chunk->data = data;
+		} else {
+			size_t range_size = range_end - range_begin;
+			if (range_size > read_buffer_capacity) {
+				free(read_buffer);
+				read_buffer = (u8*)malloc(range_size);
+				read_buffer_capacity = range_size;
+			}
+			size_t bytes_read = file_handle_read_at_offset(read_buffer, isyntax->file_handle, range_begin, range_size);
+			if (!(bytes_read > 0)) {
+				console_print_error("Error: could not read iSyntax data at offset %lld (read size %lld)\n", range_begin, range_size);
+			}
+			// Hand out the parts of the read to the chunks
+			for (i32 i = first; i <= last; ++i) {
+				isyntax_chunk_load_task_t* read = chunks_to_load + i;
+				isyntax_data_chunk_t* chunk = wsi->data_chunks + read->index;
+				u8* data = (u8*)malloc(read->read_size + safety_bytes);
+				memcpy(data, read_buffer + (read->offset - range_begin), read->read_size);
+				chunk->data = data;
+			}
+		}
+		chunks_loaded += (last - first) + 1;
+		first = last + 1;
+
+		float seconds_elapsed_io = get_seconds_elapsed(clock_io_start, get_clock());
+		if (seconds_elapsed_io > max_seconds) {
+			console_print_verbose("Loaded %d chunks before timing out\n", chunks_loaded);
+			break;
+		}
+	}
+	free(read_buffer);
+	return chunks_loaded;
 }
 
 // Sort chunks based on assigned priority scores (closer to center of screen = higher priority)
@@ -670,6 +782,15 @@ void isyntax_stream_image_tiles(isyntax_streamer_t* streamer, isyntax_t* isyntax
 				padded_bounds.min.y -= pad_amount;
 				padded_bounds.max.x += pad_amount;
 				padded_bounds.max.y += pad_amount;
+				if (streamer->has_prefetch_bounds) {
+					// Also include the predicted area, plus a margin for the neighbors needed for the reconstruction
+					bounds2i prefetch_tiles = world_bounds_to_tile_bounds(&streamer->prefetch_bounds, level->x_tile_side_in_um,
+					                                                      level->y_tile_side_in_um, streamer->origin_offset);
+					padded_bounds.min.x = MIN(padded_bounds.min.x, prefetch_tiles.min.x - 1);
+					padded_bounds.min.y = MIN(padded_bounds.min.y, prefetch_tiles.min.y - 1);
+					padded_bounds.max.x = MAX(padded_bounds.max.x, prefetch_tiles.max.x + 1);
+					padded_bounds.max.y = MAX(padded_bounds.max.y, prefetch_tiles.max.y + 1);
+				}
 				padded_bounds = clip_bounds2i(padded_bounds, level_tiles_bounds);
 
 				i32 local_bounds_width = padded_bounds.max.x - padded_bounds.min.x;
@@ -732,6 +853,42 @@ void isyntax_stream_image_tiles(isyntax_streamer_t* streamer, isyntax_t* isyntax
 				}
 			}
 
+			// If all visible tiles are loaded (or on their way), prefetch the tile closest to where the camera is heading.
+			if (!target_tile_valid && streamer->has_prefetch_bounds) {
+				bounds2i level_tiles_bounds = {{ 0, 0, (i32)target_level->width_in_tiles, (i32)target_level->height_in_tiles }};
+				bounds2i prefetch_tiles = world_bounds_to_tile_bounds(&streamer->prefetch_bounds, target_level->x_tile_side_in_um,
+				                                                      target_level->y_tile_side_in_um, streamer->origin_offset);
+				prefetch_tiles = clip_bounds2i(prefetch_tiles, level_tiles_bounds);
+				if (streamer->is_cropped) {
+					bounds2i crop_tile_bounds = world_bounds_to_tile_bounds(&streamer->crop_bounds, target_level->x_tile_side_in_um,
+					                                                        target_level->y_tile_side_in_um, streamer->origin_offset);
+					prefetch_tiles = clip_bounds2i(prefetch_tiles, crop_tile_bounds);
+				}
+				v2f prefetch_center = {
+						0.5f * (streamer->prefetch_bounds.min.x + streamer->prefetch_bounds.max.x),
+						0.5f * (streamer->prefetch_bounds.min.y + streamer->prefetch_bounds.max.y),
+				};
+				for (i32 tile_y = prefetch_tiles.min.y; tile_y < prefetch_tiles.max.y; ++tile_y) {
+					for (i32 tile_x = prefetch_tiles.min.x; tile_x < prefetch_tiles.max.x; ++tile_x) {
+						isyntax_tile_t* tile = target_level->tiles + (tile_y * target_level->width_in_tiles) + tile_x;
+						if (!tile->exists || tile->is_submitted_for_loading || tile->is_loaded) {
+							continue;
+						}
+						v2f tile_center = {
+								target_level->origin_offset.x + ((float)tile_x + 0.5f) * target_level->x_tile_side_in_um,
+								target_level->origin_offset.y + ((float)tile_y + 0.5f) * target_level->y_tile_side_in_um,
+						};
+						float dist_sq = v2f_length_squared(v2f_subtract(prefetch_center, tile_center));
+						if (dist_sq < min_dist_sq) {
+							min_dist_sq = dist_sq;
+							target_tile_x = tile_x;
+							target_tile_y = tile_y;
+							target_tile_valid = true;
+						}
+					}
+				}
+			}
+
 			// Determine prerequisites to load the target tile
 			if (target_tile_valid) {
 				// Mark the target tile, and require its neighbors to have coefficients loaded as well to enable the reconstruction.
@@ -839,36 +996,9 @@ void isyntax_stream_image_tiles(isyntax_streamer_t* streamer, isyntax_t* isyntax
 //					console_print("Wanting to load %d chunks\n", chunks_to_load_count);
 //				}
 
-				// Sorting read operations by offset to improve read performance
-				qsort(chunks_to_load, chunks_to_load_count, sizeof(chunks_to_load[0]), chunk_index_compare_func);
-
-				i64 clock_io_start = get_clock();
-				i32 chunks_loaded = 0;
-				for (i32 i = 0; i < chunks_to_load_count; ++i) {
-					u32 chunk_index = chunks_to_load[i].index;
-					isyntax_data_chunk_t * chunk = wsi->data_chunks + chunk_index;
-					if (!chunk->data) {
-						// TODO: use known cluster size instead of ad hoc computation here
-						isyntax_codeblock_t* last_codeblock = wsi->codeblocks + chunk->top_codeblock_index + (chunk->codeblock_count_per_color * 3) - 1;
-						u64 offset1 = last_codeblock->block_data_offset + last_codeblock->block_size;
-						u64 read_size = offset1 - chunk->offset;
-						size_t safety_bytes = 7; // allocate extra safety bytes at the end for bitstream_lsb_read(), which might read past the end of the buffer
-						chunk->data = (u8*)malloc(read_size + safety_bytes);
-//				        console_print("loading chunk %d\n", chunk_index);
-
-						size_t bytes_read = file_handle_read_at_offset(chunk->data, isyntax->file_handle, chunk->offset, read_size);
-						if (!(bytes_read > 0)) {
-							console_print_error("Error: could not read iSyntax data at offset %lld (read size %lld)\n", chunk->offset, read_size);
-						}
-
-						++chunks_loaded;
-						float seconds_elapsed_io = get_seconds_elapsed(clock_io_start, get_clock());
-						if (seconds_elapsed_io > 0.2f) {
-					        console_print_verbose("Loaded %d chunks before timing out\n", i+1);
-					        break;
-						}
-					}
-				}
+				// Read all the chunks needed in this iteration at once: sorted by offset, and with neighboring
+				// reads coalesced into larger reads (to reduce the number of I/O requests on high latency storage).
+				i32 chunks_loaded = isyntax_load_chunks_coalesced(isyntax, wsi, chunks_to_load, chunks_to_load_count, 0.2f);
 
 				// Flag all tiles in the target level as wanted for loading
 				// (We have prioritized loading at least 1 tile, but we don't mind loading more if we have the chunks available!)
@@ -1072,6 +1202,7 @@ void isyntax_begin_stream_image_tiles(isyntax_streamer_t* tile_streamer) {
 		atomic_increment(&isyntax->refcount); // retain; don't destroy isyntax while busy
 		is_tile_stream_task_in_progress = true;
 		ASSERT(isyntax->work_submission_queue);
+		WORK_QUEUE_NAME_TASK(isyntax_stream_image_tiles_func);
 		work_queue_submit_task(isyntax->work_submission_queue, isyntax_stream_image_tiles_func, tile_streamer,
 		                       sizeof(*tile_streamer));
 	} else {
@@ -55,12 +55,17 @@ typedef struct isyntax_streamer_t {
 	bounds2f camera_bounds;
 	bounds2f crop_bounds;
 	bool is_cropped;
+	bounds2f prefetch_bounds; // where the camera is predicted to be soon (e.g. while panning)
+	bool has_prefetch_bounds;
 //	zoom_state_t zoom;
 	i32 zoom_level;
 	work_queue_t* tile_completion_queue;
 	work_queue_callback_t* tile_completion_callback;
 	u32 tile_completion_task_identifier;
     enum isyntax_pixel_format_t pixel_format;
+	// Optional: allocates the memory that tiles are decoded into (e.g. straight into GPU upload memory).
+	// If not set, pixel_buffer_alloc() is used. Must not return NULL.
+	void* (*alloc_tile_pixels)(size_t size);
 } isyntax_streamer_t;
 
 
@@ -38,6 +38,22 @@ typedef struct isyntax_image_t isyntax_image_t;
 typedef struct isyntax_level_t isyntax_level_t;
 typedef struct isyntax_cache_t isyntax_cache_t;
 
+typedef struct isyntax_cache_stats_t {
+    int64_t hit_count;      // tiles that were needed for a read and had their coefficients resident in the cache
+    int64_t miss_count;     // tiles that were needed for a read and had to be loaded from disk and decompressed
+    int64_t eviction_count; // tiles trimmed from the cache to stay within the byte budget
+    int64_t bytes_resident; // coefficient memory currently in use by the cache
+    int64_t byte_budget;    // target size of the cache in bytes
+    int64_t tiles_resident; // tiles in the cache list (not counting tiles in flight)
+    double decode_seconds;  // total time spent loading, decompressing and transforming tiles
+    // Second tier: LZ4-compressed coefficients of evicted tiles.
+    int64_t compressed_hit_count;      // tiles restored from the compressed tier instead of being read from disk
+    int64_t compressed_eviction_count; // compressed tiles dropped to stay within the compressed byte budget
+    int64_t compressed_bytes_resident;
+    int64_t compressed_byte_budget;
+    int64_t compressed_tiles_resident;
+} isyntax_cache_stats_t;
+
 //== Common API ==
 // TODO(avirodov): are repeated calls of libisyntax_init() allowed? Currently I believe not.
 isyntax_error_t libisyntax_init();
@@ -69,6 +85,16 @@ isyntax_error_t libisyntax_cache_create(const char* debug_name_or_null, int32_t
 //  within isyntax_cache_t implementation.
 isyntax_error_t libisyntax_cache_inject(isyntax_cache_t* isyntax_cache, isyntax_t* isyntax);
 void            libisyntax_cache_destroy(isyntax_cache_t* isyntax_cache);
+// The cache budget is measured in bytes of coefficient memory. By default it is derived from the cache_size (in tiles)
+// passed to libisyntax_cache_create(), assuming that every tile holds both LL and H coefficients for all channels.
+// Use this to size the cache directly, e.g. from a per-process memory limit.
+isyntax_error_t libisyntax_cache_set_target_size_in_bytes(isyntax_cache_t* isyntax_cache, int64_t size_in_bytes);
+// Coefficients of tiles evicted from the cache can be kept in a second tier, compressed with LZ4. Restoring them is
+// much cheaper than reading and decoding them from the file again. The second tier has its own byte budget; it is
+// disabled by default (budget 0).
+isyntax_error_t libisyntax_cache_set_compressed_target_size_in_bytes(isyntax_cache_t* isyntax_cache, int64_t size_in_bytes);
+// Statistics are accumulated over the lifetime of the cache and are safe to query while other threads are reading.
+isyntax_error_t libisyntax_cache_get_stats(isyntax_cache_t* isyntax_cache, isyntax_cache_stats_t* out_stats);
 
 
 //== Tile API ==
@@ -80,4 +106,14 @@ isyntax_error_t libisyntax_tile_read(isyntax_t* isyntax, isyntax_cache_t* isynta
                                      int32_t level, int64_t tile_x, int64_t tile_y,
                                      uint32_t* pixels_buffer, int32_t pixel_format);
 
+// Reads an arbitrary region of a level into a user-supplied buffer. The region is specified in pixel coordinates of
+// the level, and need not be aligned to tile boundaries. Buffer size should be [width * height * 4]; rows are written
+// with a stride of `width` pixels. Parts of the region outside of the image are filled with white.
+// Tiles are decoded in parallel if a work queue is available; shared parent tiles are decoded only once (provided
+// that the cache is large enough to hold them).
+// pixel_format is one of isyntax_pixel_format_t.
+isyntax_error_t libisyntax_read_region(isyntax_t* isyntax, isyntax_cache_t* isyntax_cache, int32_t level,
+                                       int64_t x, int64_t y, int64_t width, int64_t height,
+                                       uint32_t* pixels_buffer, int32_t pixel_format);
+
 
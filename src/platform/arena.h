@@ -27,25 +27,52 @@
 
 #pragma once
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Growable arenas reserve address space up front, and commit memory on demand as the arena fills up.
+// If the reserved range runs out, a new block is chained onto the arena (and released again when it is popped).
+#define ARENA_COMMIT_GRANULARITY MEGABYTES(1)
+#define ARENA_BLOCK_HEADER_SIZE 64
+
 typedef struct arena_t {
-	size_t size;
-	u8* base;
-	size_t used;
+	size_t size; // size of the current block
+	u8* base;    // start of the current block
+	size_t used; // bytes used in the current block
 	i32 temp_count;
+	bool is_growable;
+	i32 block_count;
+	size_t committed;               // bytes committed in the current block (equal to size for fixed arenas)
+	size_t used_in_previous_blocks;
+	size_t block_reserve_size;      // address space to reserve for each block
+	size_t retained_size;           // committed memory that is kept after the arena is fully released
+	size_t peak_used;               // peak of (used_in_previous_blocks + used) since the last reset
+	size_t high_water_mark;         // lifetime peak (folded in from peak_used whenever that is reset)
+	i32 releases_since_trim;
 } arena_t;
 
 typedef struct temp_memory_t {
 	arena_t* arena;
+	u8* base;
 	size_t used;
 	i32 temp_index;
 } temp_memory_t;
 
+void init_growable_arena(arena_t* arena, size_t block_reserve_size, size_t retained_size);
+void destroy_growable_arena(arena_t* arena);
+void arena_grow(arena_t* arena, size_t size);
+void arena_pop_blocks(arena_t* arena, u8* base);
+void arena_trim(arena_t* arena);
+
 static inline void init_arena(arena_t* arena, size_t size, void* base) {
 	arena_t new_arena = {
 			.size = size,
 			.base = (u8*) base,
 			.used = 0,
 			.temp_count = 0,
+			.block_count = 1,
+			.committed = size,
 	};
 	*arena = new_arena;
 }
@@ -54,12 +81,22 @@ static inline void* arena_current_pos(arena_t* arena) {
 	return arena->base + arena->used;
 }
 
+static inline size_t arena_get_total_used(arena_t* arena) {
+	return arena->used_in_previous_blocks + arena->used;
+}
+
 #define arena_push_struct(arena, type) ((type*)arena_push_size((arena), sizeof(type)))
 #define arena_push_array(arena, count, type) ((type*) arena_push_size((arena), (count)* sizeof(type)))
 static inline void* arena_push_size(arena_t* arena, size_t size) {
-	ASSERT((arena->used + size) <= arena->size);
+	if (arena->used + size > arena->committed) {
+		arena_grow(arena, size); // commits more memory, or chains a new block (fatal error for fixed arenas)
+	}
 	void* result = arena->base + arena->used;
 	arena->used += size;
+	size_t total_used = arena->used_in_previous_blocks + arena->used;
+	if (total_used > arena->peak_used) {
+		arena->peak_used = total_used;
+	}
 	return result;
 }
 
@@ -73,6 +110,7 @@ static inline void arena_align(arena_t* arena, u32 alignment) {
 static inline temp_memory_t begin_temp_memory(arena_t* arena) {
 	temp_memory_t result = {
 			.arena = arena,
+			.base = arena->base,
 			.used = arena->used,
 			.temp_index = arena->temp_count,
 	};
@@ -81,12 +119,23 @@ static inline temp_memory_t begin_temp_memory(arena_t* arena) {
 }
 
 static inline void release_temp_memory(temp_memory_t* temp) {
-	ASSERT(temp->arena->temp_count > 0);
-	temp->arena->temp_count--;
-	temp->arena->used = temp->used;
-	ASSERT(temp->temp_index == temp->arena->temp_count);
+	arena_t* arena = temp->arena;
+	ASSERT(arena->temp_count > 0);
+	arena->temp_count--;
+	if (arena->base != temp->base) {
+		arena_pop_blocks(arena, temp->base);
+	}
+	arena->used = temp->used;
+	ASSERT(temp->temp_index == arena->temp_count);
+	if (arena->temp_count == 0 && arena->committed > arena->retained_size && arena->is_growable) {
+		arena_trim(arena);
+	}
 }
 
 static inline i64 arena_get_bytes_left(arena_t* arena) {
 	return arena->size - arena->used;
 }
+
+#ifdef __cplusplus
+}
+#endif
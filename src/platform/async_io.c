@@ -0,0 +1,274 @@
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2024, Pieter Valkema
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+     list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define ASYNC_IO_IMPL
+#include "async_io.h"
+#include "intrinsics.h"
+
+#if LINUX && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <errno.h>
+#endif
+#endif
+
+typedef struct async_io_request_t {
+	file_handle_t file_handle;
+	work_queue_t* completion_queue;
+	i32 completion_priority;
+	work_queue_callback_t* completion_callback;
+#if HAVE_IO_URING
+	struct iovec iov;
+#endif
+	async_io_completion_t completion;
+} async_io_request_t;
+
+static async_io_backend_enum async_io_backend;
+
+// Hands the result of a finished read over to the completion queue.
+static void async_io_complete_request(async_io_request_t* request, i64 bytes_read) {
+	async_io_completion_t* completion = &request->completion;
+	if (bytes_read >= 0 && (u64)bytes_read < completion->size) {
+		// Short read (e.g. interrupted, or a network file system): read the rest synchronously.
+		u8* dest = (u8*)completion->dest + bytes_read;
+		size_t bytes_left = completion->size - bytes_read;
+		size_t rest_bytes_read = file_handle_read_at_offset(dest, request->file_handle, completion->offset + bytes_read, bytes_left);
+		if (rest_bytes_read == bytes_left) {
+			bytes_read = (i64)completion->size;
+		}
+	}
+	completion->bytes_read = bytes_read;
+	work_queue_submit_with_priority(request->completion_queue, request->completion_callback, request->completion_priority,
+	                                NULL, NULL, completion, sizeof(*completion));
+	free(request);
+}
+
+static void async_io_pread_task_func(i32 logical_thread_index, void* userdata) {
+	async_io_request_t* request = *(async_io_request_t**) userdata;
+	async_io_completion_t* completion = &request->completion;
+	size_t bytes_read = file_handle_read_at_offset(completion->dest, request->file_handle, completion->offset, completion->size);
+	async_io_complete_request(request, (i64)bytes_read);
+}
+
+#if HAVE_IO_URING
+
+typedef struct io_uring_state_t {
+	int fd;
+	u32 sq_entries;
+	u32 cq_entries;
+	u8* sq_ring;
+	u8* cq_ring;
+	struct io_uring_sqe* sqes;
+	u32* sq_head;
+	u32* sq_tail;
+	u32 sq_mask;
+	u32* sq_array;
+	u32* cq_head;
+	u32* cq_tail;
+	u32 cq_mask;
+	struct io_uring_cqe* cqes;
+	volatile i32 in_flight_count;
+	benaphore_t submit_lock;
+	pthread_t reaper_thread;
+} io_uring_state_t;
+
+static io_uring_state_t io_uring_state;
+
+static int io_uring_enter_syscall(int fd, u32 to_submit, u32 min_complete, u32 flags) {
+	int ret;
+	do {
+		ret = (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+// Waits for completed reads and passes them on to their completion queues.
+static void* io_uring_reaper_thread(void* parameter) {
+	io_uring_state_t* ring = (io_uring_state_t*) parameter;
+	for (;;) {
+		if (io_uring_enter_syscall(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+			console_print_error("async_io: io_uring_enter() failed (errno %d)\n", errno);
+			platform_sleep(1);
+		}
+		u32 head = *ring->cq_head;
+		u32 tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail) {
+			struct io_uring_cqe* cqe = ring->cqes + (head & ring->cq_mask);
+			async_io_request_t* request = (async_io_request_t*)(uintptr_t) cqe->user_data;
+			i64 result = cqe->res;
+			++head;
+			__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+			atomic_decrement(&ring->in_flight_count);
+			async_io_complete_request(request, result);
+		}
+	}
+	return 0;
+}
+
+static bool io_uring_init(io_uring_state_t* ring, u32 entries) {
+	struct io_uring_params params = {0};
+	int fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0) {
+		return false; // not supported by the kernel, or disabled (e.g. by a seccomp policy)
+	}
+	size_t sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+	size_t cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single_mmap) {
+		sq_ring_size = cq_ring_size = MAX(sq_ring_size, cq_ring_size);
+	}
+	void* sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	void* cq_ring = single_mmap ? sq_ring : mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	void* sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+		if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+		if (cq_ring != MAP_FAILED && !single_mmap) munmap(cq_ring, cq_ring_size);
+		if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+		close(fd);
+		return false;
+	}
+
+	ring->fd = fd;
+	ring->sq_entries = params.sq_entries;
+	ring->cq_entries = params.cq_entries;
+	ring->sq_ring = (u8*) sq_ring;
+	ring->cq_ring = (u8*) cq_ring;
+	ring->sqes = (struct io_uring_sqe*) sqes;
+	ring->sq_head = (u32*)(ring->sq_ring + params.sq_off.head);
+	ring->sq_tail = (u32*)(ring->sq_ring + params.sq_off.tail);
+	ring->sq_mask = *(u32*)(ring->sq_ring + params.sq_off.ring_mask);
+	ring->sq_array = (u32*)(ring->sq_ring + params.sq_off.array);
+	ring->cq_head = (u32*)(ring->cq_ring + params.cq_off.head);
+	ring->cq_tail = (u32*)(ring->cq_ring + params.cq_off.tail);
+	ring->cq_mask = *(u32*)(ring->cq_ring + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(ring->cq_ring + params.cq_off.cqes);
+	ring->submit_lock = benaphore_create();
+
+	if (pthread_create(&ring->reaper_thread, NULL, &io_uring_reaper_thread, (void*) ring) != 0) {
+		console_print_error("async_io: could not create the io_uring reaper thread\n");
+		return false; // NOTE: the ring is leaked, but it is never used
+	}
+	return true;
+}
+
+static bool io_uring_submit_read(io_uring_state_t* ring, async_io_request_t* request) {
+	bool result = false;
+	benaphore_lock(&ring->submit_lock);
+	u32 tail = *ring->sq_tail;
+	u32 head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	// Don't submit more reads than the completion ring can hold (it would overflow).
+	if (tail - head < ring->sq_entries && ring->in_flight_count < (i32)ring->cq_entries) {
+		u32 index = tail & ring->sq_mask;
+		struct io_uring_sqe* sqe = ring->sqes + index;
+		memset(sqe, 0, sizeof(*sqe));
+		// NOTE: IORING_OP_READV instead of IORING_OP_READ, for compatibility with older kernels (< 5.6)
+		request->iov.iov_base = request->completion.dest;
+		request->iov.iov_len = request->completion.size;
+		sqe->opcode = IORING_OP_READV;
+		sqe->fd = request->file_handle;
+		sqe->off = request->completion.offset;
+		sqe->addr = (u64)(uintptr_t) &request->iov;
+		sqe->len = 1;
+		sqe->user_data = (u64)(uintptr_t) request;
+		ring->sq_array[index] = index;
+		atomic_increment(&ring->in_flight_count);
+		__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+		if (io_uring_enter_syscall(ring->fd, 1, 0, 0) < 0) {
+			// The entry stays in the submission ring and will be picked up by the kernel with the next submission.
+			console_print_error("async_io: io_uring_enter() failed (errno %d)\n", errno);
+		}
+		result = true;
+	}
+	benaphore_unlock(&ring->submit_lock);
+	return result;
+}
+
+#endif //HAVE_IO_URING
+
+void async_io_init(bool allow_io_uring) {
+#if HAVE_IO_URING
+	if (allow_io_uring && io_uring_init(&io_uring_state, 256)) {
+		async_io_backend = ASYNC_IO_BACKEND_IO_URING;
+		console_print_verbose("async_io: using io_uring\n");
+		return;
+	}
+#endif
+	if (global_io_worker_thread_count > 0) {
+		async_io_backend = ASYNC_IO_BACKEND_PREAD_THREADS;
+		console_print_verbose("async_io: using the I/O threads\n");
+	} else {
+		async_io_backend = ASYNC_IO_BACKEND_NONE;
+	}
+}
+
+async_io_backend_enum async_io_get_backend() {
+	return async_io_backend;
+}
+
+bool async_io_submit_read(file_handle_t file_handle, void* dest, u64 offset, u64 size, work_queue_t* completion_queue,
+                          i32 completion_priority, work_queue_callback_t* completion_callback, void* userdata, size_t userdata_size) {
+	if (async_io_backend == ASYNC_IO_BACKEND_NONE) {
+		return false;
+	}
+	ASSERT(userdata_size <= ASYNC_IO_MAX_USERDATA_SIZE);
+	if (userdata_size > ASYNC_IO_MAX_USERDATA_SIZE) {
+		console_print_error("async_io_submit_read(): userdata too large (%d bytes)\n", (i32)userdata_size);
+		return false;
+	}
+	async_io_request_t* request = (async_io_request_t*) calloc(1, sizeof(async_io_request_t));
+	request->file_handle = file_handle;
+	request->completion_queue = completion_queue;
+	request->completion_priority = completion_priority;
+	request->completion_callback = completion_callback;
+	request->completion.dest = dest;
+	request->completion.offset = offset;
+	request->completion.size = size;
+	if (userdata_size > 0) {
+		memcpy(request->completion.userdata, userdata, userdata_size);
+	}
+
+	bool success = false;
+#if HAVE_IO_URING
+	if (async_io_backend == ASYNC_IO_BACKEND_IO_URING) {
+		success = io_uring_submit_read(&io_uring_state, request);
+	} else
+#endif
+	{
+		WORK_QUEUE_NAME_TASK(async_io_pread_task_func);
+		success = work_queue_submit_task(get_io_work_queue(), async_io_pread_task_func, &request, sizeof(request));
+	}
+	if (!success) {
+		free(request);
+	}
+	return success;
+}
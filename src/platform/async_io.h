@@ -0,0 +1,81 @@
+/*
+  BSD 2-Clause License
+
+  Copyright (c) 2024, Pieter Valkema
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+     list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include "common.h"
+#include "platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Asynchronous file reads: a read is submitted together with a completion callback, which is submitted as a task to
+// a work queue once the data has arrived. This way, worker threads don't sit idle while waiting on the disk.
+// Backends:
+// - io_uring (Linux): the kernel performs the reads; a single reaper thread hands out the completions.
+// - pread threads: the reads are performed (synchronously) by the dedicated I/O threads (see get_io_work_queue()).
+// If neither is available, async_io_submit_read() returns false and the caller should read synchronously.
+
+typedef enum async_io_backend_enum {
+	ASYNC_IO_BACKEND_NONE = 0,
+	ASYNC_IO_BACKEND_PREAD_THREADS = 1,
+	ASYNC_IO_BACKEND_IO_URING = 2,
+} async_io_backend_enum;
+
+#define ASYNC_IO_MAX_USERDATA_SIZE 96
+
+// This is passed as the userdata to the completion callback.
+typedef struct async_io_completion_t {
+	void* dest;
+	u64 offset;
+	u64 size;
+	i64 bytes_read; // negative on error
+	u8 userdata[ASYNC_IO_MAX_USERDATA_SIZE];
+} async_io_completion_t;
+
+void async_io_init(bool allow_io_uring);
+async_io_backend_enum async_io_get_backend();
+bool async_io_submit_read(file_handle_t file_handle, void* dest, u64 offset, u64 size, work_queue_t* completion_queue,
+                          i32 completion_priority, work_queue_callback_t* completion_callback, void* userdata, size_t userdata_size);
+
+// globals
+#if defined(ASYNC_IO_IMPL)
+#define INIT(...) __VA_ARGS__
+#define extern
+#else
+#define INIT(...)
+#undef extern
+#endif
+
+extern bool async_io_use_io_uring INIT(= true);
+
+#undef INIT
+#undef extern
+
+#ifdef __cplusplus
+}
+#endif
@@ -75,6 +75,20 @@ static inline bool atomic_compare_exchange(volatile i32* destination, i32 exchan
 	return (read_value == comparand);
 }
 
+static inline i64 atomic_add_i64(volatile i64* x, i64 amount) {
+	return InterlockedAdd64((volatile long long*)x, (long long)amount);
+}
+
+static inline bool atomic_compare_exchange_u64(volatile u64* destination, u64 exchange, u64 comparand) {
+	u64 read_value = InterlockedCompareExchange64((volatile long long*)destination, exchange, comparand);
+	return (read_value == comparand);
+}
+
+static inline bool atomic_compare_exchange_ptr(void* volatile* destination, void* exchange, void* comparand) {
+	void* read_value = InterlockedCompareExchangePointer(destination, exchange, comparand);
+	return (read_value == comparand);
+}
+
 static inline u32 bit_scan_forward(u32 x) {
 	unsigned long first_bit = 0;
 	_BitScanForward(&first_bit, x);
@@ -109,6 +123,18 @@ static inline bool atomic_compare_exchange(volatile i32* destination, i32 exchan
 	return result;
 }
 
+static inline i64 atomic_add_i64(volatile i64* x, i64 amount) {
+	return OSAtomicAdd64(amount, (volatile int64_t*)x);
+}
+
+static inline bool atomic_compare_exchange_u64(volatile u64* destination, u64 exchange, u64 comparand) {
+	return OSAtomicCompareAndSwap64((int64_t)comparand, (int64_t)exchange, (volatile int64_t*)destination);
+}
+
+static inline bool atomic_compare_exchange_ptr(void* volatile* destination, void* exchange, void* comparand) {
+	return OSAtomicCompareAndSwapPtr(comparand, exchange, destination);
+}
+
 static inline u32 bit_scan_forward(u32 x) {
 	return __builtin_ctz(x);
 }
@@ -139,6 +165,20 @@ static inline bool atomic_compare_exchange(volatile i32* destination, i32 exchan
     return (read_value == comparand);
 }
 
+static inline i64 atomic_add_i64(volatile i64* x, i64 amount) {
+    return __sync_add_and_fetch(x, amount);
+}
+
+static inline bool atomic_compare_exchange_u64(volatile u64* destination, u64 exchange, u64 comparand) {
+    u64 read_value = __sync_val_compare_and_swap(destination, comparand, exchange);
+    return (read_value == comparand);
+}
+
+static inline bool atomic_compare_exchange_ptr(void* volatile* destination, void* exchange, void* comparand) {
+    void* read_value = __sync_val_compare_and_swap(destination, comparand, exchange);
+    return (read_value == comparand);
+}
+
 static inline u32 atomic_or(volatile u32* x, u32 mask) {
 	return __sync_or_and_fetch(x, mask);
 }
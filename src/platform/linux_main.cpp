@@ -27,6 +27,8 @@
 #include "viewer.h"
 #include "gui.h" // TODO: move
 #include "dicom.h"
+#include "async_io.h"
+#include "pixel_buffer_pool.h"
 
 #include "imgui.h"
 #include "backends/imgui_impl_sdl2.h"
@@ -133,28 +135,80 @@ static void* worker_thread(void* parameter) {
     return 0;
 }
 
+static void* io_worker_thread(void* parameter) {
+	platform_thread_info_t* thread_info = (platform_thread_info_t*) parameter;
+	init_thread_memory(thread_info->logical_thread_index, &global_system_info);
+
+	for (;;) {
+		if (!work_queue_is_work_waiting_to_start(thread_info->queue)) {
+			sem_wait(thread_info->queue->semaphore);
+		}
+		work_queue_do_work(thread_info->queue, thread_info->logical_thread_index);
+	}
+
+	return 0;
+}
+
 platform_thread_info_t thread_infos[MAX_THREAD_COUNT];
 
+static void linux_create_worker_thread(pthread_t* thread, void* (*thread_proc)(void*), platform_thread_info_t* thread_info,
+                                       i32* cpus, i32 cpu_count) {
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	if (cpu_count > 0) {
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		for (i32 i = 0; i < cpu_count; ++i) {
+			CPU_SET(cpus[i], &cpu_set);
+		}
+		pthread_attr_setaffinity_np(&attr, sizeof(cpu_set), &cpu_set);
+	}
+	if (pthread_create(thread, &attr, thread_proc, (void*)thread_info) != 0) {
+		// Pinning may fail (e.g. if the process is restricted to a subset of the CPUs); retry without
+		pthread_attr_destroy(&attr);
+		pthread_attr_init(&attr);
+		if (pthread_create(thread, &attr, thread_proc, (void*)thread_info) != 0) {
+			fprintf(stderr, "Error creating thread\n");
+		}
+	}
+	pthread_attr_destroy(&attr);
+}
+
 void linux_init_multithreading() {
 	init_thread_memory(0, &global_system_info);
-    global_worker_thread_count = global_system_info.suggested_total_thread_count - 1;
+
+	static thread_pool_layout_t layout;
+	get_thread_pool_layout(&global_system_info, &global_thread_pool_options, &layout);
+	global_worker_thread_count = layout.decode_thread_count;
 	global_active_worker_thread_count = global_worker_thread_count;
+	global_io_worker_thread_count = layout.io_thread_count;
+	global_system_info.suggested_total_thread_count = 1 + layout.decode_thread_count + layout.io_thread_count;
+	console_print("Starting %d decode threads%s and %d I/O threads%s\n",
+	              layout.decode_thread_count, (layout.decode_thread_cpus[0] >= 0) ? " (pinned)" : "",
+	              layout.io_thread_count, (layout.io_thread_cpu_count > 0) ? " (pinned)" : "");
 
 	global_work_queue = work_queue_create("/worksem", 1024); // Queue for newly submitted tasks
 	global_completion_queue = work_queue_create("/completionsem", 1024); // Message queue for completed tasks
+	pixel_buffer_pool_init(MEGABYTES(pixel_buffer_pool_depot_size_in_mb));
 	global_export_completion_queue = work_queue_create("/exportcompletionsem", 1024); // Message queue for export task
+	if (global_io_worker_thread_count > 0) {
+		global_io_work_queue = work_queue_create("/iosem", 1024); // Queue for tasks that mostly wait on I/O
+	}
 
     pthread_t threads[MAX_THREAD_COUNT] = {};
 
     // NOTE: the main thread is considered thread 0.
-    for (i32 i = 1; i < global_system_info.suggested_total_thread_count; ++i) {
+    for (i32 i = 1; i <= layout.decode_thread_count; ++i) {
         thread_infos[i] = (platform_thread_info_t){ .logical_thread_index = i, .queue = &global_work_queue};
-
-        if (pthread_create(threads + i, NULL, &worker_thread, (void*)(&thread_infos[i])) != 0) {
-            fprintf(stderr, "Error creating thread\n");
-        }
-
+        i32* cpu = &layout.decode_thread_cpus[i-1];
+        linux_create_worker_thread(threads + i, &worker_thread, &thread_infos[i], cpu, (*cpu >= 0) ? 1 : 0);
     }
+    for (i32 i = 1 + layout.decode_thread_count; i < global_system_info.suggested_total_thread_count; ++i) {
+        thread_infos[i] = (platform_thread_info_t){ .logical_thread_index = i, .queue = &global_io_work_queue};
+        linux_create_worker_thread(threads + i, &io_worker_thread, &thread_infos[i], layout.io_thread_cpus, layout.io_thread_cpu_count);
+    }
+
+    async_io_init(async_io_use_io_uring);
 
     test_multithreading_work_queue();
 
@@ -422,7 +476,9 @@ int main(int argc, const char** argv)
         return app_command_execute(app_state);
     }
 
-	work_queue_submit_task(&global_work_queue, (work_queue_callback_t *) load_openslide_task, NULL, 0);
+	WORK_QUEUE_NAME_TASK(load_openslide_task);
+	work_queue_submit_task(get_io_work_queue(), (work_queue_callback_t *) load_openslide_task, NULL, 0);
+	WORK_QUEUE_NAME_TASK(load_dicom_task);
 	work_queue_submit_task(&global_work_queue, (work_queue_callback_t *) load_dicom_task, NULL, 0);
     linux_init_input();
 
@@ -28,6 +28,8 @@
 #include "common.h"
 #include "platform.h"
 
+#include <sys/mman.h>
+
 int platform_stat(const char* filename, struct stat* st) {
 	return stat(filename, st);
 }
@@ -104,3 +106,90 @@ size_t file_handle_read_at_offset(void* dest, file_handle_t file_handle, u64 off
 	size_t bytes_read = pread(file_handle, dest, bytes_to_read, offset);
 	return bytes_read;
 }
+
+// Maps an entire file into memory. The mapping is private (copy-on-write): pages may be modified in memory,
+// but the changes are never written back to the file.
+u8* file_map_copy_on_write(const char* filename, i64* out_size) {
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+	u8* result = NULL;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void* data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			result = (u8*)data;
+			if (out_size) *out_size = st.st_size;
+		}
+	}
+	close(fd); // the mapping stays valid after closing the file descriptor
+	return result;
+}
+
+// Maps an entire file into memory, read-only. The mapping shares the OS page cache, so reading from it involves no copy.
+u8* file_map_read_only(const char* filename, i64* out_size) {
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+	u8* result = NULL;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data != MAP_FAILED) {
+			result = (u8*)data;
+			if (out_size) *out_size = st.st_size;
+		}
+	}
+	close(fd); // the mapping stays valid after closing the file descriptor
+	return result;
+}
+
+// Tells the kernel how a range of a mapped file is going to be accessed (length 0 means: until the end).
+void file_map_advise(u8* data, i64 size, u64 offset, u64 length, file_access_pattern_enum pattern) {
+	if (!data || offset >= (u64)size) return;
+	if (length == 0 || offset + length > (u64)size) {
+		length = size - offset;
+	}
+	// madvise() needs a page-aligned address
+	u64 page_size = (u64)getpagesize();
+	u64 aligned_offset = offset & ~(page_size - 1);
+	length += offset - aligned_offset;
+	int advice = MADV_NORMAL;
+	switch (pattern) {
+		default:
+		case FILE_ACCESS_PATTERN_NORMAL: advice = MADV_NORMAL; break;
+		case FILE_ACCESS_PATTERN_RANDOM: advice = MADV_RANDOM; break;
+		case FILE_ACCESS_PATTERN_SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+		case FILE_ACCESS_PATTERN_WILL_NEED: advice = MADV_WILLNEED; break;
+	}
+	madvise(data + aligned_offset, length, advice);
+}
+
+void file_unmap(u8* data, i64 size) {
+	if (data) {
+		munmap(data, size);
+	}
+}
+
+// Reserves address space only; pages become usable after platform_commit_memory().
+u8* platform_reserve_memory(size_t size) {
+	void* result = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return (result == MAP_FAILED) ? NULL : (u8*)result;
+}
+
+bool platform_commit_memory(void* address, size_t size) {
+	return mprotect(address, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+// Gives the physical pages back to the OS, but keeps the address range reserved.
+void platform_decommit_memory(void* address, size_t size) {
+	madvise(address, size, MADV_DONTNEED);
+	mprotect(address, size, PROT_NONE);
+}
+
+void platform_release_memory(void* address, size_t size) {
+	munmap(address, size);
+}
+
@@ -90,6 +90,153 @@ bool is_directory(const char* path) {
 }
 
 
+#if LINUX
+static bool linux_read_sysfs_line(const char* path, char* buf, size_t buf_size) {
+	FILE* fp = fopen(path, "r");
+	if (!fp) return false;
+	bool success = (fgets(buf, (int)buf_size, fp) != NULL);
+	fclose(fp);
+	if (success) {
+		size_t len = strlen(buf);
+		if (len > 0 && buf[len-1] == '\n') buf[len-1] = '\0';
+	}
+	return success;
+}
+
+static i32 linux_read_sysfs_i32(const char* path, i32 default_value) {
+	char line[64];
+	if (!linux_read_sysfs_line(path, line, sizeof(line))) return default_value;
+	return atoi(line);
+}
+
+// Parse a sysfs CPU (or node) list such as "0-3,8-11" into the individual numbers.
+static i32 parse_cpu_list(const char* list, i32* numbers, i32 max_count) {
+	i32 count = 0;
+	const char* pos = list;
+	while (*pos) {
+		char* end = NULL;
+		long first = strtol(pos, &end, 10);
+		if (end == pos) break;
+		long last = first;
+		pos = end;
+		if (*pos == '-') {
+			++pos;
+			last = strtol(pos, &end, 10);
+			if (end == pos) break;
+			pos = end;
+		}
+		for (long i = first; i <= last && count < max_count; ++i) {
+			numbers[count++] = (i32)i;
+		}
+		if (*pos != ',') break;
+		++pos;
+	}
+	return count;
+}
+
+static i32 count_distinct_domains(i32* domain_ids, i32 count, i32 max_domain_id) {
+	bool* seen = calloc(max_domain_id + 1, sizeof(bool));
+	i32 result = 0;
+	for (i32 i = 0; i < count; ++i) {
+		i32 id = domain_ids[i];
+		if (id >= 0 && id <= max_domain_id && !seen[id]) {
+			seen[id] = true;
+			++result;
+		}
+	}
+	free(seen);
+	return result;
+}
+
+static void linux_get_cpu_topology(system_info_t* system_info) {
+	i32 cpu_count = (i32)sysconf(_SC_NPROCESSORS_CONF);
+	if (cpu_count <= 0) return;
+	cpu_topology_t* topology = calloc(cpu_count, sizeof(cpu_topology_t));
+	i32* numbers = malloc(cpu_count * sizeof(i32));
+	char path[256];
+	char line[4096];
+
+	for (i32 cpu = 0; cpu < cpu_count; ++cpu) {
+		cpu_topology_t* t = topology + cpu;
+		t->core_domain = cpu;
+		t->l2_domain = cpu;
+		t->l3_domain = cpu;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+		if (linux_read_sysfs_i32(path, -1) < 0) {
+			continue; // offline CPUs don't expose their topology
+		}
+		t->is_online = true;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+		t->package_id = linux_read_sysfs_i32(path, 0);
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+		if (linux_read_sysfs_line(path, line, sizeof(line))) {
+			i32 sibling_count = parse_cpu_list(line, numbers, cpu_count);
+			if (sibling_count > 0) {
+				t->core_domain = numbers[0];
+				for (i32 i = 0; i < sibling_count; ++i) {
+					if (numbers[i] == cpu) t->smt_index = i;
+				}
+			}
+		}
+
+		for (i32 cache_index = 0; ; ++cache_index) {
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, cache_index);
+			i32 level = linux_read_sysfs_i32(path, -1);
+			if (level < 0) break;
+			if (level != 2 && level != 3) continue;
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/type", cpu, cache_index);
+			if (linux_read_sysfs_line(path, line, sizeof(line)) && strcmp(line, "Instruction") == 0) continue;
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, cache_index);
+			if (linux_read_sysfs_line(path, line, sizeof(line)) && parse_cpu_list(line, numbers, 1) == 1) {
+				if (level == 2) t->l2_domain = numbers[0];
+				else t->l3_domain = numbers[0];
+			}
+		}
+	}
+
+	// NUMA nodes: each node lists the CPUs that belong to it.
+	i32 numa_node_count = 1;
+	i32* nodes = malloc(cpu_count * sizeof(i32));
+	if (linux_read_sysfs_line("/sys/devices/system/node/online", line, sizeof(line))) {
+		i32 node_count = parse_cpu_list(line, nodes, cpu_count);
+		numa_node_count = ATLEAST(node_count, 1);
+		for (i32 i = 0; i < node_count; ++i) {
+			snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes[i]);
+			if (linux_read_sysfs_line(path, line, sizeof(line))) {
+				i32 node_cpu_count = parse_cpu_list(line, numbers, cpu_count);
+				for (i32 j = 0; j < node_cpu_count; ++j) {
+					if (numbers[j] < cpu_count) topology[numbers[j]].numa_node = nodes[i];
+				}
+			}
+		}
+	}
+
+	// Count the distinct cores and caches among the online CPUs.
+	i32 online_count = 0;
+	i32 physical_cpu_count = 0;
+	for (i32 cpu = 0; cpu < cpu_count; ++cpu) {
+		if (!topology[cpu].is_online) continue;
+		if (topology[cpu].smt_index == 0) ++physical_cpu_count;
+		numbers[online_count] = topology[cpu].l2_domain;
+		nodes[online_count] = topology[cpu].l3_domain;
+		++online_count;
+	}
+	if (online_count > 0) {
+		system_info->physical_cpu_count = physical_cpu_count;
+		system_info->l2_cache_count = count_distinct_domains(numbers, online_count, cpu_count - 1);
+		system_info->l3_cache_count = count_distinct_domains(nodes, online_count, cpu_count - 1);
+		system_info->numa_node_count = numa_node_count;
+		system_info->cpu_topology = topology;
+		system_info->cpu_topology_count = cpu_count;
+	} else {
+		free(topology);
+	}
+	free(nodes);
+	free(numbers);
+}
+#endif
+
 void get_system_info(bool verbose) {
     system_info_t system_info = {0};
 #if WINDOWS
@@ -108,11 +255,17 @@ void get_system_info(bool verbose) {
     system_info.is_macos = true;
 #elif LINUX
     system_info.logical_cpu_count = sysconf( _SC_NPROCESSORS_ONLN );
-    system_info.physical_cpu_count = system_info.logical_cpu_count; // TODO(pvalkema): how to read this on Linux?
+    system_info.physical_cpu_count = system_info.logical_cpu_count; // overwritten below if sysfs has the topology
     system_info.os_page_size = (u32) getpagesize();
     system_info.page_alignment_mask = ~((u64)(sysconf(_SC_PAGE_SIZE) - 1));
+    linux_get_cpu_topology(&system_info);
 #endif
     if (verbose) console_print("There are %d logical CPU cores\n", system_info.logical_cpu_count);
+    if (verbose && system_info.cpu_topology) {
+        console_print("There are %d physical CPU cores, %d L2 caches, %d L3 caches, %d NUMA nodes\n",
+                      system_info.physical_cpu_count, system_info.l2_cache_count, system_info.l3_cache_count,
+                      system_info.numa_node_count);
+    }
     system_info.suggested_total_thread_count = MIN(system_info.logical_cpu_count, MAX_THREAD_COUNT);
 
     //TODO(pvalkema): think about returning this instead of setting global state.
@@ -120,23 +273,221 @@ void get_system_info(bool verbose) {
 }
 
 
+void get_thread_pool_layout(system_info_t* system_info, thread_pool_options_t* options, thread_pool_layout_t* layout) {
+	memset(layout, 0, sizeof(*layout));
+	i32 max_worker_thread_count = MAX_THREAD_COUNT - 1; // the main thread is thread 0
+
+	// Decode threads are CPU-bound: by default, use one per physical core (SMT siblings compete for the same
+	// execution units and caches), minus one for the main thread.
+	i32 usable_cpu_count = options->decode_threads_use_smt ? system_info->logical_cpu_count : system_info->physical_cpu_count;
+	i32 decode_thread_count = options->decode_thread_count > 0 ? options->decode_thread_count : usable_cpu_count - 1;
+	layout->decode_thread_count = CLAMP(decode_thread_count, 1, max_worker_thread_count);
+
+	// I/O threads mostly sleep, waiting on the disk or network. A negative count disables them altogether
+	// (I/O tasks then run on the decode threads).
+	i32 io_thread_count = options->io_thread_count;
+	if (io_thread_count == 0) {
+		io_thread_count = ATLEAST(2, system_info->numa_node_count);
+	}
+	layout->io_thread_count = CLAMP(io_thread_count, 0, max_worker_thread_count - layout->decode_thread_count);
+
+	for (i32 i = 0; i < layout->decode_thread_count; ++i) {
+		layout->decode_thread_cpus[i] = -1;
+	}
+	cpu_topology_t* topology = system_info->cpu_topology;
+	i32 cpu_count = system_info->cpu_topology_count;
+	if (!topology) return;
+
+	if (options->pin_decode_threads) {
+		// Spread the decode threads round-robin over the L3 caches (and therefore over the NUMA nodes), so that a
+		// partially used pool still gets the most cache and memory bandwidth. SMT siblings come last, if allowed.
+		i32* cpu_order = malloc(cpu_count * sizeof(i32));
+		i32* rank_in_l3 = calloc(cpu_count, sizeof(i32));
+		i32* l3_fill = calloc(cpu_count, sizeof(i32));
+		i32 max_smt_index = options->decode_threads_use_smt ? INT32_MAX : 0;
+		i32 max_rank = 0;
+		for (i32 cpu = 0; cpu < cpu_count; ++cpu) {
+			cpu_topology_t* t = topology + cpu;
+			if (!t->is_online || t->smt_index > max_smt_index) continue;
+			i32 l3_domain = CLAMP(t->l3_domain, 0, cpu_count - 1);
+			rank_in_l3[cpu] = l3_fill[l3_domain]++ + t->smt_index * cpu_count;
+			max_rank = ATLEAST(max_rank, rank_in_l3[cpu]);
+		}
+		i32 order_count = 0;
+		for (i32 rank = 0; rank <= max_rank && order_count < cpu_count; ++rank) {
+			for (i32 cpu = 0; cpu < cpu_count; ++cpu) {
+				cpu_topology_t* t = topology + cpu;
+				if (t->is_online && t->smt_index <= max_smt_index && rank_in_l3[cpu] == rank) {
+					cpu_order[order_count++] = cpu;
+				}
+			}
+		}
+		// If there are more decode threads than CPUs to pin them to, leave the surplus threads unpinned.
+		for (i32 i = 0; i < ATMOST(order_count, layout->decode_thread_count); ++i) {
+			layout->decode_thread_cpus[i] = cpu_order[i];
+		}
+		free(l3_fill);
+		free(rank_in_l3);
+		free(cpu_order);
+	}
+
+	if (options->pin_io_threads && layout->io_thread_count > 0) {
+		// Keep the I/O threads on the SMT siblings, out of the way of the decode threads. Without SMT, they may
+		// only use CPUs that have no decode thread pinned to them.
+		for (i32 cpu = 0; cpu < cpu_count && layout->io_thread_cpu_count < COUNT(layout->io_thread_cpus); ++cpu) {
+			if (topology[cpu].is_online && topology[cpu].smt_index > 0) {
+				layout->io_thread_cpus[layout->io_thread_cpu_count++] = cpu;
+			}
+		}
+		if (layout->io_thread_cpu_count == 0) {
+			for (i32 cpu = 0; cpu < cpu_count && layout->io_thread_cpu_count < COUNT(layout->io_thread_cpus); ++cpu) {
+				if (!topology[cpu].is_online) continue;
+				bool is_used = false;
+				for (i32 i = 0; i < layout->decode_thread_count; ++i) {
+					if (layout->decode_thread_cpus[i] == cpu) is_used = true;
+				}
+				if (!is_used) {
+					layout->io_thread_cpus[layout->io_thread_cpu_count++] = cpu;
+				}
+			}
+		}
+	}
+}
+
+static inline size_t round_up_to_commit_granularity(size_t size) {
+	return ((size + ARENA_COMMIT_GRANULARITY - 1) / ARENA_COMMIT_GRANULARITY) * ARENA_COMMIT_GRANULARITY;
+}
+
+void init_growable_arena(arena_t* arena, size_t block_reserve_size, size_t retained_size) {
+	memset(arena, 0, sizeof(arena_t));
+	block_reserve_size = round_up_to_commit_granularity(block_reserve_size);
+	arena->base = platform_reserve_memory(block_reserve_size);
+	if (!arena->base) {
+		console_print_error("init_growable_arena(): could not reserve %zu bytes of address space\n", block_reserve_size);
+		fatal_error();
+	}
+	arena->size = block_reserve_size;
+	arena->block_count = 1;
+	arena->is_growable = true;
+	arena->block_reserve_size = block_reserve_size;
+	arena->retained_size = round_up_to_commit_granularity(retained_size);
+}
+
+void destroy_growable_arena(arena_t* arena) {
+	ASSERT(arena->is_growable);
+	arena_pop_blocks(arena, NULL);
+	platform_release_memory(arena->base, arena->size);
+	memset(arena, 0, sizeof(arena_t));
+}
+
+// Each chained block starts with a header that remembers the state of the previous block.
+typedef struct arena_block_header_t {
+	u8* prev_base;
+	size_t prev_size;
+	size_t prev_used;
+	size_t prev_committed;
+} arena_block_header_t;
+STATIC_ASSERT(sizeof(arena_block_header_t) <= ARENA_BLOCK_HEADER_SIZE);
+
+void arena_grow(arena_t* arena, size_t size) {
+	if (!arena->is_growable) {
+		console_print_error("arena_push_size(): arena is full (%zu bytes requested, %zu bytes left)\n", size, arena->size - arena->used);
+		fatal_error();
+	}
+	if (arena->used + size <= arena->size) {
+		// Commit more of the current block
+		size_t new_committed = MIN(arena->size, round_up_to_commit_granularity(arena->used + size));
+		if (!platform_commit_memory(arena->base + arena->committed, new_committed - arena->committed)) {
+			console_print_error("arena_grow(): out of memory (could not commit %zu bytes)\n", new_committed - arena->committed);
+			fatal_error();
+		}
+		arena->committed = new_committed;
+	} else {
+		// Chain a new block; the previous blocks stay where they are, so existing pointers remain valid.
+		size_t block_size = MAX(arena->block_reserve_size, round_up_to_commit_granularity(ARENA_BLOCK_HEADER_SIZE + size));
+		size_t commit_size = round_up_to_commit_granularity(ARENA_BLOCK_HEADER_SIZE + size);
+		u8* block = platform_reserve_memory(block_size);
+		if (!block || !platform_commit_memory(block, commit_size)) {
+			console_print_error("arena_grow(): out of memory (could not allocate a new block of %zu bytes)\n", block_size);
+			fatal_error();
+		}
+		arena_block_header_t* header = (arena_block_header_t*)block;
+		header->prev_base = arena->base;
+		header->prev_size = arena->size;
+		header->prev_used = arena->used;
+		header->prev_committed = arena->committed;
+		arena->used_in_previous_blocks += arena->used;
+		arena->base = block;
+		arena->size = block_size;
+		arena->used = ARENA_BLOCK_HEADER_SIZE;
+		arena->committed = commit_size;
+		++arena->block_count;
+	}
+}
+
+// Releases chained blocks until the block starting at 'base' is the current block again (NULL: until the first block).
+void arena_pop_blocks(arena_t* arena, u8* base) {
+	while (arena->block_count > 1 && arena->base != base) {
+		arena_block_header_t* header = (arena_block_header_t*)arena->base;
+		u8* block = arena->base;
+		size_t block_size = arena->size;
+		arena->base = header->prev_base;
+		arena->size = header->prev_size;
+		arena->used = header->prev_used;
+		arena->committed = header->prev_committed;
+		arena->used_in_previous_blocks -= arena->used;
+		--arena->block_count;
+		platform_release_memory(block, block_size);
+	}
+	ASSERT(base == NULL || arena->base == base);
+}
+
+// Called when the arena is fully released. Gives committed memory back to the OS, down to the larger of the
+// retained size and the recent peak usage. Waiting for a number of releases avoids thrashing when many tasks
+// in a row need a bit more than the retained size; a big spike is released right away.
+void arena_trim(arena_t* arena) {
+	ASSERT(arena->is_growable && arena->block_count == 1);
+	++arena->releases_since_trim;
+	bool is_spike = arena->committed > 4 * MAX(arena->retained_size, ARENA_COMMIT_GRANULARITY);
+	if (!is_spike && arena->releases_since_trim < 64) {
+		return;
+	}
+	size_t target = round_up_to_commit_granularity(MAX(arena->retained_size, is_spike ? arena->used : arena->peak_used));
+	if (arena->committed > target) {
+		platform_decommit_memory(arena->base + target, arena->committed - target);
+		arena->committed = target;
+	}
+	arena->high_water_mark = MAX(arena->high_water_mark, arena->peak_used);
+	arena->peak_used = arena_get_total_used(arena);
+	arena->releases_since_trim = 0;
+}
+
+static thread_memory_t* thread_memories[MAX_THREAD_COUNT];
+
 void init_thread_memory(i32 logical_thread_index, system_info_t* system_info) {
-	// Allocate a private memory buffer
-	u64 thread_memory_size = MEGABYTES(16);
-	local_thread_memory = (thread_memory_t*) malloc(thread_memory_size); // how much actually needed?
+	local_thread_memory = (thread_memory_t*) calloc(1, sizeof(thread_memory_t));
 	thread_memory_t* thread_memory = local_thread_memory;
-	memset(thread_memory, 0, sizeof(thread_memory_t));
 #if !WINDOWS
 	// TODO(pvalkema): think about whether implement creation of async I/O events is needed here
 #endif
-	thread_memory->thread_memory_raw_size = thread_memory_size;
-
-    u32 os_page_size = system_info->os_page_size;
-	thread_memory->aligned_rest_of_thread_memory = (void*)
-			((((u64)thread_memory + sizeof(thread_memory_t) + os_page_size - 1) / os_page_size) * os_page_size); // round up to next page boundary
-	thread_memory->thread_memory_usable_size = thread_memory_size - ((u64)thread_memory->aligned_rest_of_thread_memory - (u64)thread_memory);
-	init_arena(&thread_memory->temp_arena, thread_memory->thread_memory_usable_size, thread_memory->aligned_rest_of_thread_memory);
+	thread_memory->logical_thread_index = logical_thread_index;
+	init_growable_arena(&thread_memory->temp_arena, THREAD_TEMP_ARENA_RESERVE_SIZE, THREAD_TEMP_ARENA_RETAINED_SIZE);
+	if (logical_thread_index >= 0 && logical_thread_index < MAX_THREAD_COUNT) {
+		thread_memories[logical_thread_index] = thread_memory;
+	}
+}
 
+// Note: the numbers are read without synchronization, so they may be slightly out of date.
+void print_thread_memory_stats() {
+	console_print("Thread temp memory (committed / high-water mark):\n");
+	for (i32 i = 0; i < MAX_THREAD_COUNT; ++i) {
+		thread_memory_t* thread_memory = thread_memories[i];
+		if (!thread_memory) continue;
+		arena_t* arena = &thread_memory->temp_arena;
+		size_t high_water_mark = MAX(arena->high_water_mark, arena->peak_used);
+		console_print("    thread %2d: %6.1f MiB / %6.1f MiB%s\n", i, (double)arena->committed / MEGABYTES(1),
+		              (double)high_water_mark / MEGABYTES(1), arena->block_count > 1 ? " (chained)" : "");
+	}
 }
 
 
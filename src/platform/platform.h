@@ -74,6 +74,14 @@ typedef int file_handle_t;
 typedef FILE* file_stream_t;
 #endif
 
+// Hints for how a memory-mapped file is going to be accessed (see file_map_advise()).
+typedef enum file_access_pattern_enum {
+	FILE_ACCESS_PATTERN_NORMAL = 0,
+	FILE_ACCESS_PATTERN_RANDOM = 1,     // e.g. viewing: tiles are requested from all over the file
+	FILE_ACCESS_PATTERN_SEQUENTIAL = 2, // e.g. exporting: the file is scanned from front to back
+	FILE_ACCESS_PATTERN_WILL_NEED = 3,  // the range will be accessed soon: start reading it in the background
+} file_access_pattern_enum;
+
 typedef struct platform_thread_info_t {
 	i32 logical_thread_index;
 	work_queue_t* queue;
@@ -89,22 +97,56 @@ typedef struct {
 #else
 	// TODO: implement this
 #endif
-	u64 thread_memory_raw_size;
-	u64 thread_memory_usable_size; // free space from aligned_rest_of_thread_memory onward
-	void* aligned_rest_of_thread_memory;
+	i32 logical_thread_index;
 	u32 pbo;
-	arena_t temp_arena;
+	arena_t temp_arena; // growable; see THREAD_TEMP_ARENA_RESERVE_SIZE
 } thread_memory_t;
 
+// Placement of a single logical CPU in the machine's core/cache/memory hierarchy (currently only filled in on Linux).
+// Cache and core 'domains' are identified by the lowest numbered logical CPU that shares them.
+typedef struct cpu_topology_t {
+	bool is_online;
+	i32 package_id;
+	i32 core_domain;  // logical CPUs that are SMT siblings on the same physical core share this
+	i32 smt_index;    // 0 for the first hardware thread of a physical core, 1 for its sibling, etc.
+	i32 l2_domain;
+	i32 l3_domain;
+	i32 numa_node;
+} cpu_topology_t;
+
 typedef struct system_info_t {
     u32 os_page_size;
     u64 page_alignment_mask;
     i32 physical_cpu_count;
     i32 logical_cpu_count;
     i32 suggested_total_thread_count;
+    i32 l2_cache_count;
+    i32 l3_cache_count;
+    i32 numa_node_count;
+    cpu_topology_t* cpu_topology; // indexed by logical CPU number; NULL if unknown
+    i32 cpu_topology_count;
     bool is_macos;
 } system_info_t;
 
+// Sizing and pinning policy for the worker threads, configurable in the [Threads] section of slidescape.ini.
+// Decode threads are CPU-bound (they run the global work queue); I/O threads mostly wait on the disk or network
+// (they run the global I/O work queue). A thread count of 0 means 'choose automatically'.
+typedef struct thread_pool_options_t {
+	i32 decode_thread_count;
+	bool decode_threads_use_smt;
+	bool pin_decode_threads;
+	i32 io_thread_count;
+	bool pin_io_threads;
+} thread_pool_options_t;
+
+typedef struct thread_pool_layout_t {
+	i32 decode_thread_count;
+	i32 io_thread_count;
+	i32 decode_thread_cpus[MAX_THREAD_COUNT]; // logical CPU for each decode thread, or -1 if unpinned
+	i32 io_thread_cpus[MAX_THREAD_COUNT];
+	i32 io_thread_cpu_count;                  // I/O threads may run on any CPU in io_thread_cpus (if pinned)
+} thread_pool_layout_t;
+
 
 typedef struct directory_listing_t directory_listing_t;
 
@@ -148,14 +190,29 @@ void file_stream_close(file_stream_t file_stream);
 file_handle_t open_file_handle_for_simultaneous_access(const char* filename);
 void file_handle_close(file_handle_t file_handle);
 size_t file_handle_read_at_offset(void* dest, file_handle_t file_handle, u64 offset, size_t bytes_to_read);
+u8* file_map_copy_on_write(const char* filename, i64* out_size);
+u8* file_map_read_only(const char* filename, i64* out_size);
+void file_map_advise(u8* data, i64 size, u64 offset, u64 length, file_access_pattern_enum pattern);
+void file_unmap(u8* data, i64 size);
+u8* platform_reserve_memory(size_t size);
+bool platform_commit_memory(void* address, size_t size);
+void platform_decommit_memory(void* address, size_t size);
+void platform_release_memory(void* address, size_t size);
 
 
 bool file_exists(const char* filename);
 bool is_directory(const char* path);
 
 void get_system_info(bool verbose);
+void get_thread_pool_layout(system_info_t* system_info, thread_pool_options_t* options, thread_pool_layout_t* layout);
+
+// Each thread's temp arena reserves address space for its first block, but only commits what is used.
+// After spikes, committed memory above the retained size is given back to the OS.
+#define THREAD_TEMP_ARENA_RESERVE_SIZE MEGABYTES(256)
+#define THREAD_TEMP_ARENA_RETAINED_SIZE MEGABYTES(16)
 
 void init_thread_memory(i32 logical_thread_index, system_info_t* system_info);
+void print_thread_memory_stats();
 
 // globals
 #if defined(PLATFORM_IMPL)
@@ -174,14 +231,22 @@ extern const char** g_argv;
 extern system_info_t global_system_info;
 extern i32 global_worker_thread_count;
 extern i32 global_active_worker_thread_count;
+extern i32 global_io_worker_thread_count;
+extern thread_pool_options_t global_thread_pool_options INIT(= {.pin_decode_threads = true});
 extern work_queue_t global_completion_queue;
 
 extern bool is_verbose_mode INIT(= false);
+extern bool memory_mapped_files_enabled INIT(= false); // read tile data straight from a mapping of the file (no copy)
 
 
 #undef INIT
 #undef extern
 
+// Tasks that mostly wait on the disk or network should go here, so they don't tie up the decode threads.
+static inline work_queue_t* get_io_work_queue() {
+	return (global_io_worker_thread_count > 0) ? &global_io_work_queue : &global_work_queue;
+}
+
 #ifdef __cplusplus
 }
 #endif
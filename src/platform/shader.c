@@ -186,7 +186,8 @@ void load_shader(u32 shader, const char* source_filename) {
 
 }
 
-u32 load_basic_shader_program(const char* vert_filename, const char* frag_filename) {
+// Returns 0 if the program could not be built (for optional shaders, where the caller can fall back to something else).
+u32 load_shader_program_if_possible(const char* vert_filename, const char* frag_filename) {
 	u32 vertex_shader = glCreateShader(GL_VERTEX_SHADER);
 	u32 fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
 
@@ -206,7 +207,8 @@ u32 load_basic_shader_program(const char* vert_filename, const char* frag_filena
 			char info_log[2048];
 			glGetProgramInfoLog(shader_program, sizeof(info_log), NULL, info_log);
 			console_print_error("Error: shader linking failed: %s", info_log);
-			fatal_error();
+			glDeleteProgram(shader_program);
+			shader_program = 0;
 		}
 	}
 
@@ -216,6 +218,14 @@ u32 load_basic_shader_program(const char* vert_filename, const char* frag_filena
 	return shader_program;
 }
 
+u32 load_basic_shader_program(const char* vert_filename, const char* frag_filename) {
+	u32 shader_program = load_shader_program_if_possible(vert_filename, frag_filename);
+	if (!shader_program) {
+		fatal_error();
+	}
+	return shader_program;
+}
+
 i32 get_attrib(i32 program, const char *name) {
 	i32 attribute = glGetAttribLocation(program, name);
 	if(attribute == -1)
@@ -50,6 +50,7 @@
 
 #include "stringutils.h"
 #include "intrinsics.h"
+#include "pixel_buffer_pool.h"
 
 #include "gui.h"
 
@@ -1678,6 +1679,7 @@ void win32_init_multithreading() {
 
 	global_work_queue = work_queue_create("/worksem", 1024); // Queue for newly submitted tasks
 	global_completion_queue = work_queue_create("/completionsem", 1024); // Message queue for completed tasks
+	pixel_buffer_pool_init(MEGABYTES(pixel_buffer_pool_depot_size_in_mb));
 	global_export_completion_queue = work_queue_create("/exportcompletionsem", 1024); // Message queue for export task
 
 	// NOTE: the main thread is considered thread 0.
@@ -1991,9 +1993,11 @@ int main() {
 	win32_init_main_window(app_state);
 
 	// Load OpenSlide in the background, we might not need it immediately.
+	WORK_QUEUE_NAME_TASK(load_openslide_task);
 	work_queue_submit_task(&global_work_queue, load_openslide_task, NULL, 0);
 
 	// Load DICOM support in the background
+	WORK_QUEUE_NAME_TASK(load_dicom_task);
 	work_queue_submit_task(&global_work_queue, load_dicom_task, NULL, 0);
 
 	win32_init_input();
@@ -196,7 +196,7 @@ file_stream_t file_stream_open_for_writing(const char* filename) {
 
 	size_t filename_len = strlen(filename) + 1;
 	wchar_t* wide_filename = win32_string_widen(filename, filename_len, (wchar_t*) alloca(2 * filename_len));
-	HANDLE handle = CreateFileW(wide_filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+	HANDLE handle = CreateFileW(wide_filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
 	                            FILE_ATTRIBUTE_NORMAL /* | FILE_FLAG_SEQUENTIAL_SCAN */
 		/*| FILE_FLAG_NO_BUFFERING |*/ /* | FILE_FLAG_OVERLAPPED*/,
 		                        NULL);
@@ -262,3 +262,90 @@ void file_stream_close(file_stream_t file_stream) {
 	}
 }
 
+// Maps an entire file into memory. The mapping is private (copy-on-write): pages may be modified in memory,
+// but the changes are never written back to the file.
+u8* file_map_copy_on_write(const char* filename, i64* out_size) {
+	size_t filename_len = strlen(filename) + 1;
+	wchar_t* wide_filename = win32_string_widen(filename, filename_len, (wchar_t*) alloca(2 * filename_len));
+	HANDLE handle = CreateFileW(wide_filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+	                            FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+	u8* result = NULL;
+	LARGE_INTEGER filesize = {0};
+	if (GetFileSizeEx(handle, &filesize) && filesize.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingW(handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (mapping) {
+			result = (u8*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+			if (result) {
+				if (out_size) *out_size = filesize.QuadPart;
+			} else {
+				win32_diagnostic("MapViewOfFile");
+			}
+			CloseHandle(mapping); // the view keeps the mapping alive
+		} else {
+			win32_diagnostic("CreateFileMappingW");
+		}
+	}
+	CloseHandle(handle);
+	return result;
+}
+
+// Maps an entire file into memory, read-only. The mapping shares the OS file cache, so reading from it involves no copy.
+u8* file_map_read_only(const char* filename, i64* out_size) {
+	size_t filename_len = strlen(filename) + 1;
+	wchar_t* wide_filename = win32_string_widen(filename, filename_len, (wchar_t*) alloca(2 * filename_len));
+	HANDLE handle = CreateFileW(wide_filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+	                            FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+	u8* result = NULL;
+	LARGE_INTEGER filesize = {0};
+	if (GetFileSizeEx(handle, &filesize) && filesize.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingW(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping) {
+			result = (u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (result) {
+				if (out_size) *out_size = filesize.QuadPart;
+			} else {
+				win32_diagnostic("MapViewOfFile");
+			}
+			CloseHandle(mapping); // the view keeps the mapping alive
+		} else {
+			win32_diagnostic("CreateFileMappingW");
+		}
+	}
+	CloseHandle(handle);
+	return result;
+}
+
+void file_map_advise(u8* data, i64 size, u64 offset, u64 length, file_access_pattern_enum pattern) {
+	// TODO: use PrefetchVirtualMemory() for FILE_ACCESS_PATTERN_WILL_NEED (Windows 8 and later)
+}
+
+void file_unmap(u8* data, i64 size) {
+	if (data) {
+		UnmapViewOfFile(data);
+	}
+}
+
+// Reserves address space only; pages become usable after platform_commit_memory().
+u8* platform_reserve_memory(size_t size) {
+	return (u8*)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+bool platform_commit_memory(void* address, size_t size) {
+	return VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+}
+
+// Gives the physical pages back to the OS, but keeps the address range reserved.
+void platform_decommit_memory(void* address, size_t size) {
+	VirtualFree(address, size, MEM_DECOMMIT);
+}
+
+void platform_release_memory(void* address, size_t size) {
+	VirtualFree(address, 0, MEM_RELEASE);
+}
+
@@ -36,6 +36,226 @@
 #include <semaphore.h>
 #endif
 
+// The thread's current queue and thread index are set while executing a task, so that tasks submitted from within
+// a task can go into the thread's own deque.
+static THREAD_LOCAL work_queue_t* work_queue_current_queue;
+static THREAD_LOCAL i32 work_queue_current_thread_index;
+
+// Peak temp arena usage for each kind of task (identified by its callback), for diagnostics.
+#define WORK_QUEUE_TASK_MEMORY_STATS_SLOTS 64
+typedef struct work_queue_task_memory_stats_t {
+	work_queue_callback_t* volatile callback;
+	const char* volatile name; // set by work_queue_set_task_name()
+	volatile i64 task_count;
+	volatile u64 peak_temp_memory;
+} work_queue_task_memory_stats_t;
+static work_queue_task_memory_stats_t work_queue_task_memory_stats[WORK_QUEUE_TASK_MEMORY_STATS_SLOTS];
+
+// Finds (or claims) the slot for the callback; returns NULL if the table is full.
+static work_queue_task_memory_stats_t* work_queue_get_task_memory_stats(work_queue_callback_t* callback) {
+	u32 hash = (u32)(((uintptr_t)callback >> 4) * 2654435761u);
+	for (i32 i = 0; i < WORK_QUEUE_TASK_MEMORY_STATS_SLOTS; ++i) {
+		work_queue_task_memory_stats_t* stats = work_queue_task_memory_stats + ((hash + i) % WORK_QUEUE_TASK_MEMORY_STATS_SLOTS);
+		if (stats->callback != callback) {
+			if (stats->callback != NULL || !atomic_compare_exchange_ptr((void* volatile*)&stats->callback, (void*)callback, NULL)) {
+				if (stats->callback != callback) continue; // slot taken by another callback
+			}
+		}
+		return stats;
+	}
+	return NULL;
+}
+
+static void work_queue_record_task_memory_usage(work_queue_callback_t* callback, u64 peak_temp_memory) {
+	work_queue_task_memory_stats_t* stats = work_queue_get_task_memory_stats(callback);
+	if (!stats) return; // table is full: not recorded
+	atomic_add_i64(&stats->task_count, 1);
+	for (;;) {
+		u64 old_peak = stats->peak_temp_memory;
+		if (peak_temp_memory <= old_peak || atomic_compare_exchange_u64(&stats->peak_temp_memory, peak_temp_memory, old_peak)) {
+			break;
+		}
+	}
+}
+
+void work_queue_set_task_name(work_queue_callback_t* callback, const char* name) {
+	work_queue_task_memory_stats_t* stats = work_queue_get_task_memory_stats(callback);
+	if (stats && stats->name == NULL) {
+		stats->name = name;
+	}
+}
+
+void work_queue_print_task_memory_stats() {
+	console_print("Peak temp memory per task type (task count, peak):\n");
+	for (i32 i = 0; i < WORK_QUEUE_TASK_MEMORY_STATS_SLOTS; ++i) {
+		work_queue_task_memory_stats_t* stats = work_queue_task_memory_stats + i;
+		if (!stats->callback || stats->task_count == 0) continue;
+		char unnamed[32];
+		const char* name = stats->name;
+		if (!name) {
+			snprintf(unnamed, sizeof(unnamed), "(unnamed task %p)", (void*)stats->callback);
+			name = unnamed;
+		}
+		console_print("    %-48s %8lld tasks, %8.2f MiB\n", name, (long long)stats->task_count,
+		              (double)stats->peak_temp_memory / MEGABYTES(1));
+	}
+}
+
+static inline void work_queue_spin_lock(i32 volatile* lock) {
+	while (!atomic_compare_exchange(lock, 1, 0)) {
+		while (*lock) {
+			// spin
+		}
+	}
+}
+
+static inline void work_queue_spin_unlock(i32 volatile* lock) {
+	atomic_compare_exchange(lock, 0, 1);
+}
+
+static inline void work_queue_ring_lock(work_queue_ring_t* ring) {
+	work_queue_spin_lock(&ring->lock);
+}
+
+static inline void work_queue_ring_unlock(work_queue_ring_t* ring) {
+	work_queue_spin_unlock(&ring->lock);
+}
+
+// Must be called with the ring locked.
+static void work_queue_ring_grow(work_queue_ring_t* ring) {
+	i32 new_capacity = ATLEAST(16, ring->capacity * 2);
+	work_queue_entry_t* new_entries = malloc(new_capacity * sizeof(work_queue_entry_t));
+	for (i32 i = 0; i < ring->count; ++i) {
+		new_entries[i] = ring->entries[(ring->head + i) % ring->capacity];
+	}
+	if (ring->entries) {
+		free(ring->entries);
+	}
+	ring->entries = new_entries;
+	ring->capacity = new_capacity;
+	ring->head = 0;
+}
+
+static void work_queue_ring_push_back(work_queue_ring_t* ring, work_queue_entry_t* entry) {
+	work_queue_ring_lock(ring);
+	if (ring->count == ring->capacity) {
+		work_queue_ring_grow(ring);
+	}
+	ring->entries[(ring->head + ring->count) % ring->capacity] = *entry;
+	++ring->count;
+	work_queue_ring_unlock(ring);
+}
+
+static bool work_queue_ring_pop_front(work_queue_ring_t* ring, work_queue_entry_t* out_entry) {
+	if (ring->count == 0) {
+		return false; // early out without locking
+	}
+	bool result = false;
+	work_queue_ring_lock(ring);
+	if (ring->count > 0) {
+		*out_entry = ring->entries[ring->head];
+		ring->head = (ring->head + 1) % ring->capacity;
+		--ring->count;
+		result = true;
+	}
+	work_queue_ring_unlock(ring);
+	return result;
+}
+
+static bool work_queue_ring_pop_back(work_queue_ring_t* ring, work_queue_entry_t* out_entry) {
+	if (ring->count == 0) {
+		return false; // early out without locking
+	}
+	bool result = false;
+	work_queue_ring_lock(ring);
+	if (ring->count > 0) {
+		--ring->count;
+		*out_entry = ring->entries[(ring->head + ring->count) % ring->capacity];
+		result = true;
+	}
+	work_queue_ring_unlock(ring);
+	return result;
+}
+
+static void work_queue_ring_destroy(work_queue_ring_t* ring) {
+	if (ring->entries) {
+		free(ring->entries);
+	}
+	memset(ring, 0, sizeof(*ring));
+}
+
+static i32 work_queue_payload_class_for_size(size_t size) {
+	i32 class_index = 0;
+	while (((size_t)1 << (WORK_QUEUE_PAYLOAD_MIN_CLASS_SHIFT + class_index)) < size) {
+		++class_index;
+	}
+	return class_index;
+}
+
+static void* work_queue_payload_alloc(work_queue_t* queue, size_t size) {
+	work_queue_payload_storage_t* storage = queue->payload_storage;
+	if (size > ((size_t)1 << WORK_QUEUE_PAYLOAD_MAX_CLASS_SHIFT)) {
+		void* result = malloc(size);
+		if (!result) fatal_error("work_queue_payload_alloc(): out of memory");
+		atomic_add_i64(&storage->payloads_in_use, 1);
+		return result;
+	}
+	i32 class_index = work_queue_payload_class_for_size(size);
+	size_t class_size = (size_t)1 << (WORK_QUEUE_PAYLOAD_MIN_CLASS_SHIFT + class_index);
+	void* result = NULL;
+	work_queue_spin_lock(&storage->lock);
+	if (storage->free_lists[class_index]) {
+		result = storage->free_lists[class_index];
+		storage->free_lists[class_index] = *(void**)result;
+	} else {
+		if (storage->chunk_bytes_left < class_size) {
+			// Start a new chunk; whatever is left of the old one is not used anymore.
+			// Note: the first 64 bytes hold the link to the previous chunk, so that the slots stay cache line aligned.
+			u8* chunk = (u8*)malloc(WORK_QUEUE_PAYLOAD_CHUNK_SIZE);
+			if (!chunk) fatal_error("work_queue_payload_alloc(): out of memory");
+			*(void**)chunk = storage->chunks;
+			storage->chunks = chunk;
+			++storage->chunk_count;
+			storage->chunk_cursor = chunk + 64;
+			storage->chunk_bytes_left = WORK_QUEUE_PAYLOAD_CHUNK_SIZE - 64;
+		}
+		result = storage->chunk_cursor;
+		storage->chunk_cursor += class_size;
+		storage->chunk_bytes_left -= class_size;
+	}
+	atomic_add_i64(&storage->payloads_in_use, 1);
+	work_queue_spin_unlock(&storage->lock);
+	return result;
+}
+
+static void work_queue_payload_free(work_queue_t* queue, void* payload, size_t size) {
+	work_queue_payload_storage_t* storage = queue->payload_storage;
+	if (size > ((size_t)1 << WORK_QUEUE_PAYLOAD_MAX_CLASS_SHIFT)) {
+		free(payload);
+		atomic_add_i64(&storage->payloads_in_use, -1);
+		return;
+	}
+	i32 class_index = work_queue_payload_class_for_size(size);
+	work_queue_spin_lock(&storage->lock);
+	*(void**)payload = storage->free_lists[class_index];
+	storage->free_lists[class_index] = payload;
+	atomic_add_i64(&storage->payloads_in_use, -1);
+	work_queue_spin_unlock(&storage->lock);
+}
+
+static void work_queue_payload_storage_destroy(work_queue_payload_storage_t* storage) {
+	if (storage->payloads_in_use != 0) {
+		console_print_error("work_queue_destroy(): %lld task payloads were never released\n", (long long)storage->payloads_in_use);
+	}
+	void* chunk = storage->chunks;
+	while (chunk) {
+		void* prev_chunk = *(void**)chunk;
+		free(chunk);
+		chunk = prev_chunk;
+	}
+	memset(storage, 0, sizeof(*storage));
+}
+
 work_queue_t work_queue_create(const char* semaphore_name, i32 entry_count) {
 	work_queue_t queue = {0};
 
@@ -46,15 +266,32 @@ work_queue_t work_queue_create(const char* semaphore_name, i32 entry_count) {
 #else
 	queue.semaphore = sem_open(semaphore_name, O_CREAT, 0644, semaphore_initial_count);
 #endif
-	queue.entry_count = entry_count + 1; // add safety margin to detect when queue is about to overflow
-	queue.entries = calloc(1, (entry_count + 1) * sizeof(work_queue_entry_t));
+	queue.entry_count = entry_count + 1;
+	for (i32 i = 0; i < WORK_QUEUE_PRIORITY_COUNT; ++i) {
+		queue.lanes[i].capacity = queue.entry_count;
+		queue.lanes[i].entries = calloc(1, queue.entry_count * sizeof(work_queue_entry_t));
+	}
+	// Note: the deques themselves are allocated on first use.
+	queue.thread_deques = calloc(1, MAX_THREAD_COUNT * sizeof(work_queue_ring_t));
+	queue.payload_storage = calloc(1, sizeof(work_queue_payload_storage_t));
 	return queue;
 }
 
 void work_queue_destroy(work_queue_t* queue) {
-	if (queue->entries) {
-		free(queue->entries);
-		queue->entries = NULL;
+	for (i32 i = 0; i < WORK_QUEUE_PRIORITY_COUNT; ++i) {
+		work_queue_ring_destroy(queue->lanes + i);
+	}
+	if (queue->thread_deques) {
+		for (i32 i = 0; i < MAX_THREAD_COUNT; ++i) {
+			work_queue_ring_destroy(queue->thread_deques + i);
+		}
+		free(queue->thread_deques);
+		queue->thread_deques = NULL;
+	}
+	if (queue->payload_storage) {
+		work_queue_payload_storage_destroy(queue->payload_storage);
+		free(queue->payload_storage);
+		queue->payload_storage = NULL;
 	}
 #if WINDOWS
 	CloseHandle(queue->semaphore);
@@ -65,58 +302,159 @@ void work_queue_destroy(work_queue_t* queue) {
 }
 
 i32 work_queue_get_entry_count(work_queue_t* queue) {
-	i32 count = queue->next_entry_to_submit - queue->next_entry_to_execute;
-	while (count < 0) {
-		count += queue->entry_count;
+	i32 count = 0;
+	for (i32 i = 0; i < WORK_QUEUE_PRIORITY_COUNT; ++i) {
+		count += queue->lanes[i].count;
+	}
+	for (i32 i = 0; i < queue->thread_deques_in_use; ++i) {
+		count += queue->thread_deques[i].count;
 	}
 	return count;
 }
 
+static bool work_queue_push_entry(work_queue_t* queue, work_queue_entry_t* entry, work_queue_priority_enum priority);
+
 // TODO: add optional refcount increment
-bool work_queue_submit(work_queue_t* queue, work_queue_callback_t callback, u32 task_identifier, void* userdata, size_t userdata_size) {
+static bool work_queue_submit_to_lane(work_queue_t* queue, work_queue_callback_t callback, u32 task_identifier,
+                                      work_queue_priority_enum priority, work_queue_cancel_token_t* cancel_token,
+                                      work_queue_callback_t cancel_callback, work_queue_task_group_t* task_group,
+                                      void* userdata, size_t userdata_size) {
 	if (!queue) {
 		fatal_error("work_queue_add_entry(): queue is NULL");
 	}
-	if (userdata_size > sizeof(((work_queue_entry_t*)0)->userdata)) {
+	if (userdata_size > UINT32_MAX) {
 		fatal_error("work_queue_add_entry(): userdata_size overflows available space");
 	}
-	for (i32 tries = 0; tries < 1000; ++tries) {
-		// Circular FIFO buffer
-		i32 entry_to_submit = queue->next_entry_to_submit;
-		i32 new_next_entry_to_submit = (queue->next_entry_to_submit + 1) % queue->entry_count;
-		if (new_next_entry_to_submit == queue->next_entry_to_execute) {
-			// TODO: fix multithreading problem: completion queue overflowing
-			console_print_error("Warning: work queue is overflowing - job is cancelled\n");
-			return false;
-		}
+	ASSERT(priority >= 0 && priority < WORK_QUEUE_PRIORITY_COUNT);
+
+	work_queue_entry_t entry = { .is_valid = true, .callback = callback, .task_identifier = task_identifier,
+	                             .cancel_callback = cancel_callback, .cancel_token = cancel_token,
+	                             .task_group = task_group };
+	if (cancel_token) {
+		entry.cancel_generation = cancel_token->generation;
+	}
+	if (userdata_size > sizeof(entry.userdata)) {
+		ASSERT(userdata);
+		entry.payload = work_queue_payload_alloc(queue, userdata_size);
+		entry.payload_size = (u32)userdata_size;
+		memcpy(entry.payload, userdata, userdata_size);
+	} else if (userdata_size > 0) {
+		ASSERT(userdata);
+		memcpy(entry.userdata, userdata, userdata_size);
+	}
+	return work_queue_push_entry(queue, &entry, priority);
+}
 
-		bool succeeded = atomic_compare_exchange(&queue->next_entry_to_submit,
-		                                         new_next_entry_to_submit, entry_to_submit);
-		if (succeeded) {
-//		    console_print("exhange succeeded\n");
-			work_queue_entry_t* entry = queue->entries + entry_to_submit;
-			*entry = (work_queue_entry_t){ .callback = callback, .task_identifier = task_identifier };
-			if (userdata_size > 0) {
-				ASSERT(userdata);
-				memcpy(entry->userdata, userdata, userdata_size);
+// Takes over ownership of the entry's payload (if any).
+static bool work_queue_push_entry(work_queue_t* queue, work_queue_entry_t* entry, work_queue_priority_enum priority) {
+	work_queue_ring_t* ring = queue->lanes + priority;
+	i32 thread_index = work_queue_current_thread_index;
+	if (priority == WORK_QUEUE_PRIORITY_NORMAL && work_queue_current_queue == queue &&
+	    thread_index >= 0 && thread_index < MAX_THREAD_COUNT) {
+		// Submitted from within a task of this queue: keep it local to this thread (other threads may steal it)
+		ring = queue->thread_deques + thread_index;
+		for (;;) {
+			i32 in_use = queue->thread_deques_in_use;
+			if (thread_index < in_use || atomic_compare_exchange(&queue->thread_deques_in_use, thread_index + 1, in_use)) {
+				break;
 			}
-			write_barrier;
-			entry->is_valid = true;
-			write_barrier;
-			atomic_increment(&queue->completion_goal);
-			atomic_increment(&queue->start_goal);
-//		    queue->next_entry_to_submit = new_next_entry_to_submit;
-			platform_semaphore_post(queue->semaphore);
-			return true;
+		}
+	}
+	work_queue_ring_push_back(ring, entry);
+
+	atomic_increment(&queue->completion_goal);
+	atomic_increment(&queue->start_goal);
+	platform_semaphore_post(queue->semaphore);
+	return true;
+}
+
+bool work_queue_submit(work_queue_t* queue, work_queue_callback_t callback, u32 task_identifier, void* userdata, size_t userdata_size) {
+	return work_queue_submit_to_lane(queue, callback, task_identifier, WORK_QUEUE_PRIORITY_NORMAL, NULL, NULL, NULL,
+	                                 userdata, userdata_size);
+}
+
+bool work_queue_submit_with_priority(work_queue_t* queue, work_queue_callback_t callback, work_queue_priority_enum priority,
+                                     work_queue_cancel_token_t* cancel_token, work_queue_callback_t cancel_callback,
+                                     void* userdata, size_t userdata_size) {
+	ASSERT(callback);
+	return work_queue_submit_to_lane(queue, callback, 0, priority, cancel_token, cancel_callback, NULL,
+	                                 userdata, userdata_size);
+}
+
+void work_queue_cancel(work_queue_cancel_token_t* cancel_token) {
+	atomic_increment(&cancel_token->generation);
+}
+
+void work_queue_task_group_init(work_queue_task_group_t* group, work_queue_t* queue) {
+	memset(group, 0, sizeof(*group));
+	group->queue = queue;
+	group->tasks_remaining = 1; // the group is 'open' until it is closed or waited on
+}
+
+void work_queue_task_group_init_with_continuation(work_queue_task_group_t* group, work_queue_t* queue,
+                                                  work_queue_callback_t continuation, void* userdata, size_t userdata_size) {
+	work_queue_task_group_init(group, queue);
+	group->continuation = continuation;
+	group->continuation_userdata_size = userdata_size;
+	if (userdata_size > sizeof(group->continuation_userdata)) {
+		// Reserve the payload now; the continuation entry takes it over when it is submitted.
+		group->continuation_payload = work_queue_payload_alloc(queue, userdata_size);
+		memcpy(group->continuation_payload, userdata, userdata_size);
+	} else if (userdata_size > 0) {
+		memcpy(group->continuation_userdata, userdata, userdata_size);
+	}
+}
+
+bool work_queue_task_group_submit(work_queue_task_group_t* group, work_queue_callback_t callback, void* userdata, size_t userdata_size) {
+	ASSERT(callback);
+	ASSERT(group->tasks_remaining > 0); // can't add children to a group that is already closed
+	atomic_increment(&group->tasks_remaining);
+	return work_queue_submit_to_lane(group->queue, callback, 0, WORK_QUEUE_PRIORITY_NORMAL, NULL, NULL, group,
+	                                 userdata, userdata_size);
+}
+
+static void work_queue_task_group_release(work_queue_task_group_t* group) {
+	// Note: if there is no continuation, the group may be destroyed by the waiting thread as soon as the counter
+	// reaches zero, so we can't touch it anymore after decrementing.
+	bool has_continuation = (group->continuation != NULL);
+	if (atomic_decrement(&group->tasks_remaining) == 0 && has_continuation) {
+		if (group->continuation_payload) {
+			work_queue_entry_t entry = { .is_valid = true, .callback = group->continuation,
+			                             .payload = group->continuation_payload,
+			                             .payload_size = (u32)group->continuation_userdata_size };
+			group->continuation_payload = NULL;
+			work_queue_push_entry(group->queue, &entry, WORK_QUEUE_PRIORITY_NORMAL);
 		} else {
-			if (tries > 5) {
-				console_print_error("exchange failed, retrying (try #%d)\n", tries);
-			}
-			continue;
+			work_queue_submit_task(group->queue, group->continuation, group->continuation_userdata,
+			                       group->continuation_userdata_size);
 		}
+	}
+}
+
+void work_queue_task_group_close(work_queue_task_group_t* group) {
+	work_queue_task_group_release(group);
+}
+
+void work_queue_task_group_wait(work_queue_task_group_t* group) {
+	ASSERT(group->continuation == NULL);
+	work_queue_task_group_release(group);
+	work_queue_wait_until_zero(group->queue, &group->tasks_remaining);
+}
 
+// Help executing tasks from the queue until the counter drops to zero. If there is nothing left to do for this thread,
+// back off with short (but increasing) sleeps, so that we don't burn CPU while the last tasks finish on other threads.
+void work_queue_wait_until_zero(work_queue_t* queue, volatile i32* counter) {
+	i32 thread_index = (work_queue_current_queue == queue) ? work_queue_current_thread_index : 0;
+	i64 backoff_ns = 1000;
+	while (*counter > 0) {
+		if (work_queue_do_work(queue, thread_index)) {
+			backoff_ns = 1000;
+		} else {
+			platform_sleep_ns(backoff_ns);
+			backoff_ns = ATMOST(backoff_ns * 2, 250000);
+		}
 	}
-	return false;
+	read_barrier;
 }
 
 bool work_queue_submit_task(work_queue_t* queue, work_queue_callback_t callback, void* userdata, size_t userdata_size) {
@@ -128,58 +466,122 @@ bool work_queue_submit_notification(work_queue_t* queue, u32 task_identifier, vo
 	return work_queue_submit(queue, NULL, task_identifier, userdata, userdata_size);
 }
 
-work_queue_entry_t work_queue_get_next_entry(work_queue_t* queue) {
+// Order in which tasks are taken: high priority lane, own deque (newest first), normal priority lane,
+// other threads' deques (oldest first), low priority lane.
+static work_queue_entry_t work_queue_get_next_entry_for_thread(work_queue_t* queue, i32 thread_index) {
 	work_queue_entry_t result = {0};
-
-	i32 entry_to_execute = queue->next_entry_to_execute;
-	i32 new_next_entry_to_execute = (entry_to_execute + 1) % queue->entry_count;
-
-	// don't even try to execute a task if it is not yet submitted, or not yet fully submitted
-	if ((entry_to_execute != queue->next_entry_to_submit) && (queue->entries[entry_to_execute].is_valid)) {
-		bool succeeded = atomic_compare_exchange(&queue->next_entry_to_execute,
-		                                         new_next_entry_to_execute, entry_to_execute);
-		if (succeeded) {
-			// We have dibs to execute this task!
-			result = queue->entries[entry_to_execute];
-			queue->entries[entry_to_execute].is_valid = false; // discourage competing threads (maybe not needed?)
-			if (result.callback == NULL && result.task_identifier == 0) {
-				console_print_error("Warning: encountered a work entry with a missing callback routine and/or task identifier (is this intended)?\n");
+	bool found = work_queue_ring_pop_front(queue->lanes + WORK_QUEUE_PRIORITY_HIGH, &result);
+	bool has_own_deque = (thread_index >= 0 && thread_index < MAX_THREAD_COUNT);
+	if (!found && has_own_deque) {
+		found = work_queue_ring_pop_back(queue->thread_deques + thread_index, &result);
+	}
+	if (!found) {
+		found = work_queue_ring_pop_front(queue->lanes + WORK_QUEUE_PRIORITY_NORMAL, &result);
+	}
+	if (!found) {
+		i32 deque_count = queue->thread_deques_in_use;
+		i32 start_index = has_own_deque ? thread_index + 1 : 0;
+		for (i32 i = 0; i < deque_count && !found; ++i) {
+			i32 victim_index = (start_index + i) % deque_count;
+			if (victim_index != thread_index) {
+				found = work_queue_ring_pop_front(queue->thread_deques + victim_index, &result);
+				if (found) {
+					atomic_increment(&queue->steal_count);
+				}
 			}
-			result.is_valid = true;
-			read_barrier;
 		}
 	}
-
+	if (!found) {
+		found = work_queue_ring_pop_front(queue->lanes + WORK_QUEUE_PRIORITY_LOW, &result);
+	}
+	if (found) {
+		ASSERT(result.is_valid);
+		if (result.callback == NULL && result.task_identifier == 0) {
+			console_print_error("Warning: encountered a work entry with a missing callback routine and/or task identifier (is this intended)?\n");
+		}
+		read_barrier;
+	}
 	return result;
 }
 
+work_queue_entry_t work_queue_get_next_entry(work_queue_t* queue) {
+	i32 thread_index = (work_queue_current_queue == queue) ? work_queue_current_thread_index : -1;
+	return work_queue_get_next_entry_for_thread(queue, thread_index);
+}
+
+void* work_queue_entry_get_userdata(work_queue_entry_t* entry) {
+	return entry->payload ? entry->payload : entry->userdata;
+}
+
+// Entries taken with work_queue_get_next_entry() must be released once the userdata is no longer needed.
+// (work_queue_do_work() does this automatically.)
+void work_queue_release_entry(work_queue_t* queue, work_queue_entry_t* entry) {
+	if (entry->payload) {
+		work_queue_payload_free(queue, entry->payload, entry->payload_size);
+		entry->payload = NULL;
+		entry->payload_size = 0;
+	}
+}
+
+static bool work_queue_is_entry_cancelled(work_queue_entry_t* entry) {
+	return entry->cancel_token && entry->cancel_token->generation != entry->cancel_generation;
+}
+
 void work_queue_mark_entry_completed(work_queue_t* queue) {
 	atomic_increment(&queue->completion_count);
 }
 
 bool work_queue_do_work(work_queue_t* queue, int logical_thread_index) {
-	work_queue_entry_t entry = work_queue_get_next_entry(queue);
+	work_queue_entry_t entry = work_queue_get_next_entry_for_thread(queue, logical_thread_index);
 	if (entry.is_valid) {
 		atomic_decrement(&global_worker_thread_idle_count);
 		atomic_increment(&queue->start_count);
 		ASSERT(entry.callback);
-		if (entry.callback) {
+		if (work_queue_is_entry_cancelled(&entry)) {
+			// The submitter is no longer interested in the result; skip the work, but let it clean up.
+			if (entry.cancel_callback) {
+				entry.cancel_callback(logical_thread_index, work_queue_entry_get_userdata(&entry));
+			}
+			atomic_increment(&queue->cancelled_count);
+		} else if (entry.callback) {
 			// Simple way to keep track if we are executing a 'nested' task (i.e. executing a job while waiting to continue another job)
 			++work_queue_call_depth;
 
-			// Copy the user data (arguments for the call) onto the stack
-			u8* userdata = alloca(sizeof(entry.userdata));
-			memcpy(userdata, entry.userdata, sizeof(entry.userdata));
+			// Copy the user data (arguments for the call) onto the stack.
+			// A large payload belongs to this entry alone, so it can be passed as-is.
+			u8* userdata = entry.payload;
+			if (!userdata) {
+				userdata = alloca(sizeof(entry.userdata));
+				memcpy(userdata, entry.userdata, sizeof(entry.userdata));
+			}
 
 			// Ensure all the memory allocated on the thread's temp_arena will be released when the task completes
 			temp_memory_t temp = begin_temp_memory_on_local_thread();
+			arena_t* arena = temp.arena;
+			size_t arena_used_before_task = arena_get_total_used(arena);
+			size_t saved_peak_used = arena->peak_used;
+			arena->peak_used = arena_used_before_task;
+
+			// Tasks submitted to this queue by the task will be pushed onto this thread's deque
+			work_queue_t* prev_queue = work_queue_current_queue;
+			i32 prev_thread_index = work_queue_current_thread_index;
+			work_queue_current_queue = queue;
+			work_queue_current_thread_index = logical_thread_index;
 
 			// Execute the task
 			entry.callback(logical_thread_index, userdata);
 
+			work_queue_current_queue = prev_queue;
+			work_queue_current_thread_index = prev_thread_index;
+			work_queue_record_task_memory_usage(entry.callback, arena->peak_used - arena_used_before_task);
+			arena->peak_used = MAX(saved_peak_used, arena->peak_used);
 			release_temp_memory(&temp);
 			--work_queue_call_depth;
 		}
+		work_queue_release_entry(queue, &entry);
+		if (entry.task_group) {
+			work_queue_task_group_release(entry.task_group);
+		}
         work_queue_mark_entry_completed(queue);
 		atomic_increment(&global_worker_thread_idle_count);
 	}
@@ -40,40 +40,135 @@ extern "C" {
 
 typedef void (work_queue_callback_t)(int logical_thread_index, void* userdata);
 
+// Tasks are taken from the highest priority lane first; within a lane, tasks are executed in FIFO order.
+typedef enum work_queue_priority_enum {
+	WORK_QUEUE_PRIORITY_LOW = 0,
+	WORK_QUEUE_PRIORITY_NORMAL = 1,
+	WORK_QUEUE_PRIORITY_HIGH = 2,
+	WORK_QUEUE_PRIORITY_COUNT,
+} work_queue_priority_enum;
+
+// A task submitted with a cancellation token remembers the token's generation at the time of submission.
+// Calling work_queue_cancel() bumps the generation: tasks that were not yet picked up by a worker are then dropped
+// (their cancel_callback is run instead, so that the submitter can clean up).
+typedef struct work_queue_cancel_token_t {
+	i32 volatile generation;
+} work_queue_cancel_token_t;
+
+typedef struct work_queue_task_group_t work_queue_task_group_t;
+
+// Userdata up to this size is stored inside the queue entry itself. Larger userdata is copied into the queue's
+// payload storage instead, and stays there until the task has been executed (or cancelled).
+#define WORK_QUEUE_INLINE_USERDATA_SIZE 128
+
 typedef struct work_queue_entry_t {
 	bool32 is_valid;
 	u32 task_identifier;
 	work_queue_callback_t* callback;
-	u8 userdata[128];
+	work_queue_callback_t* cancel_callback;
+	work_queue_cancel_token_t* cancel_token;
+	i32 cancel_generation;
+	work_queue_task_group_t* task_group;
+	u32 payload_size;
+	void* payload; // out-of-line userdata (if larger than WORK_QUEUE_INLINE_USERDATA_SIZE), otherwise NULL
+	u8 userdata[WORK_QUEUE_INLINE_USERDATA_SIZE];
 } work_queue_entry_t;
 
+// Side storage for large task payloads, so that submitting a large task doesn't need a malloc() every time.
+// Payloads are rounded up to a power-of-two size class; freed slots go onto a free list for their class and
+// are reused by later tasks. New slots are carved from chunks that are kept until the queue is destroyed.
+// Payloads larger than the biggest size class are rare and simply use malloc().
+#define WORK_QUEUE_PAYLOAD_MIN_CLASS_SHIFT 8  // 256 bytes
+#define WORK_QUEUE_PAYLOAD_MAX_CLASS_SHIFT 16 // 64 KiB
+#define WORK_QUEUE_PAYLOAD_CLASS_COUNT (WORK_QUEUE_PAYLOAD_MAX_CLASS_SHIFT - WORK_QUEUE_PAYLOAD_MIN_CLASS_SHIFT + 1)
+#define WORK_QUEUE_PAYLOAD_CHUNK_SIZE KILOBYTES(256)
+
+typedef struct work_queue_payload_storage_t {
+	i32 volatile lock;
+	void* free_lists[WORK_QUEUE_PAYLOAD_CLASS_COUNT];
+	u8* chunk_cursor;
+	size_t chunk_bytes_left;
+	void* chunks; // linked list of all chunks (the first bytes of each chunk point to the previous one)
+	i64 chunk_count;
+	i64 volatile payloads_in_use;
+} work_queue_payload_storage_t;
+
+// Growable ring buffer of tasks, protected by a spin lock (critical sections are only a few copies long).
+// Used for the shared priority lanes (FIFO) as well as for the per-thread deques.
+typedef struct work_queue_ring_t {
+	i32 volatile lock;
+	i32 volatile count;
+	i32 head; // index of the oldest entry
+	i32 capacity;
+	work_queue_entry_t* entries;
+} work_queue_ring_t;
+
+// Work-stealing scheduler:
+// - Tasks submitted from 'outside' (e.g. from the main thread) go into the shared lane for their priority.
+// - Tasks submitted at normal priority while executing another task of the same queue go into the executing
+//   thread's own deque. The owner takes tasks from the back (LIFO, good for nested fork/join style work), other
+//   threads steal from the front when they run out of work.
+// The lanes and deques grow when they are full, so submitting a task never fails.
 typedef struct work_queue_t {
 #if WINDOWS
 	HANDLE semaphore;
 #else
 	sem_t* semaphore;
 #endif
-	i32 volatile next_entry_to_submit;
-	i32 volatile next_entry_to_execute;
+	work_queue_ring_t lanes[WORK_QUEUE_PRIORITY_COUNT];
+	work_queue_ring_t* thread_deques; // [MAX_THREAD_COUNT]
+	work_queue_payload_storage_t* payload_storage;
+	i32 volatile thread_deques_in_use; // highest thread index that ever pushed to its deque, plus one
 	i32 volatile completion_count;
 	i32 volatile completion_goal;
 	i32 volatile start_count;
 	i32 volatile start_goal;
-	i32 entry_count;
-	work_queue_entry_t* entries;
+	i32 volatile cancelled_count;
+	i32 volatile steal_count;
+	i32 entry_count; // initial capacity of each lane (soft limit; used by submitters for throttling)
 } work_queue_t;
 
+// Fork/join: submit any number of child tasks to a group, then either:
+// - wait for them with work_queue_task_group_wait() (the waiting thread helps to execute queued tasks), or
+// - close the group with work_queue_task_group_close(), if it was initialized with a continuation. The continuation
+//   is submitted as a new task once all children have completed. In that case the group must stay valid until then.
+struct work_queue_task_group_t {
+	work_queue_t* queue;
+	i32 volatile tasks_remaining; // children that have not yet completed, plus one while the group is still open
+	work_queue_callback_t* continuation; // does not change after initialization
+	size_t continuation_userdata_size;
+	void* continuation_payload; // used instead of continuation_userdata if the userdata doesn't fit
+	u8 continuation_userdata[WORK_QUEUE_INLINE_USERDATA_SIZE];
+};
+
 work_queue_t work_queue_create(const char* semaphore_name, i32 entry_count);
 void work_queue_destroy(work_queue_t* queue);
 i32 work_queue_get_entry_count(work_queue_t* queue);
 bool work_queue_submit_task(work_queue_t* queue, work_queue_callback_t callback, void* userdata, size_t userdata_size);
 bool work_queue_submit_notification(work_queue_t* queue, u32 task_identifier, void* userdata, size_t userdata_size);
 bool work_queue_submit(work_queue_t* queue, work_queue_callback_t callback, u32 task_identifier, void* userdata, size_t userdata_size);
+bool work_queue_submit_with_priority(work_queue_t* queue, work_queue_callback_t callback, work_queue_priority_enum priority,
+                                     work_queue_cancel_token_t* cancel_token, work_queue_callback_t cancel_callback,
+                                     void* userdata, size_t userdata_size);
+void work_queue_cancel(work_queue_cancel_token_t* cancel_token);
+void work_queue_task_group_init(work_queue_task_group_t* group, work_queue_t* queue);
+void work_queue_task_group_init_with_continuation(work_queue_task_group_t* group, work_queue_t* queue,
+                                                  work_queue_callback_t continuation, void* userdata, size_t userdata_size);
+bool work_queue_task_group_submit(work_queue_task_group_t* group, work_queue_callback_t callback, void* userdata, size_t userdata_size);
+void work_queue_task_group_close(work_queue_task_group_t* group);
+void work_queue_task_group_wait(work_queue_task_group_t* group);
+void work_queue_wait_until_zero(work_queue_t* queue, volatile i32* counter);
 work_queue_entry_t work_queue_get_next_entry(work_queue_t* queue);
+void* work_queue_entry_get_userdata(work_queue_entry_t* entry);
+void work_queue_release_entry(work_queue_t* queue, work_queue_entry_t* entry);
 void work_queue_mark_entry_completed(work_queue_t* queue);
 bool work_queue_do_work(work_queue_t* queue, int logical_thread_index);
 bool work_queue_is_work_in_progress(work_queue_t* queue);
 bool work_queue_is_work_waiting_to_start(work_queue_t* queue);
+// Names a task callback in the diagnostics printed by work_queue_print_task_memory_stats(); see WORK_QUEUE_NAME_TASK().
+void work_queue_set_task_name(work_queue_callback_t* callback, const char* name);
+#define WORK_QUEUE_NAME_TASK(callback) work_queue_set_task_name((work_queue_callback_t*)(callback), #callback)
+void work_queue_print_task_memory_stats();
 void dummy_work_queue_callback(int logical_thread_index, void* userdata);
 void test_multithreading_work_queue();
 
@@ -89,6 +184,7 @@ void test_multithreading_work_queue();
 
 extern THREAD_LOCAL i32 work_queue_call_depth;
 extern work_queue_t global_work_queue;
+extern work_queue_t global_io_work_queue; // only serviced if there are dedicated I/O threads
 extern i32 global_worker_thread_idle_count;
 
 
@@ -29,6 +29,7 @@
 #include "tif_lzw.h"
 #include "remote.h"
 #include "jpeg_decoder.h"
+#include "pixel_buffer_pool.h"
 
 u32 get_tiff_field_size(u16 data_type) {
 	u32 size = 0;
@@ -933,6 +934,12 @@ bool32 open_tiff_file(tiff_t* tiff, const char* filename) {
 			}
 
 #endif
+			if (memory_mapped_files_enabled) {
+				tiff->file_mapping = file_map_read_only(filename, &tiff->file_mapping_size);
+				if (tiff->file_mapping) {
+					file_map_advise(tiff->file_mapping, tiff->file_mapping_size, 0, 0, FILE_ACCESS_PATTERN_RANDOM);
+				}
+			}
 #endif
 		}
 
@@ -1339,6 +1346,10 @@ void tiff_destroy(tiff_t* tiff) {
 		close(tiff->file_handle);
 	}
 #endif
+	if (tiff->file_mapping) {
+		file_unmap(tiff->file_mapping, tiff->file_mapping_size);
+		tiff->file_mapping = NULL;
+	}
 #endif
 
 	for (i32 i = 0; i < tiff->ifd_count; ++i) {
@@ -1458,7 +1469,32 @@ static int horAcc8(u32 stride, uint8* cp0, u32 cc) {
 }
 
 
-u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_ifd, i32 tile_index, i32 level, i32 tile_x, i32 tile_y) {
+// Returns a pointer into the memory-mapped file if the range is available there, or NULL otherwise.
+static u8* tiff_get_mapped_data(tiff_t* tiff, u64 offset, u64 size) {
+#if !IS_SERVER
+	if (tiff->file_mapping && offset + size <= (u64)tiff->file_mapping_size) {
+		return tiff->file_mapping + offset;
+	}
+#endif
+	return NULL;
+}
+
+// Compressed data that was read from the memory-mapped file must not be freed.
+static void tiff_free_compressed_data(tiff_t* tiff, u8* data) {
+#if !IS_SERVER
+	if (tiff->file_mapping && data >= tiff->file_mapping && data < tiff->file_mapping + tiff->file_mapping_size) {
+		return;
+	}
+#endif
+	free(data);
+}
+
+// If prefetched_tile_data is not NULL, it holds the compressed tile (already read from the file, e.g. asynchronously);
+// tiff_decode_tile() then takes ownership of it.
+// If dest is not NULL and large enough, the tile is decoded into it (and dest is returned on success); the caller keeps
+// ownership of dest. Otherwise, the pixels are allocated with pixel_buffer_alloc().
+u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_ifd, i32 tile_index, i32 level, i32 tile_x, i32 tile_y,
+                     u8* prefetched_tile_data, u8* dest, size_t dest_size) {
 
 	u16 compression = level_ifd->compression;
 	u8* jpeg_tables = level_ifd->jpeg_tables;
@@ -1483,14 +1519,19 @@ u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_i
 			return NULL;
 		}
 
-		// TODO: optimize allocation
-		compressed_tile_data = (u8*)malloc(compressed_tile_size_in_bytes);
-
-		if (!tiff->is_remote) {
-			file_handle_read_at_offset(compressed_tile_data, tiff->file_handle, tile_offset, compressed_tile_size_in_bytes);
+		if (prefetched_tile_data) {
+			compressed_tile_data = prefetched_tile_data;
+		} else if (!tiff->is_remote) {
+			compressed_tile_data = tiff_get_mapped_data(tiff, tile_offset, compressed_tile_size_in_bytes);
+			if (!compressed_tile_data) {
+				// TODO: optimize allocation
+				compressed_tile_data = (u8*)malloc(compressed_tile_size_in_bytes);
+				file_handle_read_at_offset(compressed_tile_data, tiff->file_handle, tile_offset, compressed_tile_size_in_bytes);
+			}
 		} else {
 			console_print_verbose("[thread %d] remote tile requested: level %d, tile %d (%d, %d)\n", logical_thread_index, level, tile_index, tile_x, tile_y);
 
+			compressed_tile_data = (u8*)malloc(compressed_tile_size_in_bytes);
 			i32 bytes_read = 0;
 			u8* read_buffer = download_remote_chunk(tiff->location.hostname, tiff->location.portno, tiff->location.filename,
 			                                        tile_offset, compressed_tile_size_in_bytes, &bytes_read, logical_thread_index);
@@ -1529,10 +1570,13 @@ u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_i
 				ASSERT(level_ifd->strip_byte_counts);
 				if (level_ifd->strip_count == 1) {
 					compressed_tile_size_in_bytes = level_ifd->strip_byte_counts[0];
-					compressed_tile_data = (u8*)malloc(compressed_tile_size_in_bytes);
-					size_t bytes_read = file_handle_read_at_offset(compressed_tile_data, tiff->file_handle, level_ifd->strip_offsets[0], compressed_tile_size_in_bytes);
-					if (bytes_read != compressed_tile_size_in_bytes) {
-						failed = true;
+					compressed_tile_data = tiff_get_mapped_data(tiff, level_ifd->strip_offsets[0], compressed_tile_size_in_bytes);
+					if (!compressed_tile_data) {
+						compressed_tile_data = (u8*)malloc(compressed_tile_size_in_bytes);
+						size_t bytes_read = file_handle_read_at_offset(compressed_tile_data, tiff->file_handle, level_ifd->strip_offsets[0], compressed_tile_size_in_bytes);
+						if (bytes_read != compressed_tile_size_in_bytes) {
+							failed = true;
+						}
 					}
 				} else {
 					compressed_strip_data = (u8**)alloca(level_ifd->strip_count * sizeof(u8**));
@@ -1540,10 +1584,13 @@ u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_i
 					for (i32 i = 0; i < level_ifd->strip_count; ++i) {
 						u64 strip_offset = level_ifd->strip_offsets[i];
 						u64 strip_byte_count = level_ifd->strip_byte_counts[i];
-						compressed_strip_data[i] = (u8*)malloc(strip_byte_count);
-						size_t bytes_read = file_handle_read_at_offset(compressed_strip_data[i], tiff->file_handle, strip_offset, strip_byte_count);
-						if (bytes_read != strip_byte_count) {
-							failed = true;
+						compressed_strip_data[i] = tiff_get_mapped_data(tiff, strip_offset, strip_byte_count);
+						if (!compressed_strip_data[i]) {
+							compressed_strip_data[i] = (u8*)malloc(strip_byte_count);
+							size_t bytes_read = file_handle_read_at_offset(compressed_strip_data[i], tiff->file_handle, strip_offset, strip_byte_count);
+							if (bytes_read != strip_byte_count) {
+								failed = true;
+							}
 						}
 					}
 				}
@@ -1558,12 +1605,12 @@ u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_i
 
 		if (failed) {
 			if (compressed_tile_data) {
-				free(compressed_tile_data);
+				tiff_free_compressed_data(tiff, compressed_tile_data);
 				compressed_tile_data = NULL;
 			}
 			if (compressed_strip_data) {
 				for (i32 i = 0; i < level_ifd->strip_count; ++i) {
-					free(compressed_strip_data[i]);
+					tiff_free_compressed_data(tiff, compressed_strip_data[i]);
 					compressed_strip_data[i] = NULL;
 				}
 			}
@@ -1578,7 +1625,7 @@ u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_i
 //		console_print_verbose("[thread %d] loading tile: level %d, tile %d (%d, %d)\n", logical_thread_index, level, tile_index, tile_x, tile_y);
 
 		size_t pixel_memory_size = level_ifd->tile_width * level_ifd->tile_height * BYTES_PER_PIXEL;
-		u8* pixel_memory = (u8*)malloc(pixel_memory_size);
+		u8* pixel_memory = (dest && dest_size >= pixel_memory_size) ? dest : (u8*)pixel_buffer_alloc(pixel_memory_size);
 
 		// Take into account either tiled or multi-strip TIFF files
 		u8** compressed_streams;
@@ -1842,18 +1889,20 @@ u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_i
 		if (false) { decompression_failed:
 			// We'll return NULL in case of failure
 			if (pixel_memory) {
-				free(pixel_memory);
+				if (pixel_memory != dest) {
+					pixel_buffer_free(pixel_memory);
+				}
 				pixel_memory = NULL;
 			}
 		}
 
 		// Cleanup
 		if (compressed_tile_data) {
-			free(compressed_tile_data);
+			tiff_free_compressed_data(tiff, compressed_tile_data);
 		}
 		if (compressed_strip_data) {
 			for (i32 i = 0; i < level_ifd->strip_count; ++i) {
-				free(compressed_strip_data[i]);
+				tiff_free_compressed_data(tiff, compressed_strip_data[i]);
 			}
 		}
 		if (decompressed) {
@@ -150,19 +150,12 @@ typedef struct export_task_data_t {
 	u64 current_image_data_write_offset;
 	u64 total_tiles_to_export;
 	float progress_per_exported_tile; // for progress bar
-	volatile i32 tiles_left_to_compress_in_batch;
 	FILE* fp;
 	bool use_rgb;
 	bool is_valid;
 	export_level_task_data_t level_task_datas[WSI_MAX_LEVELS];
 } export_task_data_t;
 
-void export_notify_load_tile_completed(int logical_thread_index, void* userdata) {
-	viewer_notify_tile_completed_task_t* task = (viewer_notify_tile_completed_task_t*)userdata;
-	work_queue_submit_task(&global_export_completion_queue, export_notify_load_tile_completed, userdata,
-	                       sizeof(viewer_notify_tile_completed_task_t));
-}
-
 void construct_new_tile_from_source_tiles(export_task_data_t* export_task, export_level_task_data_t* level_task, i32 export_tile_x, i32 export_tile_y, u8** jpeg_buffer, u32* jpeg_size) {
 	u32 export_tile_width = export_task->export_tile_width;
 	i32 source_tile_width = export_task->source_tile_width;
@@ -308,13 +301,29 @@ typedef struct construct_tile_task_t {
 	u32* jpeg_size;
 } construct_tile_task_t;
 
+// Tiles are finished on several threads at once, so the (float) progress is updated with a compare-and-swap loop.
+static void export_add_progress(float amount) {
+	volatile i32* progress_bits = (volatile i32*)&global_tiff_export_progress;
+	for (;;) {
+		i32 old_bits = *progress_bits;
+		float old_progress;
+		memcpy(&old_progress, &old_bits, sizeof(float));
+		float new_progress = old_progress + amount;
+		i32 new_bits;
+		memcpy(&new_bits, &new_progress, sizeof(float));
+		if (atomic_compare_exchange(progress_bits, new_bits, old_bits)) {
+			break;
+		}
+	}
+}
+
 void construct_new_tile_from_source_tiles_func(i32 logical_thread_id, void* userdata) {
 	construct_tile_task_t* task = (construct_tile_task_t*) userdata;
 	construct_new_tile_from_source_tiles(task->export_task, task->level_task, task->export_tile_x, task->export_tile_y, task->jpeg_buffer, task->jpeg_size);
-	atomic_decrement(&task->export_task->tiles_left_to_compress_in_batch);
+	export_add_progress(task->export_task->progress_per_exported_tile);
 }
 
-void begin_construct_new_tile_from_source_tiles(export_task_data_t* export_task, export_level_task_data_t* level_task, i32 export_tile_x, i32 export_tile_y, u8** jpeg_buffer, u32* jpeg_size) {
+void begin_construct_new_tile_from_source_tiles(work_queue_task_group_t* task_group, export_task_data_t* export_task, export_level_task_data_t* level_task, i32 export_tile_x, i32 export_tile_y, u8** jpeg_buffer, u32* jpeg_size) {
 	construct_tile_task_t task = {0};
 	task.export_task = export_task;
 	task.level_task = level_task;
@@ -323,7 +332,8 @@ void begin_construct_new_tile_from_source_tiles(export_task_data_t* export_task,
 	task.jpeg_buffer = jpeg_buffer;
 	task.jpeg_size = jpeg_size;
 
-	if (!work_queue_submit_task(&global_work_queue, construct_new_tile_from_source_tiles_func, &task, sizeof(task))) {
+	WORK_QUEUE_NAME_TASK(construct_new_tile_from_source_tiles_func);
+	if (!work_queue_task_group_submit(task_group, construct_new_tile_from_source_tiles_func, &task, sizeof(task))) {
 		fatal_error();
 	}
 }
@@ -385,10 +395,10 @@ void export_bigtiff_encode_level(app_state_t* app_state, image_t* image, export_
 		i32 first_source_tile_needed = start_tile_y * source_tile_pitch + start_tile_x;
 		i32 last_source_tile_needed = (end_tile_y + extra_tiles_y) * source_tile_pitch + end_tile_x + extra_tiles_x;
 		last_source_tile_needed = ATMOST(last_source_tile_needed, level_task->source_tile_count - 1);
-		i32 source_tiles_needed = last_source_tile_needed - first_source_tile_needed + 1;
 
-		load_tile_task_t* wishlist = calloc(source_tiles_needed, sizeof(load_tile_task_t));
-		i32 tiles_to_load = 0;
+		// Load the source tiles into the tile cache, and wait for them (helping out with the work meanwhile).
+		work_queue_task_group_t read_task_group;
+		work_queue_task_group_init(&read_task_group, &global_work_queue);
 
 		i64 read_time_start = get_clock();
 
@@ -409,93 +419,26 @@ void export_bigtiff_encode_level(app_state_t* app_state, image_t* image, export_
 						continue; // already cached!
 					} else {
 						tile->need_keep_in_cache = true;
-						wishlist[tiles_to_load++] = (load_tile_task_t){
+						tile->is_submitted_for_loading = true;
+						load_tile_task_t task = {
 								.resource_id = image->resource_id,
 								.image = image, .tile = tile, .level = level,
 								.tile_x = tile->tile_x,
 								.tile_y = tile->tile_y,
 								.need_gpu_residency = tile->need_gpu_residency,
 								.need_keep_in_cache = true,
-								.completion_callback = export_notify_load_tile_completed,
+								.refcount_to_decrement = 1,
 						};
+						atomic_add(&image->refcount, task.refcount_to_decrement);
+						WORK_QUEUE_NAME_TASK(load_tile_into_cache_func);
+						work_queue_task_group_submit(&read_task_group, load_tile_into_cache_func, &task, sizeof(task));
 					}
 				}
 			}
 		}
-
-		request_tiles(image, wishlist, tiles_to_load);
 		benaphore_unlock(&image->lock);
 
-		free(wishlist);
-		wishlist = NULL;
-
-		// TODO: fix the copy-pasta
-		i32 pixel_transfer_index_start = app_state->next_pixel_transfer_to_submit;
-		while (work_queue_is_work_in_progress(&global_work_queue) ||
-               work_queue_is_work_in_progress(&global_export_completion_queue)) {
-			work_queue_entry_t entry = work_queue_get_next_entry(&global_export_completion_queue);
-			if (entry.is_valid) {
-				if (!entry.callback) fatal_error();
-                work_queue_mark_entry_completed(&global_export_completion_queue);
-
-				if (entry.callback == export_notify_load_tile_completed) {
-					benaphore_lock(&image->lock);
-					viewer_notify_tile_completed_task_t* task = (viewer_notify_tile_completed_task_t*) entry.userdata;
-					if (task->pixel_memory) {
-						bool need_free_pixel_memory = true;
-						tile_t* tile = get_tile_from_tile_index(image, task->scale, task->tile_index);
-						if (tile) {
-							tile->is_submitted_for_loading = false;
-							if (tile->need_gpu_residency) {
-								/*pixel_transfer_state_t* transfer_state =
-										submit_texture_upload_via_pbo(app_state, task->tile_width, task->tile_width,
-																	  4, task->pixel_memory, finalize_textures_immediately);
-								if (finalize_textures_immediately) {
-									tile->texture = transfer_state->texture;
-								} else {
-									transfer_state->userdata = (void*) tile;
-								}*/
-
-							}
-							if (tile->need_keep_in_cache) {
-								need_free_pixel_memory = false;
-								tile->pixels = task->pixel_memory;
-								tile->is_cached = true;
-							}
-						}
-						if (need_free_pixel_memory) {
-							free(task->pixel_memory);
-						}
-					}
-					benaphore_unlock(&image->lock);
-
-//					free(entry.data);
-				} /*else if (entry.callback == viewer_upload_already_cached_tile_to_gpu) {
-							load_tile_task_t* task = (load_tile_task_t*) entry.data;
-							tile_t* tile = task->tile;
-							if (tile->is_cached && tile->pixels) {
-								if (tile->need_gpu_residency) {
-									pixel_transfer_state_t* transfer_state = submit_texture_upload_via_pbo(app_state, TILE_DIM,
-									                                                                       TILE_DIM, 4,
-									                                                                       tile->pixels, finalize_textures_immediately);
-									tile->texture = transfer_state->texture;
-								} else {
-									ASSERT(!"viewer_only_upload_cached_tile() called but !tile->need_gpu_residency\n");
-								}
-
-								if (!task->need_keep_in_cache) {
-									free(tile->pixels);
-									tile->pixels = NULL;
-									tile->is_cached = false;
-								}
-							} else {
-								console_print("Warning: viewer_only_upload_cached_tile() called on a non-cached tile\n");
-							}
-						}*/
-			}
-
-
-		}//end of while loop
+		work_queue_task_group_wait(&read_task_group);
 
 		// Verify that all tiles are now available
 		for (i32 tile_index = first_source_tile_needed; tile_index <= last_source_tile_needed; ++tile_index) {
@@ -516,7 +459,8 @@ void export_bigtiff_encode_level(app_state_t* app_state, image_t* image, export_
 
 		// Now we can proceed with constructing the new tiles from the source tiles, and writing them to disk.
 		i64 compress_time_start = get_clock();
-		export_task->tiles_left_to_compress_in_batch = current_batch_size;
+		work_queue_task_group_t compress_task_group;
+		work_queue_task_group_init(&compress_task_group, &global_work_queue);
 
 		// Begin JPEG compression tasks for each tile.
 		for (i32 tile_index = start_tile_index; tile_index <= end_tile_index; ++tile_index) {
@@ -527,26 +471,11 @@ void export_bigtiff_encode_level(app_state_t* app_state, image_t* image, export_
 			u8** jpeg_buffer = &jpeg_compressed_buffers[work_index];
 			u32* jpeg_size = &jpeg_compressed_sizes[work_index];
 
-			begin_construct_new_tile_from_source_tiles(export_task, level_task, export_tile_x, export_tile_y, jpeg_buffer, jpeg_size);
+			begin_construct_new_tile_from_source_tiles(&compress_task_group, export_task, level_task, export_tile_x, export_tile_y, jpeg_buffer, jpeg_size);
 		}
 
 		// Wait for all compression tasks in the batch to finish.
-		float saved_tiff_export_progress = global_tiff_export_progress;
-		for(;;) {
-			i32 tiles_left_to_compress_in_batch = export_task->tiles_left_to_compress_in_batch;
-			global_tiff_export_progress = saved_tiff_export_progress + (current_batch_size - export_task->tiles_left_to_compress_in_batch) * export_task->progress_per_exported_tile;
-			if (!(tiles_left_to_compress_in_batch > 0)) {
-				break;
-			} else {
-				if (work_queue_is_work_waiting_to_start(&global_work_queue)) {
-                    work_queue_do_work(&global_work_queue, 0);
-				}
-			}
-//			if (tiles_left_to_compress_in_batch > 0) {
-//				console_print_verbose("tiles left to compress: %d\n", tiles_left_to_compress_in_batch);
-//			}
-		}
-		global_tiff_export_progress = saved_tiff_export_progress + current_batch_size* export_task->progress_per_exported_tile;
+		work_queue_task_group_wait(&compress_task_group);
 
 		// batch completed.
 
@@ -949,9 +878,11 @@ bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* ti
 		export_task.progress_per_exported_tile = progress_left / (float)(ATLEAST(1, export_task.total_tiles_to_export));
 
 		console_print_verbose("Starting TIFF export, total tiles to export = %d\n", export_task.total_tiles_to_export);
+		image_set_file_access_pattern(image, FILE_ACCESS_PATTERN_SEQUENTIAL);
 		for (i32 level = 0; level <= export_task.max_level; ++level) {
 			export_bigtiff_encode_level(app_state, image, &export_task, level);
 		}
+		image_set_file_access_pattern(image, FILE_ACCESS_PATTERN_RANDOM);
 		fclose(export_task.fp);
 
 		console_print("Exported region to '%s'\n", filename);
@@ -981,11 +912,11 @@ typedef struct export_region_task_t {
 	tiff_t* tiff;
 	bounds2f world_bounds;
 	bounds2i level0_bounds;
-	const char* filename;
 	u32 export_tile_width;
 	u16 desired_photometric_interpretation;
 	i32 quality;
 	u32 export_flags;
+	char filename[]; // copied (the caller's buffer may change while the export is running); sized to fit
 } export_region_task_t;
 
 void export_cropped_bigtiff_func(i32 logical_thread_index, void* userdata) {
@@ -1001,25 +932,29 @@ void export_cropped_bigtiff_func(i32 logical_thread_index, void* userdata) {
 
 void begin_export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* tiff, bounds2f world_bounds, bounds2i level0_bounds, const char* filename,
                                   u32 export_tile_width, u16 desired_photometric_interpretation, i32 quality, u32 export_flags) {
-	export_region_task_t task = {0};
-	task.app_state = app_state;
-	task.image = image;
-	task.tiff = tiff;
-	task.world_bounds = world_bounds;
-	task.level0_bounds = level0_bounds;
-	task.filename = filename;
-	task.export_tile_width = export_tile_width;
-	task.desired_photometric_interpretation = desired_photometric_interpretation;
-	task.quality = quality;
-	task.export_flags = export_flags;
+	size_t filename_size = strlen(filename) + 1;
+	size_t task_size = sizeof(export_region_task_t) + filename_size;
+	export_region_task_t* task = calloc(1, task_size);
+	task->app_state = app_state;
+	task->image = image;
+	task->tiff = tiff;
+	task->world_bounds = world_bounds;
+	task->level0_bounds = level0_bounds;
+	memcpy(task->filename, filename, filename_size);
+	task->export_tile_width = export_tile_width;
+	task->desired_photometric_interpretation = desired_photometric_interpretation;
+	task->quality = quality;
+	task->export_flags = export_flags;
 
 	global_tiff_export_progress = 0.0f;
 	app_state->is_export_in_progress = true;
 
 //	atomic_increment(&isyntax->refcount); // TODO: retain; don't destroy  while busy
-	if (!work_queue_submit_task(&global_work_queue, export_cropped_bigtiff_func, &task, sizeof(task))) {
+	WORK_QUEUE_NAME_TASK(export_cropped_bigtiff_func);
+	if (!work_queue_submit_task(&global_work_queue, export_cropped_bigtiff_func, task, task_size)) {
 //		tile->is_submitted_for_loading = false; // chicken out
 //		atomic_decrement(&isyntax->refcount);
 		app_state->is_export_in_progress = false;
 	};
+	free(task); // the work queue keeps its own copy
 }
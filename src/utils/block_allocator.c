@@ -17,6 +17,7 @@
 */
 
 #include "block_allocator.h"
+#include "intrinsics.h"
 
 /*
 void* block_allocator_proc(allocator_t* this_allocator, size_t size_to_allocate, u32 mode, void* ptr_to_free_or_realloc) {
@@ -37,6 +38,35 @@ void* block_allocator_proc(allocator_t* this_allocator, size_t size_to_allocate,
 }
 */
 
+// Threads claim a slot the first time they use a block allocator; the slot selects the thread's cache in each allocator.
+static volatile i32 block_allocator_thread_slots_in_use[BLOCK_ALLOCATOR_MAX_THREAD_SLOTS];
+static THREAD_LOCAL i32 local_block_allocator_thread_slot = -1;
+static THREAD_LOCAL bool local_block_allocator_thread_slot_unavailable;
+
+static i32 get_local_thread_slot() {
+	if (local_block_allocator_thread_slot < 0 && !local_block_allocator_thread_slot_unavailable) {
+		for (i32 i = 0; i < BLOCK_ALLOCATOR_MAX_THREAD_SLOTS; ++i) {
+			if (block_allocator_thread_slots_in_use[i] == 0 && atomic_compare_exchange(&block_allocator_thread_slots_in_use[i], 1, 0)) {
+				local_block_allocator_thread_slot = i;
+				break;
+			}
+		}
+		if (local_block_allocator_thread_slot < 0) {
+			local_block_allocator_thread_slot_unavailable = true; // too many threads; this thread will use the shared free list directly
+		}
+	}
+	return local_block_allocator_thread_slot;
+}
+
+// Note: blocks still in the thread's caches stay there; they will be reused by the next thread to claim the slot.
+void block_allocator_release_thread_slot() {
+	if (local_block_allocator_thread_slot >= 0) {
+		write_barrier;
+		block_allocator_thread_slots_in_use[local_block_allocator_thread_slot] = 0;
+		local_block_allocator_thread_slot = -1;
+	}
+}
+
 block_allocator_t block_allocator_create(size_t block_size, size_t max_capacity_in_blocks, size_t chunk_size) {
 	u64 total_capacity = (u64)block_size * (u64)max_capacity_in_blocks;
 	u64 chunk_count = total_capacity / chunk_size;
@@ -46,88 +76,178 @@ block_allocator_t block_allocator_create(size_t block_size, size_t max_capacity_
 	result.chunk_capacity_in_blocks = chunk_capacity_in_blocks;
 	result.chunk_size = chunk_size;
 	ASSERT(chunk_count > 0);
+	ASSERT(chunk_count * chunk_capacity_in_blocks < UINT32_MAX);
 	result.chunk_count = chunk_count;
 	result.used_chunks = 1;
 	result.chunks = calloc(1, chunk_count * sizeof(block_allocator_chunk_t));
 	result.chunks[0].memory = (u8*)malloc(chunk_size);
-	result.free_list_storage = calloc(1, max_capacity_in_blocks * sizeof(block_allocator_item_t));
-	result.lock = benaphore_create();
+	result.free_list_next = calloc(1, chunk_count * chunk_capacity_in_blocks * sizeof(u32));
+	result.thread_caches = calloc(1, BLOCK_ALLOCATOR_MAX_THREAD_SLOTS * sizeof(block_allocator_thread_cache_t));
 	result.is_valid = true;
 	return result;
 }
 
 void block_allocator_destroy(block_allocator_t* allocator) {
-	for (i32 i = 0; i < allocator->used_chunks; ++i) {
+	for (i32 i = 0; i < allocator->chunk_count; ++i) {
 		block_allocator_chunk_t* chunk = allocator->chunks + i;
 		if (chunk->memory) free(chunk->memory);
 	}
 	if (allocator->chunks) free(allocator->chunks);
-	if (allocator->free_list_storage) free(allocator->free_list_storage);
-	benaphore_destroy(&allocator->lock);
+	if (allocator->free_list_next) free((void*)allocator->free_list_next);
+	if (allocator->thread_caches) free(allocator->thread_caches);
 	memset(allocator, 0, sizeof(block_allocator_t));
 }
 
-void* block_alloc(block_allocator_t* allocator) {
-	void* result = NULL;
-	benaphore_lock(&allocator->lock);
-	if (allocator->free_list != NULL) {
-		// Grab a block from the free list
-		block_allocator_item_t* free_item = allocator->free_list;
-		result = allocator->chunks[free_item->chunk_index].memory + free_item->block_index * allocator->block_size;
-		allocator->free_list = free_item->next;
-		--allocator->free_list_length;
-	} else {
-		ASSERT(allocator->used_chunks >= 1);
-		i32 chunk_index = allocator->used_chunks-1;
-		block_allocator_chunk_t* current_chunk = allocator->chunks + chunk_index;
-		if (current_chunk->used_blocks < allocator->chunk_capacity_in_blocks) {
-			i32 block_index = current_chunk->used_blocks++;
-			result = current_chunk->memory + block_index * allocator->block_size;
+static u8* get_chunk_memory(block_allocator_t* allocator, i32 chunk_index) {
+	block_allocator_chunk_t* chunk = allocator->chunks + chunk_index;
+	u8* memory = chunk->memory;
+	if (!memory) {
+		// First block in a new chunk: whoever gets here first installs the memory.
+		u8* new_memory = (u8*)malloc(allocator->chunk_size);
+		if (atomic_compare_exchange_ptr((void* volatile*)&chunk->memory, new_memory, NULL)) {
+			atomic_increment(&allocator->used_chunks);
 		} else {
-			// Chunk is full, allocate a new chunk
-			if (allocator->used_chunks < allocator->chunk_count) {
-//				console_print("block_alloc(): allocating a new chunk\n");
-				chunk_index = allocator->used_chunks++;
-				current_chunk = allocator->chunks + chunk_index;
-				ASSERT(current_chunk->memory == NULL);
-				current_chunk->memory = (u8*)malloc(allocator->chunk_size);
-				i32 block_index = current_chunk->used_blocks++;
-				result = current_chunk->memory + block_index * allocator->block_size;
-			} else {
-				console_print_error("block_alloc(): out of memory!\n");
-				fatal_error();
+			free(new_memory);
+		}
+		memory = chunk->memory;
+	}
+	return memory;
+}
+
+static inline void* get_block_memory(block_allocator_t* allocator, u32 block) {
+	i32 chunk_index = block / allocator->chunk_capacity_in_blocks;
+	i32 block_index = block % allocator->chunk_capacity_in_blocks;
+	return get_chunk_memory(allocator, chunk_index) + block_index * allocator->block_size;
+}
+
+// Pops a single block from the shared free list; returns false if the list is empty.
+// The tag in the upper half of the list head is bumped on every change, to protect against ABA.
+static bool free_list_pop(block_allocator_t* allocator, u32* block) {
+	for (;;) {
+		u64 head = allocator->free_list_head;
+		u32 first = (u32)head;
+		if (first == 0) return false;
+		u32 next = allocator->free_list_next[first - 1];
+		u64 new_head = (((head >> 32) + 1) << 32) | next;
+		if (atomic_compare_exchange_u64(&allocator->free_list_head, new_head, head)) {
+			*block = first - 1;
+			return true;
+		}
+	}
+}
+
+// Pushes a batch of blocks onto the shared free list with a single compare-exchange.
+static void free_list_push_batch(block_allocator_t* allocator, u32* blocks, i32 count) {
+	ASSERT(count > 0);
+	for (i32 i = 0; i < count - 1; ++i) {
+		allocator->free_list_next[blocks[i]] = blocks[i + 1] + 1;
+	}
+	u32 last = blocks[count - 1];
+	for (;;) {
+		u64 head = allocator->free_list_head;
+		allocator->free_list_next[last] = (u32)head;
+		u64 new_head = (((head >> 32) + 1) << 32) | (blocks[0] + 1);
+		if (atomic_compare_exchange_u64(&allocator->free_list_head, new_head, head)) {
+			break;
+		}
+	}
+}
+
+// Hands out blocks that have never been used, taking them from the end of the used range.
+static i32 claim_unused_blocks(block_allocator_t* allocator, u32* blocks, i32 count) {
+	i64 total_blocks = (i64)allocator->chunk_count * allocator->chunk_capacity_in_blocks;
+	if (allocator->next_unused_block >= total_blocks) return 0;
+	i64 first = atomic_add_i64(&allocator->next_unused_block, count) - count;
+	i32 claimed = 0;
+	for (i64 block = first; block < first + count && block < total_blocks; ++block) {
+		blocks[claimed++] = (u32)block;
+	}
+	return claimed;
+}
+
+static i32 refill_blocks(block_allocator_t* allocator, u32* blocks, i32 count) {
+	i32 refilled = 0;
+	while (refilled < count && free_list_pop(allocator, blocks + refilled)) {
+		++refilled;
+	}
+	if (refilled == 0) {
+		refilled = claim_unused_blocks(allocator, blocks, count);
+	}
+	atomic_add_i64(&allocator->used_block_count, refilled);
+	return refilled;
+}
+
+void* block_alloc(block_allocator_t* allocator) {
+	u32 block = 0;
+	i32 slot = get_local_thread_slot();
+	if (slot >= 0) {
+		block_allocator_thread_cache_t* cache = allocator->thread_caches + slot;
+		if (cache->count == 0) {
+			// Refill in reverse, so that the blocks are handed out in the order they were taken
+			u32 refill[BLOCK_ALLOCATOR_THREAD_CACHE_BATCH_SIZE];
+			i32 refilled = refill_blocks(allocator, refill, COUNT(refill));
+			for (i32 i = 0; i < refilled; ++i) {
+				cache->blocks[i] = refill[refilled - 1 - i];
 			}
+			cache->count = refilled;
+		}
+		if (cache->count == 0) {
+			console_print_error("block_alloc(): out of memory!\n");
+			fatal_error();
+		}
+		block = cache->blocks[--cache->count];
+	} else {
+		if (refill_blocks(allocator, &block, 1) == 0) {
+			console_print_error("block_alloc(): out of memory!\n");
+			fatal_error();
 		}
 	}
-	benaphore_unlock(&allocator->lock);
-	return result;
+	return get_block_memory(allocator, block);
 }
 
 void block_free(block_allocator_t* allocator, void* ptr_to_free) {
-	benaphore_lock(&allocator->lock);
-	block_allocator_item_t free_item = {0};
 	// Find the right chunk
 	i32 chunk_index = -1;
-	for (i32 i = 0; i < allocator->used_chunks; ++i) {
-		block_allocator_chunk_t* chunk = allocator->chunks + i;
-		bool match = ((u8*)ptr_to_free >= chunk->memory && (u8*)ptr_to_free < (chunk->memory + allocator->chunk_size));
+	for (i32 i = 0; i < allocator->chunk_count; ++i) {
+		u8* memory = allocator->chunks[i].memory;
+		bool match = (memory != NULL && (u8*)ptr_to_free >= memory && (u8*)ptr_to_free < (memory + allocator->chunk_size));
 		if (match) {
 			chunk_index = i;
 			break;
 		}
 	}
-	if (chunk_index >= 0) {
-		block_allocator_chunk_t* chunk = allocator->chunks + chunk_index;
-		free_item.next = allocator->free_list;
-		free_item.chunk_index = chunk_index;
-		free_item.block_index = ((u8*)ptr_to_free - chunk->memory) / allocator->block_size;
-		i32 free_index = allocator->free_list_length++;
-		allocator->free_list_storage[free_index] = free_item;
-		allocator->free_list = allocator->free_list_storage + free_index;
-		benaphore_unlock(&allocator->lock);
-	} else {
+	if (chunk_index < 0) {
 		console_print_error("block_free(): invalid pointer!\n");
 		fatal_error();
 	}
+	u8* memory = allocator->chunks[chunk_index].memory;
+	u32 block = (u32)(chunk_index * allocator->chunk_capacity_in_blocks + ((u8*)ptr_to_free - memory) / allocator->block_size);
+
+	i32 slot = get_local_thread_slot();
+	if (slot >= 0) {
+		block_allocator_thread_cache_t* cache = allocator->thread_caches + slot;
+		if (cache->count == BLOCK_ALLOCATOR_THREAD_CACHE_CAPACITY) {
+			// Return the oldest batch to the shared free list
+			i32 batch_size = BLOCK_ALLOCATOR_THREAD_CACHE_BATCH_SIZE;
+			free_list_push_batch(allocator, cache->blocks, batch_size);
+			atomic_add_i64(&allocator->used_block_count, -batch_size);
+			cache->count -= batch_size;
+			memmove(cache->blocks, cache->blocks + batch_size, cache->count * sizeof(u32));
+		}
+		cache->blocks[cache->count++] = block;
+	} else {
+		free_list_push_batch(allocator, &block, 1);
+		atomic_add_i64(&allocator->used_block_count, -1);
+	}
+}
 
+// Blocks in the thread caches are free, but they are not on the shared free list, so they are counted in
+// used_block_count. Subtract them here, instead of updating a shared counter on every block_alloc()/block_free().
+// Note: the thread caches are read without synchronization, so the result may be slightly out of date.
+i64 block_allocator_get_in_use_block_count(block_allocator_t* allocator) {
+	i64 result = allocator->used_block_count;
+	for (i32 i = 0; i < BLOCK_ALLOCATOR_MAX_THREAD_SLOTS; ++i) {
+		result -= allocator->thread_caches[i].count;
+	}
+	return result;
 }
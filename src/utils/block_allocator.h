@@ -24,7 +24,7 @@ extern "C" {
 #endif
 
 #include "common.h"
-#include "platform.h" // for benaphore
+#include "platform.h" // for MAX_THREAD_COUNT
 
 // See:
 // https://github.com/SasLuca/rayfork/blob/rayfork-0.9/source/core/rayfork-core.c
@@ -43,16 +43,20 @@ struct allocator_t {
 };
 
 
-typedef struct block_allocator_item_t block_allocator_item_t;
-struct block_allocator_item_t {
-	i32 chunk_index;
-	i32 block_index;
-	block_allocator_item_t* next;
-};
+// Blocks are identified by a global block index (chunk_index * chunk_capacity_in_blocks + block_index).
+// Each thread keeps a small cache of free blocks per allocator; these are exchanged with a shared lock-free
+// free list in batches, so that most block_alloc()/block_free() calls don't touch any shared state.
+#define BLOCK_ALLOCATOR_THREAD_CACHE_CAPACITY 63
+#define BLOCK_ALLOCATOR_THREAD_CACHE_BATCH_SIZE 32
+#define BLOCK_ALLOCATOR_MAX_THREAD_SLOTS MAX_THREAD_COUNT
+
+typedef struct block_allocator_thread_cache_t {
+	u32 blocks[BLOCK_ALLOCATOR_THREAD_CACHE_CAPACITY];
+	i32 count;
+} block_allocator_thread_cache_t; // 256 bytes, to keep the caches of different threads on separate cache lines
 
 typedef struct block_allocator_chunk_t {
-	size_t used_blocks;
-	u8* memory;
+	u8* volatile memory;
 } block_allocator_chunk_t;
 
 typedef struct block_allocator_t {
@@ -60,12 +64,13 @@ typedef struct block_allocator_t {
 	i32 chunk_capacity_in_blocks;
 	size_t chunk_size;
 	i32 chunk_count;
-	i32 used_chunks;
+	volatile i32 used_chunks;
 	block_allocator_chunk_t* chunks;
-	block_allocator_item_t* free_list_storage;
-	block_allocator_item_t* free_list;
-	i32 free_list_length;
-	benaphore_t lock;
+	volatile u32* free_list_next; // [chunk_count * chunk_capacity_in_blocks], next block index + 1 (0 = end of list)
+	volatile u64 free_list_head;  // high 32 bits: ABA tag; low 32 bits: first block index + 1 (0 = empty)
+	volatile i64 next_unused_block; // blocks below this index have been handed out at least once
+	block_allocator_thread_cache_t* thread_caches; // [BLOCK_ALLOCATOR_MAX_THREAD_SLOTS]
+	volatile i64 used_block_count; // number of blocks not on the shared free list (includes blocks in thread caches)
 	bool is_valid;
 } block_allocator_t;
 
@@ -73,6 +78,8 @@ block_allocator_t block_allocator_create(size_t block_size, size_t max_capacity_
 void block_allocator_destroy(block_allocator_t* allocator);
 void* block_alloc(block_allocator_t* allocator);
 void block_free(block_allocator_t* allocator, void* ptr_to_free);
+i64 block_allocator_get_in_use_block_count(block_allocator_t* allocator); // blocks handed out and not yet freed
+void block_allocator_release_thread_slot(); // call before a thread exits, if it is not a long-lived worker thread
 
 #ifdef __cplusplus
 };
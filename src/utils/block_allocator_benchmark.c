@@ -0,0 +1,288 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2024  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Contention benchmark for block_allocator_t.
+// Compares the thread-caching allocator against the previous implementation of block_allocator_t (a single free list
+// protected by a benaphore), at 1 to 64 threads.
+// Each thread mimics the iSyntax decoder: it allocates a handful of coefficient blocks, touches them,
+// and frees them again; some of the blocks are freed by a different thread than the one that allocated them.
+
+#define STB_SPRINTF_IMPLEMENTATION
+#include "common.h"
+#include "intrinsics.h"
+#include "benaphore.h"
+#include "block_allocator.h"
+#include "timerutils.h"
+
+#include <pthread.h>
+
+#define BENCHMARK_BLOCK_SIZE KILOBYTES(32)
+#define BENCHMARK_CAPACITY_IN_BLOCKS 65536
+#define BENCHMARK_CHUNK_SIZE MEGABYTES(64)
+#define BENCHMARK_BLOCKS_PER_ITERATION 16
+#define BENCHMARK_ITERATIONS_PER_THREAD 20000
+#define BENCHMARK_MAX_THREADS 64
+
+// Reference: block_allocator_t as it was before the thread caches (one free list behind a benaphore), verbatim.
+typedef struct old_block_allocator_item_t old_block_allocator_item_t;
+struct old_block_allocator_item_t {
+	i32 chunk_index;
+	i32 block_index;
+	old_block_allocator_item_t* next;
+};
+
+typedef struct old_block_allocator_chunk_t {
+	size_t used_blocks;
+	u8* memory;
+} old_block_allocator_chunk_t;
+
+typedef struct old_block_allocator_t {
+	size_t block_size;
+	i32 chunk_capacity_in_blocks;
+	size_t chunk_size;
+	i32 chunk_count;
+	i32 used_chunks;
+	old_block_allocator_chunk_t* chunks;
+	old_block_allocator_item_t* free_list_storage;
+	old_block_allocator_item_t* free_list;
+	i32 free_list_length;
+	volatile i64 used_block_count; // number of blocks currently allocated (for memory usage statistics)
+	benaphore_t lock;
+	bool is_valid;
+} old_block_allocator_t;
+
+static old_block_allocator_t old_block_allocator_create(size_t block_size, size_t max_capacity_in_blocks, size_t chunk_size) {
+	u64 total_capacity = (u64)block_size * (u64)max_capacity_in_blocks;
+	u64 chunk_count = total_capacity / chunk_size;
+	u64 chunk_capacity_in_blocks = max_capacity_in_blocks / chunk_count;
+	old_block_allocator_t result = {0};
+	result.block_size = block_size;
+	result.chunk_capacity_in_blocks = chunk_capacity_in_blocks;
+	result.chunk_size = chunk_size;
+	ASSERT(chunk_count > 0);
+	result.chunk_count = chunk_count;
+	result.used_chunks = 1;
+	result.chunks = calloc(1, chunk_count * sizeof(old_block_allocator_chunk_t));
+	result.chunks[0].memory = (u8*)malloc(chunk_size);
+	result.free_list_storage = calloc(1, max_capacity_in_blocks * sizeof(old_block_allocator_item_t));
+	result.lock = benaphore_create();
+	result.is_valid = true;
+	return result;
+}
+
+static void old_block_allocator_destroy(old_block_allocator_t* allocator) {
+	for (i32 i = 0; i < allocator->used_chunks; ++i) {
+		old_block_allocator_chunk_t* chunk = allocator->chunks + i;
+		if (chunk->memory) free(chunk->memory);
+	}
+	if (allocator->chunks) free(allocator->chunks);
+	if (allocator->free_list_storage) free(allocator->free_list_storage);
+	benaphore_destroy(&allocator->lock);
+	memset(allocator, 0, sizeof(old_block_allocator_t));
+}
+
+static void* old_block_alloc(old_block_allocator_t* allocator) {
+	void* result = NULL;
+	benaphore_lock(&allocator->lock);
+	if (allocator->free_list != NULL) {
+		// Grab a block from the free list
+		old_block_allocator_item_t* free_item = allocator->free_list;
+		result = allocator->chunks[free_item->chunk_index].memory + free_item->block_index * allocator->block_size;
+		allocator->free_list = free_item->next;
+		--allocator->free_list_length;
+	} else {
+		ASSERT(allocator->used_chunks >= 1);
+		i32 chunk_index = allocator->used_chunks-1;
+		old_block_allocator_chunk_t* current_chunk = allocator->chunks + chunk_index;
+		if (current_chunk->used_blocks < allocator->chunk_capacity_in_blocks) {
+			i32 block_index = current_chunk->used_blocks++;
+			result = current_chunk->memory + block_index * allocator->block_size;
+		} else {
+			// Chunk is full, allocate a new chunk
+			if (allocator->used_chunks < allocator->chunk_count) {
+//				console_print("old_block_alloc(): allocating a new chunk\n");
+				chunk_index = allocator->used_chunks++;
+				current_chunk = allocator->chunks + chunk_index;
+				ASSERT(current_chunk->memory == NULL);
+				current_chunk->memory = (u8*)malloc(allocator->chunk_size);
+				i32 block_index = current_chunk->used_blocks++;
+				result = current_chunk->memory + block_index * allocator->block_size;
+			} else {
+				console_print_error("old_block_alloc(): out of memory!\n");
+				fatal_error();
+			}
+		}
+	}
+	++allocator->used_block_count;
+	benaphore_unlock(&allocator->lock);
+	return result;
+}
+
+static void old_block_free(old_block_allocator_t* allocator, void* ptr_to_free) {
+	benaphore_lock(&allocator->lock);
+	old_block_allocator_item_t free_item = {0};
+	// Find the right chunk
+	i32 chunk_index = -1;
+	for (i32 i = 0; i < allocator->used_chunks; ++i) {
+		old_block_allocator_chunk_t* chunk = allocator->chunks + i;
+		bool match = ((u8*)ptr_to_free >= chunk->memory && (u8*)ptr_to_free < (chunk->memory + allocator->chunk_size));
+		if (match) {
+			chunk_index = i;
+			break;
+		}
+	}
+	if (chunk_index >= 0) {
+		old_block_allocator_chunk_t* chunk = allocator->chunks + chunk_index;
+		free_item.next = allocator->free_list;
+		free_item.chunk_index = chunk_index;
+		free_item.block_index = ((u8*)ptr_to_free - chunk->memory) / allocator->block_size;
+		i32 free_index = allocator->free_list_length++;
+		allocator->free_list_storage[free_index] = free_item;
+		allocator->free_list = allocator->free_list_storage + free_index;
+		--allocator->used_block_count;
+		benaphore_unlock(&allocator->lock);
+	} else {
+		console_print_error("old_block_free(): invalid pointer!\n");
+		fatal_error();
+	}
+
+}
+
+typedef struct benchmark_thread_t {
+	pthread_t thread;
+	i32 thread_index;
+	i32 thread_count;
+	bool use_old_allocator;
+	block_allocator_t* allocator;
+	old_block_allocator_t* old_allocator;
+	// Handoff of blocks to the next thread, to get some cross-thread frees
+	void* volatile handoff[BENCHMARK_BLOCKS_PER_ITERATION / 4];
+	volatile i32 handoff_ready;
+} benchmark_thread_t;
+
+static benchmark_thread_t benchmark_threads[BENCHMARK_MAX_THREADS];
+static volatile i32 benchmark_start_flag;
+
+static void* benchmark_alloc(benchmark_thread_t* t) {
+	return t->use_old_allocator ? old_block_alloc(t->old_allocator) : block_alloc(t->allocator);
+}
+
+static void benchmark_free(benchmark_thread_t* t, void* ptr) {
+	if (t->use_old_allocator) {
+		old_block_free(t->old_allocator, ptr);
+	} else {
+		block_free(t->allocator, ptr);
+	}
+}
+
+static void* benchmark_thread_func(void* userdata) {
+	benchmark_thread_t* t = (benchmark_thread_t*)userdata;
+	benchmark_thread_t* next = benchmark_threads + (t->thread_index + 1) % t->thread_count;
+	while (!benchmark_start_flag) {}
+
+	void* blocks[BENCHMARK_BLOCKS_PER_ITERATION];
+	const i32 handoff_count = COUNT(t->handoff);
+	for (i32 iteration = 0; iteration < BENCHMARK_ITERATIONS_PER_THREAD; ++iteration) {
+		for (i32 i = 0; i < BENCHMARK_BLOCKS_PER_ITERATION; ++i) {
+			blocks[i] = benchmark_alloc(t);
+			*(volatile u64*)blocks[i] = iteration;
+		}
+		// Free blocks that a neighbouring thread handed over to us
+		if (t->handoff_ready) {
+			for (i32 i = 0; i < handoff_count; ++i) {
+				benchmark_free(t, t->handoff[i]);
+			}
+			write_barrier;
+			t->handoff_ready = 0;
+		}
+		i32 first_local = 0;
+		if (next != t && !next->handoff_ready) {
+			for (i32 i = 0; i < handoff_count; ++i) {
+				next->handoff[i] = blocks[i];
+			}
+			write_barrier;
+			next->handoff_ready = 1;
+			first_local = handoff_count;
+		}
+		for (i32 i = first_local; i < BENCHMARK_BLOCKS_PER_ITERATION; ++i) {
+			benchmark_free(t, blocks[i]);
+		}
+	}
+	block_allocator_release_thread_slot();
+	return NULL;
+}
+
+static float run_benchmark(i32 thread_count, bool use_old_allocator) {
+	block_allocator_t allocator = {0};
+	old_block_allocator_t old_allocator = {0};
+	if (use_old_allocator) {
+		old_allocator = old_block_allocator_create(BENCHMARK_BLOCK_SIZE, BENCHMARK_CAPACITY_IN_BLOCKS, BENCHMARK_CHUNK_SIZE);
+	} else {
+		allocator = block_allocator_create(BENCHMARK_BLOCK_SIZE, BENCHMARK_CAPACITY_IN_BLOCKS, BENCHMARK_CHUNK_SIZE);
+	}
+
+	benchmark_start_flag = 0;
+	for (i32 i = 0; i < thread_count; ++i) {
+		benchmark_thread_t* t = benchmark_threads + i;
+		memset(t, 0, sizeof(*t));
+		t->thread_index = i;
+		t->thread_count = thread_count;
+		t->use_old_allocator = use_old_allocator;
+		t->allocator = &allocator;
+		t->old_allocator = &old_allocator;
+	}
+	for (i32 i = 0; i < thread_count; ++i) {
+		pthread_create(&benchmark_threads[i].thread, NULL, benchmark_thread_func, benchmark_threads + i);
+	}
+	i64 start = get_clock();
+	write_barrier;
+	benchmark_start_flag = 1;
+	for (i32 i = 0; i < thread_count; ++i) {
+		pthread_join(benchmark_threads[i].thread, NULL);
+	}
+	float seconds = get_seconds_elapsed(start, get_clock());
+
+	// Blocks that were handed off but not yet picked up are simply dropped along with the allocator.
+	if (use_old_allocator) {
+		old_block_allocator_destroy(&old_allocator);
+	} else {
+		block_allocator_destroy(&allocator);
+	}
+	return seconds;
+}
+
+int main(int argc, const char** argv) {
+#if WINDOWS
+	win32_init_timer();
+#endif
+	i32 max_thread_count = BENCHMARK_MAX_THREADS;
+	if (argc > 1) {
+		max_thread_count = CLAMP(atoi(argv[1]), 1, BENCHMARK_MAX_THREADS);
+	}
+	printf("block_allocator contention benchmark: %d iterations x %d blocks per thread, block size %d KiB\n",
+	       BENCHMARK_ITERATIONS_PER_THREAD, BENCHMARK_BLOCKS_PER_ITERATION, (i32)(BENCHMARK_BLOCK_SIZE / 1024));
+	printf("%8s %16s %16s %10s\n", "threads", "old (Mops/s)", "cached (Mops/s)", "speedup");
+	for (i32 thread_count = 1; thread_count <= max_thread_count; thread_count *= 2) {
+		double ops = 2.0 * thread_count * BENCHMARK_ITERATIONS_PER_THREAD * BENCHMARK_BLOCKS_PER_ITERATION; // alloc + free
+		float old_seconds = run_benchmark(thread_count, true);
+		float cached_seconds = run_benchmark(thread_count, false);
+		printf("%8d %16.2f %16.2f %9.2fx\n", thread_count,
+		       ops / old_seconds * 1e-6, ops / cached_seconds * 1e-6, old_seconds / cached_seconds);
+	}
+	return 0;
+}
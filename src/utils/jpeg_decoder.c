@@ -118,7 +118,9 @@ bool jpeg_decode_tile(uint8_t *table_ptr, uint32_t table_length, uint8_t *input_
 	return TRUE;
 }
 
-u8* jpeg_decode_image(u8* input_ptr, u32 input_length, i32* width, i32* height, i32 *channels_in_file) {
+// Decodes into output_buffer if one is given (failing if it is too small), otherwise into a malloc'ed buffer.
+static u8* jpeg_decode_image_internal(u8* input_ptr, u32 input_length, u8* output_buffer, size_t output_capacity,
+                                      i32* width, i32* height, i32 *channels_in_file) {
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr jerr;
 
@@ -143,7 +145,15 @@ u8* jpeg_decode_image(u8* input_ptr, u32 input_length, i32* width, i32* height,
 	int row_width = cinfo.output_width;
 	int target_row_stride = row_width * cinfo.output_components;
 	size_t output_size = target_row_stride * cinfo.output_height;
-	u8* output_buffer = malloc(output_size);
+	if (output_buffer) {
+		if (output_size > output_capacity) {
+			jpeg_abort_decompress(&cinfo);
+			jpeg_destroy_decompress(&cinfo);
+			return NULL;
+		}
+	} else {
+		output_buffer = malloc(output_size);
+	}
 
 	while (cinfo.output_scanline < cinfo.output_height) {
 		u8* output_pos = output_buffer + (cinfo.output_scanline) * target_row_stride;
@@ -161,6 +171,14 @@ u8* jpeg_decode_image(u8* input_ptr, u32 input_length, i32* width, i32* height,
 	return output_buffer;
 }
 
+u8* jpeg_decode_image(u8* input_ptr, u32 input_length, i32* width, i32* height, i32 *channels_in_file) {
+	return jpeg_decode_image_internal(input_ptr, input_length, NULL, 0, width, height, channels_in_file);
+}
+
+bool jpeg_decode_image_into(u8* input_ptr, u32 input_length, u8* output_ptr, size_t output_capacity, i32* width, i32* height, i32 *channels_in_file) {
+	return jpeg_decode_image_internal(input_ptr, input_length, output_ptr, output_capacity, width, height, channels_in_file) != NULL;
+}
+
 u8* jpeg_decode_ndpi_image(u8* input_ptr, u32 input_length, i32 width, i32 height, i32 *channels_in_file) {
     struct jpeg_decompress_struct cinfo;
     struct jpeg_error_mgr jerr;
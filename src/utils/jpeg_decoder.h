@@ -14,6 +14,7 @@ void jpeg_encode_tile(u8* pixels, i32 width, i32 height, i32 quality, u8** table
                       u8** jpeg_buffer, u64* jpeg_size_ptr, bool use_rgb);
 void jpeg_encode_image(u8* pixels, i32 width, i32 height, i32 quality, u8** jpeg_buffer, u64* jpeg_size_ptr);
 u8* jpeg_decode_image(u8* input_ptr, u32 input_length, i32 *width, i32 *height, i32 *channels_in_file);
+bool jpeg_decode_image_into(u8* input_ptr, u32 input_length, u8* output_ptr, size_t output_capacity, i32 *width, i32 *height, i32 *channels_in_file);
 u8* jpeg_decode_ndpi_image(u8* input_ptr, u32 input_length, i32 width, i32 height, i32 *channels_in_file);
 EMSCRIPTEN_KEEPALIVE bool jpeg_decode_tile(uint8_t *table_ptr, uint32_t table_length, uint8_t *input_ptr, uint32_t input_length, uint8_t *output_ptr, bool is_YCbCr);
 EMSCRIPTEN_KEEPALIVE uint8_t *create_buffer(int size);
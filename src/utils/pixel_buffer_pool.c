@@ -0,0 +1,258 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2024  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+#include "intrinsics.h"
+#include "benaphore.h"
+
+#define PIXEL_BUFFER_POOL_IMPL
+#include "pixel_buffer_pool.h"
+
+// Every buffer is preceded by a header, padded to a cache line so that the pixels stay nicely aligned.
+#define PIXEL_BUFFER_HEADER_SIZE 64
+#define PIXEL_BUFFER_MAGIC 0x50425546 // 'PBUF'
+#define PIXEL_BUFFER_MAGAZINE_MAX_BYTES MEGABYTES(16)
+
+typedef struct pixel_buffer_header_t pixel_buffer_header_t;
+struct pixel_buffer_header_t {
+	pixel_buffer_header_t* next; // link in the depot free list
+	size_t capacity;
+	i32 size_class; // -1 if not pooled
+	u32 magic;
+};
+STATIC_ASSERT(sizeof(pixel_buffer_header_t) <= PIXEL_BUFFER_HEADER_SIZE);
+
+typedef struct pixel_buffer_magazine_t {
+	pixel_buffer_header_t* buffers[PIXEL_BUFFER_MAGAZINE_CAPACITY];
+	i32 count;
+} pixel_buffer_magazine_t;
+
+typedef struct pixel_buffer_depot_t {
+	pixel_buffer_header_t* free_lists[PIXEL_BUFFER_POOL_CLASS_COUNT];
+	i32 free_list_lengths[PIXEL_BUFFER_POOL_CLASS_COUNT];
+	i64 bytes_in_depot;
+	i64 capacity;
+	benaphore_t lock;
+	bool is_initialized;
+} pixel_buffer_depot_t;
+
+static pixel_buffer_depot_t global_pixel_buffer_depot;
+static THREAD_LOCAL pixel_buffer_magazine_t local_pixel_buffer_magazines[PIXEL_BUFFER_POOL_CLASS_COUNT];
+
+static struct {
+	volatile i64 alloc_count;
+	volatile i64 free_count;
+	volatile i64 thread_cache_hits;
+	volatile i64 depot_hits;
+	volatile i64 system_allocs;
+	volatile i64 system_frees;
+	volatile i64 unpooled_allocs;
+	volatile i64 bytes_in_use;
+	volatile i64 peak_bytes_in_use;
+} pixel_buffer_pool_counters;
+
+static inline size_t size_class_capacity(i32 size_class) {
+	return (size_t)1 << (size_class + PIXEL_BUFFER_POOL_MIN_CLASS_SHIFT);
+}
+
+static i32 size_class_for_size(size_t size) {
+	i32 shift = PIXEL_BUFFER_POOL_MIN_CLASS_SHIFT;
+	while (((size_t)1 << shift) < size) {
+		++shift;
+		if (shift > PIXEL_BUFFER_POOL_MAX_CLASS_SHIFT) return -1;
+	}
+	return shift - PIXEL_BUFFER_POOL_MIN_CLASS_SHIFT;
+}
+
+// Large size classes get fewer magazine slots, so that a single thread can't hoard too much memory.
+static inline i32 magazine_capacity_for_class(i32 size_class) {
+	i64 capacity = PIXEL_BUFFER_MAGAZINE_MAX_BYTES / (i64)size_class_capacity(size_class);
+	return (i32)CLAMP(capacity, 1, PIXEL_BUFFER_MAGAZINE_CAPACITY);
+}
+
+static void* pixel_buffer_from_header(pixel_buffer_header_t* header) {
+	return (u8*)header + PIXEL_BUFFER_HEADER_SIZE;
+}
+
+static pixel_buffer_header_t* pixel_buffer_header_from_ptr(void* ptr) {
+	pixel_buffer_header_t* header = (pixel_buffer_header_t*)((u8*)ptr - PIXEL_BUFFER_HEADER_SIZE);
+	ASSERT(header->magic == PIXEL_BUFFER_MAGIC);
+	return header;
+}
+
+static pixel_buffer_header_t* pixel_buffer_system_alloc(size_t capacity, i32 size_class) {
+	pixel_buffer_header_t* header = (pixel_buffer_header_t*)malloc(PIXEL_BUFFER_HEADER_SIZE + capacity);
+	if (!header) {
+		console_print_error("pixel_buffer_alloc(): out of memory (requested %zu bytes)\n", capacity);
+		return NULL;
+	}
+	header->next = NULL;
+	header->capacity = capacity;
+	header->size_class = size_class;
+	header->magic = PIXEL_BUFFER_MAGIC;
+	return header;
+}
+
+void pixel_buffer_pool_init(i64 depot_capacity) {
+	pixel_buffer_depot_t* depot = &global_pixel_buffer_depot;
+	if (depot->is_initialized) return;
+	depot->capacity = depot_capacity;
+	depot->lock = benaphore_create();
+	write_barrier;
+	depot->is_initialized = true;
+}
+
+// Move up to half a magazine's worth of buffers from the depot into the magazine.
+static void magazine_refill_from_depot(pixel_buffer_magazine_t* magazine, i32 size_class) {
+	pixel_buffer_depot_t* depot = &global_pixel_buffer_depot;
+	i32 refill_count = ATLEAST(1, magazine_capacity_for_class(size_class) / 2);
+	benaphore_lock(&depot->lock);
+	while (refill_count > 0 && depot->free_lists[size_class] != NULL) {
+		pixel_buffer_header_t* header = depot->free_lists[size_class];
+		depot->free_lists[size_class] = header->next;
+		--depot->free_list_lengths[size_class];
+		depot->bytes_in_depot -= header->capacity;
+		header->next = NULL;
+		magazine->buffers[magazine->count++] = header;
+		--refill_count;
+	}
+	benaphore_unlock(&depot->lock);
+}
+
+// Hand the older half of a full magazine over to the depot; anything that doesn't fit in the depot is freed.
+static void magazine_flush_to_depot(pixel_buffer_magazine_t* magazine) {
+	pixel_buffer_depot_t* depot = &global_pixel_buffer_depot;
+	i32 flush_count = ATLEAST(1, magazine->count / 2);
+	pixel_buffer_header_t* to_release = NULL;
+	benaphore_lock(&depot->lock);
+	for (i32 i = 0; i < flush_count; ++i) {
+		pixel_buffer_header_t* header = magazine->buffers[i];
+		if (depot->bytes_in_depot + (i64)header->capacity <= depot->capacity) {
+			header->next = depot->free_lists[header->size_class];
+			depot->free_lists[header->size_class] = header;
+			++depot->free_list_lengths[header->size_class];
+			depot->bytes_in_depot += header->capacity;
+		} else {
+			header->next = to_release;
+			to_release = header;
+		}
+	}
+	benaphore_unlock(&depot->lock);
+	magazine->count -= flush_count;
+	memmove(magazine->buffers, magazine->buffers + flush_count, magazine->count * sizeof(magazine->buffers[0]));
+
+	while (to_release) {
+		pixel_buffer_header_t* next = to_release->next;
+		free(to_release);
+		atomic_add_i64(&pixel_buffer_pool_counters.system_frees, 1);
+		to_release = next;
+	}
+}
+
+void* pixel_buffer_alloc(size_t size) {
+	if (size == 0) return NULL;
+	i32 size_class = global_pixel_buffer_depot.is_initialized ? size_class_for_size(size) : -1;
+	pixel_buffer_header_t* header = NULL;
+	if (size_class < 0) {
+		header = pixel_buffer_system_alloc(size, -1);
+		atomic_add_i64(&pixel_buffer_pool_counters.unpooled_allocs, 1);
+	} else {
+		pixel_buffer_magazine_t* magazine = local_pixel_buffer_magazines + size_class;
+		if (magazine->count > 0) {
+			atomic_add_i64(&pixel_buffer_pool_counters.thread_cache_hits, 1);
+		} else {
+			magazine_refill_from_depot(magazine, size_class);
+			if (magazine->count > 0) {
+				atomic_add_i64(&pixel_buffer_pool_counters.depot_hits, 1);
+			}
+		}
+		if (magazine->count > 0) {
+			header = magazine->buffers[--magazine->count];
+		} else {
+			header = pixel_buffer_system_alloc(size_class_capacity(size_class), size_class);
+			atomic_add_i64(&pixel_buffer_pool_counters.system_allocs, 1);
+		}
+	}
+	if (!header) return NULL;
+
+	atomic_add_i64(&pixel_buffer_pool_counters.alloc_count, 1);
+	i64 bytes_in_use = atomic_add_i64(&pixel_buffer_pool_counters.bytes_in_use, header->capacity);
+	if (bytes_in_use > pixel_buffer_pool_counters.peak_bytes_in_use) {
+		pixel_buffer_pool_counters.peak_bytes_in_use = bytes_in_use; // racy, but only used for statistics
+	}
+	return pixel_buffer_from_header(header);
+}
+
+void pixel_buffer_free(void* ptr) {
+	if (!ptr) return;
+	pixel_buffer_header_t* header = pixel_buffer_header_from_ptr(ptr);
+	atomic_add_i64(&pixel_buffer_pool_counters.free_count, 1);
+	atomic_add_i64(&pixel_buffer_pool_counters.bytes_in_use, -(i64)header->capacity);
+	if (header->size_class < 0) {
+		free(header);
+		return;
+	}
+	pixel_buffer_magazine_t* magazine = local_pixel_buffer_magazines + header->size_class;
+	if (magazine->count >= magazine_capacity_for_class(header->size_class)) {
+		magazine_flush_to_depot(magazine);
+	}
+	magazine->buffers[magazine->count++] = header;
+}
+
+void pixel_buffer_pool_get_stats(pixel_buffer_pool_stats_t* stats) {
+	memset(stats, 0, sizeof(*stats));
+	stats->alloc_count = pixel_buffer_pool_counters.alloc_count;
+	stats->free_count = pixel_buffer_pool_counters.free_count;
+	stats->thread_cache_hits = pixel_buffer_pool_counters.thread_cache_hits;
+	stats->depot_hits = pixel_buffer_pool_counters.depot_hits;
+	stats->system_allocs = pixel_buffer_pool_counters.system_allocs;
+	stats->system_frees = pixel_buffer_pool_counters.system_frees;
+	stats->unpooled_allocs = pixel_buffer_pool_counters.unpooled_allocs;
+	stats->bytes_in_use = pixel_buffer_pool_counters.bytes_in_use;
+	stats->peak_bytes_in_use = pixel_buffer_pool_counters.peak_bytes_in_use;
+
+	pixel_buffer_depot_t* depot = &global_pixel_buffer_depot;
+	if (depot->is_initialized) {
+		benaphore_lock(&depot->lock);
+		stats->bytes_in_depot = depot->bytes_in_depot;
+		stats->depot_capacity = depot->capacity;
+		memcpy(stats->depot_buffer_counts, depot->free_list_lengths, sizeof(stats->depot_buffer_counts));
+		benaphore_unlock(&depot->lock);
+	}
+}
+
+void pixel_buffer_pool_print_stats() {
+	pixel_buffer_pool_stats_t stats;
+	pixel_buffer_pool_get_stats(&stats);
+	double hit_rate = 0.0;
+	if (stats.alloc_count > 0) {
+		hit_rate = 100.0 * (double)(stats.thread_cache_hits + stats.depot_hits) / (double)stats.alloc_count;
+	}
+	console_print("Pixel buffer pool: %lld allocs, %lld frees (%.1f%% reused)\n",
+	              stats.alloc_count, stats.free_count, hit_rate);
+	console_print("    thread cache hits: %lld, depot hits: %lld, system allocs: %lld, system frees: %lld, unpooled: %lld\n",
+	              stats.thread_cache_hits, stats.depot_hits, stats.system_allocs, stats.system_frees, stats.unpooled_allocs);
+	console_print("    in use: %.1f MiB (peak %.1f MiB), depot: %.1f / %.1f MiB\n",
+	              (double)stats.bytes_in_use / MEGABYTES(1), (double)stats.peak_bytes_in_use / MEGABYTES(1),
+	              (double)stats.bytes_in_depot / MEGABYTES(1), (double)stats.depot_capacity / MEGABYTES(1));
+	for (i32 i = 0; i < PIXEL_BUFFER_POOL_CLASS_COUNT; ++i) {
+		if (stats.depot_buffer_counts[i] > 0) {
+			console_print("    depot class %zu KiB: %d buffers\n", size_class_capacity(i) / 1024, stats.depot_buffer_counts[i]);
+		}
+	}
+}
@@ -0,0 +1,76 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2024  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Pool for tile-sized pixel buffers.
+// Tiles are decoded on the worker threads, and (usually) freed on the main thread after the GPU upload.
+// Freed buffers are kept in a small per-thread cache (the 'magazine') for each power-of-two size class;
+// when a magazine overflows, half of it is handed to a shared depot, where other threads can pick them up again.
+// Buffers must be released with pixel_buffer_free() (never with free()).
+
+#define PIXEL_BUFFER_POOL_MIN_CLASS_SHIFT 12 // 4 KiB
+#define PIXEL_BUFFER_POOL_MAX_CLASS_SHIFT 26 // 64 MiB; larger requests are not pooled
+#define PIXEL_BUFFER_POOL_CLASS_COUNT (PIXEL_BUFFER_POOL_MAX_CLASS_SHIFT - PIXEL_BUFFER_POOL_MIN_CLASS_SHIFT + 1)
+#define PIXEL_BUFFER_MAGAZINE_CAPACITY 16
+
+typedef struct pixel_buffer_pool_stats_t {
+	i64 alloc_count;
+	i64 free_count;
+	i64 thread_cache_hits;  // served from the calling thread's own magazine
+	i64 depot_hits;         // served after refilling the magazine from the depot
+	i64 system_allocs;      // had to go to malloc()
+	i64 system_frees;       // returned to the system because the depot was full
+	i64 unpooled_allocs;    // too large to pool (or pool not initialized)
+	i64 bytes_in_use;
+	i64 peak_bytes_in_use;
+	i64 bytes_in_depot;
+	i64 depot_capacity;
+	i32 depot_buffer_counts[PIXEL_BUFFER_POOL_CLASS_COUNT];
+} pixel_buffer_pool_stats_t;
+
+void pixel_buffer_pool_init(i64 depot_capacity);
+void* pixel_buffer_alloc(size_t size);
+void pixel_buffer_free(void* ptr);
+void pixel_buffer_pool_get_stats(pixel_buffer_pool_stats_t* stats);
+void pixel_buffer_pool_print_stats();
+
+// globals
+#if defined(PIXEL_BUFFER_POOL_IMPL)
+#define INIT(...) __VA_ARGS__
+#define extern
+#else
+#define INIT(...)
+#undef extern
+#endif
+
+extern i32 pixel_buffer_pool_depot_size_in_mb INIT(= 256);
+
+#undef INIT
+#undef extern
+
+#ifdef __cplusplus
+}
+#endif